@@ -65,6 +65,7 @@ namespace AlphaPose{
     class InferImpl : public Infer, public ControllerImpl{
     public:
         bool startup(const string& file, int gpuid){
+            set_metrics_name(iLogger::file_name(file, false));
             return ControllerImpl::startup(make_tuple(file, gpuid));
         }
     
@@ -93,6 +94,7 @@ namespace AlphaPose{
             gpu_               = gpuid;
             tensor_allocator_  = make_shared<MonopolyAllocator<TRT::Tensor>>(max_batch_size * 2);
             stream_            = engine->get_stream();
+            commit_chunk_size_ = max_batch_size;
             result.set_value(true);
             input->resize_single_dim(0, max_batch_size);
 
@@ -108,9 +110,12 @@ namespace AlphaPose{
                     job.mono_tensor->release();
                 }
                 // 模型推理
+                stage_event_begin(0, InferStage::Forward, stream_);
                 engine->forward(false);
+                stage_event_end(0, InferStage::Forward, stream_);
 
                 // 收取结果，output->cpu里面存在一个同步操作
+                long long delivery_begin = LatencyHistogram::now_us();
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
                     
                     auto& job                   = fetch_jobs[ibatch];
@@ -122,7 +127,7 @@ namespace AlphaPose{
                     image_based_keypoints.resize(output->channel() - begin_channel);
 
                     for(int i = begin_channel; i < output->channel(); ++i){
-                        float* output_channel = output->cpu<float>(0, i);
+                        float* output_channel = output->cpu<float>(ibatch, i);
                         int location = std::max_element(output_channel, output_channel + area) - output_channel;
                         float confidence = output_channel[location];
                         float x = (location % output->width()) * stride;
@@ -132,8 +137,10 @@ namespace AlphaPose{
                         output_point.z = confidence;
                         tie(output_point.x, output_point.y) = affine_project(x, y, job.additional.d2i);
                     }
-                    job.pro->set_value(job.output);
+                    job.set_value(job.output);
                 }
+                metrics_.record(InferStage::Delivery, LatencyHistogram::now_us() - delivery_begin);
+                collect_stage_events(0);
                 fetch_jobs.clear();
             }
             INFOV("Engine destroy.");
@@ -143,7 +150,50 @@ namespace AlphaPose{
             return ControllerImpl::commit(PoseInput{.image=image, .box=box});
         }
 
+        virtual vector<shared_future<vector<Point3f>>> commits(const Mat& image, const vector<Rect>& boxes) override{
+
+            if(boxes.empty()) return {};
+            if(image.empty()){
+                INFOE("Empty image");
+                return ControllerImpl::commits_with(boxes.size(), JobOption(), [](Job& job, int index){ return false; });
+            }
+
+            // 所有框的warp都提交到stream_之后才会释放frame_lock_，之后的上传在stream上排在这些warp之后，可以直接复用
+            std::unique_lock<std::mutex> l(frame_lock_);
+            CUDATools::AutoDevice auto_device(gpu_);
+            size_t size_image     = image.cols * image.rows * 3;
+            uint8_t* image_device = (uint8_t*)frame_workspace_.gpu(size_image);
+            checkCudaRuntime(cudaMemcpyAsync(image_device, image.data, size_image, cudaMemcpyHostToDevice, stream_));
+
+            return ControllerImpl::commits_with(boxes.size(), JobOption(), [&](Job& job, int index){
+                return preprocess_box(job, image_device, image.size(), boxes[index]);
+            });
+        }
+
+        virtual shared_future<vector<Point3f>> commit(const YUVImage& image, const Rect& box) override{
+            return ControllerImpl::commit_with(JobOption(), [&](Job& job){
+                return preprocess_yuv(job, image, box);
+            });
+        }
+
+        virtual shared_future<vector<Point3f>> commit(const FrameHandle& frame, const Rect& box) override{
+            return ControllerImpl::commit_with(JobOption(), [&](Job& job){
+                return preprocess_frame(job, frame, box);
+            });
+        }
+
+        virtual vector<shared_future<vector<Point3f>>> commits(const FrameHandle& frame, const vector<Rect>& boxes) override{
+            return ControllerImpl::commits_with(boxes.size(), JobOption(), [&](Job& job, int index){
+                return preprocess_frame(job, frame, boxes[index]);
+            });
+        }
+
         virtual bool preprocess(Job& job, const PoseInput& input) override{
+            return preprocess_box(job, nullptr, input.image.size(), input.box, input.image.data);
+        }
+
+        // image_device为nullptr时，把image_host上传到job的workspace
+        bool preprocess_box(Job& job, uint8_t* image_device, const Size& image_size, const Rect& box, const uint8_t* image_host = nullptr){
 
             job.mono_tensor = tensor_allocator_->query();
             if(job.mono_tensor == nullptr){
@@ -160,25 +210,28 @@ namespace AlphaPose{
             }
 
             Size input_size(input_width_, input_height_);
-            job.additional.compute(input.image.size(), input.box, input_size);
+            job.additional.compute(image_size, box, input_size);
             
             tensor->set_stream(stream_);
             tensor->resize(1, 3, input_height_, input_width_);
             float mean[]           = {0.406, 0.457, 0.480};
             float std[]            = {1, 1, 1};
 
-            size_t size_image      = input.image.cols * input.image.rows * 3;
+            // 共享的device图像不需要再复制，workspace中只放矩阵
+            size_t size_image      = image_device == nullptr ? image_size.width * image_size.height * 3 : 0;
             size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
             auto workspace         = tensor->get_workspace();
             uint8_t* gpu_workspace = (uint8_t*)workspace->gpu(size_image + size_matrix);
             float*   affine_matrix_device = (float*)gpu_workspace;
-            uint8_t* image_device         = gpu_workspace + size_matrix;
-            checkCudaRuntime(cudaMemcpyAsync(image_device,         input.image.data,   size_image,                 cudaMemcpyHostToDevice, stream_));
+            if(image_device == nullptr){
+                image_device = gpu_workspace + size_matrix;
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            }
             checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
 
             auto normalize         = CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB;
             CUDAKernel::warp_affine_bilinear_and_normalize(
-                image_device,         input.image.cols * 3, input.image.cols, input.image.rows, 
+                image_device,         image_size.width * 3, image_size.width, image_size.height, 
                 tensor->gpu<float>(), input_width_,     input_height_, 
                 affine_matrix_device, 127, 
                 normalize, stream_
@@ -186,11 +239,107 @@ namespace AlphaPose{
             return true;
         }
 
+        bool preprocess_yuv(Job& job, const YUVImage& image, const Rect& box){
+            if(image.empty()){
+                INFOE("Empty yuv image");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+                tensor->set_workspace(make_shared<TRT::MixMemory>());
+            }
+
+            Size input_size(input_width_, input_height_);
+            job.additional.compute(Size(image.width, image.height), box, input_size);
+            
+            tensor->set_stream(stream_);
+            tensor->resize(1, 3, input_height_, input_width_);
+            float mean[]           = {0.406, 0.457, 0.480};
+            float std[]            = {1, 1, 1};
+
+            // 矩阵之后是原样复制的YUV平面，device上的平面不复制
+            size_t size_planes     = image.device ? 0 : image.bytes();
+            size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
+            auto workspace         = tensor->get_workspace();
+            uint8_t* gpu_workspace = (uint8_t*)workspace->gpu(size_matrix + size_planes);
+            uint8_t* cpu_workspace = (uint8_t*)workspace->cpu(size_matrix + size_planes);
+            float*   affine_matrix_device = (float*)gpu_workspace;
+            auto source = CUDAKernel::upload_yuv_image(image, gpu_workspace + size_matrix, cpu_workspace + size_matrix, stream_);
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
+
+            auto normalize         = CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB;
+            CUDAKernel::warp_affine_bilinear_and_normalize(
+                source, tensor->gpu<float>(), input_width_, input_height_, 
+                affine_matrix_device, 127, 
+                normalize, stream_
+            );
+            return true;
+        }
+
+        // 共享帧在device上只有一份，workspace中只放矩阵
+        bool preprocess_frame(Job& job, const FrameHandle& frame, const Rect& box){
+            if(frame == nullptr){
+                INFOE("Empty frame");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+                tensor->set_workspace(make_shared<TRT::MixMemory>());
+            }
+
+            Size input_size(input_width_, input_height_);
+            job.additional.compute(frame->size(), box, input_size);
+            
+            tensor->set_stream(stream_);
+            tensor->resize(1, 3, input_height_, input_width_);
+            float mean[]           = {0.406, 0.457, 0.480};
+            float std[]            = {1, 1, 1};
+
+            size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
+            float* affine_matrix_device = (float*)tensor->get_workspace()->gpu(size_matrix);
+            auto source = frame->source(gpu_, stream_);
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
+
+            auto normalize         = CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB;
+            CUDAKernel::warp_affine_bilinear_and_normalize(
+                source, tensor->gpu<float>(), input_width_, input_height_, 
+                affine_matrix_device, 127, 
+                normalize, stream_
+            );
+            return true;
+        }
+
+        virtual InferMetricsSnapshot metrics() override{
+            return ControllerImpl::metrics();
+        }
+
     private:
         int input_width_ = 0;
         int input_height_ = 0;
         int gpu_ = 0;
         TRT::CUStream stream_ = nullptr;
+        std::mutex frame_lock_;
+        TRT::MixMemory frame_workspace_;    // commits时整帧的device图像
     };
 
     shared_ptr<Infer> create_infer(const string& engine_file, int gpuid){
@@ -6,6 +6,9 @@
 #include <string>
 #include <future>
 #include <opencv2/opencv.hpp>
+#include <common/yuv_image.hpp>
+#include <common/shared_frame.hpp>
+#include <common/infer_metrics.hpp>
 
 namespace AlphaPose{
 
@@ -15,6 +18,19 @@ namespace AlphaPose{
     class Infer{
     public:
         virtual shared_future<vector<Point3f>> commit(const Mat& image, const Rect& box) = 0;
+
+        // 同一帧上的多个人，图像只上传一次，所有框从同一份device图像上裁剪，进入同一个batch
+        virtual vector<shared_future<vector<Point3f>>> commits(const Mat& image, const vector<Rect>& boxes) = 0;
+
+        // 与其他模型共享的帧，同一个device上只上传一次，检测模型已经上传过时这里不再有任何传输
+        virtual shared_future<vector<Point3f>> commit(const FrameHandle& frame, const Rect& box) = 0;
+        virtual vector<shared_future<vector<Point3f>>> commits(const FrameHandle& frame, const vector<Rect>& boxes) = 0;
+
+        // 直接提交解码器输出的NV12/I420，颜色转换与预处理在同一个kernel中完成
+        virtual shared_future<vector<Point3f>> commit(const YUVImage& image, const Rect& box) = 0;
+
+        // 各阶段耗时、batch大小、队列深度的直方图，metrics().to_json()可以输出为JSON
+        virtual InferMetricsSnapshot metrics() = 0;
     };
 
     // RAII，如果创建失败，返回空指针
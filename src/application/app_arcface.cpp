@@ -1,6 +1,7 @@
 #include <builder/trt_builder.hpp>
 #include <infer/trt_infer.hpp>
 #include <common/ilogger.hpp>
+#include <common/infer_pipeline.hpp>
 #include "app_retinaface/retinaface.hpp"
 #include "app_arcface/arcface.hpp"
 #include "tools/deepsort.hpp"
@@ -59,7 +60,8 @@ tuple<Mat, vector<string>> build_library(shared_ptr<RetinaFace::Infer> detector,
         auto file_name = iLogger::file_name(file, false);
         Mat image      = imread(file);
 
-        auto faces = detector->commit(image).get();
+        // 建库属于批量任务，不抢占实时流
+        auto faces = detector->commit(image, JobPriority::Low).get();
         if(faces.empty()){
             INFOW("%s no detect face.", file.c_str());
             continue;
@@ -90,7 +92,7 @@ tuple<Mat, vector<string>> build_library(shared_ptr<RetinaFace::Infer> detector,
         for(int j = 0; j < 10; ++j)
             landmarks.points[j] = face.landmark[j] - (j % 2 == 0 ? face.left : face.top);
 
-        auto feature     = arcface->commit(make_tuple(crop, landmarks)).get();
+        auto feature     = arcface->commit(make_tuple(crop, landmarks), JobPriority::Low).get();
         string face_name = file_name;
         features.push_back(feature);
         names.push_back(face_name);
@@ -173,6 +175,23 @@ int app_arcface(){
     return 0;
 }
 
+// 每一张人脸在整帧上的关键点，配合共享帧使用，不需要crop
+static vector<Arcface::landmarks> face_landmarks(const RetinaFace::box_array& faces){
+
+    vector<Arcface::landmarks> output(faces.size());
+    for(int i = 0; i < (int)faces.size(); ++i)
+        memcpy(output[i].points, faces[i].landmark, sizeof(output[i].points));
+    return output;
+}
+
+// app_arcface_video中每一帧在pipeline里的数据
+struct FaceFrame{
+    Mat image;
+    FrameHandle shared;         // detect与embed共享的整帧，只上传一次
+    RetinaFace::box_array faces;
+    vector<Arcface::feature> features;
+};
+
 int app_arcface_video(){
 
     TRT::set_device(0);
@@ -190,49 +209,83 @@ int app_arcface_video(){
     auto arcface  = Arcface::create_infer("arcface_iresnet50.fp32.trtmodel", 0);
     auto library  = build_library(detector, arcface);
     auto remote_show = create_zmq_remote_show();
+    auto frames      = SharedFramePool::create();
+
+    // detect -> embed（一帧的所有人脸一个batch） -> match，多帧同时在途，不再为每张脸等待一次
+    InferPipeline<FaceFrame> pipeline;
+    pipeline.add_model("detect", {},
+        [&](FaceFrame& frame){ return detector->commit_async(frame.shared); },
+        [](FaceFrame& frame, const RetinaFace::box_array& faces){ frame.faces = faces; }
+    );
+
+    pipeline.add_model("embed", {"detect"},
+        [&](FaceFrame& frame){ return arcface->commits_async(frame.shared, face_landmarks(frame.faces)); },
+        [](FaceFrame& frame, const vector<Arcface::feature>& features){
+            // 所有使用者都已经提交，释放共享帧，之后match才在原图上绘制
+            frame.features = features;
+            frame.shared.reset();
+        }
+    );
 
-    // 这是一段人脸晃来晃去的视频
-    VideoCapture cap("exp/WIN_20210425_14_23_24_Pro.mp4");
-    Mat image;
-    while(cap.read(image)){
-        auto faces  = detector->commit(image).get();
-        vector<string> names(faces.size());
-        for(int i = 0; i < faces.size(); ++i){
-            auto& face = faces[i];
-            auto box   = Rect(face.left, face.top, face.right-face.left, face.bottom-face.top);
-            box        = box & Rect(0, 0, image.cols, image.rows);
-            auto crop  = image(box).clone();
-            
-            Arcface::landmarks landmarks;
-            for(int j = 0; j < 10; ++j)
-                landmarks.points[j] = face.landmark[j] - (j % 2 == 0 ? face.left : face.top);
-
-            auto out          = arcface->commit(make_tuple(crop, landmarks)).get();
-            auto scores       = Mat(get<0>(library) * out.t());
+    pipeline.add_stage("match", {"embed"}, [&](FaceFrame& frame){
+        auto& image = frame.image;
+        for(int i = 0; i < (int)frame.faces.size(); ++i){
+            auto& face        = frame.faces[i];
+            auto scores       = Mat(get<0>(library) * frame.features[i].t());
             float* pscore     = scores.ptr<float>(0);
             int label         = std::max_element(pscore, pscore + scores.rows) - pscore;
             float match_score = max(0.0f, pscore[label]);
 
+            string name  = "Unknow";
+            auto color   = Scalar(0, 0, 255);
             if(match_score > 0.3f){
-                names[i] = iLogger::format("%s[%.3f]", get<1>(library)[label].c_str(), match_score);
+                name  = iLogger::format("%s[%.3f]", get<1>(library)[label].c_str(), match_score);
+                color = Scalar(0, 255, 0);
             }
-        }
-
-        for(int i = 0; i < faces.size(); ++i){
-            auto& face = faces[i];
 
-            auto color = Scalar(0, 255, 0);
-            if(names[i].empty()){
-                color = Scalar(0, 0, 255);
-                names[i] = "Unknow";
-            }
-            
             rectangle(image, cv::Point(face.left, face.top), cv::Point(face.right, face.bottom), color, 3);
-            putText(image, names[i], cv::Point(face.left, face.top - 5), 0, 1, color, 1, 16);
+            putText(image, name, cv::Point(face.left, face.top - 5), 0, 1, color, 1, 16);
         }
+    });
 
-        remote_show->post(image);
+    if(!pipeline.startup(4, 8)){
+        INFOE("Startup pipeline failed");
+        return 0;
     }
+
+    // 这是一段人脸晃来晃去的视频
+    VideoCapture cap("exp/WIN_20210425_14_23_24_Pro.mp4");
+    Mat image;
+    deque<shared_future<shared_ptr<FaceFrame>>> inflight;
+    auto show_front = [&](){
+        remote_show->post(inflight.front().get()->image);
+        inflight.pop_front();
+    };
+
+    while(cap.read(image)){
+        auto frame    = make_shared<FaceFrame>();
+        frame->image  = image.clone();
+        frame->shared = frames->create_frame(frame->image);
+        inflight.emplace_back(pipeline.commit(frame));
+
+        // 按顺序显示已经完成的帧
+        while(!inflight.empty() && inflight.front().wait_for(chrono::seconds(0)) == future_status::ready)
+            show_front();
+    }
+
+    while(!inflight.empty())
+        show_front();
+
+    auto statistics = pipeline.statistics();
+    for(auto& node : statistics.nodes)
+        INFO("Node %s, %lld frames, %.2f items/frame", node.name.c_str(), node.runs, node.runs == 0 ? 0 : node.items / (float)node.runs);
+
+    auto frame_statistics = frames->statistics();
+    INFO("Shared frames %lld, uploads %lld, reuses %lld, uploaded %.2f MB, saved %.2f MB, buffers %lld",
+        frame_statistics.frames, frame_statistics.uploads, frame_statistics.reuses,
+        frame_statistics.bytes_uploaded / 1024.0f / 1024.0f, frame_statistics.bytes_saved / 1024.0f / 1024.0f,
+        frame_statistics.allocated
+    );
     INFO("Done");
     return 0;
 }
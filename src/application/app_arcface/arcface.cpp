@@ -61,6 +61,13 @@ namespace Arcface{
         }
     };
 
+    // 流水线中每个在途batch独占的输出缓冲区
+    struct OutputSlot{
+        TRT::MixMemory output_memory;
+        float* output_host = nullptr;           // output_memory的cpu部分，锁页内存
+        cudaEvent_t done   = nullptr;           // 该batch的特征已经复制到output_host
+    };
+
     using ControllerImpl = InferController
     <
         commit_input,           // input
@@ -70,11 +77,17 @@ namespace Arcface{
     >;
     class InferImpl : public Infer, public ControllerImpl{
     public:
+        // worker中run_pipeline的deliver会访问派生类的成员，需要在这些成员析构之前停止worker
+        virtual ~InferImpl(){
+            stop();
+        }
+
         virtual bool startup(const string& file, int gpuid){
 
             float mean[] = {0.5f, 0.5f, 0.5f};
             float std[]  = {0.5f, 0.5f, 0.5f};
             normalize_   = CUDAKernel::Norm::mean_std(mean, std, 1.0f / 255.0f);
+            set_metrics_name(iLogger::file_name(file, false));
             return ControllerImpl::startup(make_tuple(file, gpuid));
         }
 
@@ -109,9 +122,17 @@ namespace Arcface{
             input->resize_single_dim(0, max_batch_size).to_gpu();
             output->resize_single_dim(0, max_batch_size).to_gpu();
 
-            vector<Job> fetch_jobs;
-            while(get_jobs_and_wait(fetch_jobs, max_batch_size)){
+            // 两套输出缓冲区，第k个batch推理时，交付第k-1个batch的结果
+            const int NUM_SLOTS = 2;
+            OutputSlot slots[NUM_SLOTS];
+            for(auto& slot : slots){
+                slot.output_host = (float*)slot.output_memory.cpu(output->bytes());
+                checkCudaRuntime(cudaEventCreateWithFlags(&slot.done, cudaEventDisableTiming));
+            }
+
+            auto launch = [&](vector<Job>& fetch_jobs, int islot){
 
+                auto& slot           = slots[islot];
                 int infer_batch_size = fetch_jobs.size();
                 if(dynamic_batch){
                     // 如果是动态batch，则修改当前推理的batch数量，能有效降低时间
@@ -126,20 +147,38 @@ namespace Arcface{
                 }
 
                 // 模型推理
+                stage_event_begin(islot, InferStage::Forward, stream_);
                 engine->forward(false);
+                stage_event_end(islot, InferStage::Forward, stream_);
+
+                stage_event_begin(islot, InferStage::Decode, stream_);
                 CUDAKernel::norm_feature(output->gpu<float>(), output->size(0), output->size(1), stream_);
+                stage_event_end(islot, InferStage::Decode, stream_);
+
+                // 异步复制到cpu，不等待，由deliver同步
+                size_t bytes = output->bytes(1) * infer_batch_size;
+                checkCudaRuntime(cudaMemcpyAsync(slot.output_host, output->gpu(), bytes, cudaMemcpyDeviceToHost, stream_));
+                checkCudaRuntime(cudaEventRecord(slot.done, stream_));
+            };
+
+            auto deliver = [&](vector<Job>& fetch_jobs, int islot){
 
-                output->to_cpu();
-                // 数据转到gpu为主，不需要复制
+                auto& slot = slots[islot];
+                checkCudaRuntime(cudaEventSynchronize(slot.done));
+
+                int infer_batch_size = fetch_jobs.size();
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
                     auto& job                 = fetch_jobs[ibatch];
-                    float* image_based_output = output->cpu<float>(ibatch);
+                    float* image_based_output = slot.output_host + ibatch * feature_length_;
 
                     memcpy(job.output.ptr<float>(0), image_based_output, sizeof(float) * feature_length_);
-                    job.pro->set_value(job.output);
+                    job.set_value(job.output);
                 }
-                fetch_jobs.clear();
-            }
+            };
+
+            run_pipeline(max_batch_size, NUM_SLOTS, launch, deliver);
+            for(auto& slot : slots)
+                checkCudaRuntime(cudaEventDestroy(slot.done));
             INFOV("Engine destroy.");
         }
 
@@ -173,12 +212,21 @@ namespace Arcface{
             float*   affine_matrix_device = (float*)gpu_workspace;
             uint8_t* image_device         = size_matrix + gpu_workspace;
 
-            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_image);
+            // 页锁定且连续的输入直接异步拷贝到device，省掉到workspace的host到host拷贝
+            // 此时job持有输入的引用，保证拷贝完成之前数据不会被释放
+            bool zero_copy                = image.isContinuous() && CUDATools::is_pinned_memory(image.data);
+            size_t size_staging           = zero_copy ? 0 : size_image;
+            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_staging);
             float* affine_matrix_host     = (float*)cpu_workspace;
             uint8_t* image_host           = size_matrix + cpu_workspace;
 
-            checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
-            checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            if(zero_copy){
+                job.input = input;
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image.data, size_image, cudaMemcpyHostToDevice, stream_));
+            }else{
+                checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            }
             checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i,   sizeof(job.additional.d2i), cudaMemcpyHostToHost,   stream_));
             checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
 
@@ -191,6 +239,70 @@ namespace Arcface{
             return true;
         }
 
+        // 共享帧在device上只有一份，landmarks为整帧上的坐标，workspace中只放矩阵
+        bool preprocess_frame(Job& job, const FrameHandle& frame, const landmarks& lands){
+            if(frame == nullptr){
+                INFOE("Empty frame");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+                tensor->set_workspace(make_shared<TRT::MixMemory>());
+            }
+
+            job.additional.compute(lands);
+            job.output = Mat_<float>(1, feature_length_);
+
+            tensor->set_stream(stream_);
+            tensor->resize(1, 3, input_height_, input_width_);
+
+            size_t size_matrix          = iLogger::upbound(sizeof(job.additional.d2i), 32);
+            auto workspace              = tensor->get_workspace();
+            float* affine_matrix_device = (float*)workspace->gpu(size_matrix);
+            float* affine_matrix_host   = (float*)workspace->cpu(size_matrix);
+
+            auto source = frame->source(gpu_, stream_);
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToHost, stream_));
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
+
+            CUDAKernel::warp_affine_bilinear_and_normalize(
+                source, tensor->gpu<float>(), input_width_, input_height_, 
+                affine_matrix_device, 0, 
+                normalize_, stream_
+            );
+            return true;
+        }
+
+        virtual std::shared_future<feature> commit(const FrameHandle& frame, const landmarks& lands, const JobOption& option) override{
+            return ControllerImpl::commit_with(option, [&](Job& job){
+                return preprocess_frame(job, frame, lands);
+            });
+        }
+
+        virtual vector<Completion<feature>> commits_async(const FrameHandle& frame, const vector<landmarks>& faces, const JobOption& option) override{
+            return ControllerImpl::commits_async_with(faces.size(), option, [&](Job& job, int index){
+                return preprocess_frame(job, frame, faces[index]);
+            });
+        }
+
+        virtual Completion<feature> commit_async(const commit_input& input, const JobOption& option) override{
+            return ControllerImpl::commit_async(input, option);
+        }
+
+        virtual vector<Completion<feature>> commits_async(const vector<commit_input>& inputs, const JobOption& option) override{
+            return ControllerImpl::commits_async(inputs, option);
+        }
+
         virtual vector<shared_future<feature>> commits(const vector<commit_input>& inputs) override{
             return ControllerImpl::commits(inputs);
         }
@@ -199,6 +311,18 @@ namespace Arcface{
             return ControllerImpl::commit(input);
         }
 
+        virtual vector<shared_future<feature>> commits(const vector<commit_input>& inputs, const JobOption& option) override{
+            return ControllerImpl::commits(inputs, option);
+        }
+
+        virtual std::shared_future<feature> commit(const commit_input& input, const JobOption& option) override{
+            return ControllerImpl::commit(input, option);
+        }
+
+        virtual InferMetricsSnapshot metrics() override{
+            return ControllerImpl::metrics();
+        }
+
     private:
         int input_width_            = 0;
         int input_height_           = 0;
@@ -6,6 +6,10 @@
 #include <string>
 #include <future>
 #include <opencv2/opencv.hpp>
+#include <common/job_option.hpp>
+#include <common/completion.hpp>
+#include <common/shared_frame.hpp>
+#include <common/infer_metrics.hpp>
 
 namespace Arcface{
 
@@ -22,6 +26,21 @@ namespace Arcface{
     public:
         virtual shared_future<feature>         commit (const commit_input& image)          = 0;
         virtual vector<shared_future<feature>> commits(const vector<commit_input>& images) = 0;
+        virtual shared_future<feature>         commit (const commit_input& image, const JobOption& option)          = 0;
+        virtual vector<shared_future<feature>> commits(const vector<commit_input>& images, const JobOption& option) = 0;
+
+        // 不使用promise/future，可以poll、get、then，或者通过infer_coroutine.hpp中的co_commit等待
+        virtual Completion<feature> commit_async(const commit_input& image, const JobOption& option = JobOption()) = 0;
+
+        // 一帧中所有人脸一起进入队列，合并为一个batch
+        virtual vector<Completion<feature>> commits_async(const vector<commit_input>& images, const JobOption& option = JobOption()) = 0;
+
+        // 与其他模型共享的整帧，landmarks为整帧上的坐标，不需要先crop，同一个device上整帧只上传一次
+        virtual shared_future<feature> commit(const FrameHandle& frame, const landmarks& lands, const JobOption& option = JobOption()) = 0;
+        virtual vector<Completion<feature>> commits_async(const FrameHandle& frame, const vector<landmarks>& faces, const JobOption& option = JobOption()) = 0;
+
+        // 各阶段耗时、batch大小、队列深度的直方图，metrics().to_json()可以输出为JSON
+        virtual InferMetricsSnapshot metrics() = 0;
     };
 
     // RAII，如果创建失败，返回空指针
@@ -0,0 +1,905 @@
+
+/**
+ * 不依赖GPU的InferController压力测试
+ *   1. worker不做任何推理，只把结果交付回去，用来单独衡量commit/队列本身的开销
+ *   2. 只sleep的假引擎，耗时 = base + per_item * batch，用来衡量batch策略的吞吐和延迟
+ *   3. 批量任务与实时流混合时，优先级对实时流延迟的影响，以及队列满时各个处理策略的表现（LockFree时DropOldest只丢弃同一优先级的任务）
+ *   4. MonopolyAllocator在多线程query/release下的吞吐，以及运行时扩缩容
+ *   5. 用假引擎作为副本，检查ReplicaPool的分发是否均衡，以及副本快慢不一时最小负载分发的效果
+ *   6. 用一个线程模拟cuda stream，演示run_pipeline在host和device之间的重叠
+ *   7. commit（promise/shared_future）与commit_async（池化的Completion）的开销对比，以及then回调
+ *   8. 一次commits的任务数超过tensor allocator容量时，分段放入队列（commit_chunk_size_）是否避免了等待超时
+ *   9. InferMetrics的各阶段计数是否与任务数一致，以及JSON输出
+ *   ./pro controller_bench
+ */
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <deque>
+#include <common/ilogger.hpp>
+#include <common/infer_controller.hpp>
+#include <common/monopoly_allocator.hpp>
+#include <common/replica_pool.hpp>
+#include "tools/fake_model.hpp"
+
+using namespace std;
+
+namespace{
+
+    using EchoControllerImpl = InferController
+    <
+        int,                    // input
+        int,                    // output
+        tuple<string, int>      // start param
+    >;
+    class EchoController : public EchoControllerImpl{
+    public:
+        virtual ~EchoController(){
+            stop();
+        }
+
+        bool startup(JobQueueType type, int max_batch_size){
+            max_batch_size_ = max_batch_size;
+            set_job_queue(type, 4096);
+            return EchoControllerImpl::startup(make_tuple(string("echo"), 0));
+        }
+
+        virtual void worker(promise<bool>& result) override{
+
+            result.set_value(true);
+
+            vector<Job> fetch_jobs;
+            while(get_jobs_and_wait(fetch_jobs, max_batch_size_)){
+                for(auto& job : fetch_jobs)
+                    job.set_value(job.output);
+                fetch_jobs.clear();
+            }
+        }
+
+        virtual bool preprocess(Job& job, const int& input) override{
+            job.output = input;
+            return true;
+        }
+
+    private:
+        int max_batch_size_ = 16;
+    };
+
+    // 输出为任务从commit到结果交付的延迟，单位ms
+    class SleepController : public FakeModel<int, double>{
+    public:
+        virtual ~SleepController(){
+            stop();
+        }
+
+        bool startup(int max_batch_size, float base_ms, float per_item_ms){
+            return FakeModel<int, double>::startup("sleep", max_batch_size, base_ms, per_item_ms);
+        }
+
+        virtual void deliver(Job& job) override{
+            job.set_value(now_ms() - job.commit_time);
+        }
+    };
+
+    // 用一个线程模拟cuda stream，提交的任务按顺序异步执行
+    class FakeStream{
+    public:
+        FakeStream(){
+            worker_ = thread([this](){
+                function<void()> task;
+                while(true){
+                    {
+                        unique_lock<mutex> l(lock_);
+                        cond_.wait(l, [&](){return !run_ || !tasks_.empty();});
+                        if(tasks_.empty()) return;
+
+                        task = move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+
+        virtual ~FakeStream(){
+            {
+                unique_lock<mutex> l(lock_);
+                run_ = false;
+            }
+            cond_.notify_one();
+            worker_.join();
+        }
+
+        void enqueue(const function<void()>& task){
+            {
+                unique_lock<mutex> l(lock_);
+                tasks_.emplace_back(task);
+            }
+            cond_.notify_one();
+        }
+
+        void sleep(float ms){
+            enqueue([=](){this_thread::sleep_for(std::chrono::microseconds((long long)(ms * 1000)));});
+        }
+
+        // 相当于cudaEventRecord，之前提交的任务都完成后future就绪
+        shared_future<void> record(){
+            auto pro = make_shared<promise<void>>();
+            enqueue([=](){pro->set_value();});
+            return pro->get_future();
+        }
+
+    private:
+        mutex lock_;
+        condition_variable cond_;
+        deque<function<void()>> tasks_;
+        bool run_ = true;
+        thread worker_;
+    };
+
+    struct PipelineCost{
+        float stage_ms   = 0;      // host：组batch、提交拷贝和推理
+        float device_ms  = 0;      // device：拷贝、推理、解码和下载
+        float deliver_ms = 0;      // host：解析结果并交付
+    };
+
+    using PipelineControllerImpl = InferController
+    <
+        int,                    // input
+        double,                 // output
+        tuple<string, int>      // start param
+    >;
+    class PipelineController : public PipelineControllerImpl{
+    public:
+        // deliver会访问派生类的成员，需要在这些成员析构之前停止worker
+        virtual ~PipelineController(){
+            stop();
+        }
+
+        bool startup(int max_batch_size, int num_slots, const PipelineCost& cost){
+            max_batch_size_ = max_batch_size;
+            num_slots_      = num_slots;
+            cost_           = cost;
+            return PipelineControllerImpl::startup(make_tuple(string("pipeline"), 0));
+        }
+
+        virtual void worker(promise<bool>& result) override{
+
+            FakeStream stream;
+            vector<shared_future<void>> events(num_slots_);
+            result.set_value(true);
+
+            auto launch = [&](vector<Job>& jobs, int slot){
+                this_thread::sleep_for(std::chrono::microseconds((long long)(cost_.stage_ms * 1000)));
+                stream.sleep(cost_.device_ms);
+                events[slot] = stream.record();
+            };
+
+            auto deliver = [&](vector<Job>& jobs, int slot){
+                events[slot].get();
+                this_thread::sleep_for(std::chrono::microseconds((long long)(cost_.deliver_ms * 1000)));
+
+                double now = now_ms();
+                for(auto& job : jobs)
+                    job.set_value(now - job.commit_time);
+            };
+            run_pipeline(max_batch_size_, num_slots_, launch, deliver);
+        }
+
+        virtual bool preprocess(Job& job, const int& input) override{
+            return true;
+        }
+
+    private:
+        int max_batch_size_ = 16;
+        int num_slots_      = 1;
+        PipelineCost cost_;
+    };
+};
+
+static const char* queue_type_name(JobQueueType type){
+    switch(type){
+    case JobQueueType::Mutex:    return "Mutex";
+    case JobQueueType::LockFree: return "LockFree";
+    default: return "Unknow";
+    }
+}
+
+// 返回每秒commit的数量，计时包含worker把最后一个任务交付完成
+static double bench_commits(JobQueueType type, int num_producer, int commits_per_producer){
+
+    EchoController controller;
+    if(!controller.startup(type, 16)){
+        INFOE("Controller startup failed");
+        return 0;
+    }
+
+    vector<thread> producers;
+    vector<shared_future<int>> last_futures(num_producer);
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_producer; ++i){
+        producers.emplace_back([&, i](){
+            shared_future<int> last;
+            for(int j = 0; j < commits_per_producer; ++j)
+                last = controller.commit(j);
+            last_futures[i] = last;
+        });
+    }
+
+    for(auto& t : producers)
+        t.join();
+
+    for(auto& f : last_futures)
+        f.get();
+
+    double cost_ms = iLogger::timestamp_now_float() - t0;
+    return num_producer * (double)commits_per_producer / (cost_ms / 1000.0);
+}
+
+enum class ResultMode : int{
+    Future     = 0,     // commit，shared_future::get
+    Completion = 1,     // commit_async，Completion::get
+    Callback   = 2      // commit_async + then，不等待单个结果
+};
+
+static const char* result_mode_name(ResultMode mode){
+    switch(mode){
+    case ResultMode::Future:     return "future";
+    case ResultMode::Completion: return "completion";
+    case ResultMode::Callback:   return "callback";
+    default: return "Unknow";
+    }
+}
+
+// 每个生产者提交commits_per_producer个任务，最多window个在途，返回所有结果的和是否正确
+static bool bench_completion(ResultMode mode, int num_producer, int commits_per_producer, int window = 256){
+
+    EchoController controller;
+    if(!controller.startup(JobQueueType::Mutex, 16)){
+        INFOE("Controller startup failed");
+        return false;
+    }
+
+    long long total = num_producer * (long long)commits_per_producer;
+    atomic<long long> checksum{0};
+    vector<thread> producers;
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_producer; ++i){
+        producers.emplace_back([&](){
+            long long local_checksum = 0;
+            if(mode == ResultMode::Future){
+                vector<shared_future<int>> futures(window);
+                for(int j = 0; j < commits_per_producer; ++j){
+                    auto& f = futures[j % window];
+                    if(f.valid()) local_checksum += f.get();
+                    f = controller.commit(j);
+                }
+                for(auto& f : futures)
+                    if(f.valid()) local_checksum += f.get();
+            }else if(mode == ResultMode::Completion){
+                vector<Completion<int>> completions(window);
+                for(int j = 0; j < commits_per_producer; ++j){
+                    auto& c = completions[j % window];
+                    if(c.valid()) local_checksum += c.get();
+                    c = controller.commit_async(j);
+                }
+                for(auto& c : completions)
+                    if(c.valid()) local_checksum += c.get();
+            }else{
+                // 事件循环式的调用方，结果在worker线程上通过回调交付，只控制在途的数量
+                atomic<int> num_done{0};
+                for(int j = 0; j < commits_per_producer; ++j){
+                    while(j - num_done.load() >= window)
+                        this_thread::yield();
+
+                    controller.commit_async(j).then([&](const int& value){
+                        checksum += value;
+                        num_done++;
+                    });
+                }
+                while(num_done.load() < commits_per_producer)
+                    this_thread::yield();
+            }
+            checksum += local_checksum;
+        });
+    }
+
+    for(auto& t : producers)
+        t.join();
+
+    double cost_ms = iLogger::timestamp_now_float() - t0;
+    long long expect = num_producer * (long long)commits_per_producer * (commits_per_producer - 1) / 2;
+    auto stat = controller.completion_statistics();
+    INFO("%-10s producers = %2d: %.0f jobs/sec, checksum %s, completion states allocated %lld / acquired %lld",
+        result_mode_name(mode), num_producer, total / (cost_ms / 1000), checksum == expect ? "ok" : "failed",
+        stat.allocated, stat.acquired
+    );
+    return checksum == expect;
+}
+
+// worker很慢时stop，还在队列中的任务也要交付：commit的future不抛异常，commit_async的get返回、then的回调被调用
+static bool check_stop_with_queued_jobs(JobQueueType type, int num_jobs){
+
+    FakeModel<int, int> controller;
+    controller.set_job_queue(type, num_jobs * 2);
+    if(!controller.startup("stop", 1, 5.0f, 0)){
+        INFOE("Controller startup failed");
+        return false;
+    }
+
+    atomic<int> num_callback{0};
+    vector<Completion<int>> completions;
+    vector<shared_future<int>> futures;
+    for(int i = 0; i < num_jobs; ++i){
+        completions.emplace_back(controller.commit_async(i));
+        completions.back().then([&](const int&){ num_callback++; });
+        futures.emplace_back(controller.commit(i));
+    }
+    controller.stop();
+
+    bool ok = num_callback == num_jobs;
+    for(auto& c : completions)
+        ok = ok && c.ready();
+
+    for(auto& f : futures){
+        try{
+            f.get();
+        }catch(const std::exception&){
+            ok = false;
+        }
+    }
+
+    // stop之后的commit直接交付空结果
+    ok = ok && controller.commit_async(0).ready();
+
+    auto stat = controller.job_queue_statistics();
+    INFO("stop %-8s after %d commits: abandoned %lld, callbacks %d, %s",
+        queue_type_name(type), num_jobs * 2, stat.abandoned, num_callback.load(), ok ? "ok" : "failed"
+    );
+    return ok && stat.abandoned > 0;
+}
+
+static float percentile(vector<double>& values, float p){
+    if(values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    int index = std::min((int)values.size() - 1, (int)(values.size() * p));
+    return values[index];
+}
+
+// num_stream路视频，每路每interval_ms提交一帧，urgent_every > 0时每隔urgent_every帧有一帧带deadline
+static void bench_batching(const BatchingPolicy& policy, int num_stream, float interval_ms, int frames_per_stream, int urgent_every = 0, float urgent_deadline_ms = 0){
+
+    SleepController controller;
+    controller.set_batching_policy(policy);
+    if(!controller.startup(16, 2.0f, 0.25f)){
+        INFOE("Controller startup failed");
+        return;
+    }
+
+    vector<thread> streams;
+    vector<vector<shared_future<double>>> normal_futures(num_stream), urgent_futures(num_stream);
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_stream; ++i){
+        streams.emplace_back([&, i](){
+            auto interval = std::chrono::microseconds((long long)(interval_ms * 1000));
+            auto tick     = std::chrono::steady_clock::now();
+            for(int j = 0; j < frames_per_stream; ++j){
+                if(urgent_every > 0 && j % urgent_every == 0){
+                    JobOption option;
+                    option.deadline_ms = urgent_deadline_ms;
+                    urgent_futures[i].emplace_back(controller.commit(j, option));
+                }else{
+                    normal_futures[i].emplace_back(controller.commit(j));
+                }
+                tick += interval;
+                this_thread::sleep_until(tick);
+            }
+        });
+    }
+
+    for(auto& t : streams)
+        t.join();
+
+    vector<double> normal_latency, urgent_latency;
+    for(auto& fs : normal_futures)
+        for(auto& f : fs) normal_latency.emplace_back(f.get());
+
+    for(auto& fs : urgent_futures)
+        for(auto& f : fs) urgent_latency.emplace_back(f.get());
+
+    double cost_ms = iLogger::timestamp_now_float() - t0;
+    int total = normal_latency.size() + urgent_latency.size();
+    INFO("target = %2d, max_wait = %.1f ms: %.0f jobs/sec, average batch %.2f, p50 %.2f ms, p99 %.2f ms", 
+        policy.target_batch_size, policy.max_wait_ms, total / (cost_ms / 1000), controller.average_batch_size(),
+        percentile(normal_latency, 0.5f), percentile(normal_latency, 0.99f)
+    );
+
+    if(!urgent_latency.empty()){
+        INFO("    deadline %.1f ms jobs: p50 %.2f ms, p99 %.2f ms", 
+            urgent_deadline_ms, percentile(urgent_latency, 0.5f), percentile(urgent_latency, 0.99f)
+        );
+    }
+}
+
+static const char* overload_policy_name(OverloadPolicy policy){
+    switch(policy){
+    case OverloadPolicy::Block:      return "Block";
+    case OverloadPolicy::Reject:     return "Reject";
+    case OverloadPolicy::DropOldest: return "DropOldest";
+    default: return "Unknow";
+    }
+}
+
+// 一个线程一次性提交num_bulk个批量任务，同时一路实时流每interval_ms提交一帧
+static void bench_priority(bool use_priority, int num_bulk, float interval_ms, int frames){
+
+    SleepController controller;
+    if(!controller.startup(16, 2.0f, 0.25f)){
+        INFOE("Controller startup failed");
+        return;
+    }
+
+    JobOption bulk_option, alarm_option;
+    if(use_priority){
+        bulk_option.priority  = JobPriority::Low;
+        alarm_option.priority = JobPriority::High;
+    }
+
+    vector<shared_future<double>> bulk_futures, alarm_futures;
+    thread bulk([&](){
+        for(int i = 0; i < num_bulk; ++i)
+            bulk_futures.emplace_back(controller.commit(i, bulk_option));
+    });
+
+    auto interval = std::chrono::microseconds((long long)(interval_ms * 1000));
+    auto tick     = std::chrono::steady_clock::now();
+    for(int i = 0; i < frames; ++i){
+        alarm_futures.emplace_back(controller.commit(i, alarm_option));
+        tick += interval;
+        this_thread::sleep_until(tick);
+    }
+    bulk.join();
+
+    vector<double> bulk_latency, alarm_latency;
+    for(auto& f : bulk_futures)  bulk_latency.emplace_back(f.get());
+    for(auto& f : alarm_futures) alarm_latency.emplace_back(f.get());
+
+    INFO("priority = %-5s: alarm p50 %.2f ms, p99 %.2f ms, bulk p50 %.2f ms, p99 %.2f ms", 
+        use_priority ? "on" : "off",
+        percentile(alarm_latency, 0.5f), percentile(alarm_latency, 0.99f),
+        percentile(bulk_latency, 0.5f), percentile(bulk_latency, 0.99f)
+    );
+}
+
+// 瞬间提交num_burst个任务，队列上限为max_queue_size
+static void bench_overload(JobQueueType type, OverloadPolicy overload, int max_queue_size, int num_burst){
+
+    SleepController controller;
+    AdmissionPolicy policy;
+    policy.max_queue_size = max_queue_size;
+    policy.overload       = overload;
+    controller.set_job_queue(type, max_queue_size);
+    controller.set_admission_policy(policy);
+    if(!controller.startup(16, 2.0f, 0.25f)){
+        INFOE("Controller startup failed");
+        return;
+    }
+
+    vector<shared_future<double>> futures;
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_burst; ++i)
+        futures.emplace_back(controller.commit(i));
+    double commit_ms = iLogger::timestamp_now_float() - t0;
+
+    int num_empty = 0;
+    vector<double> latency;
+    for(auto& f : futures){
+        double value = f.get();
+        if(value == 0) num_empty++;
+        else latency.emplace_back(value);
+    }
+
+    auto stat = controller.job_queue_statistics();
+    INFO("%-8s %-10s: commit %.2f ms, committed %lld, rejected %lld, dropped %lld, blocked %lld, empty %d, p99 %.2f ms", 
+        queue_type_name(type), overload_policy_name(overload), commit_ms,
+        stat.committed, stat.rejected, stat.dropped, stat.blocked, num_empty, percentile(latency, 0.99f)
+    );
+}
+
+// LockFree + DropOldest时，高优先级队列溢出只能丢弃同一队列中最旧的任务，已经排队的低优先级任务不受影响
+static bool check_drop_oldest_priority(int capacity){
+
+    SleepController controller;
+    AdmissionPolicy policy;
+    policy.max_queue_size = capacity;
+    policy.overload       = OverloadPolicy::DropOldest;
+    controller.set_job_queue(JobQueueType::LockFree, capacity);
+    controller.set_admission_policy(policy);
+    if(!controller.startup(capacity, 100.0f, 0.0f)){
+        INFOE("Controller startup failed");
+        return false;
+    }
+
+    // 先让worker取走一个任务进入sleep，之后提交的任务都留在队列里
+    auto first = controller.commit(0);
+    this_thread::sleep_for(chrono::milliseconds(20));
+
+    JobOption low_option, high_option;
+    low_option.priority  = JobPriority::Low;
+    high_option.priority = JobPriority::High;
+
+    vector<shared_future<double>> low_futures, high_futures;
+    for(int i = 0; i < capacity; ++i)
+        low_futures.emplace_back(controller.commit(i, low_option));
+
+    // High队列满之后，后一半的任务依次挤掉前一半
+    for(int i = 0; i < capacity * 2; ++i)
+        high_futures.emplace_back(controller.commit(i, high_option));
+
+    first.get();
+    int low_empty = 0, high_empty_old = 0, high_empty_new = 0;
+    for(auto& f : low_futures)
+        low_empty += f.get() == 0;
+
+    for(int i = 0; i < (int)high_futures.size(); ++i){
+        if(high_futures[i].get() != 0) continue;
+        if(i < capacity) high_empty_old++;
+        else high_empty_new++;
+    }
+
+    auto stat = controller.job_queue_statistics();
+    bool ok   = low_empty == 0 && high_empty_old == capacity && high_empty_new == 0 && stat.dropped == capacity;
+    INFO("LockFree DropOldest by priority: dropped %lld, low empty %d / %d, high old empty %d / %d, high new empty %d, %s",
+        stat.dropped, low_empty, capacity, high_empty_old, capacity, high_empty_new, ok ? "ok" : "failed"
+    );
+    return ok;
+}
+
+// num_thread个线程，每次query后持有hold_us再release，模拟preprocess到worker消费之间的占用
+static void bench_allocator(int capacity, int num_thread, int queries_per_thread, int hold_us){
+
+    MonopolyAllocator<int> allocator(capacity);
+    atomic<int> num_failed{0};
+    vector<thread> threads;
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_thread; ++i){
+        threads.emplace_back([&](){
+            for(int j = 0; j < queries_per_thread; ++j){
+                auto item = allocator.query();
+                if(item == nullptr){
+                    num_failed++;
+                    continue;
+                }
+
+                if(hold_us > 0)
+                    this_thread::sleep_for(std::chrono::microseconds(hold_us));
+                item->release();
+            }
+        });
+    }
+
+    for(auto& t : threads)
+        t.join();
+
+    double cost_ms = iLogger::timestamp_now_float() - t0;
+    auto stat = allocator.statistics();
+    INFO("capacity = %2d, threads = %2d, hold = %3d us: %.0f query/sec, peak %d, wait %lld, timeout %lld, failed %d, avg wait %.3f ms, max wait %.3f ms",
+        capacity, num_thread, hold_us, num_thread * (double)queries_per_thread / (cost_ms / 1000), stat.peak_occupancy,
+        stat.num_wait, stat.num_timeout, num_failed.load(), stat.num_wait == 0 ? 0 : stat.total_wait_ms / stat.num_wait, stat.max_wait_ms
+    );
+}
+
+// 持有对象时缩容，release之后才真正回收，再扩容复用被回收的对象。被回收的对象重复release不能再次入栈
+static bool check_allocator_resize(){
+
+    MonopolyAllocator<int> allocator(4);
+    vector<MonopolyAllocator<int>::MonopolyDataPointer> items;
+    for(int i = 0; i < 4; ++i)
+        items.emplace_back(allocator.query());
+
+    allocator.resize(2);
+    bool ok = allocator.query(10) == nullptr;
+    items[0]->release();
+    items[1]->release();
+    items[0]->release();
+    ok = ok && allocator.num_available() == 0 && allocator.query(10) == nullptr;
+
+    items[2]->release();
+    ok = ok && allocator.num_available() == 1;
+
+    allocator.resize(8);
+    ok = ok && allocator.num_available() == 7 && allocator.capacity() == 8;
+    items[3]->release();
+    items[3]->release();
+    ok = ok && allocator.num_available() == 8;
+
+    // 8个对象各不相同，之后没有多余的对象
+    items.clear();
+    for(int i = 0; i < 8; ++i){
+        auto item = allocator.query(10);
+        for(auto& other : items)
+            ok = ok && item != nullptr && item.get() != other.get();
+        items.emplace_back(item);
+    }
+    ok = ok && allocator.query(10) == nullptr;
+
+    auto stat = allocator.statistics();
+    INFO("resize check %s, peak %d, timeout %lld", ok ? "passed" : "failed", stat.peak_occupancy, stat.num_timeout);
+    return ok;
+}
+
+// preprocess像真实模型一样从tensor_allocator_拿对象，worker消费后归还
+class ChunkController : public FakeModel<int, int>{
+public:
+    virtual ~ChunkController(){
+        stop();
+    }
+
+    bool startup(int max_batch_size, bool chunked){
+        set_tensor_allocator(max_batch_size * 2, 20, chunked ? max_batch_size : 0);
+        return FakeModel<int, int>::startup("chunk", max_batch_size, 1.0f, 0);
+    }
+
+    virtual bool compute(Job& job, const int& input) override{
+        job.output = input + 1;
+        return true;
+    }
+};
+
+// 一次commits的任务数远大于allocator容量（max_batch_size * 2），例如一帧中的很多人
+// 不分段时，超过容量的任务在query中等待自己而超时失败，分段后先放入队列的任务被worker消费并归还对象
+// 返回是否所有任务都成功
+static bool check_commit_chunk(bool chunked, int max_batch_size, int count){
+
+    ChunkController controller;
+    if(!controller.startup(max_batch_size, chunked)){
+        INFOE("Startup failed");
+        return false;
+    }
+
+    vector<int> inputs(count);
+    for(int i = 0; i < count; ++i)
+        inputs[i] = i;
+
+    auto tic     = iLogger::timestamp_now_float();
+    auto futures = controller.commits(inputs);
+    int failed   = 0;
+    for(int i = 0; i < count; ++i){
+        if(futures[i].get() != i + 1)
+            failed++;
+    }
+
+    INFO("chunked = %s, %d commits, capacity %d: failed %d, %.2f ms, average batch %.2f",
+        chunked ? "true" : "false", count, max_batch_size * 2, failed, iLogger::timestamp_now_float() - tic, controller.average_batch_size()
+    );
+    return failed == 0;
+}
+
+// 每个任务的EndToEnd、QueueWait、Preprocess都应当被记录一次，batch直方图的总和等于任务数
+static bool check_metrics(int max_batch_size, int count){
+
+    ChunkController controller;
+    if(!controller.startup(max_batch_size, true)){
+        INFOE("Startup failed");
+        return false;
+    }
+
+    controller.set_metrics_name("chunk");
+    vector<int> inputs(count);
+    for(int i = 0; i < count; ++i)
+        inputs[i] = i;
+
+    for(auto& future : controller.commits(inputs))
+        future.get();
+
+    auto metrics     = controller.metrics();
+    auto& end_to_end = metrics.stage(InferStage::EndToEnd);
+    auto& queue_wait = metrics.stage(InferStage::QueueWait);
+    auto& preprocess = metrics.stage(InferStage::Preprocess);
+    bool ok = end_to_end.count == count && queue_wait.count == count && preprocess.count == count
+        && metrics.batch_size.sum == count && metrics.stage(InferStage::AllocatorWait).count == count;
+
+    auto parsed  = Json::parse_string(metrics.to_json().toStyledString());
+    bool json_ok = parsed.isObject() && parsed["name"].asString() == "chunk" && parsed["stages_ms"]["end_to_end"]["count"].asInt64() == count;
+    INFO("metrics %s: %lld jobs, %lld batches, end_to_end p50 = %.2f ms, p99 = %.2f ms, queue_wait p99 = %.2f ms, %.0f jobs/sec, json %s",
+        ok ? "ok" : "mismatch", end_to_end.count, metrics.batch_size.count,
+        end_to_end.percentile(50) / 1000.0f, end_to_end.percentile(99) / 1000.0f, queue_wait.percentile(99) / 1000.0f,
+        metrics.jobs_per_second(), json_ok ? "ok" : "failed"
+    );
+
+    controller.reset_metrics();
+    bool reset_ok = controller.metrics().stage(InferStage::EndToEnd).count == 0;
+    if(!reset_ok)
+        INFOE("reset_metrics failed");
+    return ok && json_ok && reset_ok;
+}
+
+// base_ms为每个副本的固定耗时，least_loaded = false时负载恒为0，退化为轮询
+// 副本耗时相同时，分配的max/min不超过1.5；存在慢副本时，least-loaded分给最慢副本的任务必须少于其他每一个副本
+static bool bench_replica_pool(const vector<float>& base_ms, bool least_loaded, int num_stream, float interval_ms, int frames_per_stream){
+
+    ReplicaPool<SleepController> pool([=](SleepController* replica){
+        return least_loaded ? replica->pending_jobs() : 0;
+    });
+
+    for(int i = 0; i < (int)base_ms.size(); ++i){
+        shared_ptr<SleepController> replica(new SleepController());
+        if(!replica->startup(16, base_ms[i], 0.25f)){
+            INFOE("Replica startup failed");
+            return false;
+        }
+        pool.add(replica, i);
+    }
+
+    vector<thread> streams;
+    vector<vector<shared_future<double>>> futures(num_stream);
+    for(int i = 0; i < num_stream; ++i){
+        streams.emplace_back([&, i](){
+            auto interval = std::chrono::microseconds((long long)(interval_ms * 1000));
+            auto tick     = std::chrono::steady_clock::now();
+            for(int j = 0; j < frames_per_stream; ++j){
+                futures[i].emplace_back(pool.dispatch()->commit(j));
+                tick += interval;
+                this_thread::sleep_until(tick);
+            }
+        });
+    }
+
+    for(auto& t : streams)
+        t.join();
+
+    vector<double> latency;
+    for(auto& fs : futures)
+        for(auto& f : fs) latency.emplace_back(f.get());
+
+    auto stats = pool.statistics();
+    string dispatched;
+    long long min_dispatched = stats[0].dispatched, max_dispatched = stats[0].dispatched;
+    for(auto& stat : stats){
+        dispatched += iLogger::format("%lld ", stat.dispatched);
+        min_dispatched = std::min(min_dispatched, stat.dispatched);
+        max_dispatched = std::max(max_dispatched, stat.dispatched);
+    }
+
+    float ratio  = max_dispatched / (float)std::max(1LL, min_dispatched);
+    int slowest  = std::max_element(base_ms.begin(), base_ms.end()) - base_ms.begin();
+    bool equal   = *std::min_element(base_ms.begin(), base_ms.end()) == base_ms[slowest];
+    bool ok      = true;
+    if(equal){
+        ok = ratio <= 1.5f;
+    }else if(least_loaded){
+        for(int i = 0; i < (int)stats.size(); ++i)
+            ok = ok && (i == slowest || stats[slowest].dispatched < stats[i].dispatched);
+    }
+
+    INFO("%-12s replicas = %d: dispatched [ %s], max/min = %.2f, p50 %.2f ms, p99 %.2f ms, %s",
+        least_loaded ? "least-loaded" : "round-robin", (int)stats.size(), dispatched.c_str(), 
+        ratio, percentile(latency, 0.5f), percentile(latency, 0.99f), ok ? "ok" : "failed"
+    );
+    return ok;
+}
+
+// 一次性提交num_jobs个任务，统计吞吐
+static void bench_pipeline(int num_slots, const PipelineCost& cost, int max_batch_size, int num_jobs){
+
+    PipelineController controller;
+    if(!controller.startup(max_batch_size, num_slots, cost)){
+        INFOE("Controller startup failed");
+        return;
+    }
+
+    vector<shared_future<double>> futures;
+    auto t0 = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_jobs; ++i)
+        futures.emplace_back(controller.commit(i));
+
+    vector<double> latency;
+    for(auto& f : futures)
+        latency.emplace_back(f.get());
+
+    double cost_ms  = iLogger::timestamp_now_float() - t0;
+    int num_batch   = (num_jobs + max_batch_size - 1) / max_batch_size;
+    INFO("slots = %d: %.0f jobs/sec, %.2f ms/batch, p50 %.2f ms", 
+        num_slots, num_jobs / (cost_ms / 1000), cost_ms / num_batch, percentile(latency, 0.5f)
+    );
+}
+
+int app_controller_bench(){
+
+    // 各个check的结果，bench部分只输出数据
+    bool ok = true;
+    const int total_commits = 200000;
+    int producers[] = {1, 2, 4, 8, 16, 32, 64};
+    JobQueueType types[] = {JobQueueType::Mutex, JobQueueType::LockFree};
+
+    INFO("===================== controller commit bench ==================================");
+    for(int num_producer : producers){
+        int per_producer = total_commits / num_producer;
+        for(auto type : types){
+            double qps = bench_commits(type, num_producer, per_producer);
+            INFO("%-8s producers = %2d, %.0f commits/sec", queue_type_name(type), num_producer, qps);
+        }
+    }
+
+    // 假引擎：2ms + 0.25ms * batch，8路 x 每路10ms一帧 = 800帧/秒
+    // 不凑batch时大部分是小batch推理，凑batch后以少量延迟换取吞吐
+    INFO("===================== batching policy bench ==================================");
+    float max_waits[] = {0.0f, 1.0f, 2.0f, 4.0f};
+    for(float max_wait : max_waits){
+        BatchingPolicy policy;
+        policy.target_batch_size = 16;
+        policy.max_wait_ms       = max_wait;
+        bench_batching(policy, 8, 10.0f, 300);
+    }
+
+    BatchingPolicy policy;
+    policy.target_batch_size = 16;
+    policy.max_wait_ms       = 4.0f;
+    bench_batching(policy, 8, 10.0f, 300, 10, 1.0f);
+
+    // 2000个批量任务约需要250ms消化完，不开优先级时实时流要排在它们后面
+    INFO("===================== priority bench ==================================");
+    bench_priority(false, 2000, 10.0f, 50);
+    bench_priority(true,  2000, 10.0f, 50);
+
+    INFO("===================== overload policy bench ==================================");
+    OverloadPolicy overloads[] = {OverloadPolicy::Block, OverloadPolicy::Reject, OverloadPolicy::DropOldest};
+    for(auto type : types){
+        for(auto overload : overloads)
+            bench_overload(type, overload, 64, 1000);
+    }
+    ok = check_drop_oldest_priority(64) && ok;
+
+    // 每个模型max_batch_size * 2个对象，生产者远多于对象数时的表现
+    INFO("===================== monopoly allocator bench ==================================");
+    int threads[] = {1, 4, 16, 64};
+    for(int num_thread : threads){
+        bench_allocator(32, num_thread, 200000 / num_thread, 0);
+        bench_allocator(32, num_thread, 2000 / num_thread, 100);
+    }
+    ok = check_allocator_resize() && ok;
+
+    INFO("===================== chunked commits check ==================================");
+    // 不分段时预期会有任务超时失败，只用于对比
+    check_commit_chunk(false, 4, 64);
+    ok = check_commit_chunk(true, 4, 64) && ok;
+
+    INFO("===================== metrics check ==================================");
+    ok = check_metrics(4, 1000) && ok;
+
+    // 4个相同的副本，分发应当均衡；其中一个副本变慢后，最小负载分发应当少给它任务
+    INFO("===================== replica pool bench ==================================");
+    ok = bench_replica_pool({2.0f, 2.0f, 2.0f, 2.0f}, false, 8, 4.0f, 250) && ok;
+    ok = bench_replica_pool({2.0f, 2.0f, 2.0f, 2.0f}, true,  8, 4.0f, 250) && ok;
+    ok = bench_replica_pool({2.0f, 2.0f, 2.0f, 12.0f}, false, 8, 4.0f, 250) && ok;
+    ok = bench_replica_pool({2.0f, 2.0f, 2.0f, 12.0f}, true,  8, 4.0f, 250) && ok;
+
+    // host 1ms + device 4ms + host 2ms，顺序执行每个batch 7ms，流水线后受限于device的4ms
+    INFO("===================== pipeline bench ==================================");
+    PipelineCost cost;
+    cost.stage_ms   = 1.0f;
+    cost.device_ms  = 4.0f;
+    cost.deliver_ms = 2.0f;
+    for(int num_slots = 1; num_slots <= 3; ++num_slots)
+        bench_pipeline(num_slots, cost, 8, 1600);
+
+    // completion的状态对象来自池，allocated约为在途任务数，之后不再增加
+    INFO("===================== completion bench ==================================");
+    ResultMode modes[] = {ResultMode::Future, ResultMode::Completion, ResultMode::Callback};
+    int completion_producers[] = {1, 4, 16};
+    for(int num_producer : completion_producers){
+        for(auto mode : modes)
+            ok = bench_completion(mode, num_producer, total_commits / num_producer) && ok;
+    }
+    ok = check_stop_with_queued_jobs(JobQueueType::Mutex, 100) && ok;
+    ok = check_stop_with_queued_jobs(JobQueueType::LockFree, 100) && ok;
+
+    if(!ok){
+        INFOE("Controller bench check failed");
+        return -1;
+    }
+    INFO("Controller bench check passed");
+    return 0;
+}
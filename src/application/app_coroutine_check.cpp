@@ -0,0 +1,222 @@
+/**
+ * 不依赖GPU的协程接口检查，检测、嵌入都是只sleep的假引擎（CPU），对齐在协程中直接计算
+ *   1. 阻塞方式：与app_arcface_tracker一样，每一帧commit(...).get()检测，每张脸commit(...).get()嵌入
+ *   2. 协程方式：每一路流是一个协程，detect -> align -> embed线性书写，所有流由一个线程上的CoroutineExecutor驱动
+ * 两种方式的结果必须一致，并对比耗时与平均batch大小
+ *   make cpp_std=c++20 run_coroutine_check
+ */
+
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <common/ilogger.hpp>
+#include <common/infer_controller.hpp>
+#include <common/infer_coroutine.hpp>
+#include "tools/fake_model.hpp"
+
+using namespace std;
+
+#if INFER_HAS_COROUTINE
+
+namespace{
+
+    struct FakeFace{
+        float left, top, right, bottom;
+    };
+
+    struct FrameInput{
+        int stream = 0;
+        int index  = 0;
+    };
+
+    typedef vector<FakeFace> FakeFaces;
+    typedef vector<float> FakeFeature;
+
+    // 每一帧1~3张脸，位置由stream、index确定
+    class FakeDetector : public FakeModel<FrameInput, FakeFaces>{
+    public:
+        virtual ~FakeDetector(){
+            stop();
+        }
+
+        virtual bool compute(Job& job, const FrameInput& input) override{
+            int num_faces = (input.stream + input.index) % 3 + 1;
+            for(int i = 0; i < num_faces; ++i){
+                float x = (input.stream * 37 + input.index * 11 + i * 101) % 500;
+                float y = (input.stream * 13 + input.index * 7  + i * 53)  % 300;
+                job.output.push_back({x, y, x + 40 + i * 8, y + 48 + i * 6});
+            }
+            return true;
+        }
+    };
+
+    // 对齐后的输入为8个值，特征为归一化后的16维向量
+    class FakeEmbedder : public FakeModel<FakeFeature, FakeFeature>{
+    public:
+        virtual ~FakeEmbedder(){
+            stop();
+        }
+
+        virtual bool compute(Job& job, const FakeFeature& input) override{
+            job.output.resize(16);
+            float norm = 0;
+            for(int i = 0; i < 16; ++i){
+                job.output[i] = input[i % input.size()] * (i + 1) + i;
+                norm += job.output[i] * job.output[i];
+            }
+            norm = sqrt(norm);
+            for(auto& v : job.output) v /= norm;
+            return true;
+        }
+    };
+
+    FakeFeature fake_align(const FakeFace& face, const FrameInput& frame){
+        float cx = (face.left + face.right) * 0.5f;
+        float cy = (face.top + face.bottom) * 0.5f;
+        float w  = face.right - face.left;
+        float h  = face.bottom - face.top;
+        return {cx, cy, w, h, cx / w, cy / h, (float)frame.stream, (float)frame.index};
+    }
+
+    // 每一帧的结果，所有特征的和
+    float accumulate_features(const vector<FakeFeature>& features){
+        float sum = 0;
+        for(auto& feature : features)
+            sum += accumulate(feature.begin(), feature.end(), 0.0f);
+        return sum;
+    }
+
+    vector<float> run_blocking(FakeDetector& detector, FakeEmbedder& embedder, int num_streams, int num_frames){
+
+        vector<float> output(num_streams * num_frames);
+        for(int index = 0; index < num_frames; ++index){
+            for(int stream = 0; stream < num_streams; ++stream){
+                FrameInput frame{stream, index};
+                auto faces = detector.commit(frame).get();
+
+                vector<FakeFeature> features;
+                for(auto& face : faces)
+                    features.emplace_back(embedder.commit(fake_align(face, frame)).get());
+                output[stream * num_frames + index] = accumulate_features(features);
+            }
+        }
+        return output;
+    }
+
+    // 一帧的detect -> align -> embed，作为子协程被run_stream等待
+    InferTask<vector<FakeFeature>> detect_and_embed(FakeDetector& detector, FakeEmbedder& embedder, FrameInput frame, CoroutineExecutor* executor){
+
+        auto faces = co_await co_commit(detector, frame, executor);
+
+        vector<FakeFeature> aligned;
+        for(auto& face : faces)
+            aligned.emplace_back(fake_align(face, frame));
+        co_return co_await co_commits(embedder, aligned, executor);
+    }
+
+    InferTask<void> run_stream(FakeDetector& detector, FakeEmbedder& embedder, CoroutineExecutor* executor, int stream, int num_frames, float* output){
+
+        for(int index = 0; index < num_frames; ++index){
+            auto features = co_await detect_and_embed(detector, embedder, FrameInput{stream, index}, executor);
+            output[index] = accumulate_features(features);
+        }
+    }
+
+    // 子协程的异常在co_await处重新抛出
+    InferTask<int> throw_after_commit(FakeDetector& detector, CoroutineExecutor* executor){
+        auto faces = co_await co_commit(detector, FrameInput{0, 0}, executor);
+        if(!faces.empty())
+            throw runtime_error("expected");
+        co_return (int)faces.size();
+    }
+
+    InferTask<void> check_exception(FakeDetector& detector, CoroutineExecutor* executor, bool* caught){
+        try{
+            co_await throw_after_commit(detector, executor);
+        }catch(const runtime_error& e){
+            *caught = true;
+        }
+    }
+
+    bool run_coroutine_check(int num_streams, int num_frames){
+
+        const int max_batch_size = 16;
+        FakeDetector detector;
+        FakeEmbedder embedder;
+        if(!detector.startup("detector", max_batch_size, 2.0f, 0.1f) || !embedder.startup("embedder", max_batch_size, 1.0f, 0.05f)){
+            INFOE("Startup fake models failed");
+            return false;
+        }
+
+        auto tic = iLogger::timestamp_now_float();
+        auto expected = run_blocking(detector, embedder, num_streams, num_frames);
+        auto blocking_ms = iLogger::timestamp_now_float() - tic;
+        float blocking_detect_batch = detector.average_batch_size();
+        float blocking_embed_batch  = embedder.average_batch_size();
+
+        FakeDetector co_detector;
+        FakeEmbedder co_embedder;
+        co_detector.startup("detector", max_batch_size, 2.0f, 0.1f);
+        co_embedder.startup("embedder", max_batch_size, 1.0f, 0.05f);
+
+        vector<float> output(num_streams * num_frames, -1);
+        CoroutineExecutor executor;
+        tic = iLogger::timestamp_now_float();
+        for(int stream = 0; stream < num_streams; ++stream)
+            executor.spawn(run_stream(co_detector, co_embedder, &executor, stream, num_frames, output.data() + stream * num_frames));
+        executor.run();
+        auto coroutine_ms = iLogger::timestamp_now_float() - tic;
+
+        int mismatch = 0;
+        for(int i = 0; i < (int)output.size(); ++i){
+            if(output[i] != expected[i])
+                mismatch++;
+        }
+
+        INFO("%d streams x %d frames, blocking: %.2f ms (batch %.2f / %.2f), coroutine on 1 thread: %.2f ms (batch %.2f / %.2f), speedup %.2fx",
+            num_streams, num_frames,
+            blocking_ms, blocking_detect_batch, blocking_embed_batch,
+            coroutine_ms, co_detector.average_batch_size(), co_embedder.average_batch_size(),
+            blocking_ms / coroutine_ms
+        );
+
+        // 不经过executor，直接在worker线程上恢复
+        vector<float> inline_output(num_frames, -1);
+        CoroutineExecutor inline_executor;
+        inline_executor.spawn(run_stream(co_detector, co_embedder, nullptr, 0, num_frames, inline_output.data()));
+        inline_executor.run();
+        for(int i = 0; i < num_frames; ++i){
+            if(inline_output[i] != expected[i])
+                mismatch++;
+        }
+
+        bool caught = false;
+        CoroutineExecutor exception_executor;
+        exception_executor.spawn(check_exception(co_detector, &exception_executor, &caught));
+        exception_executor.run();
+
+        if(mismatch > 0 || !caught){
+            INFOE("Coroutine check failed, %d mismatch, exception caught = %s", mismatch, caught ? "true" : "false");
+            return false;
+        }
+        return true;
+    }
+};
+
+int app_coroutine_check(){
+
+    bool ok = run_coroutine_check(1, 32);
+    ok = run_coroutine_check(8, 32) && ok;
+    ok = run_coroutine_check(64, 16) && ok;
+    if(ok) INFO("Coroutine check passed");
+    return ok ? 0 : -1;
+}
+
+#else
+
+int app_coroutine_check(){
+    INFOW("coroutine_check requires c++20, build with make cpp_std=c++20 or cmake -DCPP_STD=20");
+    return 0;
+}
+
+#endif // INFER_HAS_COROUTINE
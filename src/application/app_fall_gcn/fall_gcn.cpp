@@ -47,6 +47,7 @@ namespace FallGCN{
     public:
         bool startup(const string& file, int gpuid){
             gpuid_ = gpuid;
+            set_metrics_name(iLogger::file_name(file, false));
             return ControllerImpl::startup(make_tuple(file, gpuid));
         }
     
@@ -71,6 +72,7 @@ namespace FallGCN{
 
             tensor_allocator_ = make_shared<MonopolyAllocator<TRT::Tensor>>(max_batch_size * 2);
             stream_           = engine->get_stream();
+            commit_chunk_size_ = max_batch_size;
             result.set_value(true);
             input->resize_single_dim(0, max_batch_size);
 
@@ -79,16 +81,22 @@ namespace FallGCN{
 
                 // 一次推理越多越好
                 // 把图像批次丢引擎里边去
+                // 关键点在host上，直接写到输入的host内存，整个batch只上传一次
                 int infer_batch_size = fetch_jobs.size();
+                input->to_cpu(false);
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
                     auto& job = fetch_jobs[ibatch];
-                    input->copy_from_gpu(input->offset(ibatch), job.mono_tensor->data()->gpu(), input->count(1));
+                    memcpy(input->cpu<float>(ibatch), job.mono_tensor->data()->cpu<float>(), input->count(1) * sizeof(float));
                     job.mono_tensor->release();
                 }
+                input->to_gpu();
                 // 模型推理
+                stage_event_begin(0, InferStage::Forward, stream_);
                 engine->forward(false);
+                stage_event_end(0, InferStage::Forward, stream_);
 
                 // 收取结果，output->cpu里面存在一个同步操作
+                long long delivery_begin = LatencyHistogram::now_us();
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
                     
                     auto& job                   = fetch_jobs[ibatch];
@@ -99,18 +107,39 @@ namespace FallGCN{
 
                     int label = std::max_element(item_based_output, item_based_output + output->channel()) - item_based_output;
                     output_state = make_tuple((FallState)label, item_based_output[label]);
-                    job.pro->set_value(output_state);
+                    job.set_value(output_state);
                 }
+                metrics_.record(InferStage::Delivery, LatencyHistogram::now_us() - delivery_begin);
+                collect_stage_events(0);
                 fetch_jobs.clear();
             }
             INFOV("Engine destroy.");
         }
 
         virtual shared_future<tuple<FallState, float>> commit(const vector<Point3f>& keys, const Rect& box) override{
+            return commit(keys, box, JobOption());
+        }
+
+        virtual shared_future<tuple<FallState, float>> commit(const vector<Point3f>& keys, const Rect& box, const JobOption& option) override{
             FallGCNInput input;
             input.keys  = keys;
             input.box   = box;
-            return ControllerImpl::commit(input);
+            return ControllerImpl::commit(input, option);
+        }
+
+        virtual vector<shared_future<tuple<FallState, float>>> commits(const vector<vector<Point3f>>& keys, const vector<Rect>& boxes, const JobOption& option) override{
+
+            if(keys.size() != boxes.size()){
+                INFOE("keys.size()[%d] != boxes.size()[%d]", keys.size(), boxes.size());
+                return ControllerImpl::commits_with(keys.size(), option, [](Job& job, int index){ return false; });
+            }
+
+            return ControllerImpl::commits_with(keys.size(), option, [&](Job& job, int index){
+                FallGCNInput input;
+                input.keys = keys[index];
+                input.box  = boxes[index];
+                return preprocess(job, input);
+            });
         }
 
         virtual bool preprocess(Job& job, const FallGCNInput& input) override{
@@ -146,10 +175,15 @@ namespace FallGCN{
                 inptr[1] = (point.y - input.box.y) / box_max_line - 0.5f;
                 inptr[2] = point.z;
             }
-            tensor->to_gpu();
+
+            // 留在host上，由worker合并上传
             return true;
         }
 
+        virtual InferMetricsSnapshot metrics() override{
+            return ControllerImpl::metrics();
+        }
+
     private:
         int gpuid_ = 0;
         TRT::CUStream stream_ = nullptr;
@@ -6,6 +6,8 @@
 #include <string>
 #include <future>
 #include <opencv2/opencv.hpp>
+#include <common/job_option.hpp>
+#include <common/infer_metrics.hpp>
 
 namespace FallGCN{
 
@@ -23,6 +25,13 @@ namespace FallGCN{
     class Infer{
     public:
         virtual shared_future<tuple<FallState, float>> commit(const vector<Point3f>& keys, const Rect& box) = 0;
+        virtual shared_future<tuple<FallState, float>> commit(const vector<Point3f>& keys, const Rect& box, const JobOption& option) = 0;
+
+        // 一帧中所有人的关键点一起进入队列，合并为一个batch，keys与boxes一一对应
+        virtual vector<shared_future<tuple<FallState, float>>> commits(const vector<vector<Point3f>>& keys, const vector<Rect>& boxes, const JobOption& option = JobOption()) = 0;
+
+        // 各阶段耗时、batch大小、队列深度的直方图，metrics().to_json()可以输出为JSON
+        virtual InferMetricsSnapshot metrics() = 0;
     };
 
     // RAII，如果创建失败，返回空指针
@@ -5,6 +5,7 @@
 #include <builder/trt_builder.hpp>
 #include <infer/trt_infer.hpp>
 #include <common/ilogger.hpp>
+#include <common/infer_pipeline.hpp>
 
 #include "app_yolo/yolo.hpp"
 #include "app_alphapose/alpha_pose.hpp"
@@ -17,6 +18,24 @@ using namespace std;
 
 bool requires(const char* name);
 
+// 一个被确认的跟踪目标在这一帧的信息
+struct FallPerson{
+    int id = 0;
+    Rect box;
+    Rect predict_box;
+    vector<cv::Point> trace_line;
+    vector<Point3f> keys;
+    FallGCN::FallState state = FallGCN::FallState::UnCertain;
+    float confidence         = 0;
+};
+
+// 每一帧在pipeline里的数据
+struct FallFrame{
+    Mat image;
+    BoxSoAHandle objects;
+    vector<FallPerson> persons;
+};
+
 static bool compile_models(){
 
     TRT::set_device(0);
@@ -73,6 +92,90 @@ int app_fall_recognize(){
 
     auto remote_show = create_zmq_remote_show();
     auto tracker     = DeepSORT::create_tracker();
+
+    // detect -> track（按帧顺序） -> pose -> gcn -> draw，一帧中所有人一起提交（整帧只上传一次），多帧同时在途
+    InferPipeline<FallFrame> pipeline;
+    pipeline.add_model("detect", {},
+        [&](FallFrame& frame){ return detector_model->commit_soa(frame.image); },
+        [](FallFrame& frame, const BoxSoAHandle& objects){ frame.objects = objects; }
+    );
+
+    pipeline.add_stage("track", {"detect"}, [&](FallFrame& frame){
+
+        // 结构数组的结果直接交给tracker，只跟踪person（类别0）
+        tracker->update(*frame.objects, 0);
+
+        // tracker中的对象在下一帧会变化，这里复制需要的信息
+        auto final_objects = tracker->get_objects();
+        for(int i = 0; i < (int)final_objects.size(); ++i){
+            auto& person = final_objects[i];
+            if(person->time_since_update() == 0 && person->state() == DeepSORT::State::Confirmed){
+                FallPerson item;
+                item.id          = person->id();
+                item.box         = DeepSORT::convert_box_to_rect(person->last_position());
+                item.predict_box = DeepSORT::convert_box_to_rect(person->predict_box());
+                item.trace_line  = person->trace_line();
+                frame.persons.emplace_back(item);
+            }
+        }
+    }, true);
+
+    pipeline.add_model("pose", {"track"},
+        [&](FallFrame& frame){
+            vector<Rect> boxes;
+            for(auto& person : frame.persons)
+                boxes.emplace_back(person.box);
+            return pose_model->commits(frame.image, boxes);
+        },
+        [](FallFrame& frame, const vector<vector<Point3f>>& keys){
+            for(int i = 0; i < (int)keys.size(); ++i)
+                frame.persons[i].keys = keys[i];
+        }
+    );
+
+    pipeline.add_model("gcn", {"pose"},
+        [&](FallFrame& frame){
+            vector<vector<Point3f>> keys;
+            vector<Rect> boxes;
+            for(auto& person : frame.persons){
+                keys.emplace_back(person.keys);
+                boxes.emplace_back(person.box);
+            }
+            return gcn_model->commits(keys, boxes, JobPriority::High);
+        },
+        [](FallFrame& frame, const vector<tuple<FallGCN::FallState, float>>& states){
+            for(int i = 0; i < (int)states.size(); ++i){
+                frame.persons[i].state      = get<0>(states[i]);
+                frame.persons[i].confidence = get<1>(states[i]);
+            }
+        }
+    );
+
+    pipeline.add_stage("draw", {"gcn"}, [](FallFrame& frame){
+        auto& image = frame.image;
+        for(auto& person : frame.persons){
+            auto& box              = person.box;
+            const char* label_name = FallGCN::state_name(person.state);
+            rectangle(image, person.predict_box, Scalar(0, 255, 0), 1);
+            rectangle(image, box, Scalar(0, 255, 255), 1);
+
+            auto& line = person.trace_line;
+            for(int j = 0; j < (int)line.size() - 1; ++j){
+                auto& p = line[j];
+                auto& np = line[j + 1];
+                cv::line(image, p, np, Scalar(255, 128, 60), 2, 16);
+            }
+
+            putText(image, iLogger::format("%d. [%s] %.2f %%", person.id, label_name, person.confidence * 100), box.tl(), 0, 1, Scalar(0, 255, 0), 2, 16);
+            INFO("Predict is [%s], %.2f %%", label_name, person.confidence * 100);
+        }
+    });
+
+    if(!pipeline.startup(4, 8)){
+        INFOE("Startup pipeline failed");
+        return 0;
+    }
+
     // VideoWriter writer("fall_video.result.avi", cv::VideoWriter::fourcc('X', 'V', 'I', 'D'), 
     //     30,
     //     Size(cap.get(cv::CAP_PROP_FRAME_WIDTH), cap.get(cv::CAP_PROP_FRAME_HEIGHT))
@@ -81,45 +184,26 @@ int app_fall_recognize(){
     //     INFOE("Writer failed.");
     //     return 0;
     // }
-    while(cap.read(image)){
-        auto objects = detector_model->commit(image).get();
+    deque<shared_future<shared_ptr<FallFrame>>> inflight;
+    auto show_front = [&](){
+        remote_show->post(inflight.front().get()->image);
+        //writer.write(inflight.front().get()->image);
+        inflight.pop_front();
+    };
 
-        vector<DeepSORT::Box> boxes;
-        for(int i = 0; i < objects.size(); ++i){
-            auto& obj = objects[i];
-            if(obj.class_label != 0) continue;
-            boxes.emplace_back(std::move(DeepSORT::convert_to_box(obj)));
-        }
-        tracker->update(boxes);
+    while(cap.read(image)){
+        auto frame   = make_shared<FallFrame>();
+        frame->image = image.clone();
+        inflight.emplace_back(pipeline.commit(frame));
 
-        auto final_objects = tracker->get_objects();
-        for(int i = 0; i < final_objects.size(); ++i){
-            auto& person = final_objects[i];
-            if(person->time_since_update() == 0 && person->state() == DeepSORT::State::Confirmed){
-                Rect box = DeepSORT::convert_box_to_rect(person->last_position());
-                auto keys   = pose_model->commit(image, box).get();
-                auto statev = gcn_model->commit(keys, box).get();
-
-                FallGCN::FallState state = get<0>(statev);
-                float confidence         = get<1>(statev);
-                const char* label_name   = FallGCN::state_name(state);
-                rectangle(image, DeepSORT::convert_box_to_rect(person->predict_box()), Scalar(0, 255, 0), 1);
-                rectangle(image, box, Scalar(0, 255, 255), 1);
-
-                auto line = person->trace_line();
-                for(int j = 0; j < (int)line.size() - 1; ++j){
-                    auto& p = line[j];
-                    auto& np = line[j + 1];
-                    cv::line(image, p, np, Scalar(255, 128, 60), 2, 16);
-                }
-
-                putText(image, iLogger::format("%d. [%s] %.2f %%", person->id(), label_name, confidence * 100), box.tl(), 0, 1, Scalar(0, 255, 0), 2, 16);
-                INFO("Predict is [%s], %.2f %%", label_name, confidence * 100);
-           }
-        }
-        remote_show->post(image);
-        //writer.write(image);
+        // 按顺序显示已经完成的帧
+        while(!inflight.empty() && inflight.front().wait_for(chrono::seconds(0)) == future_status::ready)
+            show_front();
     }
+
+    while(!inflight.empty())
+        show_front();
+
     INFO("Done");
     return 0;
 }
\ No newline at end of file
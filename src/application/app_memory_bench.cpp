@@ -0,0 +1,134 @@
+
+/**
+ * MixMemory各个分配器的开销测试
+ *   1. 分配/释放的耗时，以及是否清零的差别（每次都是新分配，清零会触碰所有页）
+ *   2. Host/Host的Tensor在不依赖cuda的情况下resize、to_gpu/to_cpu、clone的开销
+ *   3. 分辨率不断变化的视频流，每帧新建tensor时，带缓存的分配器与直接分配的对比
+ * 没有cuda的机器上只测试Host、HostHugePage
+ *   ./pro memory_bench
+ */
+
+#include <vector>
+#include <common/ilogger.hpp>
+#include <common/trt_tensor.hpp>
+#include <common/cuda_tools.hpp>
+
+using namespace std;
+
+static bool has_cuda_device(){
+    int num_device = 0;
+    return cudaGetDeviceCount(&num_device) == cudaSuccess && num_device > 0;
+}
+
+static void bench_allocate(TRT::MemoryType type, size_t size, bool zero_fill, int iters){
+
+    auto allocator = TRT::get_memory_allocator(type);
+    auto tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < iters; ++i){
+        TRT::MixMemory memory(allocator, allocator);
+        memory.set_zero_fill(zero_fill);
+        memory.cpu(size);
+    }
+    auto ms = (iLogger::timestamp_now_float() - tic) / iters;
+    INFO("%-12s size = %6.2f MB, zero_fill = %d, %.3f ms/alloc", TRT::memory_type_name(type), size / 1024.0f / 1024.0f, zero_fill, ms);
+}
+
+// 返回拷贝回来的数据是否正确
+static bool bench_host_tensor(TRT::MemoryType type, int iters){
+
+    auto allocator = TRT::get_memory_allocator(type);
+    auto memory    = make_shared<TRT::MixMemory>(allocator, allocator);
+    TRT::Tensor tensor({16, 3, 640, 640}, memory);
+
+    // 复用的tensor只在第一次分配，之后resize到更小的尺寸不会重新分配
+    auto tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < iters; ++i){
+        tensor.resize(1 + i % 16, 3, 640, 640);
+        tensor.cpu();
+    }
+    auto resize_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+    tensor.resize(16, 3, 640, 640);
+    tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < iters; ++i){
+        tensor.cpu<float>()[0] = i;
+        tensor.to_gpu();
+        tensor.to_cpu();
+    }
+    auto copy_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+    tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < iters; ++i)
+        tensor.clone();
+    auto clone_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+    bool ok = tensor.cpu<float>()[0] == iters - 1;
+    INFO("%-12s tensor %s, resize %.3f ms, to_gpu+to_cpu %.3f ms, clone %.3f ms, check %s",
+        TRT::memory_type_name(type), tensor.shape_string(), resize_ms, copy_ms, clone_ms, ok ? "ok" : "failed"
+    );
+    return ok;
+}
+
+static void bench_variable_resolution(TRT::MemoryType type, bool caching, int num_frames){
+
+    // 几种分辨率轮流出现，每帧新建输入tensor，模拟预处理中的make_shared<TRT::Tensor>()
+    int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}, {960, 540}, {2560, 1440}};
+    int num_sizes  = sizeof(sizes) / sizeof(sizes[0]);
+
+    TRT::set_memory_caching(caching);
+    TRT::empty_memory_cache();
+    auto begin = TRT::memory_cache_statistics(type);
+    auto allocator = caching ? TRT::get_caching_allocator(type) : TRT::get_memory_allocator(type);
+
+    auto tic = iLogger::timestamp_now_float();
+    for(int i = 0; i < num_frames; ++i){
+        auto& size  = sizes[i % num_sizes];
+        auto memory = make_shared<TRT::MixMemory>(allocator, allocator);
+        TRT::Tensor tensor({1, 3, size[1], size[0]}, memory);
+        tensor.cpu<float>()[0] = i;
+    }
+    auto ms  = (iLogger::timestamp_now_float() - tic) / num_frames;
+    auto end = TRT::memory_cache_statistics(type);
+    INFO("%-12s caching = %d, %.3f ms/frame, hits = %lld, misses = %lld, peak = %.2f MB",
+        TRT::memory_type_name(type), caching, ms, end.hits - begin.hits, end.misses - begin.misses,
+        end.peak_allocated_bytes / 1024.0f / 1024.0f
+    );
+    TRT::set_memory_caching(true);
+}
+
+int app_memory_bench(){
+
+    vector<TRT::MemoryType> types{TRT::MemoryType::Host, TRT::MemoryType::HostHugePage};
+    if(has_cuda_device()){
+        types.push_back(TRT::MemoryType::Pinned);
+        types.push_back(TRT::MemoryType::Managed);
+    }else{
+        INFO("No cuda device, only host allocators are tested");
+    }
+
+    INFO("===================== allocate bench ==================================");
+    size_t sizes[] = {64 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024};
+    for(auto type : types){
+        for(size_t size : sizes){
+            int iters = size >= 64 * 1024 * 1024 ? 10 : 100;
+            bench_allocate(type, size, false, iters);
+            bench_allocate(type, size, true,  iters);
+        }
+    }
+
+    INFO("===================== host tensor bench ==================================");
+    bool ok = bench_host_tensor(TRT::MemoryType::Host, 50);
+    ok = bench_host_tensor(TRT::MemoryType::HostHugePage, 50) && ok;
+
+    INFO("===================== variable resolution bench ==================================");
+    for(auto type : types){
+        bench_variable_resolution(type, false, 500);
+        bench_variable_resolution(type, true,  500);
+    }
+
+    if(!ok){
+        INFOE("Memory bench check failed");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/**
+ * 不依赖GPU的指标服务检查
+ *   1. 两个假模型（带tensor allocator）、logger、DeepSORT跟踪器注册为collector
+ *   2. 用回环客户端GET /metrics，检查Prometheus文本中每个family都存在、每个样本都能解析，以及任务数与提交数一致
+ *   3. 其他路径返回404
+ *   ./pro metrics_server
+ */
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <common/ilogger.hpp>
+#include <common/infer_controller.hpp>
+#include "tools/metrics_server.hpp"
+#include "tools/fake_model.hpp"
+#include "tools/deepsort.hpp"
+
+using namespace std;
+
+namespace{
+
+    // 结果为输入的2倍，preprocess从tensor allocator拿对象，worker sleep之后归还并交付
+    class DoubleModel : public FakeModel<int, int>{
+    public:
+        virtual ~DoubleModel(){
+            stop();
+        }
+
+        bool startup(const string& name, int max_batch_size, float cost_ms){
+            set_tensor_allocator(max_batch_size * 2, 10000, max_batch_size);
+            return FakeModel<int, int>::startup(name, max_batch_size, cost_ms, 0);
+        }
+
+        virtual bool compute(Job& job, const int& input) override{
+            job.output = input * 2;
+            return true;
+        }
+    };
+
+    // 两个目标匀速移动，特征是各自固定的one-hot向量
+    void update_tracker(shared_ptr<DeepSORT::Tracker> tracker, int frames){
+
+        for(int i = 0; i < frames; ++i){
+            DeepSORT::BBoxes boxes;
+            for(int k = 0; k < 2; ++k){
+                float x = 50 + k * 300 + i * 2;
+                DeepSORT::Box box(x, 100, x + 60, 220);
+                box.feature = cv::Mat::zeros(1, 4, CV_32F);
+                box.feature.at<float>(0, k) = 1;
+                boxes.emplace_back(box);
+            }
+            tracker->update(boxes);
+        }
+    }
+
+    // 非注释行必须是 name{labels} value，value可以被解析
+    int count_invalid_samples(const string& text){
+
+        int invalid = 0;
+        for(auto& line : iLogger::split_string(text, "\n")){
+            if(line.empty() || line[0] == '#') continue;
+
+            auto space = line.rfind(' ');
+            if(space == string::npos || space == 0){
+                invalid++;
+                continue;
+            }
+
+            auto value = line.substr(space + 1);
+            char* end  = nullptr;
+            strtod(value.c_str(), &end);
+            if(value != "+Inf" && value != "NaN" && (end == value.c_str() || *end != 0))
+                invalid++;
+        }
+        return invalid;
+    }
+};
+
+int app_metrics_server(){
+
+    const int num_jobs = 500;
+    DoubleModel detector, embedder;
+    if(!detector.startup("detector", 8, 1.0f) || !embedder.startup("embedder", 16, 0.5f)){
+        INFOE("Startup fake models failed");
+        return -1;
+    }
+
+    auto tracker = DeepSORT::create_tracker();
+    update_tracker(tracker, 10);
+
+    auto server = create_metrics_server("127.0.0.1", 0);
+    if(server == nullptr)
+        return -1;
+
+    server->add_collector([&](MetricsWriter& writer){
+        write_infer_metrics(writer, detector.metrics());
+        write_infer_metrics(writer, embedder.metrics());
+    });
+    server->add_collector([](MetricsWriter& writer){
+        write_logger_metrics(writer);
+    });
+    server->add_collector([=](MetricsWriter& writer){
+        write_tracker_metrics(writer, "demo", tracker->statistics());
+    });
+
+    vector<int> inputs(num_jobs);
+    for(int i = 0; i < num_jobs; ++i)
+        inputs[i] = i;
+
+    // 提交的同时抓取，collector与worker并发
+    auto detector_results = detector.commits(inputs);
+    string during;
+    int during_code = http_get("127.0.0.1", server->port(), "/metrics", during);
+
+    auto embedder_results = embedder.commits(inputs);
+    for(int i = 0; i < num_jobs; ++i){
+        detector_results[i].get();
+        embedder_results[i].get();
+    }
+
+    string body, not_found;
+    int code          = http_get("127.0.0.1", server->port(), "/metrics", body);
+    int code_notfound = http_get("127.0.0.1", server->port(), "/other", not_found);
+
+    const char* expected[] = {
+        "# TYPE infer_jobs_total counter",
+        "# TYPE infer_batch_size histogram",
+        "# TYPE infer_stage_latency_seconds histogram",
+        "infer_batch_size_bucket{model=\"detector\",le=\"+Inf\"}",
+        "infer_stage_latency_seconds_count{model=\"embedder\",stage=\"end_to_end\"}",
+        "infer_queue_size{model=\"detector\"}",
+        "infer_allocator_capacity{model=\"detector\"} 16",
+        "infer_allocator_peak_occupancy{model=\"embedder\"}",
+        "logger_lines_total{level=\"info\"}",
+        "logger_dropped_lines_total",
+        "tracker_objects{tracker=\"demo\",state=\"confirmed\"}",
+        "tracker_created_objects_total{tracker=\"demo\"}",
+        "tracker_updates_total{tracker=\"demo\"} 10"
+    };
+
+    int missing = 0;
+    for(auto item : expected){
+        if(body.find(item) == string::npos){
+            INFOE("Missing [%s]", item);
+            missing++;
+        }
+    }
+
+    auto jobs_line = iLogger::format("infer_jobs_total{model=\"detector\"} %d\n", num_jobs);
+    bool jobs_ok   = body.find(jobs_line) != string::npos;
+    int invalid    = count_invalid_samples(body) + count_invalid_samples(during);
+    INFO("GET /metrics = %d (during commits %d), %d bytes, %d missing, %d invalid samples, jobs %s, GET /other = %d",
+        code, during_code, (int)body.size(), missing, invalid, jobs_ok ? "ok" : "mismatch", code_notfound
+    );
+
+    bool ok = code == 200 && during_code == 200 && code_notfound == 404 && missing == 0 && invalid == 0 && jobs_ok;
+    if(!ok){
+        INFOE("Metrics server check failed");
+        return -1;
+    }
+
+    INFO("Metrics server check passed, first lines:");
+    auto lines = iLogger::split_string(body, "\n");
+    for(int i = 0; i < std::min<int>(12, lines.size()); ++i)
+        INFO("    %s", lines[i].c_str());
+    return 0;
+}
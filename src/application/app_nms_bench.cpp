@@ -0,0 +1,351 @@
+/**
+ * NMS的一致性检查与耗时对比，输入为模拟yolo解码输出的密集box（每个anchor一个，不满足阈值的confidence为-1）
+ *   1. CPU的SIMD实现与标量实现逐位一致
+ *   2. ClassAware、ClassAgnostic与独立实现的朴素版本（全排序 + 逐对greedy）逐位一致
+ *   3. SoftNMS保留的box置信度不增
+ *   4. GPU的top-K + bitmask NMS与CPU实现逐位一致，SoftNMS在expf的误差范围内
+ *   5. 与原来的O(N^2) NMS（按输入顺序截断到1024个）的耗时对比
+ *   6. ResultCompactor紧凑回传的结果与CPU逐位一致，截断的计数，以及与按容量整块复制的字节数对比
+ *   ./pro nms_bench
+ */
+
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <common/ilogger.hpp>
+#include <common/cuda_tools.hpp>
+#include <common/box_nms.hpp>
+#include <common/nms_kernel.cuh>
+#include <common/result_compactor.hpp>
+
+using namespace std;
+
+namespace{
+
+    const int NUM_BOX_ELEMENT = 6;
+    const int MAX_OBJECTS     = 1024;
+
+    struct BenchScene{
+        const char* name;
+        int num_anchors;
+        int num_objects;
+        int boxes_per_object;
+        int num_classes;
+    };
+
+    bool has_cuda_device(){
+        int num_device = 0;
+        return cudaGetDeviceCount(&num_device) == cudaSuccess && num_device > 0;
+    }
+
+    float random_uniform(unsigned int& seed){
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) / (float)(1 << 24);
+    }
+
+    // num_objects个目标，每个目标周围抖动出boxes_per_object个box，随机放到anchor上，其余anchor为-1
+    // 置信度量化到1/256，制造大量相同的置信度，检查top-K和排序对相同置信度的处理
+    vector<float> make_scene(const BenchScene& scene, float score_threshold){
+
+        vector<float> boxes(scene.num_anchors * NUM_BOX_ELEMENT, 0);
+        for(int i = 0; i < scene.num_anchors; ++i)
+            boxes[i * NUM_BOX_ELEMENT + 4] = -1;
+
+        vector<int> anchors(scene.num_anchors);
+        for(int i = 0; i < scene.num_anchors; ++i) anchors[i] = i;
+
+        unsigned int seed = 17;
+        for(int i = scene.num_anchors - 1; i > 0; --i)
+            swap(anchors[i], anchors[(int)(random_uniform(seed) * (i + 1))]);
+
+        int num_boxes = min(scene.num_anchors, scene.num_objects * scene.boxes_per_object);
+        for(int i = 0; i < num_boxes; ++i){
+            int object = i / scene.boxes_per_object;
+            unsigned int object_seed = 1000 + object;
+            float cx     = random_uniform(object_seed) * 1920;
+            float cy     = random_uniform(object_seed) * 1080;
+            float width  = 20 + random_uniform(object_seed) * 300;
+            float height = 20 + random_uniform(object_seed) * 300;
+            int label    = (int)(random_uniform(object_seed) * scene.num_classes);
+
+            float jitter  = 0.15f;
+            float bcx     = cx + (random_uniform(seed) - 0.5f) * width  * jitter;
+            float bcy     = cy + (random_uniform(seed) - 0.5f) * height * jitter;
+            float bwidth  = width  * (1 + (random_uniform(seed) - 0.5f) * jitter);
+            float bheight = height * (1 + (random_uniform(seed) - 0.5f) * jitter);
+
+            // 少量box的类别与目标不同，检查ClassAware与ClassAgnostic的差别
+            if(random_uniform(seed) < 0.1f)
+                label = (int)(random_uniform(seed) * scene.num_classes);
+
+            float confidence = score_threshold + random_uniform(seed) * (1 - score_threshold);
+            confidence       = floor(confidence * 256) / 256;
+            confidence       = max(confidence, score_threshold);
+
+            float* pbox = boxes.data() + anchors[i] * NUM_BOX_ELEMENT;
+            pbox[0] = bcx - bwidth * 0.5f;
+            pbox[1] = bcy - bheight * 0.5f;
+            pbox[2] = bcx + bwidth * 0.5f;
+            pbox[3] = bcy + bheight * 0.5f;
+            pbox[4] = confidence;
+            pbox[5] = label;
+        }
+        return boxes;
+    }
+
+    // 不依赖box_nms.cpp的朴素实现：全排序后取top_k，逐对greedy
+    int reference_nms(const vector<float>& boxes, int top_k, float nms_threshold, NMSMethod method, float score_threshold, float* output){
+
+        int num_boxes = boxes.size() / NUM_BOX_ELEMENT;
+        vector<int> order;
+        for(int i = 0; i < num_boxes; ++i){
+            if(boxes[i * NUM_BOX_ELEMENT + 4] >= score_threshold)
+                order.push_back(i);
+        }
+
+        stable_sort(order.begin(), order.end(), [&](int a, int b){
+            return boxes[a * NUM_BOX_ELEMENT + 4] > boxes[b * NUM_BOX_ELEMENT + 4];
+        });
+        if((int)order.size() > top_k)
+            order.resize(top_k);
+
+        int num_keep = 0;
+        vector<char> removed(order.size(), 0);
+        for(int i = 0; i < (int)order.size(); ++i){
+            if(removed[i]) continue;
+
+            const float* a = boxes.data() + order[i] * NUM_BOX_ELEMENT;
+            memcpy(output + num_keep++ * NUM_BOX_ELEMENT, a, sizeof(float) * NUM_BOX_ELEMENT);
+            for(int j = i + 1; j < (int)order.size(); ++j){
+                if(box_nms_overlap(a, boxes.data() + order[j] * NUM_BOX_ELEMENT, nms_threshold, method))
+                    removed[j] = 1;
+            }
+        }
+        return num_keep;
+    }
+
+    const char* method_name(NMSMethod method){
+        switch(method){
+        case NMSMethod::ClassAware:    return "ClassAware";
+        case NMSMethod::ClassAgnostic: return "ClassAgnostic";
+        case NMSMethod::SoftNMS:       return "SoftNMS";
+        default: return "Unknow";
+        }
+    }
+
+    template<class _Func>
+    float time_ms(int iters, const _Func& func){
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) func();
+        return (iLogger::timestamp_now_float() - tic) / iters;
+    }
+
+    // 返回CPU、GPU结果的检查是否都通过
+    bool bench_scene(const BenchScene& scene, bool gpu){
+
+        const float score_threshold = 0.25f;
+        const float nms_threshold   = 0.5f;
+        auto boxes    = make_scene(scene, score_threshold);
+        int num_valid = 0;
+        for(int i = 0; i < scene.num_anchors; ++i)
+            num_valid += boxes[i * NUM_BOX_ELEMENT + 4] >= score_threshold;
+
+        INFO("==================== %s: %d anchors, %d valid boxes, %d classes ====================",
+            scene.name, scene.num_anchors, num_valid, scene.num_classes
+        );
+
+        int iters = 20;
+        vector<float> legacy_output(MAX_OBJECTS * NUM_BOX_ELEMENT);
+        int legacy_keep = 0;
+        float legacy_ms = time_ms(iters, [&](){
+            legacy_keep = CPUKernel::pairwise_nms(boxes.data(), scene.num_anchors, NUM_BOX_ELEMENT, MAX_OBJECTS, nms_threshold, score_threshold, legacy_output.data());
+        });
+        INFO("Legacy pairwise: keep %d, %d valid boxes dropped by the input order cap, %.3f ms",
+            legacy_keep, max(0, num_valid - MAX_OBJECTS), legacy_ms
+        );
+
+        float* boxes_device  = nullptr;
+        float* output_device = nullptr;
+        void* workspace      = nullptr;
+        cudaStream_t stream  = nullptr;
+        if(gpu){
+            checkCudaRuntime(cudaStreamCreate(&stream));
+            checkCudaRuntime(cudaMalloc(&boxes_device,  boxes.size() * sizeof(float)));
+            checkCudaRuntime(cudaMalloc(&output_device, (1 + MAX_OBJECTS * NUM_BOX_ELEMENT) * sizeof(float)));
+            checkCudaRuntime(cudaMalloc(&workspace,     CUDAKernel::nms_workspace_size(MAX_OBJECTS)));
+            checkCudaRuntime(cudaMemcpy(boxes_device, boxes.data(), boxes.size() * sizeof(float), cudaMemcpyHostToDevice));
+        }
+
+        bool ok = true;
+        NMSMethod methods[] = {NMSMethod::ClassAware, NMSMethod::ClassAgnostic, NMSMethod::SoftNMS};
+        for(auto method : methods){
+
+            size_t output_size = MAX_OBJECTS * NUM_BOX_ELEMENT;
+            vector<float> scalar_output(output_size, 0), simd_output(output_size, 0), reference_output(output_size, 0);
+            int scalar_keep = 0, simd_keep = 0;
+            float scalar_ms = time_ms(iters, [&](){
+                scalar_keep = CPUKernel::topk_sort_nms(boxes.data(), scene.num_anchors, NUM_BOX_ELEMENT, MAX_OBJECTS, nms_threshold, method, score_threshold, scalar_output.data(), false);
+            });
+            float simd_ms = time_ms(iters, [&](){
+                simd_keep = CPUKernel::topk_sort_nms(boxes.data(), scene.num_anchors, NUM_BOX_ELEMENT, MAX_OBJECTS, nms_threshold, method, score_threshold, simd_output.data(), true);
+            });
+
+            bool simd_ok = scalar_keep == simd_keep && memcmp(scalar_output.data(), simd_output.data(), sizeof(float) * NUM_BOX_ELEMENT * scalar_keep) == 0;
+            bool reference_ok = true;
+            if(method == NMSMethod::SoftNMS){
+                for(int i = 1; i < scalar_keep; ++i)
+                    reference_ok = reference_ok && scalar_output[i * NUM_BOX_ELEMENT + 4] <= scalar_output[(i - 1) * NUM_BOX_ELEMENT + 4];
+            }else{
+                int reference_keep = reference_nms(boxes, MAX_OBJECTS, nms_threshold, method, score_threshold, reference_output.data());
+                reference_ok = reference_keep == scalar_keep && memcmp(reference_output.data(), scalar_output.data(), sizeof(float) * NUM_BOX_ELEMENT * scalar_keep) == 0;
+            }
+
+            INFO("%-13s CPU keep %d, scalar %.3f ms, simd %.3f ms, simd %s, reference %s",
+                method_name(method), scalar_keep, scalar_ms, simd_ms,
+                simd_ok ? "exact" : "failed", reference_ok ? "ok" : "failed"
+            );
+            ok = ok && simd_ok && reference_ok;
+
+            if(!gpu) continue;
+
+            auto launch = [&](){
+                CUDAKernel::topk_sort_nms(
+                    boxes_device, scene.num_anchors, NUM_BOX_ELEMENT, MAX_OBJECTS,
+                    nms_threshold, method, score_threshold, output_device, workspace, stream
+                );
+            };
+
+            vector<float> gpu_output(1 + output_size);
+            launch();
+            checkCudaRuntime(cudaMemcpyAsync(gpu_output.data(), output_device, gpu_output.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+            checkCudaRuntime(cudaStreamSynchronize(stream));
+
+            float gpu_ms = time_ms(iters, [&](){
+                launch();
+                checkCudaRuntime(cudaStreamSynchronize(stream));
+            });
+
+            int gpu_keep     = gpu_output[0];
+            bool gpu_ok      = gpu_keep == scalar_keep;
+            float max_diff   = 0;
+            for(int i = 0; gpu_ok && i < gpu_keep * NUM_BOX_ELEMENT; ++i){
+                float diff = fabs(gpu_output[1 + i] - scalar_output[i]);
+                max_diff   = max(max_diff, diff);
+            }
+
+            // SoftNMS衰减时的expf在device上与host上有ulp级别的差异
+            float tolerance = method == NMSMethod::SoftNMS ? 1e-5f : 0;
+            gpu_ok = gpu_ok && max_diff <= tolerance;
+            INFO("%-13s GPU keep %d, max diff = %g, %.3f ms, %s",
+                method_name(method), gpu_keep, max_diff, gpu_ms, gpu_ok ? "ok" : "failed"
+            );
+            ok = ok && gpu_ok;
+        }
+
+        if(gpu){
+            checkCudaRuntime(cudaFree(boxes_device));
+            checkCudaRuntime(cudaFree(output_device));
+            checkCudaRuntime(cudaFree(workspace));
+            checkCudaRuntime(cudaStreamDestroy(stream));
+        }
+        return ok;
+    }
+
+    // 每个场景作为batch中的一张图像，容量较小，dense、crowd会发生截断。返回结果是否与CPU一致
+    bool check_result_compactor(const BenchScene* scenes, int num_scenes, OverflowPolicy policy){
+
+        const float score_threshold = 0.25f;
+        const float nms_threshold   = 0.5f;
+        const int capacity          = 256;
+        const int NUM_SLOTS         = 2;
+
+        INFO("==================== ResultCompactor, capacity %d, %s ====================",
+            capacity, policy == OverflowPolicy::Grow ? "Grow" : "KeepTopK"
+        );
+
+        cudaStream_t stream = nullptr;
+        checkCudaRuntime(cudaStreamCreate(&stream));
+
+        vector<vector<float>> scene_boxes(num_scenes);
+        vector<float*> boxes_device(num_scenes, nullptr);
+        for(int i = 0; i < num_scenes; ++i){
+            scene_boxes[i] = make_scene(scenes[i], score_threshold);
+            checkCudaRuntime(cudaMalloc(&boxes_device[i], scene_boxes[i].size() * sizeof(float)));
+            checkCudaRuntime(cudaMemcpy(boxes_device[i], scene_boxes[i].data(), scene_boxes[i].size() * sizeof(float), cudaMemcpyHostToDevice));
+        }
+
+        bool ok = true;
+        {
+            ResultCompactor compactor(NUM_SLOTS, num_scenes, NUM_BOX_ELEMENT, capacity, policy, stream);
+            for(int iteration = 0; iteration < 4; ++iteration){
+                int islot = iteration % NUM_SLOTS;
+                compactor.begin(islot);
+                int slot_capacity = compactor.capacity();
+                for(int i = 0; i < num_scenes; ++i){
+                    CUDAKernel::topk_sort_nms(
+                        boxes_device[i], scenes[i].num_anchors, NUM_BOX_ELEMENT, slot_capacity,
+                        nms_threshold, NMSMethod::ClassAware, score_threshold,
+                        compactor.output(islot, i), compactor.nms_workspace(), stream, compactor.candidates(islot, i)
+                    );
+                }
+                compactor.commit(islot, num_scenes);
+                compactor.wait(islot);
+
+                for(int i = 0; i < num_scenes; ++i){
+                    vector<float> reference(slot_capacity * NUM_BOX_ELEMENT);
+                    int keep = CPUKernel::topk_sort_nms(
+                        scene_boxes[i].data(), scenes[i].num_anchors, NUM_BOX_ELEMENT, slot_capacity,
+                        nms_threshold, NMSMethod::ClassAware, score_threshold, reference.data()
+                    );
+                    ok = ok && keep == compactor.count(islot, i) && 
+                        memcmp(reference.data(), compactor.boxes(islot, i), sizeof(float) * keep * NUM_BOX_ELEMENT) == 0;
+                }
+            }
+
+            auto statistics = compactor.statistics();
+            INFO("%lld batches, %lld images, %lld boxes, overflow %lld images / %lld boxes, capacity %d, results %s",
+                statistics.batches, statistics.images, statistics.boxes, statistics.overflow_images, statistics.overflow_boxes,
+                statistics.capacity, ok ? "ok" : "failed"
+            );
+            INFO("Copied %lld bytes, fixed size copy %lld bytes, %.1f%%",
+                statistics.bytes_copied, statistics.bytes_fixed, statistics.bytes_copied * 100.0 / max(1LL, statistics.bytes_fixed)
+            );
+        }
+
+        for(auto ptr : boxes_device)
+            checkCudaRuntime(cudaFree(ptr));
+        checkCudaRuntime(cudaStreamDestroy(stream));
+        return ok;
+    }
+};
+
+int app_nms_bench(){
+
+    bool gpu = has_cuda_device();
+    if(!gpu)
+        INFO("No cuda device, only the CPU implementation is checked");
+
+    BenchScene scenes[] = {
+        {"sparse",         25200,  20, 30, 80},
+        {"dense",          25200, 300, 40, 80},
+        {"dense, 1 class", 25200, 300, 40,  1},
+        {"crowd 1280",    100800, 800, 60, 80}
+    };
+
+    bool ok = true;
+    for(auto& scene : scenes)
+        ok = bench_scene(scene, gpu) && ok;
+
+    if(gpu){
+        int num_scenes = sizeof(scenes) / sizeof(scenes[0]);
+        ok = check_result_compactor(scenes, num_scenes, OverflowPolicy::KeepTopK) && ok;
+        ok = check_result_compactor(scenes, num_scenes, OverflowPolicy::Grow) && ok;
+    }
+
+    if(!ok){
+        INFOE("NMS bench check failed");
+        return -1;
+    }
+    return 0;
+}
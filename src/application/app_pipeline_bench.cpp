@@ -0,0 +1,256 @@
+/**
+ * 不依赖GPU的InferPipeline测试，检测、嵌入都是只sleep的假引擎
+ *   1. 手写串联：与app_arcface_video一样，每一帧commit(...).get()检测，每张脸commit(...).get()嵌入
+ *   2. InferPipeline：detect -> embed（一帧的所有脸一次commits_async） -> track（sequential），多帧同时在途
+ * 两种方式的结果必须一致，track节点必须按帧的顺序执行，并对比耗时与嵌入模型的平均batch大小
+ *   3. 开启InferTrace跑一次，检查每个任务的异步区间都有开始和结束，时间线保存为pipeline_bench.trace.json
+ *   ./pro pipeline_bench
+ */
+
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <map>
+#include <set>
+#include <common/ilogger.hpp>
+#include <common/infer_controller.hpp>
+#include <common/infer_pipeline.hpp>
+#include <common/infer_trace.hpp>
+#include <common/json.hpp>
+#include "tools/fake_model.hpp"
+
+using namespace std;
+
+namespace{
+
+    struct FakeFace{
+        float left, top, right, bottom;
+    };
+
+    typedef vector<FakeFace> FakeFaces;
+    typedef vector<float> FakeFeature;
+
+    // 每一帧1~8张脸，位置由帧号确定
+    class FakeDetector : public FakeModel<int, FakeFaces>{
+    public:
+        virtual ~FakeDetector(){
+            stop();
+        }
+
+        virtual bool compute(Job& job, const int& index) override{
+            int num_faces = index % 8 + 1;
+            for(int i = 0; i < num_faces; ++i){
+                float x = (index * 11 + i * 101) % 500;
+                float y = (index * 7  + i * 53)  % 300;
+                job.output.push_back({x, y, x + 40 + i * 8, y + 48 + i * 6});
+            }
+            return true;
+        }
+    };
+
+    class FakeEmbedder : public FakeModel<FakeFace, FakeFeature>{
+    public:
+        virtual ~FakeEmbedder(){
+            stop();
+        }
+
+        virtual bool compute(Job& job, const FakeFace& face) override{
+            job.output.resize(16);
+            float values[] = {face.left, face.top, face.right, face.bottom};
+            float norm = 0;
+            for(int i = 0; i < 16; ++i){
+                job.output[i] = values[i % 4] * (i + 1) + i;
+                norm += job.output[i] * job.output[i];
+            }
+            norm = sqrt(norm);
+            for(auto& v : job.output) v /= norm;
+            return true;
+        }
+    };
+
+    struct FrameContext{
+        int index = 0;
+        FakeFaces faces;
+        vector<FakeFeature> features;
+        float checksum = 0;
+        int track_order = -1;     // track节点执行时的序号
+    };
+
+    float accumulate_features(const vector<FakeFeature>& features){
+        float sum = 0;
+        for(auto& feature : features)
+            sum += accumulate(feature.begin(), feature.end(), 0.0f);
+        return sum;
+    }
+
+    bool run_pipeline_bench(int num_frames, int max_inflight_frames){
+
+        const int max_batch_size = 32;
+        FakeDetector detector;
+        FakeEmbedder embedder;
+        if(!detector.startup("detector", max_batch_size, 3.0f, 0.1f) || !embedder.startup("embedder", max_batch_size, 2.0f, 0.05f)){
+            INFOE("Startup fake models failed");
+            return false;
+        }
+
+        vector<float> expected(num_frames);
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < num_frames; ++i){
+            auto faces = detector.commit(i).get();
+            vector<FakeFeature> features;
+            for(auto& face : faces)
+                features.emplace_back(embedder.commit(face).get());
+            expected[i] = accumulate_features(features);
+        }
+        auto serial_ms = iLogger::timestamp_now_float() - tic;
+        float serial_batch = embedder.average_batch_size();
+
+        FakeDetector pipe_detector;
+        FakeEmbedder pipe_embedder;
+        pipe_detector.startup("detector", max_batch_size, 3.0f, 0.1f);
+        pipe_embedder.startup("embedder", max_batch_size, 2.0f, 0.05f);
+
+        int track_order = 0;
+        InferPipeline<FrameContext> pipeline;
+        pipeline.add_model("detect", {},
+            [&](FrameContext& frame){ return pipe_detector.commit_async(frame.index); },
+            [](FrameContext& frame, const FakeFaces& faces){ frame.faces = faces; }
+        );
+        pipeline.add_model("embed", {"detect"},
+            [&](FrameContext& frame){ return pipe_embedder.commits_async(frame.faces); },
+            [](FrameContext& frame, const vector<FakeFeature>& features){ frame.features = features; }
+        );
+        pipeline.add_stage("track", {"embed"}, [&](FrameContext& frame){
+            frame.checksum    = accumulate_features(frame.features);
+            frame.track_order = track_order++;
+        }, true);
+
+        if(!pipeline.startup(4, max_inflight_frames)){
+            INFOE("Startup pipeline failed");
+            return false;
+        }
+
+        // 按提交的顺序取结果
+        deque<shared_future<shared_ptr<FrameContext>>> inflight;
+        int mismatch = 0;
+        auto check = [&](const shared_ptr<FrameContext>& frame){
+            if(frame->checksum != expected[frame->index] || frame->track_order != frame->index)
+                mismatch++;
+        };
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < num_frames; ++i){
+            auto frame   = make_shared<FrameContext>();
+            frame->index = i;
+            inflight.emplace_back(pipeline.commit(frame));
+
+            while(!inflight.empty() && inflight.front().wait_for(chrono::seconds(0)) == future_status::ready){
+                check(inflight.front().get());
+                inflight.pop_front();
+            }
+        }
+
+        for(auto& future : inflight)
+            check(future.get());
+        auto pipeline_ms = iLogger::timestamp_now_float() - tic;
+
+        auto statistics = pipeline.statistics();
+        INFO("%d frames, %d inflight, serial: %.2f ms (embed batch %.2f), pipeline: %.2f ms (embed batch %.2f), speedup %.2fx",
+            num_frames, max_inflight_frames,
+            serial_ms, serial_batch,
+            pipeline_ms, pipe_embedder.average_batch_size(),
+            serial_ms / pipeline_ms
+        );
+
+        for(auto& node : statistics.nodes){
+            INFO("    node %-8s runs %lld, items/run %.2f, avg %.3f ms",
+                node.name.c_str(), node.runs,
+                node.runs == 0 ? 0 : node.items / (float)node.runs,
+                node.runs == 0 ? 0 : node.busy_us / 1000.0f / node.runs
+            );
+        }
+
+        if(mismatch > 0 || statistics.finished != num_frames){
+            INFOE("Pipeline check failed, %d mismatch, %lld finished", mismatch, statistics.finished);
+            return false;
+        }
+        return true;
+    }
+
+    // 每个job的b、e必须配对，两个模型的worker线程都要出现在时间线上
+    bool check_trace(int num_frames, int max_inflight_frames){
+
+        InferTrace::clear();
+        InferTrace::enable();
+        bool ok = run_pipeline_bench(num_frames, max_inflight_frames);
+        InferTrace::enable(false);
+
+        auto statistics = InferTrace::statistics();
+        auto text       = InferTrace::dump();
+        iLogger::save_file("pipeline_bench.trace.json", text);
+
+        auto trace = Json::parse_string(text);
+        if(!trace.isObject() || !trace["traceEvents"].isArray()){
+            INFOE("Invalid trace json");
+            return false;
+        }
+
+        map<string, int> open_jobs;
+        set<string> threads;
+        int num_jobs = 0, num_forward = 0;
+        for(auto& event : trace["traceEvents"]){
+            auto phase = event["ph"].asString();
+            auto key   = event["cat"].asString() + "/" + event["id"].asString();
+            if(phase == "M") threads.insert(event["args"]["name"].asString());
+            if(event["name"].asString() == "forward") num_forward++;
+            if(event["name"].asString() != "job") continue;
+
+            if(phase == "b"){
+                open_jobs[key]++;
+                num_jobs++;
+            }else if(phase == "e"){
+                open_jobs[key]--;
+            }
+        }
+
+        int unmatched = 0;
+        for(auto& item : open_jobs)
+            unmatched += item.second != 0;
+
+        bool has_workers = threads.count("detector worker") && threads.count("embedder worker");
+        INFO("trace: %lld events, %lld dropped, %d threads, %d jobs, %d forward, %d unmatched, saved to pipeline_bench.trace.json",
+            statistics.recorded, statistics.dropped, statistics.threads, num_jobs, num_forward, unmatched
+        );
+
+        if(unmatched > 0 || num_jobs == 0 || num_forward == 0 || !has_workers){
+            INFOE("Trace check failed");
+            return false;
+        }
+        return ok;
+    }
+
+    // 未知输入、环都应该在startup时报错
+    bool check_invalid_graph(){
+
+        InferPipeline<FrameContext> unknown;
+        unknown.add_stage("a", {"missing"}, [](FrameContext&){});
+
+        InferPipeline<FrameContext> cycle;
+        cycle.add_stage("a", {"b"}, [](FrameContext&){});
+        cycle.add_stage("b", {"a"}, [](FrameContext&){});
+
+        INFO("Expect 2 errors for invalid graphs");
+        return !unknown.startup() && !cycle.startup();
+    }
+};
+
+int app_pipeline_bench(){
+
+    bool ok = check_invalid_graph();
+    ok = run_pipeline_bench(64, 1) && ok;
+    ok = run_pipeline_bench(256, 8) && ok;
+    ok = run_pipeline_bench(256, 32) && ok;
+    ok = check_trace(64, 8) && ok;
+    if(ok) INFO("Pipeline check passed");
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,645 @@
+
+/**
+ * 预处理的一致性检查与耗时对比
+ *   1. CPU的SIMD实现与标量实现逐位一致
+ *   2. GPU的batch kernel与逐张launch的结果一致，与CPU实现的差异在浮点误差范围内
+ *   3. 逐张launch与整个batch一次launch的耗时
+ *   4. NV12、I420输入的融合路径（颜色转换+仿射+归一化一次完成）与先转BGR再仿射的两步路径逐位一致
+ *   5. 各输出格式（float32/float16/int8 × NCHW/NHWC/NC4HW4）与float32 NCHW参考的误差在该格式的精度范围内
+ * 图像包含缩放、旋转以及越界（const_value）的区域，Norm覆盖None、AlphaBeta、MeanStd以及通道翻转
+ *   ./pro preprocess_bench
+ */
+
+#include <vector>
+#include <math.h>
+#include <common/ilogger.hpp>
+#include <common/cuda_tools.hpp>
+#include <common/preprocess_kernel.cuh>
+#include <common/preprocess_cpu.hpp>
+
+using namespace std;
+
+namespace{
+
+    struct BenchImage{
+        int width, height;
+        vector<uint8_t> data;
+        float d2i[6];
+    };
+
+    // 以图像中心旋转angle度，等比缩放后居中放到dst中，得到dst到image的矩阵
+    void compute_d2i(int width, int height, int dst_width, int dst_height, float angle, float* d2i){
+
+        float scale = std::min(dst_width / (float)width, dst_height / (float)height);
+        float a     = angle / 180.0f * 3.1415926f;
+        float c     = cos(a) * scale;
+        float s     = sin(a) * scale;
+
+        // i2d = T(dst_center) * R * S * T(-image_center)
+        float i2d[6] = {
+            c, -s, -c * width * 0.5f + s * height * 0.5f + dst_width * 0.5f,
+            s,  c, -s * width * 0.5f - c * height * 0.5f + dst_height * 0.5f
+        };
+
+        float D = i2d[0] * i2d[4] - i2d[1] * i2d[3];
+        D = D != 0 ? 1.0f / D : 0;
+        float A11 = i2d[4] * D, A22 = i2d[0] * D, A12 = -i2d[1] * D, A21 = -i2d[3] * D;
+        d2i[0] = A11; d2i[1] = A12; d2i[2] = -A11 * i2d[2] - A12 * i2d[5];
+        d2i[3] = A21; d2i[4] = A22; d2i[5] = -A21 * i2d[2] - A22 * i2d[5];
+    }
+
+    vector<BenchImage> make_images(int batch, int dst_width, int dst_height){
+
+        int sizes[][2] = {{1920, 1080}, {1280, 720}, {640, 480}, {3840, 2160}, {500, 700}};
+        int num_sizes  = sizeof(sizes) / sizeof(sizes[0]);
+
+        vector<BenchImage> images(batch);
+        unsigned int seed = 31;
+        for(int i = 0; i < batch; ++i){
+            auto& image  = images[i];
+            image.width  = sizes[i % num_sizes][0];
+            image.height = sizes[i % num_sizes][1];
+            image.data.resize(image.width * image.height * 3);
+            for(auto& v : image.data){
+                seed = seed * 1103515245 + 12345;
+                v    = seed >> 24;
+            }
+            compute_d2i(image.width, image.height, dst_width, dst_height, (i % 4) * 15.0f, image.d2i);
+        }
+        return images;
+    }
+
+    float max_abs_diff(const float* a, const float* b, size_t count, size_t& mismatch){
+        float output = 0;
+        mismatch     = 0;
+        for(size_t i = 0; i < count; ++i){
+            float diff = fabs(a[i] - b[i]);
+            output     = std::max(output, diff);
+            if(diff != 0) mismatch++;
+        }
+        return output;
+    }
+
+    bool has_cuda_device(){
+        int num_device = 0;
+        return cudaGetDeviceCount(&num_device) == cudaSuccess && num_device > 0;
+    }
+
+    // GPU与CPU的fp32结果可能有fma带来的微小差异，输出的范围最大到255.5
+    const float gpu_cpu_tolerance = 1e-3f;
+
+    bool bench_gpu(
+        vector<BenchImage>& images, int dst_width, int dst_height,
+        const CUDAKernel::Norm& norm, const float* cpu_output, int iters){
+
+        int batch          = images.size();
+        size_t image_count = (size_t)3 * dst_width * dst_height;
+        cudaStream_t stream = nullptr;
+        checkCudaRuntime(cudaStreamCreate(&stream));
+
+        vector<CUDAKernel::WarpAffineSource> sources(batch);
+        vector<float> matrices(batch * 6);
+        vector<uint8_t*> images_device(batch);
+        for(int i = 0; i < batch; ++i){
+            auto& image = images[i];
+            checkCudaRuntime(cudaMalloc(&images_device[i], image.data.size()));
+            checkCudaRuntime(cudaMemcpy(images_device[i], image.data.data(), image.data.size(), cudaMemcpyHostToDevice));
+            sources[i].data      = images_device[i];
+            sources[i].line_size = image.width * 3;
+            sources[i].width     = image.width;
+            sources[i].height    = image.height;
+            memcpy(matrices.data() + i * 6, image.d2i, sizeof(image.d2i));
+        }
+
+        CUDAKernel::WarpAffineSource* sources_device = nullptr;
+        float* matrices_device = nullptr;
+        float* output_device   = nullptr;
+        checkCudaRuntime(cudaMalloc(&sources_device,  sizeof(CUDAKernel::WarpAffineSource) * batch));
+        checkCudaRuntime(cudaMalloc(&matrices_device, sizeof(float) * matrices.size()));
+        checkCudaRuntime(cudaMalloc(&output_device,   sizeof(float) * image_count * batch));
+        checkCudaRuntime(cudaMemcpy(sources_device, sources.data(), sizeof(CUDAKernel::WarpAffineSource) * batch, cudaMemcpyHostToDevice));
+        checkCudaRuntime(cudaMemcpy(matrices_device, matrices.data(), sizeof(float) * matrices.size(), cudaMemcpyHostToDevice));
+
+        auto per_image = [&](){
+            for(int i = 0; i < batch; ++i){
+                CUDAKernel::warp_affine_bilinear_and_normalize(
+                    images_device[i], sources[i].line_size, sources[i].width, sources[i].height,
+                    output_device + i * image_count, dst_width, dst_height,
+                    matrices_device + i * 6, 114, norm, stream
+                );
+            }
+        };
+
+        auto batched = [&](){
+            CUDAKernel::warp_affine_bilinear_and_normalize_batch(
+                sources_device, matrices_device, batch,
+                output_device, dst_width, dst_height, 114, norm, stream
+            );
+        };
+
+        vector<float> per_image_output(image_count * batch);
+        vector<float> batched_output(image_count * batch);
+        per_image();
+        checkCudaRuntime(cudaMemcpyAsync(per_image_output.data(), output_device, sizeof(float) * per_image_output.size(), cudaMemcpyDeviceToHost, stream));
+        batched();
+        checkCudaRuntime(cudaMemcpyAsync(batched_output.data(), output_device, sizeof(float) * batched_output.size(), cudaMemcpyDeviceToHost, stream));
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+
+        size_t mismatch_batch = 0, mismatch_cpu = 0;
+        float diff_batch = max_abs_diff(per_image_output.data(), batched_output.data(), batched_output.size(), mismatch_batch);
+        float diff_cpu   = max_abs_diff(cpu_output, batched_output.data(), batched_output.size(), mismatch_cpu);
+
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) per_image();
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+        float per_image_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) batched();
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+        float batched_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        bool batch_ok = mismatch_batch == 0;
+        bool cpu_ok   = diff_cpu <= gpu_cpu_tolerance;
+        INFO("GPU  batch vs per image: max diff = %g, mismatch = %lld, %s", diff_batch, (long long)mismatch_batch, batch_ok ? "ok" : "failed");
+        INFO("GPU  batch vs CPU: max diff = %g, mismatch = %lld / %lld, %s", diff_cpu, (long long)mismatch_cpu, (long long)batched_output.size(), cpu_ok ? "ok" : "failed");
+        INFO("GPU  %d launches %.3f ms, 1 launch %.3f ms", batch, per_image_ms, batched_ms);
+
+        for(auto ptr : images_device) checkCudaRuntime(cudaFree(ptr));
+        checkCudaRuntime(cudaFree(sources_device));
+        checkCudaRuntime(cudaFree(matrices_device));
+        checkCudaRuntime(cudaFree(output_device));
+        checkCudaRuntime(cudaStreamDestroy(stream));
+        return batch_ok && cpu_ok;
+    }
+
+    // 返回所有一致性检查是否通过
+    bool bench_norm(const char* name, const CUDAKernel::Norm& norm, int batch, int dst_width, int dst_height, bool gpu){
+
+        INFO("===================== %s, batch = %d, %d x %d ==================================", name, batch, dst_width, dst_height);
+        auto images = make_images(batch, dst_width, dst_height);
+
+        vector<CUDAKernel::WarpAffineSource> sources(batch);
+        vector<float> matrices(batch * 6);
+        for(int i = 0; i < batch; ++i){
+            sources[i].data      = images[i].data.data();
+            sources[i].line_size = images[i].width * 3;
+            sources[i].width     = images[i].width;
+            sources[i].height    = images[i].height;
+            memcpy(matrices.data() + i * 6, images[i].d2i, sizeof(images[i].d2i));
+        }
+
+        size_t count = (size_t)3 * dst_width * dst_height * batch;
+        vector<float> scalar_output(count), simd_output(count);
+
+        const int iters = 5;
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i)
+            CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, scalar_output.data(), dst_width, dst_height, 114, norm, false);
+        float scalar_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i)
+            CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, simd_output.data(), dst_width, dst_height, 114, norm, true);
+        float simd_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        size_t mismatch = 0;
+        float diff = max_abs_diff(scalar_output.data(), simd_output.data(), count, mismatch);
+        INFO("CPU  %s vs Scalar: max diff = %g, mismatch = %lld, %s", CPUKernel::simd_name(), diff, (long long)mismatch, mismatch == 0 ? "ok" : "failed");
+        INFO("CPU  Scalar %.3f ms, %s %.3f ms, speedup %.2fx", scalar_ms, CPUKernel::simd_name(), simd_ms, scalar_ms / simd_ms);
+
+        bool ok = mismatch == 0;
+        if(gpu)
+            ok = bench_gpu(images, dst_width, dst_height, norm, simd_output.data(), 20) && ok;
+        return ok;
+    }
+
+    struct BenchYUVImage{
+        YUVImage image;
+        vector<uint8_t> data;
+        float d2i[6];
+    };
+
+    // 行宽按64字节对齐，模拟解码器输出的pitch，包含奇数的宽高
+    vector<BenchYUVImage> make_yuv_images(ImageFormat format, int batch, int dst_width, int dst_height){
+
+        int sizes[][2] = {{1920, 1080}, {1281, 719}, {640, 480}, {501, 701}};
+        int num_sizes  = sizeof(sizes) / sizeof(sizes[0]);
+
+        vector<BenchYUVImage> images(batch);
+        unsigned int seed = 17;
+        for(int i = 0; i < batch; ++i){
+            auto& item       = images[i];
+            int width        = sizes[i % num_sizes][0];
+            int height       = sizes[i % num_sizes][1];
+            int y_line_size  = iLogger::upbound(width, 64);
+            int uv_line_size = format == ImageFormat::NV12 ? y_line_size : iLogger::upbound((width + 1) / 2, 64);
+            int uv_height    = (height + 1) / 2;
+            int num_uv       = format == ImageFormat::NV12 ? 1 : 2;
+            item.data.resize((size_t)y_line_size * height + (size_t)uv_line_size * uv_height * num_uv);
+            for(auto& v : item.data){
+                seed = seed * 1103515245 + 12345;
+                v    = seed >> 24;
+            }
+
+            const uint8_t* y = item.data.data();
+            const uint8_t* u = y + (size_t)y_line_size * height;
+            const uint8_t* v = u + (size_t)uv_line_size * uv_height;
+            if(format == ImageFormat::NV12)
+                item.image = YUVImage::nv12(y, u, width, height, y_line_size);
+            else
+                item.image = YUVImage::i420(y, u, v, width, height, y_line_size, uv_line_size);
+            compute_d2i(width, height, dst_width, dst_height, (i % 4) * 15.0f, item.d2i);
+        }
+        return images;
+    }
+
+    CUDAKernel::WarpAffineSource host_source(const YUVImage& image){
+        CUDAKernel::WarpAffineSource source;
+        source.format       = image.format;
+        source.data         = image.y;
+        source.u            = image.u;
+        source.v            = image.v;
+        source.line_size    = image.y_line_size;
+        source.uv_line_size = image.uv_line_size;
+        source.width        = image.width;
+        source.height       = image.height;
+        return source;
+    }
+
+    bool bench_yuv_gpu(
+        vector<BenchYUVImage>& images, int dst_width, int dst_height,
+        const CUDAKernel::Norm& norm, const float* cpu_output, int iters){
+
+        int batch          = images.size();
+        size_t image_count = (size_t)3 * dst_width * dst_height;
+        cudaStream_t stream = nullptr;
+        checkCudaRuntime(cudaStreamCreate(&stream));
+
+        vector<CUDAKernel::WarpAffineSource> sources(batch);
+        vector<uint8_t*> planes_device(batch), planes_host(batch), bgr_device(batch);
+        vector<float> matrices(batch * 6);
+        for(int i = 0; i < batch; ++i){
+            auto& image = images[i].image;
+            checkCudaRuntime(cudaMalloc(&planes_device[i], image.bytes()));
+            checkCudaRuntime(cudaMallocHost(&planes_host[i], image.bytes()));
+            checkCudaRuntime(cudaMalloc(&bgr_device[i], (size_t)image.width * image.height * 3));
+            sources[i] = CUDAKernel::upload_yuv_image(image, planes_device[i], planes_host[i], stream);
+            memcpy(matrices.data() + i * 6, images[i].d2i, sizeof(images[i].d2i));
+        }
+
+        CUDAKernel::WarpAffineSource* sources_device = nullptr;
+        float* matrices_device = nullptr;
+        float* output_device   = nullptr;
+        checkCudaRuntime(cudaMalloc(&sources_device,  sizeof(CUDAKernel::WarpAffineSource) * batch));
+        checkCudaRuntime(cudaMalloc(&matrices_device, sizeof(float) * matrices.size()));
+        checkCudaRuntime(cudaMalloc(&output_device,   sizeof(float) * image_count * batch));
+        checkCudaRuntime(cudaMemcpyAsync(sources_device, sources.data(), sizeof(CUDAKernel::WarpAffineSource) * batch, cudaMemcpyHostToDevice, stream));
+        checkCudaRuntime(cudaMemcpyAsync(matrices_device, matrices.data(), sizeof(float) * matrices.size(), cudaMemcpyHostToDevice, stream));
+
+        auto two_step = [&](){
+            for(int i = 0; i < batch; ++i){
+                auto& source = sources[i];
+                CUDAKernel::convert_yuv_to_bgr_invoke(source, bgr_device[i], stream);
+                CUDAKernel::warp_affine_bilinear_and_normalize(
+                    bgr_device[i], source.width * 3, source.width, source.height,
+                    output_device + i * image_count, dst_width, dst_height,
+                    matrices_device + i * 6, 114, norm, stream
+                );
+            }
+        };
+
+        auto fused = [&](){
+            CUDAKernel::warp_affine_bilinear_and_normalize_batch(
+                sources_device, matrices_device, batch,
+                output_device, dst_width, dst_height, 114, norm, stream
+            );
+        };
+
+        vector<float> two_step_output(image_count * batch);
+        vector<float> fused_output(image_count * batch);
+        two_step();
+        checkCudaRuntime(cudaMemcpyAsync(two_step_output.data(), output_device, sizeof(float) * two_step_output.size(), cudaMemcpyDeviceToHost, stream));
+        fused();
+        checkCudaRuntime(cudaMemcpyAsync(fused_output.data(), output_device, sizeof(float) * fused_output.size(), cudaMemcpyDeviceToHost, stream));
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+
+        size_t mismatch_two_step = 0, mismatch_cpu = 0;
+        float diff_two_step = max_abs_diff(two_step_output.data(), fused_output.data(), fused_output.size(), mismatch_two_step);
+        float diff_cpu      = max_abs_diff(cpu_output, fused_output.data(), fused_output.size(), mismatch_cpu);
+
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) two_step();
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+        float two_step_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) fused();
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+        float fused_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        bool two_step_ok = mismatch_two_step == 0;
+        bool cpu_ok      = diff_cpu <= gpu_cpu_tolerance;
+        INFO("GPU  fused vs two step: max diff = %g, mismatch = %lld, %s", diff_two_step, (long long)mismatch_two_step, two_step_ok ? "ok" : "failed");
+        INFO("GPU  fused vs CPU: max diff = %g, mismatch = %lld / %lld, %s", diff_cpu, (long long)mismatch_cpu, (long long)fused_output.size(), cpu_ok ? "ok" : "failed");
+        INFO("GPU  two step %.3f ms, fused %.3f ms", two_step_ms, fused_ms);
+
+        for(auto ptr : planes_device) checkCudaRuntime(cudaFree(ptr));
+        for(auto ptr : planes_host)   checkCudaRuntime(cudaFreeHost(ptr));
+        for(auto ptr : bgr_device)    checkCudaRuntime(cudaFree(ptr));
+        checkCudaRuntime(cudaFree(sources_device));
+        checkCudaRuntime(cudaFree(matrices_device));
+        checkCudaRuntime(cudaFree(output_device));
+        checkCudaRuntime(cudaStreamDestroy(stream));
+        return two_step_ok && cpu_ok;
+    }
+
+    // 返回所有一致性检查是否通过
+    bool bench_yuv(ImageFormat format, const CUDAKernel::Norm& norm, int batch, int dst_width, int dst_height, bool gpu){
+
+        const char* name = format == ImageFormat::NV12 ? "NV12" : "I420";
+        INFO("===================== %s, batch = %d, %d x %d ==================================", name, batch, dst_width, dst_height);
+        auto images = make_yuv_images(format, batch, dst_width, dst_height);
+
+        vector<CUDAKernel::WarpAffineSource> sources(batch);
+        vector<float> matrices(batch * 6);
+        for(int i = 0; i < batch; ++i){
+            sources[i] = host_source(images[i].image);
+            memcpy(matrices.data() + i * 6, images[i].d2i, sizeof(images[i].d2i));
+        }
+
+        size_t image_count = (size_t)3 * dst_width * dst_height;
+        size_t count       = image_count * batch;
+        vector<float> two_step_output(count), scalar_output(count), simd_output(count);
+
+        // 两步路径：整图转换为BGR，再仿射
+        const int iters = 5;
+        vector<vector<uint8_t>> bgr_images(batch);
+        auto tic = iLogger::timestamp_now_float();
+        for(int it = 0; it < iters; ++it){
+            for(int i = 0; i < batch; ++i){
+                auto& source = sources[i];
+                bgr_images[i].resize((size_t)source.width * source.height * 3);
+                CPUKernel::convert_yuv_to_bgr(source, bgr_images[i].data(), source.width * 3);
+                CPUKernel::warp_affine_bilinear_and_normalize(
+                    bgr_images[i].data(), source.width * 3, source.width, source.height,
+                    two_step_output.data() + i * image_count, dst_width, dst_height,
+                    matrices.data() + i * 6, 114, norm
+                );
+            }
+        }
+        float two_step_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i)
+            CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, scalar_output.data(), dst_width, dst_height, 114, norm, false);
+        float scalar_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i)
+            CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, simd_output.data(), dst_width, dst_height, 114, norm, true);
+        float simd_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+        size_t mismatch_scalar = 0, mismatch_simd = 0;
+        float diff_scalar = max_abs_diff(two_step_output.data(), scalar_output.data(), count, mismatch_scalar);
+        float diff_simd   = max_abs_diff(two_step_output.data(), simd_output.data(), count, mismatch_simd);
+        INFO("CPU  fused Scalar vs two step: max diff = %g, mismatch = %lld, %s", diff_scalar, (long long)mismatch_scalar, mismatch_scalar == 0 ? "ok" : "failed");
+        INFO("CPU  fused %s vs two step: max diff = %g, mismatch = %lld, %s", CPUKernel::simd_name(), diff_simd, (long long)mismatch_simd, mismatch_simd == 0 ? "ok" : "failed");
+        INFO("CPU  two step %.3f ms, fused Scalar %.3f ms, fused %s %.3f ms", two_step_ms, scalar_ms, CPUKernel::simd_name(), simd_ms);
+
+        bool ok = mismatch_scalar == 0 && mismatch_simd == 0;
+        if(gpu)
+            ok = bench_yuv_gpu(images, dst_width, dst_height, norm, simd_output.data(), 20) && ok;
+        return ok;
+    }
+
+    float half_to_float(uint16_t value){
+
+        uint32_t sign     = (uint32_t)(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1F;
+        uint32_t mantissa = value & 0x3FF;
+        float output;
+        if(exponent == 0)
+            output = ldexpf((float)mantissa, -24);
+        else if(exponent == 31)
+            output = mantissa ? NAN : INFINITY;
+        else
+            output = ldexpf((float)(mantissa | 0x400), (int)exponent - 25);
+        return sign ? -output : output;
+    }
+
+    // 把任意输出格式的一张图像还原为float32 NCHW，padding不为0时返回false
+    bool decode_output(const uint8_t* data, const CUDAKernel::Norm& norm, int width, int height, float* output){
+
+        auto type     = norm.output_type();
+        auto layout   = norm.output_layout();
+        size_t area   = (size_t)width * height;
+        bool padding_ok = true;
+        auto load = [&](size_t index){
+            if(type == CUDAKernel::NormType::Float16) return half_to_float(((const uint16_t*)data)[index]);
+            if(type == CUDAKernel::NormType::Int8)    return ((const int8_t*)data)[index] * norm.int8_scale;
+            return ((const float*)data)[index];
+        };
+
+        for(size_t i = 0; i < area; ++i){
+            for(int c = 0; c < 3; ++c){
+                size_t index;
+                if(layout == CUDAKernel::NormType::NHWC)        index = i * 3 + c;
+                else if(layout == CUDAKernel::NormType::NC4HW4) index = i * 4 + c;
+                else                                            index = c * area + i;
+                output[c * area + i] = load(index);
+            }
+            if(layout == CUDAKernel::NormType::NC4HW4 && load(i * 4 + 3) != 0)
+                padding_ok = false;
+        }
+        return padding_ok;
+    }
+
+    // 该格式相对float32的最大允许误差
+    float output_tolerance(const CUDAKernel::Norm& norm, float reference){
+        if(norm.output_type() == CUDAKernel::NormType::Float16)
+            return std::max(fabs(reference) / 2048.0f, 6e-8f);
+        if(norm.output_type() == CUDAKernel::NormType::Int8){
+            float clamped = std::min(std::max(reference, -128 * norm.int8_scale), 127 * norm.int8_scale);
+            // 半个量化步长，另外留出q * scale还原时的舍入误差
+            return fabs(reference - clamped) + norm.int8_scale * 0.5f + fabs(reference) * 1e-6f;
+        }
+        return 0;
+    }
+
+    struct FormatCheck{
+        float max_diff  = 0;
+        size_t failed   = 0;
+        bool padding_ok = true;
+    };
+
+    // output为batch张图像的输出，reference为float32 NCHW，slack为额外允许的误差（GPU与CPU的浮点差异）
+    FormatCheck check_output(const uint8_t* output, const float* reference, int batch, int width, int height, const CUDAKernel::Norm& norm, float slack){
+
+        FormatCheck check;
+        size_t image_count = (size_t)3 * width * height;
+        vector<float> decoded(image_count);
+        for(int ibatch = 0; ibatch < batch; ++ibatch){
+            check.padding_ok &= decode_output(output + ibatch * norm.output_bytes(width, height), norm, width, height, decoded.data());
+            const float* pref = reference + ibatch * image_count;
+            for(size_t i = 0; i < image_count; ++i){
+                float diff     = fabs(decoded[i] - pref[i]);
+                check.max_diff = std::max(check.max_diff, diff);
+                if(diff > output_tolerance(norm, pref[i]) + slack) check.failed++;
+            }
+        }
+        return check;
+    }
+
+    // 返回所有格式的检查是否通过
+    bool bench_output_formats(int batch, int dst_width, int dst_height, bool gpu){
+
+        INFO("===================== output formats, batch = %d, %d x %d ==================================", batch, dst_width, dst_height);
+        auto images = make_images(batch, dst_width, dst_height);
+
+        vector<CUDAKernel::WarpAffineSource> sources(batch);
+        vector<float> matrices(batch * 6);
+        for(int i = 0; i < batch; ++i){
+            sources[i].data      = images[i].data.data();
+            sources[i].line_size = images[i].width * 3;
+            sources[i].width     = images[i].width;
+            sources[i].height    = images[i].height;
+            memcpy(matrices.data() + i * 6, images[i].d2i, sizeof(images[i].d2i));
+        }
+
+        float mean[] = {0.485, 0.456, 0.406};
+        float std[]  = {0.229, 0.224, 0.225};
+        auto base    = CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB;
+        vector<float> reference((size_t)3 * dst_width * dst_height * batch);
+        CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, reference.data(), dst_width, dst_height, 114, base, false);
+
+        CUDAKernel::WarpAffineSource* sources_device = nullptr;
+        float* matrices_device   = nullptr;
+        uint8_t* output_device   = nullptr;
+        vector<uint8_t*> images_device(batch);
+        cudaStream_t stream      = nullptr;
+        if(gpu){
+            checkCudaRuntime(cudaStreamCreate(&stream));
+            vector<CUDAKernel::WarpAffineSource> sources_host = sources;
+            for(int i = 0; i < batch; ++i){
+                checkCudaRuntime(cudaMalloc(&images_device[i], images[i].data.size()));
+                checkCudaRuntime(cudaMemcpy(images_device[i], images[i].data.data(), images[i].data.size(), cudaMemcpyHostToDevice));
+                sources_host[i].data = images_device[i];
+            }
+            checkCudaRuntime(cudaMalloc(&sources_device,  sizeof(CUDAKernel::WarpAffineSource) * batch));
+            checkCudaRuntime(cudaMalloc(&matrices_device, sizeof(float) * matrices.size()));
+            checkCudaRuntime(cudaMalloc(&output_device,   sizeof(float) * 4 * dst_width * dst_height * batch));
+            checkCudaRuntime(cudaMemcpy(sources_device, sources_host.data(), sizeof(CUDAKernel::WarpAffineSource) * batch, cudaMemcpyHostToDevice));
+            checkCudaRuntime(cudaMemcpy(matrices_device, matrices.data(), sizeof(float) * matrices.size(), cudaMemcpyHostToDevice));
+        }
+
+        struct{const char* name; CUDAKernel::NormType value;} types[] = {
+            {"float32", CUDAKernel::NormType::Float32}, {"float16", CUDAKernel::NormType::Float16}, {"int8", CUDAKernel::NormType::Int8}
+        };
+        struct{const char* name; CUDAKernel::NormType value;} layouts[] = {
+            {"NCHW", CUDAKernel::NormType::NCHW}, {"NHWC", CUDAKernel::NormType::NHWC}, {"NC4HW4", CUDAKernel::NormType::NC4HW4}
+        };
+
+        bool ok = true;
+        for(auto& type : types){
+            for(auto& layout : layouts){
+
+                auto norm = base + layout.value;
+                if(type.value == CUDAKernel::NormType::Int8)
+                    norm = norm.quantize_int8(1 / 40.0f);
+                else
+                    norm = norm + type.value;
+
+                size_t bytes = norm.output_bytes(dst_width, dst_height) * batch;
+                vector<uint8_t> scalar_output(bytes), simd_output(bytes);
+                CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, scalar_output.data(), dst_width, dst_height, 114, norm, false);
+
+                const int iters = 3;
+                auto tic = iLogger::timestamp_now_float();
+                for(int i = 0; i < iters; ++i)
+                    CPUKernel::warp_affine_bilinear_and_normalize_batch(sources.data(), matrices.data(), batch, simd_output.data(), dst_width, dst_height, 114, norm, true);
+                float cpu_ms = (iLogger::timestamp_now_float() - tic) / iters;
+
+                bool simd_exact = scalar_output == simd_output;
+                auto cpu_check  = check_output(simd_output.data(), reference.data(), batch, dst_width, dst_height, norm, 0);
+                bool cpu_ok     = simd_exact && cpu_check.failed == 0 && cpu_check.padding_ok;
+                INFO("%-7s %-6s %6.2f MB, CPU max diff = %g, failed = %lld, %s exact = %d, %.3f ms, %s",
+                    type.name, layout.name, bytes / 1024.0f / 1024.0f, cpu_check.max_diff, (long long)cpu_check.failed,
+                    CPUKernel::simd_name(), simd_exact, cpu_ms, cpu_ok ? "ok" : "failed"
+                );
+                ok = ok && cpu_ok;
+
+                if(!gpu) continue;
+
+                auto launch = [&](){
+                    CUDAKernel::warp_affine_bilinear_and_normalize_batch(
+                        sources_device, matrices_device, batch,
+                        output_device, dst_width, dst_height, 114, norm, stream
+                    );
+                };
+
+                vector<uint8_t> gpu_output(bytes);
+                launch();
+                checkCudaRuntime(cudaMemcpyAsync(gpu_output.data(), output_device, bytes, cudaMemcpyDeviceToHost, stream));
+                checkCudaRuntime(cudaStreamSynchronize(stream));
+
+                const int gpu_iters = 20;
+                tic = iLogger::timestamp_now_float();
+                for(int i = 0; i < gpu_iters; ++i) launch();
+                checkCudaRuntime(cudaStreamSynchronize(stream));
+                float gpu_ms = (iLogger::timestamp_now_float() - tic) / gpu_iters;
+
+                // GPU的fp32结果与CPU可能有fma带来的微小差异，这里放宽1e-5
+                auto gpu_check = check_output(gpu_output.data(), reference.data(), batch, dst_width, dst_height, norm, 1e-5f);
+                size_t mismatch_bytes = 0;
+                for(size_t i = 0; i < bytes; ++i)
+                    mismatch_bytes += gpu_output[i] != simd_output[i];
+
+                bool gpu_ok = gpu_check.failed == 0 && gpu_check.padding_ok;
+                INFO("%-7s %-6s GPU max diff = %g, failed = %lld, bytes differ from CPU = %lld, %.3f ms, %s",
+                    type.name, layout.name, gpu_check.max_diff, (long long)gpu_check.failed, (long long)mismatch_bytes, gpu_ms,
+                    gpu_ok ? "ok" : "failed"
+                );
+                ok = ok && gpu_ok;
+            }
+        }
+
+        if(gpu){
+            for(auto ptr : images_device) checkCudaRuntime(cudaFree(ptr));
+            checkCudaRuntime(cudaFree(sources_device));
+            checkCudaRuntime(cudaFree(matrices_device));
+            checkCudaRuntime(cudaFree(output_device));
+            checkCudaRuntime(cudaStreamDestroy(stream));
+        }
+        return ok;
+    }
+};
+
+int app_preprocess_bench(){
+
+    bool gpu = has_cuda_device();
+    if(!gpu)
+        INFO("No cuda device, only the CPU implementation is checked");
+
+    float mean[] = {0.485, 0.456, 0.406};
+    float std[]  = {0.229, 0.224, 0.225};
+    bool ok = true;
+    ok = bench_norm("None",               CUDAKernel::Norm(), 4, 640, 640, gpu) && ok;
+    ok = bench_norm("AlphaBeta + ToRGB",  CUDAKernel::Norm::alpha_beta(1 / 255.0f) + CUDAKernel::NormType::ToRGB, 16, 640, 640, gpu) && ok;
+    ok = bench_norm("MeanStd + ToRGB",    CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB, 16, 640, 640, gpu) && ok;
+    ok = bench_norm("MeanStd, odd width", CUDAKernel::Norm::mean_std(mean, std), 3, 333, 201, gpu) && ok;
+
+    auto yolo_norm = CUDAKernel::Norm::alpha_beta(1 / 255.0f) + CUDAKernel::NormType::ToRGB;
+    ok = bench_yuv(ImageFormat::NV12, yolo_norm, 8, 640, 640, gpu) && ok;
+    ok = bench_yuv(ImageFormat::I420, yolo_norm, 8, 640, 640, gpu) && ok;
+    ok = bench_yuv(ImageFormat::NV12, CUDAKernel::Norm::mean_std(mean, std), 3, 333, 201, gpu) && ok;
+
+    ok = bench_output_formats(8, 640, 640, gpu) && ok;
+    ok = bench_output_formats(2, 333, 201, gpu) && ok;
+
+    if(!ok){
+        INFOE("Preprocess bench check failed");
+        return -1;
+    }
+    return 0;
+}
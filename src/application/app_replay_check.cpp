@@ -0,0 +1,236 @@
+/**
+ * 回放后端的录制与回放检查，不需要TensorRT引擎
+ *   1. 生成一个源模型，由load_infer加载，作为被录制的引擎
+ *   2. 按不同的batch大小forward，每次forward之后ReplayRecorder记录，保存为回放文件
+ *   3. load_infer加载回放文件，InferController的worker按batch forward，结果必须与源引擎逐位一致
+ *   4. 截断、数量或者维度被破坏的文件必须加载失败
+ *   ./pro replay_check
+ */
+
+#include <vector>
+#include <string.h>
+#include <common/ilogger.hpp>
+#include <common/infer_controller.hpp>
+#include <infer/trt_infer.hpp>
+#include <infer/replay_infer.hpp>
+
+using namespace std;
+
+namespace{
+
+    const int MAX_BATCH_SIZE = 8;
+    const int INPUT_SIZE     = 4;
+    const int OUTPUT_SIZE    = 3;
+
+    vector<float> make_input(int index){
+        return {(float)index, index * 0.5f, -(float)index, 1.0f / (index + 1)};
+    }
+
+    vector<float> make_output(const vector<float>& input){
+        return {input[0] + input[1] + input[2] + input[3], input[1] * input[3], input[0] * 2 - 1};
+    }
+
+    TRT::ReplayModel make_source_model(int num_samples){
+
+        TRT::ReplayModel model;
+        model.max_batch_size = MAX_BATCH_SIZE;
+        model.inputs.push_back({"images", {MAX_BATCH_SIZE, INPUT_SIZE}});
+        model.outputs.push_back({"output", {MAX_BATCH_SIZE, OUTPUT_SIZE}});
+        for(int i = 0; i < num_samples; ++i){
+            TRT::ReplayRecord record;
+            record.inputs.push_back(make_input(i));
+            record.outputs.push_back(make_output(record.inputs[0]));
+            model.records.emplace_back(record);
+        }
+        return model;
+    }
+
+    // 按1, 2, 3...的batch大小forward源引擎，每次forward之后录制
+    bool record_replay_file(const string& source_file, const string& replay_file, int num_samples){
+
+        auto engine = TRT::load_infer(source_file);
+        if(engine == nullptr){
+            INFOE("Load source model %s failed", source_file.c_str());
+            return false;
+        }
+
+        TRT::ReplayRecorder recorder(engine, 1.0f, 0.1f);
+        auto input = engine->input();
+        for(int begin = 0, batch = 1; begin < num_samples; begin += batch, batch = batch % MAX_BATCH_SIZE + 1){
+            int batch_size = std::min(batch, num_samples - begin);
+            input->resize_single_dim(0, batch_size);
+            for(int i = 0; i < batch_size; ++i){
+                auto sample = make_input(begin + i);
+                memcpy(input->cpu<float>(i), sample.data(), sizeof(float) * sample.size());
+            }
+            engine->forward();
+            recorder.record();
+        }
+
+        if(recorder.num_record() != num_samples){
+            INFOE("Recorded %d samples, expect %d", recorder.num_record(), num_samples);
+            return false;
+        }
+        return recorder.save(replay_file);
+    }
+
+    using ControllerImpl = InferController
+    <
+        vector<float>,          // input
+        vector<float>,          // output
+        tuple<string, int>      // start param
+    >;
+
+    // 与真实模型一样在worker中load_infer，凑batch后forward
+    class ReplayController : public ControllerImpl{
+    public:
+        virtual ~ReplayController(){
+            stop();
+        }
+
+        bool startup(const string& file){
+            set_metrics_name("replay");
+            return ControllerImpl::startup(make_tuple(file, 0));
+        }
+
+        virtual void worker(promise<bool>& result) override{
+
+            auto engine = TRT::load_infer(get<0>(start_param_));
+            if(engine == nullptr){
+                INFOE("Engine %s load failed", get<0>(start_param_).c_str());
+                result.set_value(false);
+                return;
+            }
+
+            engine->print();
+            int max_batch_size = engine->get_max_batch_size();
+            auto input         = engine->input();
+            auto output        = engine->output();
+            result.set_value(true);
+
+            vector<Job> fetch_jobs;
+            while(get_jobs_and_wait(fetch_jobs, max_batch_size)){
+
+                int infer_batch_size = fetch_jobs.size();
+                input->resize_single_dim(0, infer_batch_size);
+                for(int i = 0; i < infer_batch_size; ++i)
+                    memcpy(input->cpu<float>(i), fetch_jobs[i].input.data(), sizeof(float) * input->count(1));
+
+                engine->forward();
+                for(int i = 0; i < infer_batch_size; ++i){
+                    float* poutput = output->cpu<float>(i);
+                    fetch_jobs[i].set_value(vector<float>(poutput, poutput + output->count(1)));
+                }
+                fetch_jobs.clear();
+            }
+            INFO("Engine destroy.");
+        }
+
+        virtual bool preprocess(Job& job, const vector<float>& input) override{
+            if((int)input.size() != INPUT_SIZE) return false;
+            job.input = input;
+            return true;
+        }
+    };
+
+    bool check_replay(const string& replay_file, int num_samples){
+
+        ReplayController controller;
+        if(!controller.startup(replay_file)){
+            INFOE("Controller startup failed");
+            return false;
+        }
+
+        vector<vector<float>> inputs;
+        for(int i = 0; i < num_samples; ++i)
+            inputs.emplace_back(make_input(i));
+
+        auto tic     = iLogger::timestamp_now_float();
+        auto futures = controller.commits(inputs);
+        int mismatch = 0;
+        for(int i = 0; i < num_samples; ++i){
+            auto output = futures[i].get();
+            auto expect = make_output(inputs[i]);
+            if(output.size() != expect.size() || memcmp(output.data(), expect.data(), sizeof(float) * expect.size()) != 0)
+                mismatch++;
+        }
+
+        auto metrics = controller.metrics();
+        INFO("Replay %d samples, %.2f ms, %lld batches, mismatch = %d, %s",
+            num_samples, iLogger::timestamp_now_float() - tic, metrics.batch_size.count, mismatch, mismatch == 0 ? "ok" : "failed"
+        );
+        return mismatch == 0;
+    }
+
+    // 修改data中offset处的一个uint32，或者截断到offset
+    bool check_corrupted(const vector<unsigned char>& data, const char* name, size_t offset, unsigned int value, bool truncate = false){
+
+        auto corrupted = data;
+        if(truncate)
+            corrupted.resize(offset);
+        else
+            memcpy(&corrupted[offset], &value, sizeof(value));
+
+        bool rejected = TRT::load_infer_from_memory(corrupted.data(), corrupted.size()) == nullptr;
+        INFO("Corrupted replay file, %s: %s", name, rejected ? "rejected" : "failed, loaded");
+        return rejected;
+    }
+
+    bool check_corrupted_files(const string& replay_file){
+
+        auto data = iLogger::load_file(replay_file);
+        if(data.empty()){
+            INFOE("Load %s failed", replay_file.c_str());
+            return false;
+        }
+
+        // 文件头：magic, version, max_batch_size, dynamic_batch, base_ms, per_item_ms, num_input, num_output
+        // 之后是images、output两个binding，每个为name_length, name, ndims, dims[2]，再之后是num_record
+        auto binding_bytes = [](const char* name){ return sizeof(unsigned int) * 2 + strlen(name) + sizeof(int) * 2; };
+        const size_t num_input_offset  = sizeof(unsigned int) * 6;
+        const size_t first_dim_offset  = sizeof(unsigned int) * 8 + binding_bytes("images") - sizeof(int) * 2;
+        const size_t num_record_offset = sizeof(unsigned int) * 8 + binding_bytes("images") + binding_bytes("output");
+        const size_t record_bytes      = sizeof(float) * (INPUT_SIZE + OUTPUT_SIZE);
+
+        unsigned int num_record = 0;
+        memcpy(&num_record, &data[num_record_offset], sizeof(num_record));
+        if(data.size() != num_record_offset + sizeof(num_record) + num_record * record_bytes){
+            INFOE("Unexpected replay file layout, %d bytes, %u records", (int)data.size(), num_record);
+            return false;
+        }
+
+        bool ok = true;
+        ok = check_corrupted(data, "truncated",            data.size() - record_bytes / 2, 0, true) && ok;
+        ok = check_corrupted(data, "huge num_input",       num_input_offset, 0x7FFFFFFF) && ok;
+        ok = check_corrupted(data, "negative dim",         first_dim_offset, (unsigned int)-1) && ok;
+        ok = check_corrupted(data, "zero dim",             first_dim_offset + sizeof(int), 0) && ok;
+        ok = check_corrupted(data, "huge num_record",      num_record_offset, 0xFFFFFFFF) && ok;
+        ok = check_corrupted(data, "num_record + 1",       num_record_offset, num_record + 1) && ok;
+        return ok;
+    }
+};
+
+int app_replay_check(){
+
+    const int num_samples     = 100;
+    const string source_file  = "replay_check_source.replay";
+    const string replay_file  = "replay_check.replay";
+
+    if(!TRT::save_replay_file(source_file, make_source_model(num_samples))){
+        INFOE("Save source model failed");
+        return -1;
+    }
+
+    if(!record_replay_file(source_file, replay_file, num_samples))
+        return -1;
+
+    bool ok = check_replay(replay_file, num_samples);
+    ok = check_corrupted_files(replay_file) && ok;
+
+    if(!ok){
+        INFOE("Replay check failed");
+        return -1;
+    }
+    INFO("Replay check passed");
+    return 0;
+}
@@ -16,9 +16,9 @@ namespace RetinaFace{
 
     void decode_kernel_invoker(
         float* predict, int num_bboxes, float confidence_threshold, 
-        float nms_threshold, float* invert_affine_matrix, float* parray,
+        float nms_threshold, float* invert_affine_matrix, float* candidates, float* parray,
         int max_objects, float* prior,
-        cudaStream_t stream
+        void* nms_workspace, cudaStream_t stream, int* num_candidates
     );
 
     struct AffineMatrix{
@@ -53,12 +53,20 @@ namespace RetinaFace{
     >;
     class InferImpl : public Infer, public ControllerImpl{
     public:
-        virtual bool startup(const string& file, int gpuid, float confidence_threshold){
+        // worker中run_pipeline的deliver会访问派生类的成员，需要在这些成员析构之前停止worker
+        virtual ~InferImpl(){
+            stop();
+        }
+
+        virtual bool startup(const string& file, int gpuid, float confidence_threshold, int max_objects, OverflowPolicy overflow_policy){
 
             float mean[] = {104, 117, 123};
             float std[]  = {1, 1, 1};
             normalize_   = CUDAKernel::Norm::mean_std(mean, std, 1.0f);
             confidence_threshold_ = confidence_threshold;
+            max_objects_          = max_objects;
+            overflow_policy_      = overflow_policy;
+            set_metrics_name(iLogger::file_name(file, false));
             return ControllerImpl::startup(make_tuple(file, gpuid));
         }
 
@@ -124,10 +132,8 @@ namespace RetinaFace{
 
             engine->print();
 
-            const int MAX_IMAGE_BBOX = 1024;
             const int NUM_BOX_ELEMENT = 16;    // left, top, right, bottom, confidence, label(0 or -1), landmark(x, y) * 5
             TRT::Tensor affin_matrix_device(TRT::DataType::dtFloat);
-            TRT::Tensor output_array_device(TRT::DataType::dtFloat);
             TRT::Tensor prior(TRT::DataType::dtFloat);
             int max_batch_size = engine->get_max_batch_size();
             auto input         = engine->input();
@@ -151,13 +157,20 @@ namespace RetinaFace{
             // 这里8个值的目的是保证 8 * sizeof(float) % 32 == 0
             affin_matrix_device.resize(max_batch_size, 8).to_gpu();
 
-            // 这里的 1 + MAX_IMAGE_BBOX结构是，counter + bboxes ...
-            output_array_device.resize(max_batch_size, 1 + MAX_IMAGE_BBOX * NUM_BOX_ELEMENT).to_gpu(); 
+            // 解码的候选框（每个prior一个），batch内的图像在stream上顺序使用，只需要一份
+            int num_priors = prior.size(1);
+            TRT::MixMemory decode_workspace;
+            float* candidates = (float*)decode_workspace.gpu(num_priors * NUM_BOX_ELEMENT * sizeof(float));
 
-            vector<Job> fetch_jobs;
-            while(get_jobs_and_wait(fetch_jobs, max_batch_size)){
+            // 两套输出缓冲区，第k个batch推理时，交付第k-1个batch的结果
+            // 每张图像最多max_objects_个box，但只把实际的数量和box复制回host
+            const int NUM_SLOTS = 2;
+            ResultCompactor compactor(NUM_SLOTS, max_batch_size, NUM_BOX_ELEMENT, max_objects_, overflow_policy_, stream_);
+
+            auto launch = [&](vector<Job>& fetch_jobs, int islot){
 
                 int infer_batch_size = fetch_jobs.size();
+                compactor.begin(islot);
                 if(dynamic_batch){
                     // 如果是动态batch，则修改当前推理的batch数量，能有效降低时间
                     input->resize_single_dim(0, infer_batch_size);
@@ -172,49 +185,57 @@ namespace RetinaFace{
                 }
 
                 // 模型推理
+                stage_event_begin(islot, InferStage::Forward, stream_);
                 engine->forward(false);
+                stage_event_end(islot, InferStage::Forward, stream_);
 
-                // 数据转到gpu为主，不需要复制
-                output_array_device.to_gpu(false);
+                stage_event_begin(islot, InferStage::Decode, stream_);
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
-                    auto& job                 = fetch_jobs[ibatch];
                     float* image_based_output = output->gpu<float>(ibatch);
-                    float* output_array_ptr   = output_array_device.gpu<float>(ibatch);
                     auto affine_matrix        = affin_matrix_device.gpu<float>(ibatch);
-                    checkCudaRuntime(cudaMemsetAsync(output_array_ptr, 0, sizeof(int), stream_));
                     decode_kernel_invoker(
                         image_based_output, 
-                        output->size(1), confidence_threshold_, 0.5f, affine_matrix, 
-                        output_array_ptr, MAX_IMAGE_BBOX, prior.gpu<float>(),
-                        stream_
+                        num_priors, confidence_threshold_, 0.5f, affine_matrix, 
+                        candidates, compactor.output(islot, ibatch), compactor.capacity(), prior.gpu<float>(),
+                        compactor.nms_workspace(), stream_, compactor.candidates(islot, ibatch)
                     );
                 }
+                stage_event_end(islot, InferStage::Decode, stream_);
+
+                // 异步复制每张图像的数量到cpu，不等待，由deliver同步
+                compactor.commit(islot, infer_batch_size);
+            };
+
+            auto deliver = [&](vector<Job>& fetch_jobs, int islot){
+
+                compactor.wait(islot);
 
-                // 数据转到cpu上，复制过来
-                output_array_device.to_cpu();
+                int infer_batch_size = fetch_jobs.size();
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
-                    float* parray = output_array_device.cpu<float>(ibatch);
-                    int count     = min(MAX_IMAGE_BBOX, (int)*parray);
+                    int count     = compactor.count(islot, ibatch);
+                    auto parray   = compactor.boxes(islot, ibatch);
                     auto& job     = fetch_jobs[ibatch];
                     auto& image_based_boxes   = job.output;
+                    image_based_boxes.reserve(count);
                     for(int i = 0; i < count; ++i){
-                        float* pbox = parray + 1 + i * NUM_BOX_ELEMENT;
-                        int label = pbox[5];
-                        if(label != -1){
-                            FaceBox box;
-                            box.left       = pbox[0];
-                            box.top        = pbox[1];
-                            box.right      = pbox[2];
-                            box.bottom     = pbox[3];
-                            box.confidence = pbox[4];
-                            memcpy(box.landmark, pbox + 6, sizeof(box.landmark));
-                            image_based_boxes.emplace_back(box);
-                        }
+                        const float* pbox = parray + i * NUM_BOX_ELEMENT;
+                        FaceBox box;
+                        box.left       = pbox[0];
+                        box.top        = pbox[1];
+                        box.right      = pbox[2];
+                        box.bottom     = pbox[3];
+                        box.confidence = pbox[4];
+                        memcpy(box.landmark, pbox + 6, sizeof(box.landmark));
+                        image_based_boxes.emplace_back(box);
                     }
-                    job.pro->set_value(image_based_boxes);
+                    job.set_value(image_based_boxes);
                 }
-                fetch_jobs.clear();
-            }
+
+                std::unique_lock<std::mutex> l(result_statistics_lock_);
+                result_statistics_ = compactor.statistics();
+            };
+
+            run_pipeline(max_batch_size, NUM_SLOTS, launch, deliver);
             INFOV("Engine destroy.");
         }
 
@@ -246,12 +267,21 @@ namespace RetinaFace{
             float*   affine_matrix_device = (float*)gpu_workspace;
             uint8_t* image_device         = size_matrix + gpu_workspace;
 
-            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_image);
+            // 页锁定且连续的输入直接异步拷贝到device，省掉到workspace的host到host拷贝
+            // 此时job持有输入的引用，保证拷贝完成之前数据不会被释放
+            bool zero_copy                = image.isContinuous() && CUDATools::is_pinned_memory(image.data);
+            size_t size_staging           = zero_copy ? 0 : size_image;
+            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_staging);
             float* affine_matrix_host     = (float*)cpu_workspace;
             uint8_t* image_host           = size_matrix + cpu_workspace;
 
-            checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
-            checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            if(zero_copy){
+                job.input = image;
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image.data, size_image, cudaMemcpyHostToDevice, stream_));
+            }else{
+                checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            }
             checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToHost, stream_));
             checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
 
@@ -264,6 +294,101 @@ namespace RetinaFace{
             return true;
         }
 
+        bool preprocess_yuv(Job& job, const YUVImage& image){
+            if(image.empty()){
+                INFOE("Empty yuv image");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+                tensor->set_workspace(make_shared<TRT::MixMemory>());
+            }
+
+            Size input_size(input_width_, input_height_);
+            job.additional.compute(Size(image.width, image.height), input_size);
+            
+            tensor->set_stream(stream_);
+            tensor->resize(1, 3, input_height_, input_width_);
+
+            // workspace的布局与BGR相同，矩阵之后是原样复制的YUV平面，device上的平面不复制
+            size_t size_planes     = image.device ? 0 : image.bytes();
+            size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
+            auto workspace         = tensor->get_workspace();
+            uint8_t* gpu_workspace        = (uint8_t*)workspace->gpu(size_matrix + size_planes);
+            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_planes);
+            float*   affine_matrix_device = (float*)gpu_workspace;
+            float*   affine_matrix_host   = (float*)cpu_workspace;
+
+            auto source = CUDAKernel::upload_yuv_image(image, size_matrix + gpu_workspace, size_matrix + cpu_workspace, stream_);
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToHost, stream_));
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
+
+            CUDAKernel::warp_affine_bilinear_and_normalize(
+                source, tensor->gpu<float>(), input_width_, input_height_, 
+                affine_matrix_device, 0, 
+                normalize_, stream_
+            );
+            return true;
+        }
+
+        // 共享帧在device上只有一份，workspace中只放矩阵
+        bool preprocess_frame(Job& job, const FrameHandle& frame){
+            if(frame == nullptr){
+                INFOE("Empty frame");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+                tensor->set_workspace(make_shared<TRT::MixMemory>());
+            }
+
+            Size input_size(input_width_, input_height_);
+            job.additional.compute(frame->size(), input_size);
+            
+            tensor->set_stream(stream_);
+            tensor->resize(1, 3, input_height_, input_width_);
+
+            size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
+            auto workspace         = tensor->get_workspace();
+            float* affine_matrix_device = (float*)workspace->gpu(size_matrix);
+            float* affine_matrix_host   = (float*)workspace->cpu(size_matrix);
+
+            auto source = frame->source(gpu_, stream_);
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToHost, stream_));
+            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
+
+            CUDAKernel::warp_affine_bilinear_and_normalize(
+                source, tensor->gpu<float>(), input_width_, input_height_, 
+                affine_matrix_device, 0, 
+                normalize_, stream_
+            );
+            return true;
+        }
+
+        virtual Completion<box_array> commit_async(const Mat& image, const JobOption& option) override{
+            return ControllerImpl::commit_async(image, option);
+        }
+
         virtual vector<shared_future<box_array>> commits(const vector<Mat>& images) override{
             return ControllerImpl::commits(images);
         }
@@ -272,18 +397,57 @@ namespace RetinaFace{
             return ControllerImpl::commit(image);
         }
 
+        virtual vector<shared_future<box_array>> commits(const vector<Mat>& images, const JobOption& option) override{
+            return ControllerImpl::commits(images, option);
+        }
+
+        virtual std::shared_future<box_array> commit(const Mat& image, const JobOption& option) override{
+            return ControllerImpl::commit(image, option);
+        }
+
+        virtual std::shared_future<box_array> commit(const YUVImage& image, const JobOption& option) override{
+            return ControllerImpl::commit_with(option, [&](Job& job){
+                return preprocess_yuv(job, image);
+            });
+        }
+
+        virtual std::shared_future<box_array> commit(const FrameHandle& frame, const JobOption& option) override{
+            return ControllerImpl::commit_with(option, [&](Job& job){
+                return preprocess_frame(job, frame);
+            });
+        }
+
+        virtual Completion<box_array> commit_async(const FrameHandle& frame, const JobOption& option) override{
+            return ControllerImpl::commit_async_with(option, [&](Job& job){
+                return preprocess_frame(job, frame);
+            });
+        }
+
+        virtual InferMetricsSnapshot metrics() override{
+            return ControllerImpl::metrics();
+        }
+
+        virtual ResultStatistics result_statistics() override{
+            std::unique_lock<std::mutex> l(result_statistics_lock_);
+            return result_statistics_;
+        }
+
     private:
         int input_width_            = 0;
         int input_height_           = 0;
         int gpu_                    = 0;
         float confidence_threshold_ = 0;
+        int max_objects_            = 1024;
+        OverflowPolicy overflow_policy_ = OverflowPolicy::KeepTopK;
+        std::mutex result_statistics_lock_;
+        ResultStatistics result_statistics_;
         TRT::CUStream stream_       = nullptr;
         CUDAKernel::Norm normalize_;
     };
 
-    shared_ptr<Infer> create_infer(const string& engine_file, int gpuid, float confidence_threshold){
+    shared_ptr<Infer> create_infer(const string& engine_file, int gpuid, float confidence_threshold, int max_objects, OverflowPolicy overflow_policy){
         shared_ptr<InferImpl> instance(new InferImpl());
-        if(!instance->startup(engine_file, gpuid, confidence_threshold)){
+        if(!instance->startup(engine_file, gpuid, confidence_threshold, max_objects, overflow_policy)){
             instance.reset();
         }
         return instance;
@@ -6,6 +6,12 @@
 #include <string>
 #include <future>
 #include <opencv2/opencv.hpp>
+#include <common/job_option.hpp>
+#include <common/yuv_image.hpp>
+#include <common/result_compactor.hpp>
+#include <common/completion.hpp>
+#include <common/shared_frame.hpp>
+#include <common/infer_metrics.hpp>
 
 namespace RetinaFace{
 
@@ -27,10 +33,32 @@ namespace RetinaFace{
     public:
         virtual shared_future<box_array> commit(const cv::Mat& image) = 0;
         virtual vector<shared_future<box_array>> commits(const vector<cv::Mat>& images) = 0;
+        virtual shared_future<box_array> commit(const cv::Mat& image, const JobOption& option) = 0;
+        virtual vector<shared_future<box_array>> commits(const vector<cv::Mat>& images, const JobOption& option) = 0;
+
+        // 直接提交解码器输出的NV12/I420，颜色转换与预处理在同一个kernel中完成
+        virtual shared_future<box_array> commit(const YUVImage& image, const JobOption& option = JobOption()) = 0;
+
+        // 不使用promise/future，可以poll、get、then，或者通过infer_coroutine.hpp中的co_commit等待
+        virtual Completion<box_array> commit_async(const cv::Mat& image, const JobOption& option = JobOption()) = 0;
+
+        // 与其他模型共享的帧，同一个device上只上传一次，见common/shared_frame.hpp
+        virtual shared_future<box_array> commit(const FrameHandle& frame, const JobOption& option = JobOption()) = 0;
+        virtual Completion<box_array> commit_async(const FrameHandle& frame, const JobOption& option = JobOption()) = 0;
+
+        // 结果回传的统计：交付的box数、超过max_objects被截断的图像数、实际复制的字节数等
+        virtual ResultStatistics result_statistics() = 0;
+
+        // 各阶段耗时、batch大小、队列深度的直方图，metrics().to_json()可以输出为JSON
+        virtual InferMetricsSnapshot metrics() = 0;
     };
 
     // RAII，如果创建失败，返回空指针
-    shared_ptr<Infer> create_infer(const string& engine_file, int gpuid, float confidence_threshold=0.5f);
+    // 每张图像最多max_objects个人脸，超过时按overflow_policy处理
+    shared_ptr<Infer> create_infer(
+        const string& engine_file, int gpuid, float confidence_threshold=0.5f,
+        int max_objects=1024, OverflowPolicy overflow_policy=OverflowPolicy::KeepTopK
+    );
 
 }; // namespace RetinaFace
 
@@ -1,6 +1,7 @@
 
 
 #include <common/cuda_tools.hpp>
+#include <common/nms_kernel.cuh>
 
 namespace RetinaFace{
 
@@ -16,25 +17,25 @@ namespace RetinaFace{
         return 1.0f / (1.0f + exp(-x));
     }
 
+    // 每个prior写一个候选框到candidates，不满足阈值的confidence为-1，之后交给topk_sort_nms，不需要原子操作
     static __global__ void decode_kernel(
-        float* predict, int num_bboxes, float deconfidence_threshold, float nms_threshold, 
-        float* invert_affine_matrix, float* parray, int max_objects, float* prior_array
+        float* predict, int num_bboxes, float deconfidence_threshold, 
+        float* invert_affine_matrix, float* candidates, float* prior_array
     ){  
         int position = blockDim.x * blockIdx.x + threadIdx.x;
 		if (position >= num_bboxes) return;
 
         float* pitem     = predict     + 16 * position;
+        float* pout_item = candidates  + position * NUM_BOX_ELEMENT;
 
         // cx, cy, w, h, neg_conf, pos_conf, landmark0.x, landmark0.y, landmark1.x, landmark1.y, landmark2.x, landmark2.y
         float neg_deconfidence = pitem[4];
         float pos_deconfidence = pitem[5];
         float object_deconfidence = (pos_deconfidence - neg_deconfidence);
-        if(object_deconfidence < deconfidence_threshold)
-            return;
-
-        int index = atomicAdd(parray, 1);
-        if(index >= max_objects)
+        if(object_deconfidence < deconfidence_threshold){
+            pout_item[4] = -1;
             return;
+        }
 
         float* prior     = prior_array + 4  * position;
         float cx         = prior[0] + pitem[0] * variances[0] * prior[2];
@@ -48,7 +49,6 @@ namespace RetinaFace{
         affine_project(invert_affine_matrix, left,  top,    &left,  &top);
         affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
 
-        float* pout_item = parray + 1 + index * NUM_BOX_ELEMENT;
         *pout_item++ = left;
         *pout_item++ = top;
         *pout_item++ = right;
@@ -66,71 +66,27 @@ namespace RetinaFace{
         }
     }
 
-    static __device__ float box_iou(
-        float aleft, float atop, float aright, float abottom, 
-        float bleft, float btop, float bright, float bbottom
-    ){
-
-        float cleft 	= max(aleft, bleft);
-        float ctop 		= max(atop, btop);
-        float cright 	= min(aright, bright);
-        float cbottom 	= min(abottom, bbottom);
-        
-        float c_area = max(cright - cleft, 0.0f) * max(cbottom - ctop, 0.0f);
-        if(c_area == 0.0f)
-            return 0.0f;
-        
-        float a_area = max(0.0f, aright - aleft) * max(0.0f, abottom - atop);
-        float b_area = max(0.0f, bright - bleft) * max(0.0f, bbottom - btop);
-        return c_area / (a_area + b_area - c_area);
-    }
-
-    static __global__ void nms_kernel(float* bboxes, int max_objects, float threshold){
-
-        int position = (blockDim.x * blockIdx.x + threadIdx.x);
-        int count = min((int)*bboxes, max_objects);
-        if (position >= count) 
-            return;
-        
-        float* pcurrent = bboxes + 1 + position * NUM_BOX_ELEMENT;
-        for(int i = 0; i < count; ++i){
-            float* pitem = bboxes + 1 + i * NUM_BOX_ELEMENT;
-            if(i == position || pcurrent[5] != pitem[5]) continue;
-
-            float iou = box_iou(
-                pcurrent[0], pcurrent[1], pcurrent[2], pcurrent[3],
-                   pitem[0],    pitem[1],    pitem[2],    pitem[3]
-            );
-
-            if(iou > threshold){
-                if(pitem[4] > pcurrent[4]){
-                    // 如果发现iou大，并且b > a，置信度。b是第i个框，a是当前框
-                    // 表示当前框要过滤掉，不需要保留了
-                    pcurrent[5] = -1;
-                    return;
-                }
-            }
-        }
-    }
-
     static float desigmoid(float x){
         return -log(1.0f / x - 1.0f);
     }
 
     void decode_kernel_invoker(
         float* predict, int num_bboxes, float confidence_threshold, float nms_threshold, 
-        float* invert_affine_matrix, float* parray, int max_objects, float* prior,
-        cudaStream_t stream
+        float* invert_affine_matrix, float* candidates, float* parray, int max_objects, float* prior,
+        void* nms_workspace, cudaStream_t stream, int* num_candidates
     ){
         auto grid = CUDATools::grid_dims(num_bboxes);
         auto block = CUDATools::block_dims(num_bboxes);
         checkCudaKernel(decode_kernel<<<grid, block, 0, stream>>>(
-            predict, num_bboxes, desigmoid(confidence_threshold), nms_threshold, 
-            invert_affine_matrix, parray, max_objects, prior
+            predict, num_bboxes, desigmoid(confidence_threshold),
+            invert_affine_matrix, candidates, prior
         ));
 
-        grid = CUDATools::grid_dims(max_objects);
-        block = CUDATools::block_dims(max_objects);
-        checkCudaKernel(nms_kernel<<<grid, block, 0, stream>>>(parray, max_objects, nms_threshold));
+        // 有效的confidence都大于0，label都为0，结果按置信度降序
+        CUDAKernel::topk_sort_nms(
+            candidates, num_bboxes, NUM_BOX_ELEMENT, max_objects,
+            nms_threshold, NMSMethod::ClassAware, 0.0f,
+            parray, nms_workspace, stream, num_candidates
+        );
     }
 };
\ No newline at end of file
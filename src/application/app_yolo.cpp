@@ -51,6 +51,24 @@ static const char* cocolabels[] = {
 
 bool requires(const char* name);
 
+// 模型内部各阶段的耗时分布，比外面包一层timestamp_now_float更能看出时间花在哪里
+static void dump_metrics(shared_ptr<Yolo::Infer> engine, const string& root){
+
+    auto metrics = engine->metrics();
+    for(int i = 0; i < (int)InferStage::NumStage; ++i){
+        auto& stage = metrics.stages[i];
+        INFO("%-14s count %lld, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+            infer_stage_name((InferStage)i), stage.count,
+            stage.mean() / 1000.0, stage.percentile(50) / 1000.0, stage.percentile(99) / 1000.0, stage.max / 1000.0
+        );
+    }
+    INFO("batch size mean %.2f, queue depth p99 %lld, %.2f jobs/s", metrics.batch_size.mean(), metrics.queue_depth.percentile(99), metrics.jobs_per_second());
+
+    string save_path = iLogger::format("%s/metrics.json", root.c_str());
+    iLogger::save_file(save_path, metrics.to_json().toStyledString());
+    INFO("Save metrics to %s", save_path.c_str());
+}
+
 static void forward_engine(const string& engine_file, Yolo::Type type){
 
     auto engine = Yolo::create_infer(engine_file, type, 0, 0.4f);
@@ -68,29 +86,35 @@ static void forward_engine(const string& engine_file, Yolo::Type type){
         auto image = cv::imread(files[i]);
 
         auto t0    = iLogger::timestamp_now_float();
-        auto boxes = engine->commit(image).get();
+        auto boxes = engine->commit_soa(image).get();
         float inference_time = iLogger::timestamp_now_float() - t0;
 
-        // 框给画到图上
-        for(auto& obj : boxes){
+        // 框给画到图上，直接读取结构数组
+        const float* left   = boxes->left();
+        const float* top    = boxes->top();
+        const float* right  = boxes->right();
+        const float* bottom = boxes->bottom();
+        const int* label    = boxes->label();
+        for(int j = 0; j < boxes->size(); ++j){
 
             // 使用根据类别计算的随机颜色填充
             uint8_t b, g, r;
-            tie(r, g, b) = iLogger::random_color(obj.class_label);
-            cv::rectangle(image, cv::Point(obj.left, obj.top), cv::Point(obj.right, obj.bottom), cv::Scalar(b, g, r), 5);
+            tie(r, g, b) = iLogger::random_color(label[j]);
+            cv::rectangle(image, cv::Point(left[j], top[j]), cv::Point(right[j], bottom[j]), cv::Scalar(b, g, r), 5);
 
             // 绘制类别名字
-            auto name = cocolabels[obj.class_label];
+            auto name = cocolabels[label[j]];
             int width = cv::getTextSize(name, 0, 1, 2, nullptr).width + 10;
-            cv::rectangle(image, cv::Point(obj.left-3, obj.top-33), cv::Point(obj.left + width, obj.top), cv::Scalar(b, g, r), -1);
-            cv::putText(image, iLogger::format("%s", name), cv::Point(obj.left, obj.top-5), 0, 1, cv::Scalar::all(0), 2, 16);
+            cv::rectangle(image, cv::Point(left[j]-3, top[j]-33), cv::Point(left[j] + width, top[j]), cv::Scalar(b, g, r), -1);
+            cv::putText(image, iLogger::format("%s", name), cv::Point(left[j], top[j]-5), 0, 1, cv::Scalar::all(0), 2, 16);
         }
 
         string file_name = iLogger::file_name(files[i], false);
         string save_path = iLogger::format("%s/%s.jpg", root.c_str(), file_name.c_str());
-        INFO("Save to %s, %d object, %.2f ms", save_path.c_str(), boxes.size(), inference_time);
+        INFO("Save to %s, %d object, %.2f ms", save_path.c_str(), boxes->size(), inference_time);
         cv::imwrite(save_path, image);
     }
+    dump_metrics(engine, root);
 }
 
 static void forward_engine_dynamic_batch(const string& engine_file, Yolo::Type type){
@@ -108,8 +132,11 @@ static void forward_engine_dynamic_batch(const string& engine_file, Yolo::Type t
     auto files = iLogger::find_files("inference", "*.jpg;*.jpeg;*.png;*.gif;*.tif");
     vector<cv::Mat> images;
     for(int i = 0; i < files.size(); ++i){
-        auto image = cv::imread(files[i]);
-        images.emplace_back(image);
+        // 放到页锁定内存中，commit时跳过预处理中host到host的拷贝
+        auto image  = cv::imread(files[i]);
+        auto pinned = TRT::create_pinned_mat(image.rows, image.cols, image.type());
+        image.copyTo(pinned);
+        images.emplace_back(pinned);
     }
 
     // warmup
@@ -147,6 +174,7 @@ static void forward_engine_dynamic_batch(const string& engine_file, Yolo::Type t
         INFO("Save to %s, %d object, average time %.2f ms", save_path.c_str(), boxes.size(), inference_average_time);
         cv::imwrite(save_path, image);
     }
+    dump_metrics(engine, root);
 }
 
 static void test_plugin(){
@@ -3,11 +3,16 @@
 #include <mutex>
 #include <queue>
 #include <condition_variable>
+#include <algorithm>
 #include <infer/trt_infer.hpp>
 #include <common/ilogger.hpp>
 #include <common/infer_controller.hpp>
 #include <common/preprocess_kernel.cuh>
+#include <common/nms_kernel.cuh>
+#include <common/result_compactor.hpp>
+#include "yolo_decode.hpp"
 #include <common/monopoly_allocator.hpp>
+#include <common/replica_pool.hpp>
 #include <common/cuda_tools.hpp>
 
 namespace Yolo{
@@ -18,21 +23,154 @@ namespace Yolo{
         switch(type){
         case Type::V5: return "YoloV5";
         case Type::X: return "YoloX";
+        case Type::V5Raw: return "YoloV5Raw";
+        case Type::XRaw: return "YoloXRaw";
         default: return "Unknow";
         }
     }
 
-    void decode_kernel_invoker(
-        float* predict, int num_bboxes, int num_classes, float confidence_threshold, 
-        float nms_threshold, float* invert_affine_matrix, float* parray,
-        int max_objects, cudaStream_t stream
-    );
+    // yolov5 P3-P5默认的anchor，按stride从小到大
+    static const float V5_ANCHORS[3][MAX_HEAD_ANCHORS][2] = {
+        {{10, 13},  {16, 30},   {33, 23}},
+        {{30, 61},  {62, 45},   {59, 119}},
+        {{116, 90}, {156, 198}, {373, 326}}
+    };
+
+    // 解码时每个head所在的输出tensor，以及在每张图像的输出中的偏移
+    struct HeadBinding{
+        shared_ptr<TRT::Tensor> tensor;
+        int offset = 0;
+
+        HeadBinding(const shared_ptr<TRT::Tensor>& tensor, int offset):tensor(tensor), offset(offset){}
+    };
+
+    // 根据模型的输出建立解码的head，输出的形状不符合type时返回false
+    static bool build_decode_heads(TRT::Infer* engine, Type type, int input_width, int input_height, DecodeParam& param, vector<HeadBinding>& bindings){
+
+        param     = DecodeParam();
+        bindings.clear();
+
+        if(type == Type::V5 || type == Type::X || type == Type::XRaw){
+            auto output = engine->tensor("output");
+            if(output == nullptr || output->ndims() != 3){
+                INFOE("Unsupport output for %s, expect [N, A, 5 + classes]", type_name(type));
+                return false;
+            }
+
+            int num_positions = output->size(1);
+            int num_element   = output->size(2);
+            param.type        = type == Type::XRaw ? HeadType::XRaw : HeadType::Decoded;
+            param.num_classes = num_element - 5;
+            if(type != Type::XRaw){
+                auto& head       = param.add_head();
+                head.width       = num_positions;
+                head.height      = 1;
+                head.cell_stride = num_element;
+                bindings.emplace_back(output, 0);
+                return true;
+            }
+
+            int strides[] = {8, 16, 32};
+            for(int stride : strides){
+                auto& head       = param.add_head();
+                head.width       = input_width / stride;
+                head.height      = input_height / stride;
+                head.stride      = stride;
+                head.cell_stride = num_element;
+                bindings.emplace_back(output, head.first_position * num_element);
+            }
+
+            if(param.num_positions() != num_positions){
+                INFOE("%s output has %d positions, but the input %dx%d expect %d", type_name(type), num_positions, input_width, input_height, param.num_positions());
+                return false;
+            }
+            return true;
+        }
+
+        if(type != Type::V5Raw){
+            INFOE("Unsupport type %d", type);
+            return false;
+        }
+
+        // 按head的大小从大到小，即stride从小到大，对应V5_ANCHORS
+        vector<shared_ptr<TRT::Tensor>> outputs;
+        for(int i = 0; i < engine->num_output(); ++i)
+            outputs.push_back(engine->output(i));
+
+        if(outputs.size() != 3){
+            INFOE("%s expect 3 outputs, but got %d", type_name(type), (int)outputs.size());
+            return false;
+        }
+
+        // 两种布局的H都在第2维
+        sort(outputs.begin(), outputs.end(), [](const shared_ptr<TRT::Tensor>& a, const shared_ptr<TRT::Tensor>& b){
+            return a->size(2) > b->size(2);
+        });
+
+        param.type = HeadType::V5Raw;
+        for(int i = 0; i < (int)outputs.size(); ++i){
+            auto& output = outputs[i];
+            auto& head   = param.add_head();
+            int num_classes = 0;
+            if(output->ndims() == 4){
+                // [N, na * (5 + classes), H, W]
+                head.num_anchors    = MAX_HEAD_ANCHORS;
+                head.height         = output->size(2);
+                head.width          = output->size(3);
+                num_classes         = output->size(1) / head.num_anchors - 5;
+                head.anchor_stride  = (5 + num_classes) * head.height * head.width;
+                head.cell_stride    = 1;
+                head.element_stride = head.height * head.width;
+            }else if(output->ndims() == 5){
+                // [N, na, H, W, 5 + classes]
+                head.num_anchors    = output->size(1);
+                head.height         = output->size(2);
+                head.width          = output->size(3);
+                num_classes         = output->size(4) - 5;
+                head.anchor_stride  = head.height * head.width * output->size(4);
+                head.cell_stride    = output->size(4);
+                head.element_stride = 1;
+            }
+
+            if(num_classes <= 0 || head.num_anchors != MAX_HEAD_ANCHORS || (i > 0 && num_classes != param.num_classes)){
+                INFOE("Unsupport output %s for %s", output->shape_string(), type_name(type));
+                return false;
+            }
+
+            param.num_classes = num_classes;
+            head.stride       = input_height / (float)head.height;
+            memcpy(head.anchors, V5_ANCHORS[i], sizeof(head.anchors));
+            bindings.emplace_back(output, 0);
+        }
+        return true;
+    }
+
+    // commit_soa的结果，由worker交付。任务被拒绝或丢弃时没有交付，析构时给出空的结果
+    struct SoAResult{
+        promise<BoxSoAHandle> pro;
+        bool delivered = false;
+
+        void deliver(const BoxSoAHandle& boxes){
+            pro.set_value(boxes);
+            delivered = true;
+        }
+
+        ~SoAResult(){
+            if(!delivered) pro.set_value(make_shared<BoxSoA>());
+        }
+    };
 
     // 因为图像需要进行预处理，这里采用仿射变换warpAffine进行处理，因此在这里计算仿射变换的矩阵
     struct AffineMatrix{
         float i2d[6];       // image to dst(network), 2x3 matrix
         float d2i[6];       // dst to image, 2x3 matrix
 
+        // 预处理时放到device上的图像，BGR或者YUV，worker中用于batch的仿射变换
+        CUDAKernel::WarpAffineSource source;
+
+        // 不为空时以结构数组交付到这里，不构造box_array
+        shared_ptr<SoAResult> soa;
+
         void compute(const cv::Size& from, const cv::Size& to){
             float scale_x = to.width / (float)from.width;
             float scale_y = to.height / (float)from.height;
@@ -92,6 +230,13 @@ namespace Yolo{
         }
     };
 
+    // 流水线中每个在途batch独占的输出缓冲区
+    // 输出缓冲区由ResultCompactor管理
+    struct OutputSlot{
+        // batch预处理的参数表，前面是每张图的d2i矩阵（解码时也使用），后面是每张图的WarpAffineSource
+        TRT::MixMemory warp_table;
+    };
+
     using ControllerImpl = InferController
     <
         Mat,                    // input
@@ -101,11 +246,19 @@ namespace Yolo{
     >;
     class InferImpl : public Infer, public ControllerImpl{
     public:
-        virtual bool startup(const string& file, Type type, int gpuid, float confidence_threshold){
+        // worker中run_pipeline的deliver会访问派生类的成员，需要在这些成员析构之前停止worker
+        virtual ~InferImpl(){
+            stop();
+        }
+
+        virtual bool startup(
+            const string& file, Type type, int gpuid, float confidence_threshold, float nms_threshold, NMSMethod nms_method,
+            int max_objects, OverflowPolicy overflow_policy
+        ){
 
-            if(type == Type::V5){
+            if(type == Type::V5 || type == Type::V5Raw){
                 normalize_ = CUDAKernel::Norm::alpha_beta(1 / 255.0f) + CUDAKernel::NormType::ToRGB;
-            }else if(type == Type::X){
+            }else if(type == Type::X || type == Type::XRaw){
                 float mean[] = {0.485, 0.456, 0.406};
                 float std[]  = {0.229, 0.224, 0.225};
                 normalize_ = CUDAKernel::Norm::mean_std(mean, std) + CUDAKernel::NormType::ToRGB;
@@ -113,7 +266,13 @@ namespace Yolo{
                 INFOE("Unsupport type %d", type);
             }
             
+            type_                 = type;
             confidence_threshold_ = confidence_threshold;
+            nms_threshold_        = nms_threshold;
+            nms_method_           = nms_method;
+            max_objects_          = max_objects;
+            overflow_policy_      = overflow_policy;
+            set_metrics_name(iLogger::file_name(file, false));
             return ControllerImpl::startup(make_tuple(file, gpuid));
         }
 
@@ -132,18 +291,22 @@ namespace Yolo{
 
             engine->print();
 
-            const int MAX_IMAGE_BBOX  = 1024;
-            const int NUM_BOX_ELEMENT = 6;      // left, top, right, bottom, confidence, class
-            TRT::Tensor affin_matrix_device(TRT::DataType::dtFloat);
-            TRT::Tensor output_array_device(TRT::DataType::dtFloat);
             int max_batch_size = engine->get_max_batch_size();
             auto input         = engine->tensor("images");
-            auto output        = engine->tensor("output");
             bool dynamic_batch = engine->is_dynamic_batch_dimension();
-            int num_classes    = output->size(2) - 5;
-
             input_width_       = input->size(3);
             input_height_      = input->size(2);
+
+            // 解码的head，每张图像只需要更新head的data
+            DecodeParam decode_param;
+            vector<HeadBinding> head_bindings;
+            if(!build_decode_heads(engine.get(), type_, input_width_, input_height_, decode_param, head_bindings)){
+                result.set_value(false);
+                return;
+            }
+            decode_param.confidence_threshold = confidence_threshold_;
+            int num_bboxes = decode_param.num_positions();
+
             tensor_allocator_  = make_shared<MonopolyAllocator<TRT::Tensor>>(max_batch_size * 2);
             stream_            = engine->get_stream();
             gpu_               = gpuid;
@@ -151,64 +314,113 @@ namespace Yolo{
 
             // 余弦分配好内存
             input->resize_single_dim(0, max_batch_size).to_gpu();
-            affin_matrix_device.set_stream(stream_);
 
-            // 这里8个值的目的是保证 8 * sizeof(float) % 32 == 0
-            affin_matrix_device.resize(max_batch_size, 8).to_gpu();
-
-            // 这里的 1 + MAX_IMAGE_BBOX结构是，counter + bboxes ...
-            output_array_device.resize(max_batch_size, 1 + MAX_IMAGE_BBOX * NUM_BOX_ELEMENT).to_gpu(); 
+            size_t size_matrices   = iLogger::upbound(max_batch_size * 6 * sizeof(float), 32);
+            size_t size_warp_table = size_matrices + max_batch_size * sizeof(CUDAKernel::WarpAffineSource);
+
+            // 解码的候选框（每个anchor一个），batch内的图像在stream上顺序使用，只需要一份
+            TRT::MixMemory decode_workspace;
+            float* candidates = (float*)decode_workspace.gpu(num_bboxes * NUM_BOX_ELEMENT * sizeof(float));
+
+            // 两套输出缓冲区，第k个batch推理时，交付第k-1个batch的结果
+            // 每张图像最多max_objects_个box，但只把实际的数量和box复制回host
+            const int NUM_SLOTS = 2;
+            OutputSlot slots[NUM_SLOTS];
+            ResultCompactor compactor(NUM_SLOTS, max_batch_size, NUM_BOX_ELEMENT, max_objects_, overflow_policy_, stream_);
+            for(auto& slot : slots){
+                slot.warp_table.cpu(size_warp_table);
+                slot.warp_table.gpu(size_warp_table);
+            }
 
-            vector<Job> fetch_jobs;
-            while(get_jobs_and_wait(fetch_jobs, max_batch_size)){
+            auto launch = [&](vector<Job>& fetch_jobs, int islot){
 
+                auto& slot           = slots[islot];
                 int infer_batch_size = fetch_jobs.size();
+                compactor.begin(islot);
                 if(dynamic_batch){
                     // 如果是动态batch，则修改当前推理的batch数量，能有效降低时间
                     input->resize_single_dim(0, infer_batch_size);
                 }
 
+                // 整个batch的参数表一次复制到device，一次launch完成所有图像的预处理，直接写到input
+                float* matrices_host  = (float*)slot.warp_table.cpu();
+                auto sources_host     = (CUDAKernel::WarpAffineSource*)((uint8_t*)matrices_host + size_matrices);
+                float* matrices_device = (float*)slot.warp_table.gpu();
+                auto sources_device   = (CUDAKernel::WarpAffineSource*)((uint8_t*)matrices_device + size_matrices);
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
-                    auto& job  = fetch_jobs[ibatch];
-                    auto& mono = job.mono_tensor->data();
-                    affin_matrix_device.copy_from_gpu(affin_matrix_device.offset(ibatch), mono->get_workspace()->gpu(), 6);
-                    input->copy_from_gpu(input->offset(ibatch), mono->gpu(), mono->count());
-                    job.mono_tensor->release();
+                    auto& job             = fetch_jobs[ibatch];
+                    sources_host[ibatch]  = job.additional.source;
+                    memcpy(matrices_host + ibatch * 6, job.additional.d2i, sizeof(job.additional.d2i));
                 }
 
+                checkCudaRuntime(cudaMemcpyAsync(matrices_device, matrices_host, size_warp_table, cudaMemcpyHostToDevice, stream_));
+                CUDAKernel::warp_affine_bilinear_and_normalize_batch(
+                    sources_device, matrices_device, infer_batch_size,
+                    input->gpu<float>(), input_width_, input_height_,
+                    114, normalize_, stream_
+                );
+
+                // 后续使用workspace的拷贝与kernel在同一个stream上，所以这里可以直接归还
+                for(auto& job : fetch_jobs)
+                    job.mono_tensor->release();
+
                 // 模型推理
+                stage_event_begin(islot, InferStage::Forward, stream_);
                 engine->forward(false);
+                stage_event_end(islot, InferStage::Forward, stream_);
 
-                // 数据转到gpu为主，不需要复制
-                output_array_device.to_gpu(false);
+                stage_event_begin(islot, InferStage::Decode, stream_);
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
                     
-                    auto& job                 = fetch_jobs[ibatch];
-                    float* image_based_output = output->gpu<float>(ibatch);
-                    float* output_array_ptr   = output_array_device.gpu<float>(ibatch);
-                    auto affine_matrix        = affin_matrix_device.gpu<float>(ibatch);
-                    checkCudaRuntime(cudaMemsetAsync(output_array_ptr, 0, sizeof(int), stream_));
-                    decode_kernel_invoker(image_based_output, output->size(1), num_classes, confidence_threshold_, 0.5f, affine_matrix, output_array_ptr, MAX_IMAGE_BBOX, stream_);
+                    for(int ihead = 0; ihead < decode_param.num_heads; ++ihead){
+                        auto& binding = head_bindings[ihead];
+                        decode_param.heads[ihead].data = binding.tensor->gpu<float>(ibatch) + binding.offset;
+                    }
+
+                    auto affine_matrix = matrices_device + ibatch * 6;
+                    decode_kernel_invoker(
+                        decode_param, affine_matrix, nms_threshold_, nms_method_, 
+                        candidates, compactor.output(islot, ibatch), compactor.capacity(), 
+                        compactor.nms_workspace(), stream_, compactor.candidates(islot, ibatch)
+                    );
                 }
+                stage_event_end(islot, InferStage::Decode, stream_);
+
+                // 异步复制每张图像的数量到cpu，不等待，由deliver同步
+                compactor.commit(islot, infer_batch_size);
+            };
+
+            auto deliver = [&](vector<Job>& fetch_jobs, int islot){
+
+                compactor.wait(islot);
 
-                // 数据转到cpu上，复制过来
-                output_array_device.to_cpu();
+                int infer_batch_size = fetch_jobs.size();
                 for(int ibatch = 0; ibatch < infer_batch_size; ++ibatch){
-                    float* parray = output_array_device.cpu<float>(ibatch);
-                    int count     = min(MAX_IMAGE_BBOX, (int)*parray);
+                    int count     = compactor.count(islot, ibatch);
+                    auto parray   = compactor.boxes(islot, ibatch);
                     auto& job     = fetch_jobs[ibatch];
+                    if(job.additional.soa){
+                        auto boxes = soa_pool_->query(count);
+                        boxes->assign(parray, count, NUM_BOX_ELEMENT);
+                        job.additional.soa->deliver(boxes);
+                        job.set_value(job.output);
+                        continue;
+                    }
+
                     auto& image_based_boxes   = job.output;
+                    image_based_boxes.reserve(count);
                     for(int i = 0; i < count; ++i){
-                        float* pbox = parray + 1 + i * NUM_BOX_ELEMENT;
-                        int label = pbox[5];
-                        if(label != -1){
-                            image_based_boxes.emplace_back(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], label);
-                        }
+                        const float* pbox = parray + i * NUM_BOX_ELEMENT;
+                        image_based_boxes.emplace_back(pbox[0], pbox[1], pbox[2], pbox[3], pbox[4], (int)pbox[5]);
                     }
-                    job.pro->set_value(image_based_boxes);
+                    job.set_value(image_based_boxes);
                 }
-                fetch_jobs.clear();
-            }
+
+                std::unique_lock<std::mutex> l(result_statistics_lock_);
+                result_statistics_ = compactor.statistics();
+            };
+
+            run_pipeline(max_batch_size, NUM_SLOTS, launch, deliver);
             INFOV("Engine destroy.");
         }
 
@@ -224,37 +436,81 @@ namespace Yolo{
             if(tensor == nullptr){
                 // not init
                 tensor = make_shared<TRT::Tensor>();
-                tensor->set_workspace(make_shared<TRT::MixMemory>());
+
+                // 每次都由上传的图像完整覆盖，不需要清零
+                auto workspace = make_shared<TRT::MixMemory>();
+                workspace->set_zero_fill(false);
+                tensor->set_workspace(workspace);
             }
 
             Size input_size(input_width_, input_height_);
             job.additional.compute(image.size(), input_size);
             
             tensor->set_stream(stream_);
-            tensor->resize(1, 3, input_height_, input_width_);
 
+            // 这里只把图像复制到device，仿射变换在worker中对整个batch一次完成
             size_t size_image      = image.cols * image.rows * 3;
-            size_t size_matrix     = iLogger::upbound(sizeof(job.additional.d2i), 32);
             auto workspace         = tensor->get_workspace();
-            uint8_t* gpu_workspace        = (uint8_t*)workspace->gpu(size_matrix + size_image);
-            float*   affine_matrix_device = (float*)gpu_workspace;
-            uint8_t* image_device         = size_matrix + gpu_workspace;
-
-            uint8_t* cpu_workspace        = (uint8_t*)workspace->cpu(size_matrix + size_image);
-            float* affine_matrix_host     = (float*)cpu_workspace;
-            uint8_t* image_host           = size_matrix + cpu_workspace;
-
-            checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
-            checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
-            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_host, job.additional.d2i, sizeof(job.additional.d2i), cudaMemcpyHostToHost, stream_));
-            checkCudaRuntime(cudaMemcpyAsync(affine_matrix_device, affine_matrix_host, sizeof(job.additional.d2i), cudaMemcpyHostToDevice, stream_));
-
-            CUDAKernel::warp_affine_bilinear_and_normalize(
-                image_device,         image.cols * 3,       image.cols,       image.rows, 
-                tensor->gpu<float>(), input_width_,         input_height_, 
-                affine_matrix_device, 114, 
-                normalize_, stream_
-            );
+            uint8_t* image_device  = (uint8_t*)workspace->gpu(size_image);
+
+            // 页锁定且连续的输入直接异步拷贝到device，省掉到workspace的host到host拷贝
+            // 此时job持有输入的引用，保证拷贝完成之前数据不会被释放
+            bool zero_copy = image.isContinuous() && CUDATools::is_pinned_memory(image.data);
+            if(zero_copy){
+                job.input = image;
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image.data, size_image, cudaMemcpyHostToDevice, stream_));
+            }else{
+                uint8_t* image_host = (uint8_t*)workspace->cpu(size_image);
+                checkCudaRuntime(cudaMemcpyAsync(image_host,   image.data, size_image, cudaMemcpyHostToHost,   stream_));
+                checkCudaRuntime(cudaMemcpyAsync(image_device, image_host, size_image, cudaMemcpyHostToDevice, stream_));
+            }
+
+            auto& source     = job.additional.source;
+            source           = CUDAKernel::WarpAffineSource();
+            source.data      = image_device;
+            source.line_size = image.cols * 3;
+            source.width     = image.cols;
+            source.height    = image.rows;
+            return true;
+        }
+
+        bool preprocess_yuv(Job& job, const YUVImage& image){
+            if(image.empty()){
+                INFOE("Empty yuv image");
+                return false;
+            }
+
+            job.mono_tensor = tensor_allocator_->query();
+            if(job.mono_tensor == nullptr){
+                INFOE("Tensor allocator query failed.");
+                return false;
+            }
+
+            CUDATools::AutoDevice auto_device(gpu_);
+            auto& tensor = job.mono_tensor->data();
+            if(tensor == nullptr){
+                // not init
+                tensor = make_shared<TRT::Tensor>();
+
+                // 每次都由上传的图像完整覆盖，不需要清零
+                auto workspace = make_shared<TRT::MixMemory>();
+                workspace->set_zero_fill(false);
+                tensor->set_workspace(workspace);
+            }
+
+            Size input_size(input_width_, input_height_);
+            job.additional.compute(Size(image.width, image.height), input_size);
+            tensor->set_stream(stream_);
+
+            // 平面原样复制到device，颜色转换在worker中与仿射变换一起完成
+            uint8_t* device_workspace = nullptr;
+            uint8_t* host_workspace   = nullptr;
+            if(!image.device){
+                auto workspace   = tensor->get_workspace();
+                device_workspace = (uint8_t*)workspace->gpu(image.bytes());
+                host_workspace   = (uint8_t*)workspace->cpu(image.bytes());
+            }
+            job.additional.source = CUDAKernel::upload_yuv_image(image, device_workspace, host_workspace, stream_);
             return true;
         }
 
@@ -266,18 +522,134 @@ namespace Yolo{
             return ControllerImpl::commit(image);
         }
 
+        virtual Completion<box_array> commit_async(const Mat& image) override{
+            return ControllerImpl::commit_async(image);
+        }
+
+        virtual shared_future<BoxSoAHandle> commit_soa(const Mat& image) override{
+            auto soa = make_shared<SoAResult>();
+            shared_future<BoxSoAHandle> future = soa->pro.get_future();
+            ControllerImpl::commit_with(JobOption(), [&](Job& job){
+                job.additional.soa = soa;
+                return preprocess(job, image);
+            });
+            return future;
+        }
+
+        virtual InferMetricsSnapshot metrics() override{
+            return ControllerImpl::metrics();
+        }
+
+        virtual ResultStatistics result_statistics() override{
+            std::unique_lock<std::mutex> l(result_statistics_lock_);
+            return result_statistics_;
+        }
+
+        virtual std::shared_future<box_array> commit(const YUVImage& image) override{
+            return ControllerImpl::commit_with(JobOption(), [&](Job& job){
+                return preprocess_yuv(job, image);
+            });
+        }
+
     private:
         int input_width_            = 0;
         int input_height_           = 0;
         int gpu_                    = 0;
+        Type type_                  = Type::V5;
         float confidence_threshold_ = 0;
+        float nms_threshold_        = 0;
+        NMSMethod nms_method_       = NMSMethod::ClassAware;
+        int max_objects_            = 1024;
+        OverflowPolicy overflow_policy_ = OverflowPolicy::KeepTopK;
+        std::mutex result_statistics_lock_;
+        ResultStatistics result_statistics_;
+        shared_ptr<BoxSoAPool> soa_pool_ = BoxSoAPool::create();
         TRT::CUStream stream_       = nullptr;
         CUDAKernel::Norm normalize_;
     };
 
-    shared_ptr<Infer> create_infer(const string& engine_file, Type type, int gpuid, float confidence_threshold){
+    shared_ptr<Infer> create_infer(
+        const string& engine_file, Type type, int gpuid, float confidence_threshold, float nms_threshold, NMSMethod nms_method,
+        int max_objects, OverflowPolicy overflow_policy
+    ){
         shared_ptr<InferImpl> instance(new InferImpl());
-        if(!instance->startup(engine_file, type, gpuid, confidence_threshold)){
+        if(!instance->startup(engine_file, type, gpuid, confidence_threshold, nms_threshold, nms_method, max_objects, overflow_policy)){
+            instance.reset();
+        }
+        return instance;
+    }
+
+    class InferPoolImpl : public Infer{
+    public:
+        InferPoolImpl():pool_([](InferImpl* replica){return replica->pending_jobs();}){}
+
+        bool startup(
+            const string& file, Type type, const vector<int>& gpuids, int replicas_per_device, 
+            float confidence_threshold, float nms_threshold, NMSMethod nms_method, int max_objects, OverflowPolicy overflow_policy
+        ){
+
+            for(int gpuid : gpuids){
+                for(int i = 0; i < replicas_per_device; ++i){
+                    shared_ptr<InferImpl> replica(new InferImpl());
+                    if(!replica->startup(file, type, gpuid, confidence_threshold, nms_threshold, nms_method, max_objects, overflow_policy)){
+                        INFOE("Replica %d on device %d startup failed", i, gpuid);
+                        return false;
+                    }
+                    pool_.add(replica, gpuid);
+                }
+            }
+            return !pool_.empty();
+        }
+
+        virtual vector<shared_future<box_array>> commits(const vector<Mat>& images) override{
+            // 一组图像交给同一个副本，保持batch
+            return pool_.dispatch()->commits(images);
+        }
+
+        virtual std::shared_future<box_array> commit(const Mat& image) override{
+            return pool_.dispatch()->commit(image);
+        }
+
+        virtual std::shared_future<box_array> commit(const YUVImage& image) override{
+            return pool_.dispatch()->commit(image);
+        }
+
+        virtual shared_future<BoxSoAHandle> commit_soa(const Mat& image) override{
+            return pool_.dispatch()->commit_soa(image);
+        }
+
+        virtual Completion<box_array> commit_async(const Mat& image) override{
+            return pool_.dispatch()->commit_async(image);
+        }
+
+        virtual ResultStatistics result_statistics() override{
+            ResultStatistics output;
+            for(int i = 0; i < (int)pool_.size(); ++i)
+                output.merge(pool_.replica(i)->result_statistics());
+            return output;
+        }
+
+        // 所有副本合并为一个直方图
+        virtual InferMetricsSnapshot metrics() override{
+            InferMetricsSnapshot output;
+            for(int i = 0; i < (int)pool_.size(); ++i){
+                auto replica = pool_.replica(i)->metrics();
+                output.name  = replica.name;
+                output.merge(replica);
+            }
+            return output;
+        }
+
+    private:
+        ReplicaPool<InferImpl> pool_;
+    };
+
+    shared_ptr<Infer> create_infer_pool(
+        const string& engine_file, Type type, const vector<int>& gpuids, int replicas_per_device, 
+        float confidence_threshold, float nms_threshold, NMSMethod nms_method, int max_objects, OverflowPolicy overflow_policy
+    ){
+        shared_ptr<InferPoolImpl> instance(new InferPoolImpl());
+        if(!instance->startup(engine_file, type, gpuids, replicas_per_device, confidence_threshold, nms_threshold, nms_method, max_objects, overflow_policy)){
             instance.reset();
         }
         return instance;
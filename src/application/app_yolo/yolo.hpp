@@ -6,18 +6,30 @@
 #include <string>
 #include <future>
 #include <opencv2/opencv.hpp>
+#include <common/yuv_image.hpp>
+#include <common/box_nms.hpp>
+#include <common/result_compactor.hpp>
+#include <common/box_soa.hpp>
+#include <common/completion.hpp>
+#include <common/infer_metrics.hpp>
 
 /**
  * @brief 发挥极致的性能体验
- * 支持YoloX和YoloV5
+ * 支持YoloX和YoloV5，以及两者不带后处理导出的模型
  */
 namespace Yolo{
 
     using namespace std;
 
     enum class Type : int{
-        V5 = 0,
-        X  = 1
+        V5    = 0,
+        X     = 1,
+
+        // 导出时不带后处理的模型，sigmoid、grid、anchor在解码kernel中完成，引擎中少了concat、sigmoid等层
+        // V5Raw: Detect的三个卷积输出直接作为模型输出，[N, 3 * (5 + classes), H, W]或[N, 3, H, W, 5 + classes]，使用默认的anchor
+        // XRaw:  decode_in_inference = False，输出[N, A, 5 + classes]，A为stride 8、16、32的cell总数
+        V5Raw = 2,
+        XRaw  = 3
     };    
 
     struct ObjectBox{
@@ -37,10 +49,40 @@ namespace Yolo{
     public:
         virtual shared_future<box_array> commit(const cv::Mat& image) = 0;
         virtual vector<shared_future<box_array>> commits(const vector<cv::Mat>& images) = 0;
+
+        // 直接提交解码器输出的NV12/I420，颜色转换与预处理在同一个kernel中完成
+        virtual shared_future<box_array> commit(const YUVImage& image) = 0;
+
+        // 结构数组形式的结果，存储来自内部的池，跟踪、绘制直接读取，最后一个引用释放时归还
+        virtual shared_future<BoxSoAHandle> commit_soa(const cv::Mat& image) = 0;
+
+        // 不使用promise/future，可以poll、get或者then注册回调（在worker线程上调用）
+        virtual Completion<box_array> commit_async(const cv::Mat& image) = 0;
+
+        // 结果回传的统计：交付的box数、超过max_objects被截断的图像数、实际复制的字节数等
+        virtual ResultStatistics result_statistics() = 0;
+
+        // 各阶段耗时、batch大小、队列深度的直方图，metrics().to_json()可以输出为JSON，副本池为所有副本的合并
+        virtual InferMetricsSnapshot metrics() = 0;
     };
 
     // RAII，如果创建失败，返回空指针
-    shared_ptr<Infer> create_infer(const string& engine_file, Type type, int gpuid, float confidence_threshold=0.25f);
+    // 解码后按置信度取前max_objects个框排序，再按nms_method做NMS，结果按置信度降序
+    // 超过max_objects的候选框按overflow_policy处理，并计入result_statistics
+    shared_ptr<Infer> create_infer(
+        const string& engine_file, Type type, int gpuid, float confidence_threshold=0.25f, 
+        float nms_threshold=0.5f, NMSMethod nms_method=NMSMethod::ClassAware,
+        int max_objects=1024, OverflowPolicy overflow_policy=OverflowPolicy::KeepTopK
+    );
+
+    // 副本池，每个gpuid上创建replicas_per_device个副本（各自独立的worker和执行上下文），
+    // 每次commit分发给负载最小的副本。gpuid可以重复出现，用于给某个设备更多的副本
+    // 任何一个副本创建失败，返回空指针
+    shared_ptr<Infer> create_infer_pool(
+        const string& engine_file, Type type, const vector<int>& gpuids, int replicas_per_device=2, 
+        float confidence_threshold=0.25f, float nms_threshold=0.5f, NMSMethod nms_method=NMSMethod::ClassAware,
+        int max_objects=1024, OverflowPolicy overflow_policy=OverflowPolicy::KeepTopK
+    );
     const char* type_name(Type type);
 
 }; // namespace Yolo
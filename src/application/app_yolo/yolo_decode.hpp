@@ -0,0 +1,238 @@
+#ifndef YOLO_DECODE_HPP
+#define YOLO_DECODE_HPP
+
+#include <string.h>
+#include <math.h>
+#include <common/cuda_tools.hpp>
+#include <common/box_nms.hpp>
+
+#ifdef __CUDACC__
+#define YOLO_DECODE_HOST_DEVICE __host__ __device__
+#else
+#define YOLO_DECODE_HOST_DEVICE
+#endif
+
+/**
+ * @brief yolo输出的解码，一个或多个head，每个anchor位置解码为一个候选框（left, top, right, bottom, confidence, label）
+ * 不满足阈值的候选框confidence为-1，之后交给topk_sort_nms
+ * 解码的计算在host和device上共用，并且不使用fma、使用相同的exp实现，因此CPU与GPU的结果逐位一致
+ */
+namespace Yolo{
+
+    const int NUM_BOX_ELEMENT  = 6;      // left, top, right, bottom, confidence, class
+    const int MAX_DECODE_HEADS = 4;
+    const int MAX_HEAD_ANCHORS = 3;
+
+    enum class HeadType : int{
+        Decoded = 0,    // 导出时已经包含后处理：cx, cy, width, height, objectness, classes...，都是最终的值
+        V5Raw   = 1,    // yolov5 Detect的卷积输出，都是logits，需要sigmoid，中心点与宽高由grid、anchor计算
+        XRaw    = 2     // yolox不带decode的输出，objectness、classes已经sigmoid，中心点与宽高由grid、stride计算
+    };
+
+    /**
+     * 一个head的布局，第a个anchor、第(y, x)个cell的第k个值位于
+     *   data[a * anchor_stride + (y * width + x) * cell_stride + k * element_stride]
+     * 例如卷积输出[na * (5 + classes), H, W]：anchor_stride = (5 + classes) * H * W, cell_stride = 1, element_stride = H * W
+     * 以及[na, H, W, 5 + classes]、[H * W, 5 + classes]：element_stride = 1
+     */
+    struct DecodeHead{
+        const float* data = nullptr;    // 当前图像的head
+        int width         = 0;
+        int height        = 0;
+        int num_anchors   = 1;
+        float stride      = 1;
+        float anchors[MAX_HEAD_ANCHORS][2] = {{0}};     // V5Raw的anchor宽高（输入图像上的像素）
+        int anchor_stride  = 0;
+        int cell_stride    = 0;
+        int element_stride = 1;
+        int first_position = 0;         // 在候选框中的起始位置
+
+        YOLO_DECODE_HOST_DEVICE int num_positions() const{return num_anchors * width * height;}
+    };
+
+    struct DecodeParam{
+        HeadType type              = HeadType::Decoded;
+        int num_heads              = 0;
+        int num_classes            = 0;
+        float confidence_threshold = 0.25f;
+        DecodeHead heads[MAX_DECODE_HEADS];
+
+        // 添加一个head，first_position接在前一个head之后
+        DecodeHead& add_head(){
+            DecodeHead& head    = heads[num_heads];
+            head.first_position = num_positions();
+            num_heads++;
+            return head;
+        }
+
+        // 候选框的总数
+        YOLO_DECODE_HOST_DEVICE int num_positions() const{
+            return num_heads == 0 ? 0 : heads[num_heads - 1].first_position + heads[num_heads - 1].num_positions();
+        }
+    };
+
+    // device上显式使用_rn，避免nvcc合并为fma
+    YOLO_DECODE_HOST_DEVICE inline float decode_mul(float a, float b){
+#ifdef __CUDA_ARCH__
+        return __fmul_rn(a, b);
+#else
+        return a * b;
+#endif
+    }
+
+    YOLO_DECODE_HOST_DEVICE inline float decode_add(float a, float b){
+#ifdef __CUDA_ARCH__
+        return __fadd_rn(a, b);
+#else
+        return a + b;
+#endif
+    }
+
+    YOLO_DECODE_HOST_DEVICE inline float decode_div(float a, float b){
+#ifdef __CUDA_ARCH__
+        return __fdiv_rn(a, b);
+#else
+        return a / b;
+#endif
+    }
+
+    // 2^k，k在[-126, 127]
+    YOLO_DECODE_HOST_DEVICE inline float decode_exp2i(int k){
+        int bits = (k + 127) << 23;
+#ifdef __CUDA_ARCH__
+        return __int_as_float(bits);
+#else
+        float output;
+        memcpy(&output, &bits, sizeof(output));
+        return output;
+#endif
+    }
+
+    // exp(x) = 2^k * exp(r)，|r| <= ln2 / 2，多项式为cephes的expf，误差在2ulp以内
+    // 不使用expf，因为host与device的expf结果不同
+    YOLO_DECODE_HOST_DEVICE inline float decode_exp(float x){
+        x       = fminf(fmaxf(x, -87.0f), 88.0f);
+        float k = rintf(decode_mul(x, 1.44269504088896341f));
+        float r = decode_add(decode_add(x, -decode_mul(k, 0.693359375f)), decode_mul(k, 2.12194440e-4f));
+
+        float p = 1.9875691500e-4f;
+        p = decode_add(decode_mul(p, r), 1.3981999507e-3f);
+        p = decode_add(decode_mul(p, r), 8.3334519073e-3f);
+        p = decode_add(decode_mul(p, r), 4.1665795894e-2f);
+        p = decode_add(decode_mul(p, r), 1.6666665459e-1f);
+        p = decode_add(decode_mul(p, r), 5.0000001201e-1f);
+        p = decode_add(decode_add(decode_mul(decode_mul(p, r), r), r), 1.0f);
+        return decode_mul(p, decode_exp2i((int)k));
+    }
+
+    YOLO_DECODE_HOST_DEVICE inline float decode_sigmoid(float x){
+        return decode_div(1.0f, decode_add(1.0f, decode_exp(-x)));
+    }
+
+    YOLO_DECODE_HOST_DEVICE inline void decode_affine_project(const float* matrix, float x, float y, float* ox, float* oy){
+        *ox = decode_add(decode_add(decode_mul(matrix[0], x), decode_mul(matrix[1], y)), matrix[2]);
+        *oy = decode_add(decode_add(decode_mul(matrix[3], x), decode_mul(matrix[4], y)), matrix[5]);
+    }
+
+    // 解码第position个候选框到pout，invert_affine_matrix把输入图像的坐标映射回原图
+    YOLO_DECODE_HOST_DEVICE inline void decode_position(const DecodeParam& param, int position, const float* invert_affine_matrix, float* pout){
+
+        int ihead = 0;
+        while(ihead + 1 < param.num_heads && position >= param.heads[ihead + 1].first_position)
+            ihead++;
+
+        const DecodeHead& head = param.heads[ihead];
+        int local   = position - head.first_position;
+        int area    = head.width * head.height;
+        int anchor  = local / area;
+        int cell    = local - anchor * area;
+        int gy      = cell / head.width;
+        int gx      = cell - gy * head.width;
+        int es      = head.element_stride;
+        const float* pitem = head.data + anchor * head.anchor_stride + cell * head.cell_stride;
+
+        // objectness不满足时不读取类别，大部分cell在这里结束
+        float objectness = pitem[4 * es];
+        if(param.type == HeadType::V5Raw)
+            objectness = decode_sigmoid(objectness);
+
+        if(objectness < param.confidence_threshold){
+            pout[4] = -1;
+            return;
+        }
+
+        // V5Raw比较logits，sigmoid单调，只需要对最大的一个计算
+        const float* class_confidence = pitem + 5 * es;
+        float confidence = *class_confidence;
+        int label        = 0;
+        for(int i = 1; i < param.num_classes; ++i){
+            class_confidence += es;
+            if(*class_confidence > confidence){
+                confidence = *class_confidence;
+                label      = i;
+            }
+        }
+
+        if(param.type == HeadType::V5Raw)
+            confidence = decode_sigmoid(confidence);
+
+        confidence = decode_mul(confidence, objectness);
+        if(confidence < param.confidence_threshold){
+            pout[4] = -1;
+            return;
+        }
+
+        float cx     = pitem[0];
+        float cy     = pitem[es];
+        float width  = pitem[2 * es];
+        float height = pitem[3 * es];
+        if(param.type == HeadType::V5Raw){
+            // xy = (sigmoid * 2 - 0.5 + grid) * stride, wh = (sigmoid * 2)^2 * anchor
+            cx     = decode_mul(decode_add(decode_add(decode_mul(decode_sigmoid(cx), 2.0f), -0.5f), (float)gx), head.stride);
+            cy     = decode_mul(decode_add(decode_add(decode_mul(decode_sigmoid(cy), 2.0f), -0.5f), (float)gy), head.stride);
+            width  = decode_mul(decode_sigmoid(width), 2.0f);
+            height = decode_mul(decode_sigmoid(height), 2.0f);
+            width  = decode_mul(decode_mul(width, width), head.anchors[anchor][0]);
+            height = decode_mul(decode_mul(height, height), head.anchors[anchor][1]);
+        }else if(param.type == HeadType::XRaw){
+            // xy = (reg + grid) * stride, wh = exp(reg) * stride
+            cx     = decode_mul(decode_add(cx, (float)gx), head.stride);
+            cy     = decode_mul(decode_add(cy, (float)gy), head.stride);
+            width  = decode_mul(decode_exp(width), head.stride);
+            height = decode_mul(decode_exp(height), head.stride);
+        }
+
+        float half_width  = decode_mul(width, 0.5f);
+        float half_height = decode_mul(height, 0.5f);
+        float left   = decode_add(cx, -half_width);
+        float top    = decode_add(cy, -half_height);
+        float right  = decode_add(cx, half_width);
+        float bottom = decode_add(cy, half_height);
+        decode_affine_project(invert_affine_matrix, left,  top,    &left,  &top);
+        decode_affine_project(invert_affine_matrix, right, bottom, &right, &bottom);
+
+        pout[0] = left;
+        pout[1] = top;
+        pout[2] = right;
+        pout[3] = bottom;
+        pout[4] = confidence;
+        pout[5] = label;
+    }
+
+    /**
+     * @brief 解码全部head到candidates（param.num_positions()个候选框），然后top-K + 排序 + NMS，
+     * 结果写到parray：count + 按置信度降序的box。param中head的data、invert_affine_matrix都是device指针
+     * num_candidates为device指针，写入NMS之前满足阈值的候选框数量
+     */
+    void decode_kernel_invoker(
+        const DecodeParam& param, float* invert_affine_matrix,
+        float nms_threshold, NMSMethod nms_method,
+        float* candidates, float* parray, int max_objects, void* nms_workspace, cudaStream_t stream,
+        int* num_candidates = nullptr
+    );
+
+    // decode_kernel_invoker中解码部分的CPU实现，指针都是host内存
+    void decode_cpu(const DecodeParam& param, const float* invert_affine_matrix, float* candidates);
+};
+
+#endif // YOLO_DECODE_HPP
@@ -0,0 +1,12 @@
+
+#include "yolo_decode.hpp"
+
+namespace Yolo{
+
+    void decode_cpu(const DecodeParam& param, const float* invert_affine_matrix, float* candidates){
+
+        int num_positions = param.num_positions();
+        for(int position = 0; position < num_positions; ++position)
+            decode_position(param, position, invert_affine_matrix, candidates + position * NUM_BOX_ELEMENT);
+    }
+};
@@ -0,0 +1,372 @@
+/**
+ * yolo解码的一致性检查与耗时对比
+ *   1. decode_exp与expf的相对误差
+ *   2. V5Raw（[3 * (5 + classes), H, W]与[3, H, W, 5 + classes]两种布局）与导出后处理（sigmoid、grid、anchor）后的Decoded逐位一致
+ *   3. XRaw与导出decode（grid、exp）后的Decoded逐位一致
+ *   4. GPU的解码 + NMS与CPU的decode_cpu + CPUKernel::topk_sort_nms逐位一致
+ *   ./pro yolo_decode_bench
+ */
+
+#include <vector>
+#include <math.h>
+#include <string.h>
+#include <common/ilogger.hpp>
+#include <common/cuda_tools.hpp>
+#include <common/nms_kernel.cuh>
+#include "app_yolo/yolo_decode.hpp"
+
+using namespace std;
+using namespace Yolo;
+
+namespace{
+
+    const int NUM_CLASSES = 80;
+    const int NUM_ELEMENT = 5 + NUM_CLASSES;
+    const int MAX_OBJECTS = 1024;
+    const int STRIDES[]   = {8, 16, 32};
+    const float ANCHORS[3][MAX_HEAD_ANCHORS][2] = {
+        {{10, 13},  {16, 30},   {33, 23}},
+        {{30, 61},  {62, 45},   {59, 119}},
+        {{116, 90}, {156, 198}, {373, 326}}
+    };
+
+    bool has_cuda_device(){
+        int num_device = 0;
+        return cudaGetDeviceCount(&num_device) == cudaSuccess && num_device > 0;
+    }
+
+    float random_uniform(unsigned int& seed, float low, float high){
+        seed = seed * 1103515245 + 12345;
+        return low + (seed >> 8) / (float)(1 << 24) * (high - low);
+    }
+
+    // 模拟的head输出，大部分cell的objectness很低，约2%的cell为目标
+    float random_objectness_logit(unsigned int& seed){
+        return random_uniform(seed, 0, 1) < 0.02f ? random_uniform(seed, -1, 6) : random_uniform(seed, -12, -3);
+    }
+
+    // 1920x1080的图像letterbox到640x640，d2i把输入的坐标映射回原图
+    void make_d2i(float* d2i){
+        float scale = 640 / 1920.0f;
+        float i2d[6] = {scale, 0, -scale * 1920 * 0.5f + 640 * 0.5f, 0, scale, -scale * 1080 * 0.5f + 640 * 0.5f};
+        d2i[0] = 1 / scale; d2i[1] = 0; d2i[2] = -i2d[2] / scale;
+        d2i[3] = 0; d2i[4] = 1 / scale; d2i[5] = -i2d[5] / scale;
+    }
+
+    size_t count_mismatch(const vector<float>& a, const vector<float>& b){
+        size_t mismatch = 0;
+        for(size_t i = 0; i < a.size(); i += NUM_BOX_ELEMENT){
+            // 无效的候选框只比较confidence
+            size_t count = a[i + 4] == -1 && b[i + 4] == -1 ? 0 : NUM_BOX_ELEMENT;
+            mismatch += memcmp(&a[i], &b[i], sizeof(float) * count) != 0;
+        }
+        return mismatch;
+    }
+
+    template<class _Func>
+    float time_ms(int iters, const _Func& func){
+        auto tic = iLogger::timestamp_now_float();
+        for(int i = 0; i < iters; ++i) func();
+        return (iLogger::timestamp_now_float() - tic) / iters;
+    }
+
+    bool check_decode_exp(){
+        double max_error = 0;
+        for(float x = -87.0f; x <= 88.0f; x += 0.00173f){
+            double reference = exp((double)x);
+            max_error = max(max_error, fabs(decode_exp(x) - reference) / reference);
+        }
+        bool ok = max_error < 1e-6;
+        INFO("decode_exp max relative error = %g, %s", max_error, ok ? "ok" : "failed");
+        return ok;
+    }
+
+    // CPU上的解码 + NMS，作为GPU的参考，输出与parray的格式相同
+    void decode_and_nms_cpu(const DecodeParam& param, const float* d2i, vector<float>& candidates, vector<float>& output){
+        candidates.resize(param.num_positions() * NUM_BOX_ELEMENT);
+        output.assign(1 + MAX_OBJECTS * NUM_BOX_ELEMENT, 0);
+        decode_cpu(param, d2i, candidates.data());
+        output[0] = CPUKernel::topk_sort_nms(
+            candidates.data(), param.num_positions(), NUM_BOX_ELEMENT, MAX_OBJECTS,
+            0.5f, NMSMethod::ClassAware, param.confidence_threshold, output.data() + 1
+        );
+    }
+
+    // 把host上的head复制到device，解码 + NMS，返回是否与CPU的结果一致
+    bool check_gpu(const char* name, const DecodeParam& param, const vector<vector<float>*>& head_data, const float* d2i){
+
+        vector<float> candidates, reference;
+        decode_and_nms_cpu(param, d2i, candidates, reference);
+
+        cudaStream_t stream = nullptr;
+        checkCudaRuntime(cudaStreamCreate(&stream));
+
+        DecodeParam device_param = param;
+        vector<float*> heads_device;
+        for(int i = 0; i < param.num_heads; ++i){
+            auto& data = *head_data[i];
+            float* ptr = nullptr;
+            checkCudaRuntime(cudaMalloc(&ptr, data.size() * sizeof(float)));
+            checkCudaRuntime(cudaMemcpy(ptr, data.data(), data.size() * sizeof(float), cudaMemcpyHostToDevice));
+            device_param.heads[i].data = ptr + (param.heads[i].data - data.data());
+            heads_device.push_back(ptr);
+        }
+
+        float* d2i_device        = nullptr;
+        float* candidates_device = nullptr;
+        float* output_device     = nullptr;
+        void* workspace_device   = nullptr;
+        checkCudaRuntime(cudaMalloc(&d2i_device,        6 * sizeof(float)));
+        checkCudaRuntime(cudaMalloc(&candidates_device, candidates.size() * sizeof(float)));
+        checkCudaRuntime(cudaMalloc(&output_device,     reference.size() * sizeof(float)));
+        checkCudaRuntime(cudaMalloc(&workspace_device,  CUDAKernel::nms_workspace_size(MAX_OBJECTS)));
+        checkCudaRuntime(cudaMemcpy(d2i_device, d2i, 6 * sizeof(float), cudaMemcpyHostToDevice));
+
+        auto launch = [&](){
+            decode_kernel_invoker(
+                device_param, d2i_device, 0.5f, NMSMethod::ClassAware,
+                candidates_device, output_device, MAX_OBJECTS, workspace_device, stream
+            );
+        };
+
+        vector<float> gpu_candidates(candidates.size()), gpu_output(reference.size());
+        launch();
+        checkCudaRuntime(cudaMemcpyAsync(gpu_candidates.data(), candidates_device, candidates.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+        checkCudaRuntime(cudaMemcpyAsync(gpu_output.data(), output_device, reference.size() * sizeof(float), cudaMemcpyDeviceToHost, stream));
+        checkCudaRuntime(cudaStreamSynchronize(stream));
+
+        float gpu_ms = time_ms(50, [&](){
+            launch();
+            checkCudaRuntime(cudaStreamSynchronize(stream));
+        });
+
+        int keep = reference[0];
+        size_t candidates_mismatch = count_mismatch(gpu_candidates, candidates);
+        bool output_ok = gpu_output[0] == reference[0] && memcmp(gpu_output.data(), reference.data(), sizeof(float) * (1 + keep * NUM_BOX_ELEMENT)) == 0;
+        bool ok = candidates_mismatch == 0 && output_ok;
+        INFO("%-16s GPU decode + nms %.3f ms, candidates differ = %lld, keep %d, %s",
+            name, gpu_ms, (long long)candidates_mismatch, keep, ok ? "ok" : "failed"
+        );
+
+        for(auto ptr : heads_device) checkCudaRuntime(cudaFree(ptr));
+        checkCudaRuntime(cudaFree(d2i_device));
+        checkCudaRuntime(cudaFree(candidates_device));
+        checkCudaRuntime(cudaFree(output_device));
+        checkCudaRuntime(cudaFree(workspace_device));
+        checkCudaRuntime(cudaStreamDestroy(stream));
+        return ok;
+    }
+
+    // 返回CPU、GPU解码的检查是否都通过
+    bool bench_v5_raw(int input_size, bool gpu){
+
+        INFO("==================== V5Raw %dx%d ====================", input_size, input_size);
+
+        float d2i[6];
+        make_d2i(d2i);
+
+        // 每个head的logits，按[na, H, W, 5 + classes]生成
+        unsigned int seed = 7;
+        vector<vector<float>> logits(3);
+        int num_positions = 0;
+        for(int ihead = 0; ihead < 3; ++ihead){
+            int size = input_size / STRIDES[ihead];
+            logits[ihead].resize(MAX_HEAD_ANCHORS * size * size * NUM_ELEMENT);
+            for(size_t i = 0; i < logits[ihead].size(); i += NUM_ELEMENT){
+                float* pitem = &logits[ihead][i];
+                for(int k = 0; k < 4; ++k) pitem[k] = random_uniform(seed, -3, 3);
+                pitem[4] = random_objectness_logit(seed);
+                for(int k = 5; k < NUM_ELEMENT; ++k) pitem[k] = random_uniform(seed, -8, 4);
+            }
+            num_positions += MAX_HEAD_ANCHORS * size * size;
+        }
+
+        // 卷积输出的布局[na * (5 + classes), H, W]
+        vector<vector<float>> conv(3);
+        for(int ihead = 0; ihead < 3; ++ihead){
+            int area = (input_size / STRIDES[ihead]) * (input_size / STRIDES[ihead]);
+            conv[ihead].resize(logits[ihead].size());
+            for(int a = 0; a < MAX_HEAD_ANCHORS; ++a)
+                for(int cell = 0; cell < area; ++cell)
+                    for(int k = 0; k < NUM_ELEMENT; ++k)
+                        conv[ihead][(a * NUM_ELEMENT + k) * area + cell] = logits[ihead][(a * area + cell) * NUM_ELEMENT + k];
+        }
+
+        // 导出Detect后处理的等价计算：全部sigmoid，xy = (y * 2 - 0.5 + grid) * stride，wh = (y * 2)^2 * anchor
+        vector<float> decoded(num_positions * NUM_ELEMENT);
+        float* pdecoded = decoded.data();
+        for(int ihead = 0; ihead < 3; ++ihead){
+            int size = input_size / STRIDES[ihead];
+            for(int a = 0; a < MAX_HEAD_ANCHORS; ++a){
+                for(int cell = 0; cell < size * size; ++cell, pdecoded += NUM_ELEMENT){
+                    const float* pitem = &logits[ihead][(a * size * size + cell) * NUM_ELEMENT];
+                    for(int k = 0; k < NUM_ELEMENT; ++k)
+                        pdecoded[k] = decode_sigmoid(pitem[k]);
+
+                    float stride = STRIDES[ihead];
+                    float w = decode_mul(pdecoded[2], 2.0f);
+                    float h = decode_mul(pdecoded[3], 2.0f);
+                    pdecoded[0] = decode_mul(decode_add(decode_add(decode_mul(pdecoded[0], 2.0f), -0.5f), (float)(cell % size)), stride);
+                    pdecoded[1] = decode_mul(decode_add(decode_add(decode_mul(pdecoded[1], 2.0f), -0.5f), (float)(cell / size)), stride);
+                    pdecoded[2] = decode_mul(decode_mul(w, w), ANCHORS[ihead][a][0]);
+                    pdecoded[3] = decode_mul(decode_mul(h, h), ANCHORS[ihead][a][1]);
+                }
+            }
+        }
+
+        auto make_param = [&](HeadType type){
+            DecodeParam param;
+            param.type        = type;
+            param.num_classes = NUM_CLASSES;
+            return param;
+        };
+
+        DecodeParam decoded_param = make_param(HeadType::Decoded);
+        auto& decoded_head        = decoded_param.add_head();
+        decoded_head.data         = decoded.data();
+        decoded_head.width        = num_positions;
+        decoded_head.height       = 1;
+        decoded_head.cell_stride  = NUM_ELEMENT;
+
+        DecodeParam nchw_param = make_param(HeadType::V5Raw);
+        DecodeParam nhwc_param = make_param(HeadType::V5Raw);
+        for(int ihead = 0; ihead < 3; ++ihead){
+            int size = input_size / STRIDES[ihead];
+            for(auto param : {&nchw_param, &nhwc_param}){
+                auto& head       = param->add_head();
+                head.width       = size;
+                head.height      = size;
+                head.num_anchors = MAX_HEAD_ANCHORS;
+                head.stride      = STRIDES[ihead];
+                memcpy(head.anchors, ANCHORS[ihead], sizeof(head.anchors));
+                if(param == &nchw_param){
+                    head.data           = conv[ihead].data();
+                    head.anchor_stride  = NUM_ELEMENT * size * size;
+                    head.cell_stride    = 1;
+                    head.element_stride = size * size;
+                }else{
+                    head.data           = logits[ihead].data();
+                    head.anchor_stride  = size * size * NUM_ELEMENT;
+                    head.cell_stride    = NUM_ELEMENT;
+                    head.element_stride = 1;
+                }
+            }
+        }
+
+        vector<float> reference(num_positions * NUM_BOX_ELEMENT), nchw(reference.size()), nhwc(reference.size());
+        int iters = 10;
+        float decoded_ms = time_ms(iters, [&](){decode_cpu(decoded_param, d2i, reference.data());});
+        float nchw_ms    = time_ms(iters, [&](){decode_cpu(nchw_param, d2i, nchw.data());});
+        float nhwc_ms    = time_ms(iters, [&](){decode_cpu(nhwc_param, d2i, nhwc.data());});
+
+        int num_valid = 0;
+        for(int i = 0; i < num_positions; ++i)
+            num_valid += reference[i * NUM_BOX_ELEMENT + 4] != -1;
+
+        size_t nchw_mismatch = count_mismatch(nchw, reference);
+        size_t nhwc_mismatch = count_mismatch(nhwc, reference);
+        INFO("%d positions, %d candidates", num_positions, num_valid);
+        INFO("CPU decoded %.3f ms (sigmoid/grid/anchor in the graph is not counted)", decoded_ms);
+        INFO("CPU raw [na*no, H, W] %.3f ms, differ = %lld, %s", nchw_ms, (long long)nchw_mismatch, nchw_mismatch == 0 ? "ok" : "failed");
+        INFO("CPU raw [na, H, W, no] %.3f ms, differ = %lld, %s", nhwc_ms, (long long)nhwc_mismatch, nhwc_mismatch == 0 ? "ok" : "failed");
+
+        bool ok = nchw_mismatch == 0 && nhwc_mismatch == 0;
+        if(gpu){
+            ok = check_gpu("V5Raw NCHW", nchw_param, {&conv[0], &conv[1], &conv[2]}, d2i) && ok;
+            ok = check_gpu("V5Raw NHWC", nhwc_param, {&logits[0], &logits[1], &logits[2]}, d2i) && ok;
+            ok = check_gpu("V5 decoded", decoded_param, {&decoded}, d2i) && ok;
+        }
+        return ok;
+    }
+
+    // 返回CPU、GPU解码的检查是否都通过
+    bool bench_x_raw(int input_size, bool gpu){
+
+        INFO("==================== XRaw %dx%d ====================", input_size, input_size);
+
+        float d2i[6];
+        make_d2i(d2i);
+
+        int num_positions = 0;
+        for(int stride : STRIDES)
+            num_positions += (input_size / stride) * (input_size / stride);
+
+        // reg为原始值，objectness、classes已经sigmoid
+        unsigned int seed = 11;
+        vector<float> raw(num_positions * NUM_ELEMENT);
+        for(size_t i = 0; i < raw.size(); i += NUM_ELEMENT){
+            float* pitem = &raw[i];
+            pitem[0] = random_uniform(seed, -0.5f, 1.5f);
+            pitem[1] = random_uniform(seed, -0.5f, 1.5f);
+            pitem[2] = random_uniform(seed, -1, 4);
+            pitem[3] = random_uniform(seed, -1, 4);
+            pitem[4] = decode_sigmoid(random_objectness_logit(seed));
+            for(int k = 5; k < NUM_ELEMENT; ++k) pitem[k] = random_uniform(seed, 0, 1);
+        }
+
+        // 导出decode的等价计算：xy = (reg + grid) * stride，wh = exp(reg) * stride
+        vector<float> decoded(raw);
+        float* pdecoded = decoded.data();
+        for(int stride : STRIDES){
+            int size = input_size / stride;
+            for(int cell = 0; cell < size * size; ++cell, pdecoded += NUM_ELEMENT){
+                pdecoded[0] = decode_mul(decode_add(pdecoded[0], (float)(cell % size)), (float)stride);
+                pdecoded[1] = decode_mul(decode_add(pdecoded[1], (float)(cell / size)), (float)stride);
+                pdecoded[2] = decode_mul(decode_exp(pdecoded[2]), (float)stride);
+                pdecoded[3] = decode_mul(decode_exp(pdecoded[3]), (float)stride);
+            }
+        }
+
+        DecodeParam decoded_param;
+        decoded_param.num_classes = NUM_CLASSES;
+        auto& decoded_head        = decoded_param.add_head();
+        decoded_head.data         = decoded.data();
+        decoded_head.width        = num_positions;
+        decoded_head.height       = 1;
+        decoded_head.cell_stride  = NUM_ELEMENT;
+
+        DecodeParam raw_param;
+        raw_param.type        = HeadType::XRaw;
+        raw_param.num_classes = NUM_CLASSES;
+        for(int stride : STRIDES){
+            auto& head       = raw_param.add_head();
+            head.width       = input_size / stride;
+            head.height      = input_size / stride;
+            head.stride      = stride;
+            head.cell_stride = NUM_ELEMENT;
+            head.data        = raw.data() + head.first_position * NUM_ELEMENT;
+        }
+
+        vector<float> reference(num_positions * NUM_BOX_ELEMENT), output(reference.size());
+        int iters = 10;
+        float decoded_ms = time_ms(iters, [&](){decode_cpu(decoded_param, d2i, reference.data());});
+        float raw_ms     = time_ms(iters, [&](){decode_cpu(raw_param, d2i, output.data());});
+        size_t mismatch  = count_mismatch(output, reference);
+        INFO("CPU decoded %.3f ms, raw %.3f ms, differ = %lld, %s", decoded_ms, raw_ms, (long long)mismatch, mismatch == 0 ? "ok" : "failed");
+
+        bool ok = mismatch == 0;
+        if(gpu){
+            vector<vector<float>*> head_data(raw_param.num_heads, &raw);
+            ok = check_gpu("XRaw", raw_param, head_data, d2i) && ok;
+        }
+        return ok;
+    }
+};
+
+int app_yolo_decode_bench(){
+
+    bool gpu = has_cuda_device();
+    if(!gpu)
+        INFO("No cuda device, only the CPU implementation is checked");
+
+    bool ok = check_decode_exp();
+    ok = bench_v5_raw(640, gpu) && ok;
+    ok = bench_v5_raw(1280, gpu) && ok;
+    ok = bench_x_raw(640, gpu) && ok;
+
+    if(!ok){
+        INFOE("Yolo decode bench check failed");
+        return -1;
+    }
+    return 0;
+}
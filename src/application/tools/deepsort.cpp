@@ -4,6 +4,7 @@
 #include <set>
 #include <algorithm>
 #include <utility>
+#include <atomic>
 #include "Eigen/Core"
 #include "Eigen/Cholesky"
 #include "Eigen/LU"
@@ -720,7 +721,48 @@ namespace DeepSORT {
             }
         }
 
-        void update(const BBoxes& boxes) {
+        virtual void update(const BBoxes& boxes) {
+            update_boxes(boxes);
+        }
+
+        virtual void update(const BoxSoA& boxes, int class_label) {
+
+            soa_index_.clear();
+            const int* label = boxes.label();
+            for (int i = 0; i < (int)boxes.size(); ++i) {
+                if (class_label < 0 || label[i] == class_label) {
+                    soa_index_.push_back(i);
+                }
+            }
+            update_boxes(SoABoxes(boxes, soa_index_));
+        }
+
+        virtual TrackerStatistics statistics() {
+            TrackerStatistics output;
+            output.objects   = num_objects_;
+            output.confirmed = num_confirmed_;
+            output.tentative = num_objects_ - num_confirmed_;
+            output.created   = id_next_ - 1;
+            output.updates   = num_updates_;
+            return output;
+        }
+
+    private:
+        // 按索引读取BoxSoA，访问时构造Box，没有feature
+        struct SoABoxes {
+            const BoxSoA& soa;
+            const std::vector<int>& index;
+
+            SoABoxes(const BoxSoA& soa, const std::vector<int>& index):soa(soa), index(index){}
+            size_t size() const {return index.size();}
+            Box operator[](size_t i) const {
+                int k = index[i];
+                return Box(soa.left()[k], soa.top()[k], soa.right()[k], soa.bottom()[k]);
+            }
+        };
+
+        template<typename _Boxes>
+        void update_boxes(const _Boxes& boxes) {
 
             predict();
 
@@ -797,11 +839,19 @@ namespace DeepSORT {
                         [](const TrackObject &obj){return obj.state() != State::Deleted;}
                         );
             objects_ = objects_tmp;
+
+            int num_confirmed = std::count_if(objects_.begin(), objects_.end(),
+                        [](const TrackObject &obj){return obj.state() == State::Confirmed;}
+                        );
+            num_confirmed_ = num_confirmed;
+            num_objects_   = objects_.size();
+            num_updates_++;
         }
 
+        template<typename _Boxes>
         void match(const std::vector<int> &objects_index, 
                 const std::vector<int> &boxes_index, 
-                const std::vector<Box> &boxes,
+                const _Boxes &boxes,
                 std::vector<int> &match_boxes_index,
                 std::vector<int> &match_objects_index) {
             std::vector<std::vector<double>> cost_matrix_data;
@@ -809,7 +859,7 @@ namespace DeepSORT {
                 std::vector<double> cost_matrix_item;
                 for (auto box_idx : boxes_index) {
                     auto &TrackObject = objects_[obj_idx];
-                    auto &box = boxes[box_idx];
+                    const Box &box = boxes[box_idx];
                     BBoxXYAH boxah(box);
 
                     auto maha_distance = km_filter_.ma_distance(
@@ -862,7 +912,11 @@ namespace DeepSORT {
         }
 
     private:
-        int id_next_{1};
+        std::atomic<int> id_next_{1};
+        std::atomic<int> num_objects_{0};
+        std::atomic<int> num_confirmed_{0};
+        std::atomic<long long> num_updates_{0};
+        std::vector<int> soa_index_;
         std::vector<TrackObjectImpl> objects_;
         KalmanFilter km_filter_;
         float cosine_distance_threshold_ = 0;
@@ -5,6 +5,7 @@
 #include <memory>
 #include <vector>
 #include <opencv2/opencv.hpp>
+#include <common/box_soa.hpp>
 
 namespace DeepSORT {
 
@@ -37,6 +38,15 @@ enum class State : int{
 
 typedef std::vector<Box> BBoxes;
 
+// 最近一次update之后的对象数，可以在其他线程读取（例如指标服务）
+struct TrackerStatistics{
+    int objects       = 0;
+    int confirmed     = 0;
+    int tentative     = 0;
+    long long created = 0;      // 创建过的对象总数
+    long long updates = 0;      // update的次数
+};
+
 class TrackObject{
 public:
 	virtual int id() const = 0;
@@ -55,6 +65,11 @@ class Tracker{
 public:
     virtual std::vector<TrackObject *> get_objects() = 0;
     virtual void update(const BBoxes& boxes) = 0;
+
+    // 直接读取检测器的结构数组结果，class_label >= 0时只使用该类别的框，不需要先转换为BBoxes
+    virtual void update(const BoxSoA& boxes, int class_label = -1) = 0;
+
+    virtual TrackerStatistics statistics() = 0;
 };
 
 std::shared_ptr<Tracker> create_tracker(
@@ -0,0 +1,109 @@
+#ifndef FAKE_MODEL_HPP
+#define FAKE_MODEL_HPP
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <common/infer_controller.hpp>
+#include <common/monopoly_allocator.hpp>
+#include <common/infer_trace.hpp>
+
+/**
+ * @brief 不依赖GPU的假模型，给各个bench、check共用
+ * worker只sleep，耗时 = base_ms + per_item_ms * batch，结果由compute在commit线程上直接算出
+ * set_tensor_allocator之后，preprocess像真实模型一样从tensor_allocator_拿对象，worker交付前归还
+ * worker线程上有虚函数调用，子类需要在自己的析构中stop，否则析构时修改vptr会与worker竞争
+ *   class FakeDetector : public FakeModel<int, Faces>{
+ *       virtual ~FakeDetector(){ stop(); }
+ *       virtual bool compute(Job& job, const int& input) override{ ... }
+ *   };
+ *   detector.set_tensor_allocator(16);
+ *   detector.startup("detector", 8, 2.0f, 0.1f);
+ */
+template<class Input, class Output>
+class FakeModel : public InferController<Input, Output, std::tuple<std::string, int>>{
+public:
+    typedef InferController<Input, Output, std::tuple<std::string, int>> ControllerImpl;
+    typedef typename ControllerImpl::Job Job;
+
+    virtual ~FakeModel(){
+        this->stop();
+    }
+
+    // 需要在startup之前调用，capacity个对象，query等待超过timeout_ms则任务失败；commit_chunk_size > 0时commits分段放入队列
+    void set_tensor_allocator(int capacity, int timeout_ms = 10000, int commit_chunk_size = 0){
+        this->tensor_allocator_  = std::make_shared<MonopolyAllocator<TRT::Tensor>>(capacity);
+        this->commit_chunk_size_ = commit_chunk_size;
+        query_timeout_ms_        = timeout_ms;
+    }
+
+    bool startup(const std::string& name, int max_batch_size, float base_ms, float per_item_ms){
+        max_batch_size_ = max_batch_size;
+        base_ms_        = base_ms;
+        per_item_ms_    = per_item_ms;
+        this->set_metrics_name(name);
+        return ControllerImpl::startup(std::make_tuple(name, 0));
+    }
+
+    virtual void worker(std::promise<bool>& result) override{
+
+        result.set_value(true);
+
+        std::vector<Job> fetch_jobs;
+        while(this->get_jobs_and_wait(fetch_jobs, max_batch_size_)){
+
+            int infer_batch_size = fetch_jobs.size();
+            auto cost = std::chrono::microseconds((long long)((base_ms_ + per_item_ms_ * infer_batch_size) * 1000));
+            {
+                InferTrace::Span span("forward", this->trace_category_, "batch", infer_batch_size);
+                std::this_thread::sleep_for(cost);
+            }
+
+            num_forward_++;
+            num_items_ += infer_batch_size;
+            for(auto& job : fetch_jobs){
+                if(job.mono_tensor)
+                    job.mono_tensor->release();
+                deliver(job);
+            }
+            fetch_jobs.clear();
+        }
+    }
+
+    virtual bool preprocess(Job& job, const Input& input) override{
+
+        if(this->tensor_allocator_){
+            job.mono_tensor = this->tensor_allocator_->query(query_timeout_ms_);
+            if(job.mono_tensor == nullptr)
+                return false;
+        }
+        return compute(job, input);
+    }
+
+    // 写入job.output，返回false时任务失败
+    virtual bool compute(Job& job, const Input& input){
+        return true;
+    }
+
+    // 默认交付compute的结果，在worker线程上调用
+    virtual void deliver(Job& job){
+        job.set_value(job.output);
+    }
+
+    float average_batch_size() const{
+        return num_forward_ == 0 ? 0 : num_items_ / (float)num_forward_;
+    }
+
+private:
+    int max_batch_size_   = 16;
+    float base_ms_        = 0;
+    float per_item_ms_    = 0;
+    int query_timeout_ms_ = 10000;
+    std::atomic<int> num_forward_{0};
+    std::atomic<int> num_items_{0};
+};
+
+#endif // FAKE_MODEL_HPP
@@ -0,0 +1,389 @@
+#include "metrics_server.hpp"
+#include <common/ilogger.hpp>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+
+#if !defined(_WIN32)
+#   include <errno.h>
+#   include <poll.h>
+#   include <netdb.h>
+#   include <unistd.h>
+#   include <arpa/inet.h>
+#   include <netinet/in.h>
+#   include <sys/types.h>
+#   include <sys/socket.h>
+#endif
+
+using namespace std;
+
+static string format_value(double value){
+
+    if(isnan(value)) return "NaN";
+    if(isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+}
+
+static string escape_label(const string& value){
+
+    string output;
+    output.reserve(value.size());
+    for(char c : value){
+        if(c == '\\')      output += "\\\\";
+        else if(c == '"')  output += "\\\"";
+        else if(c == '\n') output += "\\n";
+        else output.push_back(c);
+    }
+    return output;
+}
+
+void MetricsWriter::gauge(const string& name, const string& help, double value, const MetricLabels& labels){
+    sample(family(name, "gauge", help), name, labels, value);
+}
+
+void MetricsWriter::counter(const string& name, const string& help, double value, const MetricLabels& labels){
+    sample(family(name, "counter", help), name, labels, value);
+}
+
+void MetricsWriter::histogram(const string& name, const string& help, const HistogramSnapshot& histogram,
+    const vector<double>& bounds, double scale, const MetricLabels& labels){
+
+    auto& output = family(name, "histogram", help);
+    auto bucket_labels = labels;
+    bucket_labels.emplace_back("le", "");
+
+    size_t ibucket = 0;
+    long long cumulative = 0;
+    for(double bound : bounds){
+        while(ibucket < histogram.buckets.size() && LatencyHistogram::bucket_upper(ibucket) * scale <= bound)
+            cumulative += histogram.buckets[ibucket++];
+
+        bucket_labels.back().second = format_value(bound);
+        sample(output, name + "_bucket", bucket_labels, cumulative);
+    }
+
+    bucket_labels.back().second = "+Inf";
+    sample(output, name + "_bucket", bucket_labels, histogram.count);
+    sample(output, name + "_sum",    labels, histogram.sum * scale);
+    sample(output, name + "_count",  labels, histogram.count);
+}
+
+string MetricsWriter::str() const{
+
+    string output;
+    for(auto& name : order_){
+        auto& item = families_.at(name);
+        output += "# HELP " + name + " " + item.help + "\n";
+        output += "# TYPE " + name + " " + item.type + "\n";
+        for(auto& line : item.samples)
+            output += line;
+    }
+    return output;
+}
+
+MetricsWriter::Family& MetricsWriter::family(const string& name, const string& type, const string& help){
+
+    auto iter = families_.find(name);
+    if(iter != families_.end())
+        return iter->second;
+
+    order_.push_back(name);
+    auto& output = families_[name];
+    output.type  = type;
+    output.help  = help;
+    return output;
+}
+
+void MetricsWriter::sample(Family& family, const string& name, const MetricLabels& labels, double value){
+
+    string line = name;
+    if(!labels.empty()){
+        line += "{";
+        for(size_t i = 0; i < labels.size(); ++i){
+            if(i > 0) line += ",";
+            line += labels[i].first + "=\"" + escape_label(labels[i].second) + "\"";
+        }
+        line += "}";
+    }
+    line += " " + format_value(value) + "\n";
+    family.samples.emplace_back(move(line));
+}
+
+void write_infer_metrics(MetricsWriter& writer, const InferMetricsSnapshot& metrics){
+
+    // 秒为单位的耗时桶，与Prometheus客户端的默认值相近
+    static const vector<double> latency_bounds = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5};
+    static const vector<double> size_bounds    = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+
+    MetricLabels model = {{"model", metrics.name}};
+    auto& end_to_end   = metrics.stage(InferStage::EndToEnd);
+    writer.counter("infer_jobs_total", "Jobs delivered since startup or reset_metrics", end_to_end.count, model);
+    writer.counter("infer_batches_total", "Batches taken by the worker", metrics.batch_size.count, model);
+    writer.gauge("infer_jobs_per_second", "Average delivered jobs per second since startup or reset_metrics", metrics.jobs_per_second(), model);
+    writer.histogram("infer_batch_size", "Jobs per batch taken by the worker", metrics.batch_size, size_bounds, 1.0, model);
+    writer.histogram("infer_queue_depth", "Queue depth when the worker takes a batch", metrics.queue_depth, size_bounds, 1.0, model);
+
+    for(int i = 0; i < (int)InferStage::NumStage; ++i){
+        auto& stage = metrics.stages[i];
+        if(stage.count == 0) continue;
+
+        MetricLabels labels = {{"model", metrics.name}, {"stage", infer_stage_name((InferStage)i)}};
+        writer.histogram("infer_stage_latency_seconds", "Latency of each job stage", stage, latency_bounds, 1e-6, labels);
+    }
+
+    writer.gauge("infer_queue_size", "Jobs waiting in the queue", metrics.queue_size, model);
+    writer.gauge("infer_inflight_jobs", "Jobs being processed by the worker", metrics.inflight, model);
+    if(metrics.allocator_capacity > 0){
+        writer.gauge("infer_allocator_capacity", "Tensor allocator capacity", metrics.allocator_capacity, model);
+        writer.gauge("infer_allocator_occupancy", "Tensors currently held by jobs", metrics.allocator_occupancy, model);
+        writer.gauge("infer_allocator_peak_occupancy", "Peak tensors held by jobs", metrics.allocator_peak, model);
+    }
+}
+
+void write_logger_metrics(MetricsWriter& writer){
+
+    auto statistics = iLogger::logger_statistics();
+    for(int level = 0; level <= ILOGGER_VERBOSE; ++level)
+        writer.counter("logger_lines_total", "Log lines printed", statistics.lines[level], {{"level", iLogger::level_string(level)}});
+    writer.counter("logger_dropped_lines_total", "Log lines not written to the log file after the logger shut down", statistics.dropped);
+}
+
+void write_tracker_metrics(MetricsWriter& writer, const string& name, const DeepSORT::TrackerStatistics& statistics){
+
+    writer.gauge("tracker_objects", "Tracked objects after the latest update", statistics.confirmed, {{"tracker", name}, {"state", "confirmed"}});
+    writer.gauge("tracker_objects", "Tracked objects after the latest update", statistics.tentative, {{"tracker", name}, {"state", "tentative"}});
+    writer.counter("tracker_created_objects_total", "Objects created by the tracker", statistics.created, {{"tracker", name}});
+    writer.counter("tracker_updates_total", "Tracker updates", statistics.updates, {{"tracker", name}});
+}
+
+#if defined(_WIN32)
+
+std::shared_ptr<MetricsServer> create_metrics_server(const std::string& address, int port){
+    INFOE("Metrics server is not supported on windows");
+    return nullptr;
+}
+
+int http_get(const std::string& host, int port, const std::string& path, std::string& body, int timeout_ms){
+    INFOE("http_get is not supported on windows");
+    return -1;
+}
+
+#else
+
+static void set_socket_timeout(int fd, int timeout_ms){
+    timeval timeout;
+    timeout.tv_sec  = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static bool send_all(int fd, const string& data){
+
+    size_t sent = 0;
+    while(sent < data.size()){
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+class MetricsServerImpl : public MetricsServer{
+public:
+    virtual ~MetricsServerImpl(){
+        run_ = false;
+        if(worker_.joinable())
+            worker_.join();
+
+        if(fd_ != -1)
+            ::close(fd_);
+    }
+
+    bool listen(const string& address, int port){
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port   = htons(port);
+        if(inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1){
+            INFOE("Invalid metrics server address: %s", address.c_str());
+            return false;
+        }
+
+        fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        if(fd_ == -1){
+            INFOE("Create socket failed: %s", strerror(errno));
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if(::bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd_, 16) != 0){
+            INFOE("Metrics server listen on %s:%d failed: %s", address.c_str(), port, strerror(errno));
+            return false;
+        }
+
+        socklen_t length = sizeof(addr);
+        getsockname(fd_, (sockaddr*)&addr, &length);
+        port_ = ntohs(addr.sin_port);
+
+        run_    = true;
+        worker_ = thread(&MetricsServerImpl::worker, this);
+        INFO("Metrics server listening on http://%s:%d/metrics", address.c_str(), port_);
+        return true;
+    }
+
+    virtual void add_collector(const Collector& collector) override{
+        unique_lock<mutex> l(lock_);
+        collectors_.push_back(collector);
+    }
+
+    virtual string scrape() override{
+
+        vector<Collector> collectors;
+        {
+            unique_lock<mutex> l(lock_);
+            collectors = collectors_;
+        }
+
+        MetricsWriter writer;
+        for(auto& collector : collectors)
+            collector(writer);
+        return writer.str();
+    }
+
+    virtual int port() override{
+        return port_;
+    }
+
+private:
+    // 用poll等待连接，stop时最多100ms退出
+    void worker(){
+        while(run_){
+            pollfd item;
+            item.fd      = fd_;
+            item.events  = POLLIN;
+            item.revents = 0;
+            if(::poll(&item, 1, 100) <= 0) continue;
+
+            int client = ::accept(fd_, nullptr, nullptr);
+            if(client == -1) continue;
+
+            set_socket_timeout(client, 1000);
+            handle(client);
+            ::close(client);
+        }
+    }
+
+    void handle(int client){
+
+        // 只需要请求行，读到头部结束为止
+        string request;
+        char buffer[1024];
+        while(request.find("\r\n\r\n") == string::npos && request.size() < 8192){
+            ssize_t n = ::recv(client, buffer, sizeof(buffer), 0);
+            if(n <= 0) break;
+            request.append(buffer, n);
+        }
+
+        auto line  = request.substr(0, request.find("\r\n"));
+        auto parts = iLogger::split_string(line, " ");
+        if(parts.size() < 2){
+            reply(client, 400, "Bad Request", "text/plain", "Bad Request\n");
+            return;
+        }
+
+        auto path = parts[1].substr(0, parts[1].find('?'));
+        if(parts[0] != "GET"){
+            reply(client, 405, "Method Not Allowed", "text/plain", "Method Not Allowed\n");
+        }else if(path == "/metrics"){
+            reply(client, 200, "OK", "text/plain; version=0.0.4; charset=utf-8", scrape());
+        }else{
+            reply(client, 404, "Not Found", "text/plain", "Not Found\n");
+        }
+    }
+
+    void reply(int client, int code, const char* status, const char* content_type, const string& body){
+
+        auto header = iLogger::format(
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+            code, status, content_type, (int)body.size()
+        );
+        if(send_all(client, header))
+            send_all(client, body);
+    }
+
+private:
+    int fd_   = -1;
+    int port_ = 0;
+    atomic<bool> run_{false};
+    thread worker_;
+    mutex lock_;
+    vector<Collector> collectors_;
+};
+
+std::shared_ptr<MetricsServer> create_metrics_server(const std::string& address, int port){
+
+    shared_ptr<MetricsServerImpl> instance(new MetricsServerImpl());
+    if(!instance->listen(address, port)){
+        instance.reset();
+    }
+    return instance;
+}
+
+int http_get(const std::string& host, int port, const std::string& path, std::string& body, int timeout_ms){
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* result = nullptr;
+    if(getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0 || result == nullptr){
+        INFOE("Resolve %s failed", host.c_str());
+        return -1;
+    }
+
+    int fd = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if(fd == -1){
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    set_socket_timeout(fd, timeout_ms);
+    bool connected = ::connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+    freeaddrinfo(result);
+    if(!connected){
+        INFOE("Connect %s:%d failed: %s", host.c_str(), port, strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+
+    auto request = iLogger::format("GET %s HTTP/1.1\r\nHost: %s:%d\r\nConnection: close\r\n\r\n", path.c_str(), host.c_str(), port);
+    string response;
+    if(send_all(fd, request)){
+        char buffer[4096];
+        ssize_t n = 0;
+        while((n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            response.append(buffer, n);
+    }
+    ::close(fd);
+
+    // HTTP/1.1 200 OK
+    int code = -1;
+    if(sscanf(response.c_str(), "HTTP/%*d.%*d %d", &code) != 1)
+        return -1;
+
+    auto header_end = response.find("\r\n\r\n");
+    body = header_end == string::npos ? string() : response.substr(header_end + 4);
+    return code;
+}
+
+#endif
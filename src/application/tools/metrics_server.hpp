@@ -0,0 +1,82 @@
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <common/infer_metrics.hpp>
+#include "deepsort.hpp"
+
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+/**
+ * @brief Prometheus文本格式（version 0.0.4）的输出，同名的样本归到同一个family下，HELP、TYPE只输出一次
+ */
+class MetricsWriter{
+public:
+    void gauge(const std::string& name, const std::string& help, double value, const MetricLabels& labels = {});
+    void counter(const std::string& name, const std::string& help, double value, const MetricLabels& labels = {});
+
+    /**
+     * @brief 把LatencyHistogram的快照按bounds输出为累积的_bucket、_sum、_count，bounds为乘以scale之后的单位
+     * 跨越边界的HDR桶计入更大的le，因此每个le的计数不会偏大
+     */
+    void histogram(const std::string& name, const std::string& help, const HistogramSnapshot& histogram,
+        const std::vector<double>& bounds, double scale = 1.0, const MetricLabels& labels = {});
+
+    std::string str() const;
+
+private:
+    struct Family{
+        std::string type;
+        std::string help;
+        std::vector<std::string> samples;
+    };
+
+    Family& family(const std::string& name, const std::string& type, const std::string& help);
+    void sample(Family& family, const std::string& name, const MetricLabels& labels, double value);
+
+    std::vector<std::string> order_;
+    std::map<std::string, Family> families_;
+};
+
+// 模型的QPS、batch大小直方图、各阶段耗时、队列深度以及tensor allocator占用，label为model
+void write_infer_metrics(MetricsWriter& writer, const InferMetricsSnapshot& metrics);
+
+// 各级别日志的行数，以及logger关闭之后没有写入日志文件的行数
+void write_logger_metrics(MetricsWriter& writer);
+
+// 跟踪器的对象数，label为tracker
+void write_tracker_metrics(MetricsWriter& writer, const std::string& name, const DeepSORT::TrackerStatistics& statistics);
+
+/**
+ * @brief 内嵌的HTTP服务，GET /metrics时依次调用collector生成Prometheus文本
+ * collector在服务线程上调用，只能读取线程安全的统计（例如Infer::metrics()、Tracker::statistics()）
+ *   auto server = create_metrics_server("0.0.0.0", 9464);
+ *   server->add_collector([=](MetricsWriter& writer){
+ *       write_infer_metrics(writer, yolo->metrics());
+ *   });
+ * 每个连接只处理一个请求，回复后关闭，不支持keep-alive
+ */
+class MetricsServer{
+public:
+    typedef std::function<void(MetricsWriter& writer)> Collector;
+
+    virtual void add_collector(const Collector& collector) = 0;
+
+    // 不经过网络直接生成一次输出
+    virtual std::string scrape() = 0;
+
+    // 实际监听的端口，create时port = 0则由系统分配
+    virtual int port() = 0;
+};
+
+// 失败时返回nullptr
+std::shared_ptr<MetricsServer> create_metrics_server(const std::string& address = "0.0.0.0", int port = 9464);
+
+// 用于测试的回环客户端，返回HTTP状态码，失败返回-1
+int http_get(const std::string& host, int port, const std::string& path, std::string& body, int timeout_ms = 3000);
+
+#endif // METRICS_SERVER_HPP
@@ -9,37 +9,65 @@ int app_retinaface();
 int app_arcface();
 int app_arcface_video();
 int app_arcface_tracker();
+int app_controller_bench();
+int app_memory_bench();
+int app_preprocess_bench();
+int app_nms_bench();
+int app_yolo_decode_bench();
+int app_coroutine_check();
+int app_pipeline_bench();
+int app_metrics_server();
+int app_replay_check();
 
 int main(int argc, char** argv){
 
     const char* method = "yolo";
+    int result = 0;
     if(argc > 1){
         method = argv[1];
     }
 
     if(strcmp(method, "yolo") == 0){
-        app_yolo();
+        result = app_yolo();
     }else if(strcmp(method, "alphapose") == 0){
-        app_alphapose();
+        result = app_alphapose();
     }else if(strcmp(method, "fall_recognize") == 0){
-        app_fall_recognize();
+        result = app_fall_recognize();
     }else if(strcmp(method, "retinaface") == 0){
-        app_retinaface();
+        result = app_retinaface();
     }else if(strcmp(method, "arcface") == 0){
-        app_arcface();
+        result = app_arcface();
     }else if(strcmp(method, "arcface_video") == 0){
-        app_arcface_video();
+        result = app_arcface_video();
     }else if(strcmp(method, "arcface_tracker") == 0){
-        app_arcface_tracker();
+        result = app_arcface_tracker();
+    }else if(strcmp(method, "controller_bench") == 0){
+        result = app_controller_bench();
+    }else if(strcmp(method, "memory_bench") == 0){
+        result = app_memory_bench();
+    }else if(strcmp(method, "preprocess_bench") == 0){
+        result = app_preprocess_bench();
+    }else if(strcmp(method, "nms_bench") == 0){
+        result = app_nms_bench();
+    }else if(strcmp(method, "yolo_decode_bench") == 0){
+        result = app_yolo_decode_bench();
+    }else if(strcmp(method, "coroutine_check") == 0){
+        result = app_coroutine_check();
+    }else if(strcmp(method, "pipeline_bench") == 0){
+        result = app_pipeline_bench();
+    }else if(strcmp(method, "metrics_server") == 0){
+        result = app_metrics_server();
+    }else if(strcmp(method, "replay_check") == 0){
+        result = app_replay_check();
     }else{
         printf(
             "Help: \n"
-            "    ./pro method[yolo、alphapose、fall_recognize、retinaface、arcface、arcface_video、arcface_tracker]\n"
+            "    ./pro method[yolo、alphapose、fall_recognize、retinaface、arcface、arcface_video、arcface_tracker、controller_bench、memory_bench、preprocess_bench、nms_bench、yolo_decode_bench、coroutine_check、pipeline_bench、metrics_server、replay_check]\n"
             "\n"
             "    ./pro yolo\n"
             "    ./pro alphapose\n"
             "    ./pro fall_recognize\n"
         );
     }
-    return 0;
+    return result;
 }
\ No newline at end of file
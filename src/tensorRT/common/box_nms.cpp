@@ -0,0 +1,272 @@
+
+#include "box_nms.hpp"
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_KERNEL_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CPU_KERNEL_NEON
+#endif
+
+namespace CPUKernel{
+
+    using namespace std;
+
+    // 排序后的box，SoA的布局便于SIMD一次读取多个box
+    struct SortedBoxes{
+        vector<float> left, top, right, bottom, area, label;
+        vector<int> index;      // 在输入中的索引
+
+        void build(const float* boxes, int box_element, const vector<int>& order){
+            int n = order.size();
+            left.resize(n);  top.resize(n);  right.resize(n);  bottom.resize(n);  area.resize(n);  label.resize(n);
+            index = order;
+            for(int i = 0; i < n; ++i){
+                const float* pbox = boxes + order[i] * box_element;
+                left[i]   = pbox[0];
+                top[i]    = pbox[1];
+                right[i]  = pbox[2];
+                bottom[i] = pbox[3];
+                area[i]   = box_nms_area(pbox);
+                label[i]  = pbox[5];
+            }
+        }
+    };
+
+    // 置信度top-K，并按置信度降序排序，置信度相同时索引小的在前，与kernel中的排序键一致，返回top-K之前的数量
+    static int select_topk(const float* boxes, int num_boxes, int box_element, int top_k, float score_threshold, vector<int>& order){
+
+        order.clear();
+        for(int i = 0; i < num_boxes; ++i){
+            if(boxes[i * box_element + 4] >= score_threshold)
+                order.push_back(i);
+        }
+
+        auto greater = [&](int a, int b){
+            float ca = boxes[a * box_element + 4];
+            float cb = boxes[b * box_element + 4];
+            return ca > cb || (ca == cb && a < b);
+        };
+
+        int num_valid = order.size();
+        if(num_valid > top_k){
+            nth_element(order.begin(), order.begin() + top_k, order.end(), greater);
+            order.resize(top_k);
+        }
+        sort(order.begin(), order.end(), greater);
+        return num_valid;
+    }
+
+    // 抑制box i之后与其重叠的box，返回处理到的位置
+    static int suppress_scalar(const float* boxes, int box_element, const SortedBoxes& sorted, int i, int begin, float nms_threshold, NMSMethod method, vector<char>& removed){
+
+        const float* a = boxes + sorted.index[i] * box_element;
+        int n = sorted.index.size();
+        for(int j = begin; j < n; ++j){
+            if(!removed[j] && box_nms_overlap(a, boxes + sorted.index[j] * box_element, nms_threshold, method))
+                removed[j] = 1;
+        }
+        return n;
+    }
+
+#ifdef CPU_KERNEL_AVX2
+    static bool has_avx2(){
+        static bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    // 一次计算box i与8个box的iou，运算顺序与box_nms_iou相同且不使用fma，因此与标量实现逐位一致
+    __attribute__((target("avx2")))
+    static int suppress_avx2(const SortedBoxes& sorted, int i, int begin, float nms_threshold, NMSMethod method, vector<char>& removed){
+
+        const int LANES   = 8;
+        int n             = sorted.index.size();
+        __m256 a_left     = _mm256_set1_ps(sorted.left[i]);
+        __m256 a_top      = _mm256_set1_ps(sorted.top[i]);
+        __m256 a_right    = _mm256_set1_ps(sorted.right[i]);
+        __m256 a_bottom   = _mm256_set1_ps(sorted.bottom[i]);
+        __m256 a_area     = _mm256_set1_ps(sorted.area[i]);
+        __m256 a_label    = _mm256_set1_ps(sorted.label[i]);
+        __m256 threshold  = _mm256_set1_ps(nms_threshold);
+        __m256 zero       = _mm256_setzero_ps();
+        bool class_aware  = method != NMSMethod::ClassAgnostic;
+
+        int j = begin;
+        for(; j + LANES <= n; j += LANES){
+            __m256 cleft   = _mm256_max_ps(a_left,   _mm256_loadu_ps(&sorted.left[j]));
+            __m256 ctop    = _mm256_max_ps(a_top,    _mm256_loadu_ps(&sorted.top[j]));
+            __m256 cright  = _mm256_min_ps(a_right,  _mm256_loadu_ps(&sorted.right[j]));
+            __m256 cbottom = _mm256_min_ps(a_bottom, _mm256_loadu_ps(&sorted.bottom[j]));
+            __m256 c_area  = _mm256_mul_ps(_mm256_max_ps(_mm256_sub_ps(cright, cleft), zero), _mm256_max_ps(_mm256_sub_ps(cbottom, ctop), zero));
+            __m256 iou     = _mm256_div_ps(c_area, _mm256_sub_ps(_mm256_add_ps(a_area, _mm256_loadu_ps(&sorted.area[j])), c_area));
+            iou            = _mm256_blendv_ps(iou, zero, _mm256_cmp_ps(c_area, zero, _CMP_EQ_OQ));
+
+            __m256 overlap = _mm256_cmp_ps(iou, threshold, _CMP_GT_OQ);
+            if(class_aware)
+                overlap = _mm256_and_ps(overlap, _mm256_cmp_ps(a_label, _mm256_loadu_ps(&sorted.label[j]), _CMP_EQ_OQ));
+
+            int mask = _mm256_movemask_ps(overlap);
+            while(mask){
+                int k = __builtin_ctz(mask);
+                removed[j + k] = 1;
+                mask &= mask - 1;
+            }
+        }
+        return j;
+    }
+#endif // CPU_KERNEL_AVX2
+
+#ifdef CPU_KERNEL_NEON
+    // 与AVX2的实现相同，4个box一组
+    static int suppress_neon(const SortedBoxes& sorted, int i, int begin, float nms_threshold, NMSMethod method, vector<char>& removed){
+
+        const int LANES    = 4;
+        int n              = sorted.index.size();
+        float32x4_t a_left   = vdupq_n_f32(sorted.left[i]);
+        float32x4_t a_top    = vdupq_n_f32(sorted.top[i]);
+        float32x4_t a_right  = vdupq_n_f32(sorted.right[i]);
+        float32x4_t a_bottom = vdupq_n_f32(sorted.bottom[i]);
+        float32x4_t a_area   = vdupq_n_f32(sorted.area[i]);
+        float32x4_t a_label  = vdupq_n_f32(sorted.label[i]);
+        float32x4_t threshold = vdupq_n_f32(nms_threshold);
+        float32x4_t zero     = vdupq_n_f32(0);
+        bool class_aware     = method != NMSMethod::ClassAgnostic;
+        alignas(16) uint32_t lanes[LANES];
+
+        int j = begin;
+        for(; j + LANES <= n; j += LANES){
+            float32x4_t cleft   = vmaxq_f32(a_left,   vld1q_f32(&sorted.left[j]));
+            float32x4_t ctop    = vmaxq_f32(a_top,    vld1q_f32(&sorted.top[j]));
+            float32x4_t cright  = vminq_f32(a_right,  vld1q_f32(&sorted.right[j]));
+            float32x4_t cbottom = vminq_f32(a_bottom, vld1q_f32(&sorted.bottom[j]));
+            float32x4_t c_area  = vmulq_f32(vmaxq_f32(vsubq_f32(cright, cleft), zero), vmaxq_f32(vsubq_f32(cbottom, ctop), zero));
+            float32x4_t iou     = vdivq_f32(c_area, vsubq_f32(vaddq_f32(a_area, vld1q_f32(&sorted.area[j])), c_area));
+            iou                 = vbslq_f32(vceqq_f32(c_area, zero), zero, iou);
+
+            uint32x4_t overlap = vcgtq_f32(iou, threshold);
+            if(class_aware)
+                overlap = vandq_u32(overlap, vceqq_f32(a_label, vld1q_f32(&sorted.label[j])));
+
+            vst1q_u32(lanes, overlap);
+            for(int k = 0; k < LANES; ++k){
+                if(lanes[k]) removed[j + k] = 1;
+            }
+        }
+        return j;
+    }
+#endif // CPU_KERNEL_NEON
+
+    static void greedy_nms(const float* boxes, int box_element, const SortedBoxes& sorted, float nms_threshold, NMSMethod method, bool use_simd, vector<int>& keep){
+
+        int n = sorted.index.size();
+        vector<char> removed(n, 0);
+        for(int i = 0; i < n; ++i){
+            if(removed[i]) continue;
+
+            keep.push_back(i);
+            int j = i + 1;
+            if(use_simd){
+#if defined(CPU_KERNEL_AVX2)
+                if(has_avx2())
+                    j = suppress_avx2(sorted, i, j, nms_threshold, method, removed);
+#elif defined(CPU_KERNEL_NEON)
+                j = suppress_neon(sorted, i, j, nms_threshold, method, removed);
+#endif
+            }
+            suppress_scalar(boxes, box_element, sorted, i, j, nms_threshold, method, removed);
+        }
+    }
+
+    // 每次取剩余置信度最高的box（相同时取排序靠前的），同类别的其余box按iou衰减
+    static int soft_nms(const float* boxes, int box_element, const SortedBoxes& sorted, float score_threshold, float* output){
+
+        int n = sorted.index.size();
+        vector<float> scores(n);
+        vector<char> alive(n, 1);
+        for(int i = 0; i < n; ++i)
+            scores[i] = boxes[sorted.index[i] * box_element + 4];
+
+        int num_keep = 0;
+        while(true){
+            int best = -1;
+            for(int i = 0; i < n; ++i){
+                if(alive[i] && (best == -1 || scores[i] > scores[best]))
+                    best = i;
+            }
+
+            if(best == -1 || scores[best] < score_threshold)
+                break;
+
+            const float* pbest = boxes + sorted.index[best] * box_element;
+            float* pout        = output + num_keep++ * box_element;
+            memcpy(pout, pbest, sizeof(float) * box_element);
+            pout[4]     = scores[best];
+            alive[best] = 0;
+
+            for(int j = 0; j < n; ++j){
+                if(!alive[j] || sorted.label[j] != pbest[5]) continue;
+
+                float iou  = box_nms_iou(pbest, boxes + sorted.index[j] * box_element);
+                scores[j] *= expf(-(iou * iou) / SOFT_NMS_SIGMA);
+                if(scores[j] < score_threshold)
+                    alive[j] = 0;
+            }
+        }
+        return num_keep;
+    }
+
+    int topk_sort_nms(
+        const float* boxes, int num_boxes, int box_element, int top_k,
+        float nms_threshold, NMSMethod method, float score_threshold,
+        float* output, bool use_simd, int* num_candidates){
+
+        vector<int> order;
+        int num_valid = select_topk(boxes, num_boxes, box_element, std::min(top_k, MAX_NMS_TOPK), score_threshold, order);
+        if(num_candidates) *num_candidates = num_valid;
+
+        SortedBoxes sorted;
+        sorted.build(boxes, box_element, order);
+        if(method == NMSMethod::SoftNMS)
+            return soft_nms(boxes, box_element, sorted, score_threshold, output);
+
+        vector<int> keep;
+        greedy_nms(boxes, box_element, sorted, nms_threshold, method, use_simd, keep);
+        for(int i = 0; i < (int)keep.size(); ++i)
+            memcpy(output + i * box_element, boxes + sorted.index[keep[i]] * box_element, sizeof(float) * box_element);
+        return keep.size();
+    }
+
+    int pairwise_nms(
+        const float* boxes, int num_boxes, int box_element, int max_objects,
+        float nms_threshold, float score_threshold, float* output){
+
+        vector<int> candidates;
+        for(int i = 0; i < num_boxes && (int)candidates.size() < max_objects; ++i){
+            if(boxes[i * box_element + 4] >= score_threshold)
+                candidates.push_back(i);
+        }
+
+        int num_keep = 0;
+        for(int position : candidates){
+            const float* pcurrent = boxes + position * box_element;
+            bool suppressed = false;
+            for(int i : candidates){
+                const float* pitem = boxes + i * box_element;
+                if(i == position || pcurrent[5] != pitem[5]) continue;
+
+                if(box_nms_iou(pcurrent, pitem) > nms_threshold && pitem[4] > pcurrent[4]){
+                    suppressed = true;
+                    break;
+                }
+            }
+
+            if(!suppressed)
+                memcpy(output + num_keep++ * box_element, pcurrent, sizeof(float) * box_element);
+        }
+        return num_keep;
+    }
+};
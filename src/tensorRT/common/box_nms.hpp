@@ -0,0 +1,88 @@
+
+#ifndef BOX_NMS_HPP
+#define BOX_NMS_HPP
+
+#include <math.h>
+
+#ifdef __CUDACC__
+#define BOX_NMS_HOST_DEVICE __host__ __device__
+#else
+#define BOX_NMS_HOST_DEVICE
+#endif
+
+/**
+ * @brief 检测框的NMS，box为连续的box_element个float，前6个依次为
+ *   left, top, right, bottom, confidence, label
+ * 流程为：置信度top-K（置信度相同时取索引小的）-> 按置信度降序排序 -> NMS
+ * GPU的实现在nms_kernel.cuh，CPU的实现在这里，两者对同一组box的结果逐位一致（SoftNMS除外，expf在两边有ulp级别的差异）
+ */
+enum class NMSMethod : int{
+    ClassAware    = 0,      // 只抑制同类别的box
+    ClassAgnostic = 1,      // 不区分类别
+    SoftNMS       = 2       // 同类别的box按exp(-iou^2 / sigma)衰减置信度，低于score_threshold的丢弃
+};
+
+// SoftNMS的gaussian sigma
+const float SOFT_NMS_SIGMA = 0.5f;
+
+// top_k的上限，GPU上排序在一个block的shared memory中完成
+const int MAX_NMS_TOPK = 4096;
+
+// device上使用__fmul_rn，避免与后面的加法合并为fma，保证host和device的iou逐位一致
+BOX_NMS_HOST_DEVICE inline float box_nms_mul(float a, float b){
+#ifdef __CUDA_ARCH__
+    return __fmul_rn(a, b);
+#else
+    return a * b;
+#endif
+}
+
+BOX_NMS_HOST_DEVICE inline float box_nms_area(const float* box){
+    return box_nms_mul(fmaxf(0.0f, box[2] - box[0]), fmaxf(0.0f, box[3] - box[1]));
+}
+
+BOX_NMS_HOST_DEVICE inline float box_nms_iou(const float* a, const float* b){
+
+    float cleft   = fmaxf(a[0], b[0]);
+    float ctop    = fmaxf(a[1], b[1]);
+    float cright  = fminf(a[2], b[2]);
+    float cbottom = fminf(a[3], b[3]);
+
+    float c_area = box_nms_mul(fmaxf(cright - cleft, 0.0f), fmaxf(cbottom - ctop, 0.0f));
+    if(c_area == 0.0f)
+        return 0.0f;
+
+    return c_area / (box_nms_area(a) + box_nms_area(b) - c_area);
+}
+
+// b是否会被a抑制（不考虑置信度的先后）
+BOX_NMS_HOST_DEVICE inline bool box_nms_overlap(const float* a, const float* b, float nms_threshold, NMSMethod method){
+    if(method != NMSMethod::ClassAgnostic && a[5] != b[5])
+        return false;
+    return box_nms_iou(a, b) > nms_threshold;
+}
+
+namespace CPUKernel{
+
+    /**
+     * @brief 与CUDAKernel::topk_sort_nms相同的算法
+     * boxes中confidence < score_threshold的box不参与，保留的box按置信度降序写到output（最多top_k个），返回保留的数量
+     * use_simd = false时使用标量实现，用于对照
+     * num_candidates不为空时写入top-K之前满足score_threshold的box数量
+     */
+    int topk_sort_nms(
+        const float* boxes, int num_boxes, int box_element, int top_k,
+        float nms_threshold, NMSMethod method, float score_threshold,
+        float* output, bool use_simd = true, int* num_candidates = nullptr);
+
+    /**
+     * @brief 原来yolo_decode.cu中的实现，用于对照
+     * 按输入顺序取前max_objects个有效的box（不排序），一个box只要与任意一个置信度更高的同类box的iou大于阈值就被抑制，O(N^2)
+     * 保留的box按输入顺序写到output，返回保留的数量
+     */
+    int pairwise_nms(
+        const float* boxes, int num_boxes, int box_element, int max_objects,
+        float nms_threshold, float score_threshold, float* output);
+};
+
+#endif // BOX_NMS_HPP
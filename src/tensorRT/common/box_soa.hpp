@@ -0,0 +1,228 @@
+#ifndef BOX_SOA_HPP
+#define BOX_SOA_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <assert.h>
+
+/**
+ * @brief 结构数组（SoA）形式的检测框，left、top、right、bottom、confidence、label各自连续存放
+ * 存储来自BoxSoAPool，通过BoxSoAHandle（引用计数）在worker与跟踪、绘制等消费者之间传递，不再复制，
+ * 最后一个引用释放时，对象与存储一起归还给pool，下一帧直接复用。shared_ptr的控制块同样来自pool，query没有堆分配
+ */
+class BoxSoA{
+public:
+    BoxSoA() = default;
+    BoxSoA(const BoxSoA& other) = delete;
+    BoxSoA& operator = (const BoxSoA& other) = delete;
+
+    int size()     const{return size_;}
+    int capacity() const{return capacity_;}
+    bool empty()   const{return size_ == 0;}
+
+    const float* left()       const{return data_;}
+    const float* top()        const{return data_ + capacity_;}
+    const float* right()      const{return data_ + capacity_ * 2;}
+    const float* bottom()     const{return data_ + capacity_ * 3;}
+    const float* confidence() const{return data_ + capacity_ * 4;}
+    const int*   label()      const{return (const int*)(data_ + capacity_ * 5);}
+
+    float* left()       {return data_;}
+    float* top()        {return data_ + capacity_;}
+    float* right()      {return data_ + capacity_ * 2;}
+    float* bottom()     {return data_ + capacity_ * 3;}
+    float* confidence() {return data_ + capacity_ * 4;}
+    int*   label()      {return (int*)(data_ + capacity_ * 5);}
+
+    void resize(int size){size_ = std::min(std::max(0, size), capacity_);}
+
+    // 从count个交错排列的box转置，每个box为box_element个float，前6个依次为left, top, right, bottom, confidence, label
+    void assign(const float* boxes, int count, int box_element){
+        resize(count);
+        float* pleft   = left();
+        float* ptop    = top();
+        float* pright  = right();
+        float* pbottom = bottom();
+        float* pconf   = confidence();
+        int* plabel    = label();
+        for(int i = 0; i < size_; ++i, boxes += box_element){
+            pleft[i]   = boxes[0];
+            ptop[i]    = boxes[1];
+            pright[i]  = boxes[2];
+            pbottom[i] = boxes[3];
+            pconf[i]   = boxes[4];
+            plabel[i]  = (int)boxes[5];
+        }
+    }
+
+private:
+    friend class BoxSoAPool;
+    float* data_   = nullptr;   // 6个数组，每个capacity_个元素，由BoxSoAPool持有
+    int size_      = 0;
+    int capacity_  = 0;
+    int level_     = 0;
+};
+
+typedef std::shared_ptr<BoxSoA> BoxSoAHandle;
+
+struct BoxSoAPoolStatistics{
+    long long queries        = 0;
+    long long allocated      = 0;   // 新分配的块数，稳定后不再增加
+    long long reused         = 0;
+    long long control_blocks = 0;   // 新分配的shared_ptr控制块数，稳定后同样不再增加
+    int free_blocks          = 0;
+};
+
+/**
+ * @brief BoxSoA的池，容量按64 << level分级，每级最多缓存max_free_blocks块
+ * query可以在任意线程调用，handle可以在任意线程释放。handle持有pool的引用，因此pool先于handle析构也是安全的
+ */
+class BoxSoAPool : public std::enable_shared_from_this<BoxSoAPool>{
+public:
+    static std::shared_ptr<BoxSoAPool> create(int max_free_blocks = 16){
+        return std::shared_ptr<BoxSoAPool>(new BoxSoAPool(max_free_blocks));
+    }
+
+    virtual ~BoxSoAPool(){
+        for(auto& level : free_){
+            for(auto soa : level)
+                destroy(soa);
+        }
+
+        for(auto block : free_control_blocks_)
+            ::operator delete(block);
+    }
+
+    // 至少能放下count个box，size为0
+    BoxSoAHandle query(int count){
+
+        int level = 0;
+        while((MIN_CAPACITY << level) < count) ++level;
+
+        BoxSoA* soa = nullptr;
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            statistics_.queries++;
+            if(level < (int)free_.size() && !free_[level].empty()){
+                soa = free_[level].back();
+                free_[level].pop_back();
+                statistics_.reused++;
+                statistics_.free_blocks--;
+            }else{
+                statistics_.allocated++;
+            }
+        }
+
+        if(soa == nullptr){
+            soa = new BoxSoA();
+            soa->capacity_ = MIN_CAPACITY << level;
+            soa->level_    = level;
+            soa->data_     = new float[soa->capacity_ * NUM_ARRAYS];
+        }
+        soa->size_ = 0;
+
+        // pool的引用由控制块中的allocator持有，deleter在它之前调用，这里用裸指针即可
+        BoxSoAPool* pool = this;
+        return BoxSoAHandle(soa, [pool](BoxSoA* soa){
+            pool->release(soa);
+        }, ControlBlockAllocator<BoxSoA>(shared_from_this()));
+    }
+
+    BoxSoAPoolStatistics statistics(){
+        std::unique_lock<std::mutex> l(lock_);
+        return statistics_;
+    }
+
+private:
+    /**
+     * @brief 从pool的空闲链表中分配shared_ptr的控制块
+     * 控制块析构时先销毁deleter，再用allocator的副本归还内存，因此由allocator持有pool，保证归还时pool还在
+     */
+    template<class T>
+    struct ControlBlockAllocator{
+        typedef T value_type;
+        std::shared_ptr<BoxSoAPool> pool;
+
+        ControlBlockAllocator(std::shared_ptr<BoxSoAPool> pool):pool(pool){}
+
+        template<class U>
+        ControlBlockAllocator(const ControlBlockAllocator<U>& other):pool(other.pool){}
+
+        // shared_ptr每次只分配一个控制块
+        T* allocate(size_t n){
+            static_assert(sizeof(T) <= CONTROL_BLOCK_SIZE, "Control block is larger than CONTROL_BLOCK_SIZE");
+            assert(n == 1);
+            return (T*)pool->allocate_control_block();
+        }
+
+        void deallocate(T* p, size_t n){
+            pool->deallocate_control_block(p);
+        }
+
+        template<class U> bool operator == (const ControlBlockAllocator<U>& other) const{ return pool == other.pool; }
+        template<class U> bool operator != (const ControlBlockAllocator<U>& other) const{ return pool != other.pool; }
+    };
+
+    BoxSoAPool(int max_free_blocks):max_free_blocks_(max_free_blocks){}
+
+    // 控制块的类型只有一种，统一按CONTROL_BLOCK_SIZE分配，最多缓存max_free_blocks个
+    void* allocate_control_block(){
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            if(!free_control_blocks_.empty()){
+                void* block = free_control_blocks_.back();
+                free_control_blocks_.pop_back();
+                return block;
+            }
+            statistics_.control_blocks++;
+        }
+        return ::operator new(CONTROL_BLOCK_SIZE);
+    }
+
+    void deallocate_control_block(void* block){
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            if((int)free_control_blocks_.size() < max_free_blocks_){
+                free_control_blocks_.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+    void release(BoxSoA* soa){
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            if((int)free_.size() <= soa->level_)
+                free_.resize(soa->level_ + 1);
+
+            auto& level = free_[soa->level_];
+            if((int)level.size() < max_free_blocks_){
+                level.push_back(soa);
+                statistics_.free_blocks++;
+                return;
+            }
+        }
+        destroy(soa);
+    }
+
+    static void destroy(BoxSoA* soa){
+        delete [] soa->data_;
+        delete soa;
+    }
+
+private:
+    static const int MIN_CAPACITY          = 64;
+    static const int NUM_ARRAYS            = 6;
+    static const size_t CONTROL_BLOCK_SIZE = 128;
+
+    std::mutex lock_;
+    std::vector<std::vector<BoxSoA*>> free_;
+    std::vector<void*> free_control_blocks_;
+    int max_free_blocks_ = 16;
+    BoxSoAPoolStatistics statistics_;
+};
+
+#endif // BOX_SOA_HPP
@@ -0,0 +1,31 @@
+
+#include "result_compactor.hpp"
+
+namespace CUDAKernel{
+
+	// 每个block处理一张图像，前面图像的数量之和即为这张图像在packed中的起始位置
+	static __global__ void compact_results_kernel(const float* arrays, size_t array_stride, int box_element, int* header, float* packed){
+
+		int ibatch = blockIdx.x;
+		int offset = 0;
+		for(int i = 0; i < ibatch; ++i)
+			offset += (int)arrays[i * array_stride];
+
+		const float* parray = arrays + ibatch * array_stride;
+		int count = (int)parray[0];
+		if(threadIdx.x == 0)
+			header[ibatch * 2] = count;
+
+		float* pout = packed + (size_t)offset * box_element;
+		for(int i = threadIdx.x; i < count * box_element; i += blockDim.x)
+			pout[i] = parray[1 + i];
+	}
+
+	void compact_results_invoke(
+		const float* arrays, size_t array_stride, int batch, int box_element,
+		int* header, float* packed, cudaStream_t stream){
+
+		if(batch <= 0) return;
+		checkCudaKernel(compact_results_kernel<<<batch, 256, 0, stream>>>(arrays, array_stride, box_element, header, packed));
+	}
+};
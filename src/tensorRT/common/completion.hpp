@@ -0,0 +1,209 @@
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+template<class T>
+class CompletionPool;
+
+/**
+ * @brief 轻量的完成通知，作为shared_ptr<promise> + shared_future的替代
+ * 状态对象来自CompletionPool，引用计数是侵入式的，最后一个引用释放时归还给pool，没有每个任务的堆分配
+ *   get():     阻塞直到结果就绪
+ *   ready():   非阻塞查询
+ *   then(cb):  结果就绪时在交付结果的线程（通常是worker）上调用cb，如果已经就绪则立即在当前线程调用
+ *              回调中不要做耗时的事情，它会阻塞后面任务的交付
+ * 每个Completion只能set_value一次，then只能注册一个回调
+ */
+template<class T>
+class Completion{
+public:
+    typedef std::function<void(const T&)> Callback;
+
+    Completion() = default;
+    Completion(const Completion& other):state_(other.state_){ add_ref(); }
+    Completion(Completion&& other):state_(other.state_){ other.state_ = nullptr; }
+
+    Completion& operator = (const Completion& other){
+        if(this != &other){
+            release();
+            state_ = other.state_;
+            add_ref();
+        }
+        return *this;
+    }
+
+    Completion& operator = (Completion&& other){
+        if(this != &other){
+            release();
+            state_       = other.state_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+
+    virtual ~Completion(){ release(); }
+
+    bool valid() const{ return state_ != nullptr; }
+
+    bool ready() const{
+        return state_ != nullptr && state_->ready.load(std::memory_order_acquire);
+    }
+
+    const T& get() const{
+        if(!ready()){
+            std::unique_lock<std::mutex> l(state_->lock);
+            state_->num_waiters++;
+            state_->cond.wait(l, [&](){ return state_->ready.load(std::memory_order_relaxed); });
+            state_->num_waiters--;
+        }
+        return state_->value;
+    }
+
+    void then(const Callback& callback){
+        {
+            std::unique_lock<std::mutex> l(state_->lock);
+            if(!state_->ready.load(std::memory_order_relaxed)){
+                state_->callback = callback;
+                return;
+            }
+        }
+        callback(state_->value);
+    }
+
+    // 由交付结果的一方调用
+    void set_value(const T& value){
+        Callback callback;
+        bool notify = false;
+        {
+            std::unique_lock<std::mutex> l(state_->lock);
+            state_->value = value;
+            state_->ready.store(true, std::memory_order_release);
+            callback.swap(state_->callback);
+            notify = state_->num_waiters > 0;
+        }
+
+        if(notify) state_->cond.notify_all();
+        if(callback) callback(state_->value);
+    }
+
+private:
+    friend class CompletionPool<T>;
+
+    struct State{
+        std::atomic<int> refcount{0};
+        std::atomic<bool> ready{false};
+        T value;
+        Callback callback;
+        int num_waiters = 0;
+        std::mutex lock;
+        std::condition_variable cond;
+
+        // 被持有时引用pool，保证pool在最后一个Completion之后析构
+        std::shared_ptr<CompletionPool<T>> pool;
+    };
+
+    explicit Completion(State* state):state_(state){ add_ref(); }
+
+    void add_ref(){
+        if(state_) state_->refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(){
+        if(state_ && state_->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            CompletionPool<T>::recycle(state_);
+        state_ = nullptr;
+    }
+
+    State* state_ = nullptr;
+};
+
+struct CompletionPoolStatistics{
+    long long acquired  = 0;
+    long long allocated = 0;    // 新分配的状态对象数，稳定后不再增加
+    int free_states     = 0;
+};
+
+/**
+ * @brief Completion的状态对象池，最多缓存max_free_states个空闲对象
+ */
+template<class T>
+class CompletionPool : public std::enable_shared_from_this<CompletionPool<T>>{
+public:
+    typedef typename Completion<T>::State State;
+
+    static std::shared_ptr<CompletionPool> create(int max_free_states = 4096){
+        return std::shared_ptr<CompletionPool>(new CompletionPool(max_free_states));
+    }
+
+    virtual ~CompletionPool(){
+        for(auto state : free_)
+            delete state;
+    }
+
+    Completion<T> acquire(){
+
+        State* state = nullptr;
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            statistics_.acquired++;
+            if(!free_.empty()){
+                state = free_.back();
+                free_.pop_back();
+            }else{
+                statistics_.allocated++;
+            }
+        }
+
+        if(state == nullptr)
+            state = new State();
+
+        state->pool = this->shared_from_this();
+        return Completion<T>(state);
+    }
+
+    CompletionPoolStatistics statistics(){
+        std::unique_lock<std::mutex> l(lock_);
+        CompletionPoolStatistics output = statistics_;
+        output.free_states = free_.size();
+        return output;
+    }
+
+private:
+    friend class Completion<T>;
+
+    CompletionPool(int max_free_states):max_free_states_(max_free_states){}
+
+    static void recycle(State* state){
+
+        // 先取出pool的引用，归还之后再释放，pool可能在这里析构
+        std::shared_ptr<CompletionPool> pool;
+        pool.swap(state->pool);
+        state->ready.store(false, std::memory_order_relaxed);
+        state->value       = T();
+        state->callback    = nullptr;
+        state->num_waiters = 0;
+
+        {
+            std::unique_lock<std::mutex> l(pool->lock_);
+            if((int)pool->free_.size() < pool->max_free_states_){
+                pool->free_.push_back(state);
+                return;
+            }
+        }
+        delete state;
+    }
+
+private:
+    std::mutex lock_;
+    std::vector<State*> free_;
+    int max_free_states_ = 4096;
+    CompletionPoolStatistics statistics_;
+};
+
+#endif // COMPLETION_HPP
@@ -28,6 +28,26 @@ namespace CUDATools{
         return true;
     }
 
+    bool is_pinned_memory(const void* ptr){
+        if(ptr == nullptr) return false;
+
+        cudaPointerAttributes attributes;
+        if(cudaPointerGetAttributes(&attributes, ptr) != cudaSuccess){
+            // 旧版本的cuda对普通的pageable内存会返回错误，这里清除掉，避免影响后续的检查
+            cudaGetLastError();
+            return false;
+        }
+        return attributes.type == cudaMemoryTypeHost;
+    }
+
+    bool register_host_memory(void* ptr, size_t size){
+        return checkCudaRuntime(cudaHostRegister(ptr, size, cudaHostRegisterDefault));
+    }
+
+    bool unregister_host_memory(void* ptr){
+        return checkCudaRuntime(cudaHostUnregister(ptr));
+    }
+
     dim3 grid_dims(int numJobs) {
         int numBlockThreads = numJobs < GPU_BLOCK_THREADS ? numJobs : GPU_BLOCK_THREADS;
         return dim3(((numJobs + numBlockThreads - 1) / (float)numBlockThreads));
@@ -50,6 +50,13 @@ namespace CUDATools{
     bool check_driver(CUresult e, const char* call, int iLine, const char *szFile);
     bool check_runtime(cudaError_t e, const char* call, int iLine, const char *szFile);
 
+    // ptr是否为页锁定内存（cudaMallocHost分配或者cudaHostRegister注册过），页锁定内存可以直接异步拷贝到device
+    bool is_pinned_memory(const void* ptr);
+
+    // 把已有的host内存注册为页锁定内存，注册后is_pinned_memory返回true，用完需要unregister
+    bool register_host_memory(void* ptr, size_t size);
+    bool unregister_host_memory(void* ptr);
+
     dim3 grid_dims(int numJobs);
     dim3 block_dims(int numJobs);
 
@@ -370,11 +370,17 @@ namespace iLogger{
         shared_ptr<FILE> handler;
         bool logger_shutdown{false};
 
+        // 全局对象，静态初始化为0
+        atomic<long long> lines_[ILOGGER_VERBOSE + 1];
+        atomic<long long> dropped_;
+
         void write(const string& line) {
 
             lock_guard<mutex> l(logger_lock_);
-            if(logger_shutdown) 
+            if(logger_shutdown){
+                dropped_++;
                 return;
+            }
 
             if (!keep_run_) {
 
@@ -524,11 +530,22 @@ namespace iLogger{
         return __g_logger.logger_level;
     }
 
+    LoggerStatistics logger_statistics(){
+        LoggerStatistics output;
+        for(int i = 0; i <= ILOGGER_VERBOSE; ++i)
+            output.lines[i] = __g_logger.lines_[i];
+        output.dropped = __g_logger.dropped_;
+        return output;
+    }
+
     void __log_func(const char* file, int line, int level, const char* fmt, ...) {
 
         if(level > __g_logger.logger_level)
             return;
 
+        if(level >= 0 && level <= ILOGGER_VERBOSE)
+            __g_logger.lines_[level]++;
+
         string now = time_now();
         va_list vl;
         va_start(vl, fmt);
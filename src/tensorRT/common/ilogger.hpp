@@ -84,6 +84,13 @@ namespace iLogger{
     void __log_func(const char* file, int line, int level, const char* fmt, ...);
     void destroy_logger();
 
+    // lines为各级别输出的行数，dropped为logger关闭之后没有写入日志文件的行数
+    struct LoggerStatistics{
+        long long lines[ILOGGER_VERBOSE + 1] = {0};
+        long long dropped = 0;
+    };
+    LoggerStatistics logger_statistics();
+
     string base64_decode(const string& base64);
     string base64_encode(const void* data, size_t size);
     string get_random_temp_file_name();
@@ -7,9 +7,59 @@
 #include <mutex>
 #include <thread>
 #include <queue>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <infer/trt_infer.hpp>
 #include "monopoly_allocator.hpp"
+#include "mpmc_queue.hpp"
+#include "job_option.hpp"
+#include "completion.hpp"
+#include "infer_metrics.hpp"
+#include "infer_trace.hpp"
+#include "cuda_tools.hpp"
+#include "ilogger.hpp"
+
+enum class JobQueueType : int{
+    Mutex    = 0,     // std::queue + mutex，默认方式
+    LockFree = 1      // 有界无锁队列，worker采用先自旋再挂起的等待方式，适合很多线程同时commit
+};
+
+// 动态batch策略，worker拿到第一个任务后，最多再等待max_wait_ms凑够target_batch_size个任务
+// 窗口内若有任务的deadline先到，则提前推理，max_wait_ms = 0时关闭（拿到任务立即返回）
+struct BatchingPolicy{
+    int   target_batch_size = 0;    // 0表示使用worker的max_batch_size
+    float max_wait_ms       = 0;
+};
+
+// 队列满时的处理方式
+enum class OverloadPolicy : int{
+    Block      = 0,     // commit阻塞，直到队列有空位
+    Reject     = 1,     // 新任务直接返回空结果
+    DropOldest = 2      // 丢弃不高于新任务优先级的最旧任务（LockFree时只丢弃同一优先级的），没有可丢弃的则拒绝新任务
+};
+
+struct AdmissionPolicy{
+    // Mutex时为所有优先级的任务总数上限，0表示不限制
+    // LockFree时不作为总数上限，只用于设置每个优先级队列的容量（向上取整到2的幂），各优先级的队列互不影响，
+    // DropOldest也只丢弃同一优先级队列中最旧的任务（丢弃其他队列的任务不会腾出空位）
+    int max_queue_size      = 0;
+    OverloadPolicy overload = OverloadPolicy::Block;
+
+    // 防饿死，高优先级连续插队starvation_limit次后，让低优先级的任务执行一次，0表示严格按优先级
+    int starvation_limit    = 8;
+};
+
+struct JobQueueStatistics{
+    long long committed = 0;        // 进入队列的任务数
+    long long rejected  = 0;
+    long long dropped   = 0;
+    long long blocked   = 0;        // commit因为队列满而等待的次数
+    long long abandoned = 0;        // stop时还在队列中、交付了空结果的任务数
+    int queue_size      = 0;
+};
 
 template<class Input, class Output, class StartParam=std::tuple<std::string, int>, class JobAdditional=int>
 class InferController{
@@ -19,117 +69,919 @@ public:
         Output output;
         JobAdditional additional;
         MonopolyAllocator<TRT::Tensor>::MonopolyDataPointer mono_tensor;
-        std::shared_ptr<std::promise<Output>> pro;
+        std::shared_ptr<std::promise<Output>> pro;     // commit提交的任务
+        Completion<Output> completion;                  // commit_async提交的任务
+        double commit_time = 0;     // now_ms，单调时钟
+        double deadline    = 0;     // 0表示不限制
+        int priority       = (int)JobPriority::Normal;
+        InferMetrics* metrics = nullptr;    // 不为空时，交付时记录EndToEnd
+        long long trace_id    = 0;          // 不为0时，交付时结束InferTrace中这个任务的异步区间
+        const char* trace_category = nullptr;
+
+        // 交付结果，worker中统一使用这个，而不是直接访问pro
+        void set_value(const Output& value){
+            // 先记录再交付，拿到结果的一方读到的统计已经包含这个任务
+            if(metrics) metrics->record_ms(InferStage::EndToEnd, now_ms() - commit_time);
+            if(trace_id) InferTrace::async_end("job", trace_category, trace_id);
+            if(pro) pro->set_value(value);
+            else if(completion.valid()) completion.set_value(value);
+        }
     };
 
     virtual ~InferController(){
         stop();
     }
 
+    // 单调时钟，毫秒。commit_time、deadline以及排队时间都基于它，不受系统时间调整的影响
+    static double now_ms(){
+        return LatencyHistogram::now_us() / 1000.0;
+    }
+
     void stop(){
-        run_ = false;
+        {
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            run_ = false;
+        };
         cond_.notify_all();
+        space_cond_.notify_all();
 
         if(worker_){
             worker_->join();
             worker_.reset();
         }
+
+        // worker已经退出，队列中剩下的任务不会再被处理，交付空结果，
+        // 否则commit的future会抛broken_promise，commit_async的get会一直等待、then的回调不会被调用
+        abandon_queued_jobs();
+        release_stage_events();
+    }
+
+    // 需要在startup之前调用，capacity仅对LockFree有效（每个优先级一个队列，会向上取整到2的幂）
+    void set_job_queue(JobQueueType type, int capacity = 1024){
+        queue_type_ = type;
+        for(int i = 0; i < NUM_PRIORITY; ++i){
+            if(type == JobQueueType::LockFree)
+                lockfree_jobs_[i] = std::make_shared<MPMCQueue<Job>>(capacity);
+            else
+                lockfree_jobs_[i].reset();
+        }
+    }
+
+    JobQueueType job_queue_type() const{ return queue_type_; }
+
+    void set_batching_policy(const BatchingPolicy& policy){ batching_ = policy; }
+    BatchingPolicy batching_policy() const{ return batching_; }
+
+    // 需要在startup之前调用
+    void set_admission_policy(const AdmissionPolicy& policy){ admission_ = policy; }
+    AdmissionPolicy admission_policy() const{ return admission_; }
+
+    JobQueueStatistics job_queue_statistics(){
+        JobQueueStatistics out;
+        out.committed  = num_committed_;
+        out.rejected   = num_rejected_;
+        out.dropped    = num_dropped_;
+        out.abandoned  = num_abandoned_;
+        out.blocked    = num_blocked_;
+        out.queue_size = queue_size();
+        return out;
+    }
+
+    int queue_size(){
+        if(queue_type_ == JobQueueType::LockFree){
+            size_t size = 0;
+            for(int i = 0; i < NUM_PRIORITY; ++i)
+                size += lockfree_jobs_[i]->size_approx();
+            return size;
+        }
+        return num_jobs_;
+    }
+
+    // 排队中的任务加上worker正在处理的batch，作为副本池分发时的负载
+    int pending_jobs(){
+        return queue_size() + num_inflight_;
     }
 
     bool startup(const StartParam& param){
         run_ = true;
 
+        // LockFree时队列上限由每个优先级队列的容量决定
+        if(queue_type_ == JobQueueType::LockFree && admission_.max_queue_size > 0)
+            set_job_queue(queue_type_, admission_.max_queue_size);
+
         std::promise<bool> pro;
         start_param_ = param;
-        worker_      = std::make_shared<std::thread>(&InferController::worker, this, std::ref(pro));
+        worker_      = std::make_shared<std::thread>([this, &pro](){
+            InferTrace::set_thread_name(std::string(trace_category_) + " worker");
+            worker(pro);
+        });
         return pro.get_future().get();
     }
 
     virtual std::shared_future<Output> commit(const Input& input){
+        return commit(input, JobOption());
+    }
+
+    virtual std::shared_future<Output> commit(const Input& input, const JobOption& option){
+        return commit_with(option, [&](Job& job){
+            return preprocess(job, input);
+        });
+    }
+
+    virtual std::vector<std::shared_future<Output>> commits(const std::vector<Input>& inputs){
+        return commits(inputs, JobOption());
+    }
+
+    /**
+     * @brief commit的替代，返回池化的Completion，没有promise/future的堆分配，
+     * 可以poll（ready）、阻塞get，或者用then注册在worker线程上调用的回调，
+     * 适合事件循环式的调用方，不需要为每个等待中的结果占用一个线程
+     * stop时还在队列中的任务会交付Output()，回调在调用stop的线程上执行
+     */
+    Completion<Output> commit_async(const Input& input, const JobOption& option = JobOption()){
+        return commit_async_with(option, [&](Job& job){
+            return preprocess(job, input);
+        });
+    }
+
+    /**
+     * @brief 各阶段耗时、batch大小、队列深度的直方图，记录是无锁的，可以一直开着
+     * 用metrics().to_json().toStyledString()输出为JSON
+     */
+    InferMetricsSnapshot metrics(){
+        auto output       = metrics_.snapshot(metrics_name_);
+        output.queue_size = queue_size();
+        output.inflight   = num_inflight_;
+        if(tensor_allocator_){
+            auto allocator = tensor_allocator_->statistics();
+            output.stages[(int)InferStage::AllocatorWait] = tensor_allocator_->wait_histogram().snapshot();
+            output.allocator_capacity  = allocator.capacity;
+            output.allocator_occupancy = std::max(0, allocator.capacity - allocator.available);
+            output.allocator_peak      = allocator.peak_occupancy;
+        }
+        return output;
+    }
+
+    void reset_metrics(){
+        metrics_.reset();
+        if(tensor_allocator_)
+            tensor_allocator_->wait_histogram().reset();
+    }
+
+    // 需要在startup之前调用，JSON中用于区分模型，同时作为InferTrace中的category和worker线程名
+    void set_metrics_name(const std::string& name){
+        metrics_name_   = name;
+        trace_category_ = InferTrace::intern(name);
+    }
+
+    CompletionPoolStatistics completion_statistics(){
+        return completion_pool_->statistics();
+    }
+
+    virtual std::vector<std::shared_future<Output>> commits(const std::vector<Input>& inputs, const JobOption& option){
+        return commits_with(inputs.size(), option, [&](Job& job, int index){
+            return preprocess(job, inputs[index]);
+        });
+    }
+
+    // commits的Completion版本，所有任务一起进入队列，worker可以在同一个batch中取到，适合一帧中的所有crop
+    std::vector<Completion<Output>> commits_async(const std::vector<Input>& inputs, const JobOption& option = JobOption()){
+        return commits_async_with(inputs.size(), option, [&](Job& job, int index){
+            return preprocess(job, inputs[index]);
+        });
+    }
+
+protected:
+    virtual void worker(std::promise<bool>& result) = 0;
+    virtual bool preprocess(Job& job, const Input& input) = 0;
+
+    /**
+     * @brief 由preprocess_function完成预处理后进入队列，用于Input以外的输入类型，
+     * 例如直接提交YUV平面，preprocess_function的签名为bool(Job& job)
+     */
+    template<class _PreprocessFunction>
+    std::shared_future<Output> commit_with(const JobOption& option, const _PreprocessFunction& preprocess_function){
 
         Job job;
         job.pro = std::make_shared<std::promise<Output>>();
-        if(!preprocess(job, input)){
-            job.pro->set_value(Output());
-            return job.pro->get_future();
+        std::shared_future<Output> future = job.pro->get_future();
+        submit_job(job, option, preprocess_function);
+        return future;
+    }
+
+    // commit_with的Completion版本
+    template<class _PreprocessFunction>
+    Completion<Output> commit_async_with(const JobOption& option, const _PreprocessFunction& preprocess_function){
+
+        Job job;
+        job.completion = completion_pool_->acquire();
+        Completion<Output> completion = job.completion;
+        submit_job(job, option, preprocess_function);
+        return completion;
+    }
+
+    /**
+     * @brief 一组任务，preprocess_function(Job& job, int index)预处理第index个，签名为bool(Job&, int)
+     * 用于共用一次上传的输入，例如同一张图像上的多个框
+     */
+    template<class _PreprocessFunction>
+    std::vector<std::shared_future<Output>> commits_with(int count, const JobOption& option, const _PreprocessFunction& preprocess_function){
+
+        std::vector<std::shared_future<Output>> results(count);
+        submit_jobs(count, option, [&](Job& job, int index){
+            job.pro        = std::make_shared<std::promise<Output>>();
+            results[index] = job.pro->get_future();
+        }, preprocess_function);
+        return results;
+    }
+
+    template<class _PreprocessFunction>
+    std::vector<Completion<Output>> commits_async_with(int count, const JobOption& option, const _PreprocessFunction& preprocess_function){
+
+        std::vector<Completion<Output>> results(count);
+        submit_jobs(count, option, [&](Job& job, int index){
+            job.completion = completion_pool_->acquire();
+            results[index] = job.completion;
+        }, preprocess_function);
+        return results;
+    }
+
+    template<class _MakeResult, class _PreprocessFunction>
+    void submit_jobs(int count, const JobOption& option, const _MakeResult& make_result, const _PreprocessFunction& preprocess_function){
+
+        std::vector<Job> jobs;
+        jobs.reserve(commit_chunk_size_ > 0 ? std::min(count, commit_chunk_size_) : count);
+
+        for(int i = 0; i < count; ++i){
+            Job job;
+            make_result(job, i);
+            setup_job_option(job, option);
+
+            // 预处理失败的任务已经给出了结果，不再进入队列
+            long long preprocess_begin = LatencyHistogram::now_us();
+            bool preprocess_ok = preprocess_function(job, i);
+            long long preprocess_end   = LatencyHistogram::now_us();
+            InferTrace::complete("preprocess", trace_category_, preprocess_begin, preprocess_end);
+            if(!preprocess_ok){
+                job.metrics = nullptr;
+                job.set_value(Output());
+                continue;
+            }
+            metrics_.record(InferStage::Preprocess, preprocess_end - preprocess_begin);
+            jobs.emplace_back(std::move(job));
+
+            // 先放入队列，worker才会归还这些任务的tensor，否则任务数超过allocator的容量时，query会一直等待自己
+            if(commit_chunk_size_ > 0 && (int)jobs.size() >= commit_chunk_size_){
+                push_jobs(jobs);
+                jobs.clear();
+            }
+        }
+        push_jobs(jobs);
+    }
+
+    template<class _PreprocessFunction>
+    void submit_job(Job& job, const JobOption& option, const _PreprocessFunction& preprocess_function){
+
+        setup_job_option(job, option);
+        long long preprocess_begin = LatencyHistogram::now_us();
+        bool preprocess_ok = preprocess_function(job);
+        long long preprocess_end   = LatencyHistogram::now_us();
+        InferTrace::complete("preprocess", trace_category_, preprocess_begin, preprocess_end);
+        if(!preprocess_ok){
+            job.metrics = nullptr;
+            job.set_value(Output());
+            return;
         }
-        
+        metrics_.record(InferStage::Preprocess, preprocess_end - preprocess_begin);
         ///////////////////////////////////////////////////////////
+        if(queue_type_ == JobQueueType::LockFree){
+            push_lockfree_job(job);
+            wakeup_worker();
+            return;
+        }
+
+        if(push_job(job))
+            cond_.notify_one();
+    }
+
+    virtual bool get_jobs_and_wait(std::vector<Job>& fetch_jobs, int max_size){
+
+        // worker回来取任务，说明上一个batch已经处理完
+        num_inflight_ = 0;
+        long long wait_begin = InferTrace::enabled() ? InferTrace::now_us() : 0;
+        if(queue_type_ == JobQueueType::LockFree){
+            if(!wait_lockfree_jobs()) return false;
+            pop_jobs(fetch_jobs, max_size);
+        }else{
+            {
+                std::unique_lock<std::mutex> l(jobs_lock_);
+                cond_.wait(l, [&](){
+                    return !run_ || num_jobs_ > 0;
+                });
+
+                if(!run_) return false;
+
+                Job job;
+                for(int i = 0; i < max_size && pop_job_by_priority(job); ++i)
+                    fetch_jobs.emplace_back(std::move(job));
+            };
+            notify_space();
+        }
+
+        if(batching_.max_wait_ms > 0 && !fetch_jobs.empty())
+            wait_batch_window(fetch_jobs, max_size);
+
+        num_inflight_ = fetch_jobs.size();
+        record_fetched_jobs(fetch_jobs);
+        if(wait_begin) InferTrace::complete("wait_jobs", trace_category_, wait_begin, InferTrace::now_us(), "batch", fetch_jobs.size());
+        return true;
+    }
+
+    virtual bool get_job_and_wait(Job& fetch_job){
+
+        num_inflight_ = 0;
+        long long wait_begin = InferTrace::enabled() ? InferTrace::now_us() : 0;
+        if(queue_type_ == JobQueueType::LockFree){
+            while(wait_lockfree_jobs()){
+                if(pop_job_by_priority(fetch_job)){
+                    num_inflight_ = 1;
+                    record_fetched_job(fetch_job, 1);
+                    if(wait_begin) InferTrace::complete("wait_jobs", trace_category_, wait_begin, InferTrace::now_us(), "batch", 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
         {
             std::unique_lock<std::mutex> l(jobs_lock_);
-            jobs_.push(job);
+            cond_.wait(l, [&](){
+                return !run_ || num_jobs_ > 0;
+            });
+
+            if(!run_) return false;
+            pop_job_by_priority(fetch_job);
         };
-        cond_.notify_one();
-        return job.pro->get_future();
+        num_inflight_ = 1;
+        notify_space();
+        record_fetched_job(fetch_job, 1);
+        if(wait_begin) InferTrace::complete("wait_jobs", trace_category_, wait_begin, InferTrace::now_us(), "batch", 1);
+        return true;
     }
 
-    virtual std::vector<std::shared_future<Output>> commits(const std::vector<Input>& inputs){
+    typedef std::function<void(std::vector<Job>& jobs, int slot)> PipelineStage;
+
+    /**
+     * @brief 流水线式的worker循环，最多num_slots个batch同时在途，每个slot对应一套输入输出缓冲区
+     *   launch:  把batch的拷贝、推理、解码以及结果下载异步提交到stream上，不等待完成
+     *   deliver: 等待该slot上的异步操作完成，解析结果并交付
+     * 有新任务时先提交，slot用完了才交付最旧的batch，因此第k+1个batch提交时，第k个batch在推理，
+     * 第k-1个batch在交付。没有新任务时交付最旧的batch。num_slots = 1时等价于顺序执行
+     */
+    void run_pipeline(int max_batch_size, int num_slots, const PipelineStage& launch, const PipelineStage& deliver){
+
+        struct InFlight{
+            std::vector<Job> jobs;
+            int slot = 0;
+        };
+
+        std::deque<InFlight> inflight;
+        int num_inflight_jobs = 0;
+        int next_slot = 0;
+        num_slots = std::max(1, num_slots);
+
+        auto deliver_oldest = [&](){
+            auto& batch = inflight.front();
+            long long deliver_begin = LatencyHistogram::now_us();
+            deliver(batch.jobs, batch.slot);
+
+            long long deliver_end = LatencyHistogram::now_us();
+            metrics_.record(InferStage::Delivery, deliver_end - deliver_begin);
+            InferTrace::complete("deliver", trace_category_, deliver_begin, deliver_end, "slot", batch.slot);
+            collect_stage_events(batch.slot);
+            num_inflight_jobs -= batch.jobs.size();
+            inflight.pop_front();
+        };
+
+        while(true){
+            InFlight batch;
+            if(inflight.empty()){
+                if(!get_jobs_and_wait(batch.jobs, max_batch_size))
+                    break;
+            }else{
+                if(!run_) break;
+                pop_jobs(batch.jobs, max_batch_size);
+                record_fetched_jobs(batch.jobs);
+            }
+
+            if(batch.jobs.empty()){
+                deliver_oldest();
+                num_inflight_ = num_inflight_jobs;
+                continue;
+            }
 
-        std::vector<Job> jobs(inputs.size());
-        std::vector<std::shared_future<Output>> results(inputs.size());
+            if((int)inflight.size() >= num_slots)
+                deliver_oldest();
 
-        for(int i = 0; i < inputs.size(); ++i){
-            Job& job = jobs[i];
-            job.pro = std::make_shared<std::promise<Output>>();
-            if(!preprocess(job, inputs[i])){
-                job.pro->set_value(Output());
+            // 交付是按顺序的，所以轮转到的slot一定已经空闲
+            batch.slot = next_slot;
+            next_slot  = (next_slot + 1) % num_slots;
+            {
+                InferTrace::Span span("launch", trace_category_, "batch", batch.jobs.size());
+                launch(batch.jobs, batch.slot);
             }
-            results[i] = job.pro->get_future();
+
+            num_inflight_jobs += batch.jobs.size();
+            num_inflight_ = num_inflight_jobs;
+            inflight.emplace_back(std::move(batch));
         }
-        
-        ///////////////////////////////////////////////////////////
+
+        // 退出前把已经提交的batch交付完
+        while(!inflight.empty())
+            deliver_oldest();
+        num_inflight_ = 0;
+        release_stage_events();
+    }
+
+    /**
+     * @brief 标记stream上一个异步阶段（通常是Forward、Decode）的开始和结束，在launch中调用
+     * run_pipeline在这个slot交付之后统计两个事件之间的GPU耗时；自己写循环的worker在同步之后调用collect_stage_events
+     * 只能在worker线程上调用
+     */
+    void stage_event_begin(int islot, InferStage stage, cudaStream_t stream){
+        record_stage_event(islot, stage, stream, true);
+    }
+
+    void stage_event_end(int islot, InferStage stage, cudaStream_t stream){
+        record_stage_event(islot, stage, stream, false);
+    }
+
+    void collect_stage_events(int islot){
+
+        if(islot >= (int)stage_events_.size()) return;
+
+        auto& events = stage_events_[islot];
+        for(int i = 0; i < (int)InferStage::NumStage; ++i){
+            if(!events.marked[i]) continue;
+
+            float ms = 0;
+            events.marked[i] = false;
+            checkCudaRuntime(cudaEventSynchronize(events.end[i]));
+            checkCudaRuntime(cudaEventElapsedTime(&ms, events.begin[i], events.end[i]));
+            metrics_.record_ms((InferStage)i, ms);
+        }
+    }
+
+    void release_stage_events(){
+        for(auto& events : stage_events_){
+            for(int i = 0; i < (int)InferStage::NumStage; ++i){
+                if(events.begin[i]) checkCudaRuntime(cudaEventDestroy(events.begin[i]));
+                if(events.end[i])   checkCudaRuntime(cudaEventDestroy(events.end[i]));
+            }
+        }
+        stage_events_.clear();
+    }
+
+    // 一组任务放入队列后只唤醒一次worker
+    void push_jobs(std::vector<Job>& jobs){
+
+        if(jobs.empty()) return;
+        if(queue_type_ == JobQueueType::LockFree){
+            for(auto& job : jobs)
+                push_lockfree_job(job);
+            wakeup_worker();
+            return;
+        }
+
+        for(auto& job : jobs)
+            push_job(job);
+
+        cond_.notify_one();
+    }
+
+    // 不阻塞，取出最多max_size个任务
+    int pop_jobs(std::vector<Job>& fetch_jobs, int max_size){
+
+        int count = 0;
+        Job job;
+        if(queue_type_ == JobQueueType::LockFree){
+            for(; count < max_size && pop_job_by_priority(job); ++count)
+                fetch_jobs.emplace_back(std::move(job));
+            return count;
+        }
+
         {
             std::unique_lock<std::mutex> l(jobs_lock_);
-            for(auto& job : jobs)
-                jobs_.emplace(std::move(job));
+            for(; count < max_size && pop_job_by_priority(job); ++count)
+                fetch_jobs.emplace_back(std::move(job));
         };
 
-        cond_.notify_one();
-        return results;
+        if(count > 0)
+            notify_space();
+        return count;
     }
 
-protected:
-    virtual void worker(std::promise<bool>& result) = 0;
-    virtual bool preprocess(Job& job, const Input& input) = 0;
-    
-    virtual bool get_jobs_and_wait(std::vector<Job>& fetch_jobs, int max_size){
+    // 等待新任务到来或者超时
+    void wait_jobs_for(double timeout_ms){
+
+        auto timeout = std::chrono::microseconds((long long)(timeout_ms * 1000));
+        if(queue_type_ == JobQueueType::LockFree){
+            num_parked_++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> l(jobs_lock_);
+                cond_.wait_for(l, timeout, [&](){
+                    return !run_ || has_jobs();
+                });
+            }
+            num_parked_--;
+            return;
+        }
 
         std::unique_lock<std::mutex> l(jobs_lock_);
-        cond_.wait(l, [&](){
-            return !run_ || !jobs_.empty();
+        cond_.wait_for(l, timeout, [&](){
+            return !run_ || has_jobs();
         });
+    }
+
+    // 凑batch，直到满足target_batch_size、窗口结束或者某个任务的deadline到达
+    void wait_batch_window(std::vector<Job>& fetch_jobs, int max_size){
+
+        int target_size = max_size;
+        if(batching_.target_batch_size > 0)
+            target_size = std::min(batching_.target_batch_size, max_size);
+
+        // 窗口从最早commit的任务开始计算，保证任务的排队延迟不超过max_wait_ms
+        double flush_time = fetch_jobs[0].commit_time + batching_.max_wait_ms;
+        for(auto& job : fetch_jobs){
+            flush_time = std::min(flush_time, job.commit_time + batching_.max_wait_ms);
+            if(job.deadline > 0)
+                flush_time = std::min(flush_time, job.deadline);
+        }
+
+        while(run_ && (int)fetch_jobs.size() < target_size){
+            double remain = flush_time - now_ms();
+            if(remain <= 0) break;
+
+            wait_jobs_for(remain);
+
+            int old_size = fetch_jobs.size();
+            pop_jobs(fetch_jobs, target_size - old_size);
+            for(int i = old_size; i < (int)fetch_jobs.size(); ++i){
+                if(fetch_jobs[i].deadline > 0)
+                    flush_time = std::min(flush_time, fetch_jobs[i].deadline);
+            }
+        }
+    }
 
-        if(!run_) return false;
-        
-        for(int i = 0; i < max_size && !jobs_.empty(); ++i){
-            fetch_jobs.emplace_back(std::move(jobs_.front()));
-            jobs_.pop();
+    void setup_job_option(Job& job, const JobOption& option){
+        job.metrics     = &metrics_;
+        job.commit_time = now_ms();
+        job.priority    = std::max(0, std::min(NUM_PRIORITY - 1, (int)option.priority));
+        if(option.deadline_ms > 0)
+            job.deadline = job.commit_time + option.deadline_ms;
+
+        if(InferTrace::enabled()){
+            job.trace_id       = InferTrace::next_id();
+            job.trace_category = trace_category_;
+            InferTrace::async_begin("job", trace_category_, job.trace_id);
+        }
+    }
+
+    // worker取到任务时记录排队时间、batch大小以及当时的队列深度
+    void record_fetched_job(const Job& job, int batch_size){
+        metrics_.record_ms(InferStage::QueueWait, now_ms() - job.commit_time);
+        metrics_.record_batch(batch_size, queue_size() + batch_size);
+        if(job.trace_id) InferTrace::async_instant("batched", trace_category_, job.trace_id, "batch", batch_size);
+    }
+
+    void record_fetched_jobs(const std::vector<Job>& jobs){
+
+        if(jobs.empty()) return;
+
+        double now = now_ms();
+        for(auto& job : jobs){
+            metrics_.record_ms(InferStage::QueueWait, now - job.commit_time);
+            if(job.trace_id) InferTrace::async_instant("batched", trace_category_, job.trace_id, "batch", jobs.size());
+        }
+        metrics_.record_batch(jobs.size(), queue_size() + jobs.size());
+    }
+
+    void record_stage_event(int islot, InferStage stage, cudaStream_t stream, bool begin){
+
+        if(islot >= (int)stage_events_.size())
+            stage_events_.resize(islot + 1);
+
+        auto& events = stage_events_[islot];
+        auto& event  = begin ? events.begin[(int)stage] : events.end[(int)stage];
+        if(event == nullptr)
+            checkCudaRuntime(cudaEventCreate(&event));
+
+        checkCudaRuntime(cudaEventRecord(event, stream));
+        if(!begin) events.marked[(int)stage] = true;
+    }
+
+    // 被拒绝或者丢弃的任务，归还tensor并交付空结果
+    void abandon_job(Job& job){
+        job.metrics = nullptr;
+        if(job.mono_tensor){
+            job.mono_tensor->release();
+            job.mono_tensor.reset();
+        }
+        job.set_value(Output());
+    }
+
+    // 取出队列中所有的任务并交付空结果，worker退出之后调用
+    void abandon_queued_jobs(){
+
+        std::vector<Job> jobs;
+        {
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            Job job;
+            for(int i = 0; i < NUM_PRIORITY; ++i){
+                while(pop_job_from(i, job))
+                    jobs.emplace_back(std::move(job));
+            }
+        };
+
+        for(auto& job : jobs)
+            abandon_job(job);
+        num_abandoned_ += jobs.size();
+        notify_space();
+    }
+
+    // Mutex队列的入队，返回false表示任务被拒绝
+    bool push_job(Job& job){
+
+        Job dropped_job;
+        bool has_dropped = false;
+        {
+            // stop之后不再入队，队列已经清空，不会再有worker交付结果
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            bool rejected = !run_;
+            int max_size  = admission_.max_queue_size;
+            if(!rejected && max_size > 0 && num_jobs_ >= max_size){
+
+                if(admission_.overload == OverloadPolicy::Block){
+                    num_blocked_++;
+                    num_space_waiters_++;
+                    space_cond_.wait(l, [&](){
+                        return !run_ || num_jobs_ < max_size;
+                    });
+                    num_space_waiters_--;
+                    rejected = !run_;
+                }else if(admission_.overload == OverloadPolicy::DropOldest){
+                    has_dropped = pop_oldest_job(job.priority, dropped_job);
+                    rejected    = !has_dropped;
+                }else{
+                    rejected = true;
+                }
+            }
+
+            if(rejected){
+                num_rejected_++;
+                l.unlock();
+                abandon_job(job);
+                return false;
+            }
+
+            jobs_[job.priority].emplace(std::move(job));
+            num_jobs_++;
+            num_committed_++;
+        };
+
+        if(has_dropped){
+            num_dropped_++;
+            abandon_job(dropped_job);
         }
         return true;
     }
 
-    virtual bool get_job_and_wait(Job& fetch_job){
+    void push_lockfree_job(Job& job){
 
-        std::unique_lock<std::mutex> l(jobs_lock_);
-        cond_.wait(l, [&](){
-            return !run_ || !jobs_.empty();
-        });
+        auto& queue = lockfree_jobs_[job.priority];
+        bool blocked = false;
+
+        // item在try_push失败时不会被move走
+        while(!queue->try_push(job)){
+            if(admission_.overload == OverloadPolicy::Reject){
+                num_rejected_++;
+                abandon_job(job);
+                return;
+            }
+
+            if(admission_.overload == OverloadPolicy::DropOldest){
+                Job dropped_job;
+                if(pop_oldest_job(job.priority, dropped_job)){
+                    num_dropped_++;
+                    abandon_job(dropped_job);
+                    continue;
+                }
+
+                num_rejected_++;
+                abandon_job(job);
+                return;
+            }
+
+            if(!run_){
+                num_rejected_++;
+                abandon_job(job);
+                return;
+            }
+
+            // 队列满时让出cpu，等worker消费
+            if(!blocked){
+                blocked = true;
+                num_blocked_++;
+            }
+            std::this_thread::yield();
+        }
+        num_committed_++;
+
+        // 与stop并发时，任务可能在stop清空队列之后才入队，这里再清空一次
+        if(!run_)
+            abandon_queued_jobs();
+    }
+
+    // 丢弃优先级不高于priority的最旧任务，从最低优先级开始找，Mutex时需要持有jobs_lock_
+    bool pop_oldest_job(int priority, Job& job){
 
-        if(!run_) false;
-        
-        fetch_job = std::move(jobs_.front());
-        jobs_.pop();
+        // LockFree时每个优先级的容量是独立的，只有同一个队列出队才能腾出空位
+        if(queue_type_ == JobQueueType::LockFree)
+            return lockfree_jobs_[priority]->try_pop(job);
+
+        for(int i = NUM_PRIORITY - 1; i >= priority; --i){
+            if(!jobs_[i].empty()){
+                job = std::move(jobs_[i].front());
+                jobs_[i].pop();
+                num_jobs_--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool has_jobs(int level){
+        if(queue_type_ == JobQueueType::LockFree)
+            return !lockfree_jobs_[level]->empty();
+        return !jobs_[level].empty();
+    }
+
+    bool has_jobs(){
+        for(int i = 0; i < NUM_PRIORITY; ++i){
+            if(has_jobs(i)) return true;
+        }
+        return false;
+    }
+
+    bool pop_job_from(int level, Job& job){
+        if(queue_type_ == JobQueueType::LockFree)
+            return lockfree_jobs_[level]->try_pop(job);
+
+        if(jobs_[level].empty())
+            return false;
+
+        job = std::move(jobs_[level].front());
+        jobs_[level].pop();
+        num_jobs_--;
         return true;
     }
 
+    // 按优先级取任务，高优先级连续插队超过starvation_limit次后，让下一个等待中的低优先级任务先执行
+    // Mutex时需要持有jobs_lock_，LockFree时只在worker线程调用
+    bool pop_job_by_priority(Job& job){
+
+        int highest = -1;
+        int lower   = -1;
+        for(int i = 0; i < NUM_PRIORITY; ++i){
+            if(!has_jobs(i)) continue;
+
+            if(highest == -1) highest = i;
+            else{
+                lower = i;
+                break;
+            }
+        }
+
+        if(highest == -1)
+            return false;
+
+        if(lower == -1){
+            num_overtake_ = 0;
+        }else if(admission_.starvation_limit > 0 && num_overtake_ >= admission_.starvation_limit){
+            num_overtake_ = 0;
+            if(pop_job_from(lower, job))
+                return true;
+        }else{
+            num_overtake_++;
+        }
+
+        if(pop_job_from(highest, job))
+            return true;
+
+        // LockFree下，DropOldest的生产者可能同时取走了任务
+        for(int i = 0; i < NUM_PRIORITY; ++i){
+            if(pop_job_from(i, job))
+                return true;
+        }
+        return false;
+    }
+
+    void notify_space(){
+        if(admission_.overload == OverloadPolicy::Block && num_space_waiters_ > 0){
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            space_cond_.notify_all();
+        }
+    }
+
+    void wakeup_worker(){
+
+        // 与wait_lockfree_jobs中的num_parked_++配对，保证不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(num_parked_.load() > 0){
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            cond_.notify_one();
+        }
+    }
+
+    static void cpu_relax(){
+        #if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+        #endif
+    }
+
+    // 自适应的先自旋再挂起，上次自旋等到了任务则放宽自旋次数，挂起过则减半
+    bool wait_lockfree_jobs(){
+
+        const int MIN_SPIN = 64;
+        const int MAX_SPIN = 16384;
+        for(int i = 0; i < spin_limit_; ++i){
+            if(!run_) return false;
+            if(has_jobs()){
+                spin_limit_ = std::min(MAX_SPIN, spin_limit_ * 2);
+                return true;
+            }
+
+            if(i < MIN_SPIN) cpu_relax();
+            else std::this_thread::yield();
+        }
+
+        spin_limit_ = std::max(MIN_SPIN, spin_limit_ / 2);
+        num_parked_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> l(jobs_lock_);
+            cond_.wait(l, [&](){
+                return !run_ || has_jobs();
+            });
+        }
+        num_parked_--;
+        return run_;
+    }
+
 protected:
+    static const int NUM_PRIORITY = 3;
+
     StartParam start_param_;
     std::atomic<bool> run_;
     std::mutex jobs_lock_;
-    std::queue<Job> jobs_;
+    std::queue<Job> jobs_[NUM_PRIORITY];
+    std::atomic<int> num_jobs_{0};
+    std::atomic<int> num_inflight_{0};
     std::shared_ptr<std::thread> worker_;
     std::condition_variable cond_;
     std::shared_ptr<MonopolyAllocator<TRT::Tensor>> tensor_allocator_;
+    std::shared_ptr<CompletionPool<Output>> completion_pool_ = CompletionPool<Output>::create();
+
+    JobQueueType queue_type_ = JobQueueType::Mutex;
+    std::shared_ptr<MPMCQueue<Job>> lockfree_jobs_[NUM_PRIORITY];
+    std::atomic<int> num_parked_{0};
+    int spin_limit_ = 1024;
+    BatchingPolicy batching_;
+
+    // commits时每多少个任务放入队列一次，0表示全部预处理完再放入，worker中通常设置为max_batch_size
+    int commit_chunk_size_ = 0;
+
+    AdmissionPolicy admission_;
+    std::condition_variable space_cond_;
+    std::atomic<int> num_space_waiters_{0};
+    int num_overtake_      = 0;
+    std::atomic<long long> num_committed_{0};
+    std::atomic<long long> num_rejected_{0};
+    std::atomic<long long> num_dropped_{0};
+    std::atomic<long long> num_abandoned_{0};
+    std::atomic<long long> num_blocked_{0};
+
+    // 每个slot上各阶段的开始、结束事件，只在worker线程上访问
+    struct StageEvents{
+        cudaEvent_t begin[(int)InferStage::NumStage] = {};
+        cudaEvent_t end[(int)InferStage::NumStage]   = {};
+        bool marked[(int)InferStage::NumStage]       = {};
+    };
+    std::vector<StageEvents> stage_events_;
+    InferMetrics metrics_;
+    std::string metrics_name_;
+    const char* trace_category_ = "infer";
 };
 
-#endif // INFER_CONTROLLER_HPP
\ No newline at end of file
+#endif // INFER_CONTROLLER_HPP
@@ -0,0 +1,332 @@
+#ifndef INFER_COROUTINE_HPP
+#define INFER_COROUTINE_HPP
+
+/**
+ * @brief C++20协程的推理接口，co_await commit_async返回的Completion，不阻塞线程
+ * 需要-std=c++20（make cpp_std=c++20，或cmake -DCPP_STD=20），否则这个头文件为空，INFER_HAS_COROUTINE为0
+ *
+ *   InferTask<void> stream(CoroutineExecutor& executor, ...){
+ *       auto faces   = co_await co_commit(*detector, image, &executor);
+ *       auto feature = co_await co_commit(*arcface, make_tuple(crop, landmarks), &executor);
+ *   }
+ *   executor.spawn(stream(executor, ...));
+ *   executor.run();
+ *
+ * 结果就绪时，worker线程把协程交给executor，由executor.run()所在的线程恢复执行，
+ * 因此一个线程可以同时驱动很多路流。executor为空时直接在worker线程上恢复，协程体内不要做耗时的事情
+ */
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#define INFER_HAS_COROUTINE 1
+
+#include <new>
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "completion.hpp"
+#include "ilogger.hpp"
+
+class CoroutineExecutor;
+
+namespace InferCoroutine{
+
+    template<class T>
+    class InferTaskPromise;
+
+    // 协程结束时，恢复等待它的协程，没有则把完成通知给executor
+    struct FinalAwaiter{
+        bool await_ready() const noexcept{ return false; }
+
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept;
+
+        void await_resume() const noexcept{}
+    };
+
+    class InferTaskPromiseBase{
+    public:
+        std::suspend_always initial_suspend() const noexcept{ return {}; }
+        FinalAwaiter final_suspend() const noexcept{ return {}; }
+        void unhandled_exception(){ exception_ = std::current_exception(); }
+
+        void rethrow_if_exception(){
+            if(exception_) std::rethrow_exception(exception_);
+        }
+
+        std::coroutine_handle<> continuation_;
+        CoroutineExecutor* detached_executor_ = nullptr;   // 由executor.spawn启动的协程
+        std::exception_ptr exception_;
+    };
+};
+
+/**
+ * @brief 协程的返回类型，创建后不执行，co_await或者executor.spawn时才开始
+ */
+template<class T>
+class InferTask{
+public:
+    typedef InferCoroutine::InferTaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    InferTask() = default;
+    explicit InferTask(handle_type handle):handle_(handle){}
+    InferTask(InferTask&& other) noexcept:handle_(std::exchange(other.handle_, nullptr)){}
+    InferTask(const InferTask& other) = delete;
+
+    InferTask& operator = (InferTask&& other) noexcept{
+        if(this != &other){
+            destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    virtual ~InferTask(){ destroy(); }
+
+    bool await_ready() const noexcept{ return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept{
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+    }
+
+    T await_resume(){
+        handle_.promise().rethrow_if_exception();
+        if constexpr(!std::is_void<T>::value)
+            return std::move(*handle_.promise().value_);
+    }
+
+    // 交给executor之后由协程自己在结束时销毁
+    handle_type release(){ return std::exchange(handle_, nullptr); }
+
+private:
+    void destroy(){
+        if(handle_){
+            handle_.destroy();
+            handle_ = nullptr;
+        }
+    }
+
+    handle_type handle_ = nullptr;
+};
+
+namespace InferCoroutine{
+
+    template<class T>
+    class InferTaskPromise : public InferTaskPromiseBase{
+    public:
+        InferTask<T> get_return_object(){ return InferTask<T>(std::coroutine_handle<InferTaskPromise>::from_promise(*this)); }
+        void return_value(T value){ value_ = std::move(value); }
+
+        // 避免要求T可以默认构造
+        struct Optional{
+            alignas(T) unsigned char storage[sizeof(T)];
+            bool has_value = false;
+
+            Optional& operator = (T&& value){
+                reset();
+                new (storage) T(std::move(value));
+                has_value = true;
+                return *this;
+            }
+
+            T& operator *(){ return *reinterpret_cast<T*>(storage); }
+
+            void reset(){
+                if(has_value) reinterpret_cast<T*>(storage)->~T();
+                has_value = false;
+            }
+
+            ~Optional(){ reset(); }
+        };
+        Optional value_;
+    };
+
+    template<>
+    class InferTaskPromise<void> : public InferTaskPromiseBase{
+    public:
+        InferTask<void> get_return_object(){ return InferTask<void>(std::coroutine_handle<InferTaskPromise>::from_promise(*this)); }
+        void return_void(){}
+    };
+};
+
+/**
+ * @brief 在一个线程上恢复协程的执行器
+ * post可以在任意线程调用（通常是worker交付结果时），run在调用线程上依次恢复，
+ * spawn的协程全部结束后run返回
+ */
+class CoroutineExecutor{
+public:
+    template<class T>
+    void spawn(InferTask<T>&& task){
+        auto handle = task.release();
+        handle.promise().detached_executor_ = this;
+        num_tasks_++;
+        post(handle);
+    }
+
+    // 在锁内notify，run返回后executor可能立即析构
+    void post(std::coroutine_handle<> handle){
+        std::unique_lock<std::mutex> l(lock_);
+        ready_.push_back(handle);
+        cond_.notify_one();
+    }
+
+    void run(){
+        while(true){
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> l(lock_);
+                cond_.wait(l, [&](){ return !ready_.empty() || num_tasks_ == 0; });
+                if(ready_.empty()) return;
+
+                handle = ready_.front();
+                ready_.pop_front();
+            }
+            handle.resume();
+        }
+    }
+
+    int num_tasks() const{ return num_tasks_; }
+
+    // spawn的协程结束，由FinalAwaiter调用
+    void task_done(std::coroutine_handle<> handle){
+        handle.destroy();
+
+        std::unique_lock<std::mutex> l(lock_);
+        num_tasks_--;
+        cond_.notify_one();
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::atomic<int> num_tasks_{0};
+};
+
+template<class Promise>
+std::coroutine_handle<> InferCoroutine::FinalAwaiter::await_suspend(std::coroutine_handle<Promise> handle) noexcept{
+    auto& promise = handle.promise();
+    if(promise.continuation_)
+        return promise.continuation_;
+
+    if(promise.detached_executor_){
+        if(promise.exception_){
+            try{
+                std::rethrow_exception(promise.exception_);
+            }catch(const std::exception& e){
+                INFOE("Unhandled exception in coroutine: %s", e.what());
+            }catch(...){
+                INFOE("Unhandled exception in coroutine");
+            }
+        }
+        promise.detached_executor_->task_done(handle);
+    }
+    return std::noop_coroutine();
+}
+
+/**
+ * @brief 等待一个Completion，结果就绪时在executor上恢复，executor为空时在交付结果的线程上恢复
+ */
+template<class T>
+class CompletionAwaiter{
+public:
+    CompletionAwaiter(Completion<T> completion, CoroutineExecutor* executor)
+    :completion_(std::move(completion)), executor_(executor){}
+
+    bool await_ready() const{ return completion_.ready(); }
+
+    void await_suspend(std::coroutine_handle<> handle){
+        // then可能在这里立即调用回调，之后不能再访问this
+        CoroutineExecutor* executor = executor_;
+        completion_.then([executor, handle](const T&){
+            if(executor) executor->post(handle);
+            else handle.resume();
+        });
+    }
+
+    T await_resume(){ return completion_.get(); }
+
+private:
+    Completion<T> completion_;
+    CoroutineExecutor* executor_ = nullptr;
+};
+
+/**
+ * @brief 等待一组Completion全部就绪，结果按提交顺序返回
+ */
+template<class T>
+class CompletionsAwaiter{
+public:
+    CompletionsAwaiter(std::vector<Completion<T>> completions, CoroutineExecutor* executor)
+    :completions_(std::move(completions)), executor_(executor){}
+
+    bool await_ready() const{
+        for(auto& completion : completions_)
+            if(!completion.ready()) return false;
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle){
+
+        // 多注册一次计数，保证所有回调都注册完之前不会恢复
+        remaining_ = completions_.size() + 1;
+        auto on_ready = [this, handle](const T&){ finish_one(handle); };
+        for(auto& completion : completions_)
+            completion.then(on_ready);
+        finish_one(handle);
+    }
+
+    std::vector<T> await_resume(){
+        std::vector<T> output;
+        output.reserve(completions_.size());
+        for(auto& completion : completions_)
+            output.emplace_back(completion.get());
+        return output;
+    }
+
+private:
+    void finish_one(std::coroutine_handle<> handle){
+        if(remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        if(executor_) executor_->post(handle);
+        else handle.resume();
+    }
+
+    std::vector<Completion<T>> completions_;
+    CoroutineExecutor* executor_ = nullptr;
+    std::atomic<size_t> remaining_{0};
+};
+
+template<class T>
+CompletionAwaiter<T> co_completion(Completion<T> completion, CoroutineExecutor* executor = nullptr){
+    return CompletionAwaiter<T>(std::move(completion), executor);
+}
+
+// 对InferController或者提供commit_async的模型接口，co_await co_commit(model, input, &executor)
+template<class Model, class Input>
+auto co_commit(Model& model, const Input& input, CoroutineExecutor* executor = nullptr){
+    return co_completion(model.commit_async(input), executor);
+}
+
+template<class Model, class Input>
+auto co_commits(Model& model, const std::vector<Input>& inputs, CoroutineExecutor* executor = nullptr){
+    typedef typename std::decay<decltype(model.commit_async(inputs[0]).get())>::type Output;
+    std::vector<Completion<Output>> completions;
+    completions.reserve(inputs.size());
+    for(auto& input : inputs)
+        completions.emplace_back(model.commit_async(input));
+    return CompletionsAwaiter<Output>(std::move(completions), executor);
+}
+
+#else
+#define INFER_HAS_COROUTINE 0
+#endif // __cpp_impl_coroutine
+
+#endif // INFER_COROUTINE_HPP
@@ -0,0 +1,186 @@
+#ifndef INFER_METRICS_HPP
+#define INFER_METRICS_HPP
+
+#include <string>
+#include <atomic>
+#include "latency_histogram.hpp"
+#include "json.hpp"
+
+/**
+ * @brief InferController中一个任务经过的阶段，耗时单位为微秒
+ * QueueWait、Preprocess、EndToEnd、Delivery由InferController统计，AllocatorWait来自tensor_allocator_，
+ * Forward、Decode是stream上的GPU耗时，需要模型在launch中用stage_event_begin/end标记
+ */
+enum class InferStage : int{
+    QueueWait     = 0,      // commit到worker取走任务
+    Preprocess    = 1,      // commit线程上的预处理，包含AllocatorWait
+    AllocatorWait = 2,      // tensor allocator的query等待
+    Forward       = 3,      // 推理
+    Decode        = 4,      // 解码、NMS等后处理
+    Delivery      = 5,      // worker等待一个batch完成、解析并交付
+    EndToEnd      = 6,      // commit到结果交付
+    NumStage      = 7
+};
+
+inline const char* infer_stage_name(InferStage stage){
+    switch(stage){
+        case InferStage::QueueWait:     return "queue_wait";
+        case InferStage::Preprocess:    return "preprocess";
+        case InferStage::AllocatorWait: return "allocator_wait";
+        case InferStage::Forward:       return "forward";
+        case InferStage::Decode:        return "decode";
+        case InferStage::Delivery:      return "delivery";
+        case InferStage::EndToEnd:      return "end_to_end";
+        default: return "unknow";
+    }
+}
+
+/**
+ * @brief scale为输出时乘的系数，耗时的直方图传0.001输出毫秒
+ * 除了统计值外，buckets为非空桶的[下界, 上界, 计数]，可以离线合并或者重新计算分位数
+ */
+inline Json::Value histogram_to_json(const HistogramSnapshot& histogram, double scale = 1.0){
+
+    Json::Value output(Json::objectValue);
+    output["count"] = (Json::Int64)histogram.count;
+    output["mean"]  = histogram.mean() * scale;
+    output["min"]   = histogram.min * scale;
+    output["max"]   = histogram.max * scale;
+    output["p50"]   = histogram.percentile(50) * scale;
+    output["p90"]   = histogram.percentile(90) * scale;
+    output["p99"]   = histogram.percentile(99) * scale;
+    output["p999"]  = histogram.percentile(99.9) * scale;
+
+    Json::Value buckets(Json::arrayValue);
+    for(size_t i = 0; i < histogram.buckets.size(); ++i){
+        if(histogram.buckets[i] == 0) continue;
+
+        Json::Value bucket(Json::arrayValue);
+        bucket.append(LatencyHistogram::bucket_lower(i) * scale);
+        bucket.append(LatencyHistogram::bucket_upper(i) * scale);
+        bucket.append((Json::Int64)histogram.buckets[i]);
+        buckets.append(bucket);
+    }
+    output["buckets"] = buckets;
+    return output;
+}
+
+struct InferMetricsSnapshot{
+    std::string name;
+    HistogramSnapshot stages[(int)InferStage::NumStage];   // 微秒
+    HistogramSnapshot batch_size;                           // worker每次取到的任务数
+    HistogramSnapshot queue_depth;                          // worker取任务时队列中的任务数（包括取走的）
+    double elapsed_seconds = 0;                             // 距离创建或者reset_metrics的时间
+
+    // 取快照时的瞬时值，不受reset_metrics影响
+    int queue_size          = 0;        // 排队中的任务数
+    int inflight            = 0;        // worker正在处理的任务数
+    int allocator_capacity  = 0;        // tensor allocator的容量，没有allocator时为0
+    int allocator_occupancy = 0;        // 被占用的数量
+    int allocator_peak      = 0;        // 占用数的峰值
+
+    const HistogramSnapshot& stage(InferStage stage) const{ return stages[(int)stage]; }
+
+    // 每秒交付的任务数、batch数
+    double jobs_per_second() const{
+        return elapsed_seconds <= 0 ? 0 : stage(InferStage::EndToEnd).count / elapsed_seconds;
+    }
+
+    double batches_per_second() const{
+        return elapsed_seconds <= 0 ? 0 : batch_size.count / elapsed_seconds;
+    }
+
+    // 多个副本的合并，elapsed_seconds取最长的
+    void merge(const InferMetricsSnapshot& other){
+        for(int i = 0; i < (int)InferStage::NumStage; ++i)
+            stages[i].merge(other.stages[i]);
+
+        batch_size.merge(other.batch_size);
+        queue_depth.merge(other.queue_depth);
+        elapsed_seconds = std::max(elapsed_seconds, other.elapsed_seconds);
+
+        queue_size          += other.queue_size;
+        inflight            += other.inflight;
+        allocator_capacity  += other.allocator_capacity;
+        allocator_occupancy += other.allocator_occupancy;
+        allocator_peak      += other.allocator_peak;
+    }
+
+    // 耗时以毫秒输出
+    Json::Value to_json() const{
+
+        Json::Value output(Json::objectValue);
+        output["name"]               = name;
+        output["elapsed_seconds"]    = elapsed_seconds;
+        output["jobs_per_second"]    = jobs_per_second();
+        output["batches_per_second"] = batches_per_second();
+
+        Json::Value stages_json(Json::objectValue);
+        for(int i = 0; i < (int)InferStage::NumStage; ++i)
+            stages_json[infer_stage_name((InferStage)i)] = histogram_to_json(stages[i], 0.001);
+
+        output["stages_ms"]   = stages_json;
+        output["batch_size"]  = histogram_to_json(batch_size);
+        output["queue_depth"] = histogram_to_json(queue_depth);
+
+        Json::Value current(Json::objectValue);
+        current["queue_size"]          = queue_size;
+        current["inflight"]            = inflight;
+        current["allocator_capacity"]  = allocator_capacity;
+        current["allocator_occupancy"] = allocator_occupancy;
+        current["allocator_peak"]      = allocator_peak;
+        output["current"] = current;
+        return output;
+    }
+};
+
+/**
+ * @brief 一个模型的各阶段直方图，记录都是无锁的
+ */
+class InferMetrics{
+public:
+    InferMetrics(){ reset(); }
+
+    void record(InferStage stage, long long us){
+        stages_[(int)stage].record(us);
+    }
+
+    void record_ms(InferStage stage, double ms){
+        stages_[(int)stage].record((long long)(ms * 1000));
+    }
+
+    void record_batch(int batch_size, int queue_depth){
+        batch_size_.record(batch_size);
+        queue_depth_.record(queue_depth);
+    }
+
+    InferMetricsSnapshot snapshot(const std::string& name) const{
+
+        InferMetricsSnapshot output;
+        output.name = name;
+        for(int i = 0; i < (int)InferStage::NumStage; ++i)
+            output.stages[i] = stages_[i].snapshot();
+
+        output.batch_size      = batch_size_.snapshot();
+        output.queue_depth     = queue_depth_.snapshot();
+        output.elapsed_seconds = (LatencyHistogram::now_us() - start_us_.load(std::memory_order_relaxed)) / 1e6;
+        return output;
+    }
+
+    void reset(){
+        for(int i = 0; i < (int)InferStage::NumStage; ++i)
+            stages_[i].reset();
+
+        batch_size_.reset();
+        queue_depth_.reset();
+        start_us_ = LatencyHistogram::now_us();
+    }
+
+private:
+    LatencyHistogram stages_[(int)InferStage::NumStage];
+    LatencyHistogram batch_size_;
+    LatencyHistogram queue_depth_;
+    std::atomic<long long> start_us_{0};
+};
+
+#endif // INFER_METRICS_HPP
@@ -0,0 +1,500 @@
+#ifndef INFER_PIPELINE_HPP
+#define INFER_PIPELINE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <condition_variable>
+#include "completion.hpp"
+#include "ilogger.hpp"
+
+/**
+ * @brief 多个模型与CPU处理组成的有向无环图，每一帧的数据为一个Context，节点读写Context中自己的字段
+ *
+ *   struct Frame{ cv::Mat image; vector<FaceBox> faces; vector<Mat> features; };
+ *   InferPipeline<Frame> pipeline;
+ *   pipeline.add_model("detect", {}, [&](Frame& f){ return detector->commit_async(f.image); },
+ *                                    [](Frame& f, const box_array& faces){ f.faces = faces; });
+ *   pipeline.add_model("embed", {"detect"}, [&](Frame& f){ return arcface->commits_async(crops(f)); },
+ *                                           [](Frame& f, const vector<Mat>& features){ f.features = features; });
+ *   pipeline.add_stage("draw", {"embed"}, [](Frame& f){ ... }, true);
+ *   pipeline.startup();
+ *   auto result = pipeline.commit(make_shared<Frame>(...));
+ *
+ * 节点在输入节点全部完成后执行。fan-out是一次提交这一帧的所有item（例如commits_async），
+ * 全部完成后collect拿到按顺序的结果（fan-in），因此一帧的所有crop进入同一个batch，
+ * 多帧同时在途时，不同帧的crop也会合并。
+ * submit可以返回Completion<T>、shared_future<T>或者它们的vector：
+ *   Completion通过then得到通知，不占用线程；shared_future在执行线程上等待
+ * sequential的节点按commit的顺序一次执行一帧，用于跟踪器这类有状态的处理
+ * 节点函数都在pipeline的执行线程上调用，不会在模型的worker线程上执行
+ */
+namespace InferPipelineDetail{
+
+    template<class R>
+    struct Result;
+
+    template<class T>
+    struct Result<Completion<T>>{
+        typedef T Output;
+        static int count(const Completion<T>& r){return 1;}
+        static void when_ready(Completion<T>& r, const std::function<void()>& ready){
+            r.then([ready](const T&){ ready(); });
+        }
+        static Output get(Completion<T>& r){return r.get();}
+    };
+
+    template<class T>
+    struct Result<std::shared_future<T>>{
+        typedef T Output;
+        static int count(const std::shared_future<T>& r){return 1;}
+        static void when_ready(std::shared_future<T>& r, const std::function<void()>& ready){
+            r.wait();
+            ready();
+        }
+        static Output get(std::shared_future<T>& r){return r.get();}
+    };
+
+    template<class T>
+    struct Result<std::vector<Completion<T>>>{
+        typedef std::vector<T> Output;
+        static int count(const std::vector<Completion<T>>& r){return r.size();}
+        static void when_ready(std::vector<Completion<T>>& r, const std::function<void()>& ready){
+
+            // 多计一次，保证所有回调注册完之前不会调用ready
+            auto remaining = std::make_shared<std::atomic<int>>(r.size() + 1);
+            auto finish_one = [remaining, ready](){
+                if(remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) ready();
+            };
+            for(auto& completion : r)
+                completion.then([finish_one](const T&){ finish_one(); });
+            finish_one();
+        }
+        static Output get(std::vector<Completion<T>>& r){
+            Output output;
+            output.reserve(r.size());
+            for(auto& completion : r)
+                output.emplace_back(completion.get());
+            return output;
+        }
+    };
+
+    template<class T>
+    struct Result<std::vector<std::shared_future<T>>>{
+        typedef std::vector<T> Output;
+        static int count(const std::vector<std::shared_future<T>>& r){return r.size();}
+        static void when_ready(std::vector<std::shared_future<T>>& r, const std::function<void()>& ready){
+            for(auto& future : r)
+                future.wait();
+            ready();
+        }
+        static Output get(std::vector<std::shared_future<T>>& r){
+            Output output;
+            output.reserve(r.size());
+            for(auto& future : r)
+                output.emplace_back(future.get());
+            return output;
+        }
+    };
+};
+
+struct PipelineNodeStatistics{
+    std::string name;
+    long long runs     = 0;     // 执行的帧数
+    long long items    = 0;     // 提交给模型的item数，fan-out时items / runs为每帧平均的item数
+    long long busy_us  = 0;     // 从开始执行到完成（包括等待模型）的总时间
+    long long failures = 0;     // 抛出异常的次数
+};
+
+struct PipelineStatistics{
+    long long committed = 0;
+    long long finished  = 0;
+    int inflight        = 0;
+    std::vector<PipelineNodeStatistics> nodes;
+};
+
+template<class Context>
+class InferPipeline{
+public:
+    typedef std::shared_ptr<Context> ContextPtr;
+    typedef std::function<void()> Done;
+
+    // 通用节点，处理完成后调用done（可以在任意线程、只能调用一次）
+    typedef std::function<void(Context& context, const Done& done)> NodeFunction;
+
+    InferPipeline() = default;
+    InferPipeline(const InferPipeline& other) = delete;
+    InferPipeline& operator = (const InferPipeline& other) = delete;
+
+    // 等待在途的帧全部完成，节点引用的模型需要比pipeline后析构
+    virtual ~InferPipeline(){
+        stop();
+    }
+
+    void add_node(const std::string& name, const std::vector<std::string>& inputs, const NodeFunction& function, bool sequential = false){
+
+        if(running_){
+            INFOE("Pipeline is running, can not add node [%s]", name.c_str());
+            return;
+        }
+
+        std::unique_ptr<Node> node(new Node());
+        node->name        = name;
+        node->input_names = inputs;
+        node->function    = function;
+        node->sequential  = sequential;
+        nodes_.emplace_back(std::move(node));
+    }
+
+    // CPU处理
+    template<class Function>
+    void add_stage(const std::string& name, const std::vector<std::string>& inputs, Function function, bool sequential = false){
+        add_node(name, inputs, [function](Context& context, const Done& done){
+            function(context);
+            done();
+        }, sequential);
+    }
+
+    /**
+     * @brief 模型节点，submit(Context&)提交并返回Completion<T>、shared_future<T>或者它们的vector（fan-out），
+     * 全部就绪后在执行线程上调用collect(Context&, T或者vector<T>)
+     */
+    template<class Submit, class Collect>
+    void add_model(const std::string& name, const std::vector<std::string>& inputs, Submit submit, Collect collect, bool sequential = false){
+
+        typedef typename std::decay<decltype(submit(std::declval<Context&>()))>::type ResultType;
+        typedef InferPipelineDetail::Result<ResultType> Traits;
+
+        // 执行时按下标取节点，add_node之后nodes_可能扩容
+        int inode = nodes_.size();
+        add_node(name, inputs, [this, inode, submit, collect](Context& context, const Done& done){
+
+            Node* node  = nodes_[inode].get();
+            auto result = std::make_shared<ResultType>(submit(context));
+            node->items += Traits::count(*result);
+
+            Context* pcontext = &context;
+            Traits::when_ready(*result, [this, node, result, pcontext, collect, done](){
+                post([node, result, pcontext, collect, done](){
+                    try{
+                        collect(*pcontext, Traits::get(*result));
+                    }catch(const std::exception& e){
+                        node->failures++;
+                        INFOE("Pipeline node [%s] collect failed: %s", node->name.c_str(), e.what());
+                    }
+                    done();
+                });
+            });
+        }, sequential);
+    }
+
+    // 检查图并启动执行线程，max_inflight_frames为同时在途的最大帧数，超过时commit阻塞
+    bool startup(int num_threads = 4, int max_inflight_frames = 8){
+
+        if(running_){
+            INFOE("Pipeline already started");
+            return false;
+        }
+
+        std::map<std::string, int> index;
+        for(int i = 0; i < (int)nodes_.size(); ++i){
+            if(index.find(nodes_[i]->name) != index.end()){
+                INFOE("Duplicate pipeline node [%s]", nodes_[i]->name.c_str());
+                return false;
+            }
+            index[nodes_[i]->name] = i;
+        }
+
+        for(int i = 0; i < (int)nodes_.size(); ++i){
+            auto& node = nodes_[i];
+            node->children.clear();
+            node->num_inputs = node->input_names.size();
+        }
+
+        for(int i = 0; i < (int)nodes_.size(); ++i){
+            for(auto& input : nodes_[i]->input_names){
+                auto iter = index.find(input);
+                if(iter == index.end()){
+                    INFOE("Pipeline node [%s] has unknown input [%s]", nodes_[i]->name.c_str(), input.c_str());
+                    return false;
+                }
+                nodes_[iter->second]->children.push_back(i);
+            }
+        }
+
+        // Kahn，所有节点都能被访问到说明没有环
+        std::vector<int> num_inputs(nodes_.size());
+        std::vector<int> queue;
+        for(int i = 0; i < (int)nodes_.size(); ++i){
+            num_inputs[i] = nodes_[i]->num_inputs;
+            if(num_inputs[i] == 0) queue.push_back(i);
+        }
+
+        roots_ = queue;
+        for(int i = 0; i < (int)queue.size(); ++i){
+            for(int child : nodes_[queue[i]]->children){
+                if(--num_inputs[child] == 0)
+                    queue.push_back(child);
+            }
+        }
+
+        if(queue.size() != nodes_.size() || nodes_.empty()){
+            INFOE("Pipeline graph is empty or has a cycle");
+            return false;
+        }
+
+        max_inflight_frames_ = std::max(1, max_inflight_frames);
+        running_ = true;
+        for(int i = 0; i < std::max(1, num_threads); ++i)
+            threads_.emplace_back(&InferPipeline::executor_loop, this);
+        return true;
+    }
+
+    // 提交一帧，所有节点完成后future就绪，得到的是同一个context
+    std::shared_future<ContextPtr> commit(const ContextPtr& context){
+
+        std::shared_ptr<Frame> frame(new Frame());
+        frame->context = context;
+        frame->pro     = std::make_shared<std::promise<ContextPtr>>();
+        std::shared_future<ContextPtr> future = frame->pro->get_future();
+
+        if(!running_){
+            INFOE("Pipeline is not running");
+            frame->pro->set_value(context);
+            return future;
+        }
+
+        {
+            std::unique_lock<std::mutex> l(frames_lock_);
+            frames_cond_.wait(l, [&](){ return inflight_ < max_inflight_frames_; });
+            inflight_++;
+            frame->index = committed_++;
+        }
+
+        frame->remaining_nodes = nodes_.size();
+        frame->remaining_inputs.resize(nodes_.size());
+        for(int i = 0; i < (int)nodes_.size(); ++i)
+            frame->remaining_inputs[i] = nodes_[i]->num_inputs;
+
+        for(int inode : roots_)
+            schedule(frame, inode);
+        return future;
+    }
+
+    PipelineStatistics statistics(){
+
+        PipelineStatistics output;
+        {
+            std::unique_lock<std::mutex> l(frames_lock_);
+            output.committed = committed_;
+            output.finished  = finished_;
+            output.inflight  = inflight_;
+        }
+
+        for(auto& node : nodes_){
+            PipelineNodeStatistics item;
+            item.name     = node->name;
+            item.runs     = node->runs;
+            item.items    = node->items;
+            item.busy_us  = node->busy_us;
+            item.failures = node->failures;
+            output.nodes.push_back(item);
+        }
+        return output;
+    }
+
+    void stop(){
+
+        if(!running_) return;
+        {
+            std::unique_lock<std::mutex> l(frames_lock_);
+            frames_cond_.wait(l, [&](){ return inflight_ == 0; });
+        }
+
+        {
+            std::unique_lock<std::mutex> l(tasks_lock_);
+            running_ = false;
+            tasks_cond_.notify_all();
+        }
+
+        for(auto& t : threads_)
+            t.join();
+        threads_.clear();
+    }
+
+private:
+    struct Frame{
+        long long index = 0;
+        ContextPtr context;
+        std::shared_ptr<std::promise<ContextPtr>> pro;
+        std::mutex lock;
+        std::vector<int> remaining_inputs;
+        int remaining_nodes = 0;
+    };
+    typedef std::shared_ptr<Frame> FramePtr;
+
+    struct Node{
+        std::string name;
+        std::vector<std::string> input_names;
+        std::vector<int> children;
+        int num_inputs = 0;
+        NodeFunction function;
+        bool sequential = false;
+
+        // sequential时按帧的顺序执行
+        std::mutex lock;
+        std::map<long long, FramePtr> pending;
+        long long next_frame = 0;
+        bool busy = false;
+
+        std::atomic<long long> runs{0};
+        std::atomic<long long> items{0};
+        std::atomic<long long> busy_us{0};
+        std::atomic<long long> failures{0};
+    };
+
+    void post(const std::function<void()>& task){
+        std::unique_lock<std::mutex> l(tasks_lock_);
+        tasks_.push_back(task);
+        tasks_cond_.notify_one();
+    }
+
+    void executor_loop(){
+        while(true){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> l(tasks_lock_);
+                tasks_cond_.wait(l, [&](){ return !running_ || !tasks_.empty(); });
+                if(tasks_.empty()) return;
+
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    void schedule(const FramePtr& frame, int inode){
+
+        Node* node = nodes_[inode].get();
+        if(!node->sequential){
+            post([this, frame, inode](){ run_node(frame, inode); });
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> l(node->lock);
+            node->pending[frame->index] = frame;
+        }
+        start_sequential(inode);
+    }
+
+    // 轮到的帧已经就绪并且节点空闲时执行
+    void start_sequential(int inode){
+
+        Node* node = nodes_[inode].get();
+        FramePtr frame;
+        {
+            std::unique_lock<std::mutex> l(node->lock);
+            if(node->busy) return;
+
+            auto iter = node->pending.find(node->next_frame);
+            if(iter == node->pending.end()) return;
+
+            frame = iter->second;
+            node->pending.erase(iter);
+            node->busy = true;
+        }
+        post([this, frame, inode](){ run_node(frame, inode); });
+    }
+
+    void run_node(const FramePtr& frame, int inode){
+
+        Node* node  = nodes_[inode].get();
+        auto tic    = std::chrono::steady_clock::now();
+        auto called = std::make_shared<std::atomic<bool>>(false);
+        Done done   = [this, frame, inode, tic, called](){
+            if(called->exchange(true)) return;
+
+            auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tic).count();
+            nodes_[inode]->busy_us += cost;
+            finish_node(frame, inode);
+        };
+
+        node->runs++;
+        try{
+            node->function(*frame->context, done);
+        }catch(const std::exception& e){
+            node->failures++;
+            INFOE("Pipeline node [%s] failed: %s", node->name.c_str(), e.what());
+            done();
+        }
+    }
+
+    void finish_node(const FramePtr& frame, int inode){
+
+        Node* node = nodes_[inode].get();
+        if(node->sequential){
+            {
+                std::unique_lock<std::mutex> l(node->lock);
+                node->busy = false;
+                node->next_frame++;
+            }
+            start_sequential(inode);
+        }
+
+        std::vector<int> ready;
+        bool finished = false;
+        {
+            std::unique_lock<std::mutex> l(frame->lock);
+            for(int child : node->children){
+                if(--frame->remaining_inputs[child] == 0)
+                    ready.push_back(child);
+            }
+            finished = --frame->remaining_nodes == 0;
+        }
+
+        for(int child : ready)
+            schedule(frame, child);
+
+        if(finished){
+            {
+                std::unique_lock<std::mutex> l(frames_lock_);
+                inflight_--;
+                finished_++;
+                frames_cond_.notify_all();
+            }
+
+            // 之后不再访问this，pipeline可能已经在析构
+            frame->pro->set_value(frame->context);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::vector<int> roots_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> running_{false};
+
+    std::mutex tasks_lock_;
+    std::condition_variable tasks_cond_;
+    std::deque<std::function<void()>> tasks_;
+
+    std::mutex frames_lock_;
+    std::condition_variable frames_cond_;
+    int max_inflight_frames_ = 8;
+    int inflight_            = 0;
+    long long committed_     = 0;
+    long long finished_      = 0;
+};
+
+#endif // INFER_PIPELINE_HPP
@@ -0,0 +1,304 @@
+#include "infer_trace.hpp"
+#include "ilogger.hpp"
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include <stdio.h>
+
+using namespace std;
+
+namespace InferTrace{
+
+    std::atomic<bool> __enabled{false};
+
+    namespace{
+
+        /**
+         * 每个槽位是一个seqlock，sequence为2 * index + 1时正在写，2 * index + 2时第index个事件写完
+         * 字段都用relaxed原子变量，读的一方拿到的要么是完整的事件，要么发现sequence变化而跳过
+         */
+        struct Slot{
+            std::atomic<unsigned long long> sequence{0};
+            std::atomic<const char*> name{nullptr};
+            std::atomic<const char*> category{nullptr};
+            std::atomic<const char*> arg_name{nullptr};
+            std::atomic<long long> timestamp{0};
+            std::atomic<long long> duration{0};
+            std::atomic<long long> id{0};
+            std::atomic<long long> arg_value{0};
+            std::atomic<char> phase{0};
+        };
+
+        struct Event{
+            char phase;
+            const char* name;
+            const char* category;
+            const char* arg_name;
+            long long timestamp;
+            long long duration;
+            long long id;
+            long long arg_value;
+        };
+
+        struct ThreadBuffer{
+            int tid = 0;
+            string name;                                // 由registry的锁保护
+            unsigned long long capacity = 0;
+            unique_ptr<Slot[]> slots;
+            std::atomic<unsigned long long> head{0};    // 写入过的事件总数，只有所属线程写
+            std::atomic<unsigned long long> tail{0};    // 已经清除的位置
+            std::atomic<bool> alive{true};              // 所属线程是否还在
+        };
+
+        struct Registry{
+            mutex lock;
+            vector<shared_ptr<ThreadBuffer>> buffers;
+            unordered_set<string> strings;
+            int next_tid = 0;
+            int capacity = 1 << 14;
+        };
+
+        // 不析构，其他全局对象析构时仍然可以记录
+        Registry& registry(){
+            static Registry* instance = new Registry();
+            return *instance;
+        }
+
+        struct ThreadState{
+            shared_ptr<ThreadBuffer> buffer;
+            string name;
+
+            ~ThreadState(){
+                if(buffer) buffer->alive = false;
+            }
+        };
+
+        thread_local ThreadState local_state;
+        std::atomic<long long> global_id{0};
+
+        ThreadBuffer* local_buffer(){
+
+            auto& state = local_state;
+            if(state.buffer) return state.buffer.get();
+
+            // 只在线程第一次记录时分配
+            auto& reg   = registry();
+            auto buffer = make_shared<ThreadBuffer>();
+            unique_lock<mutex> l(reg.lock);
+            buffer->capacity = 1;
+            while(buffer->capacity < (unsigned long long)reg.capacity) buffer->capacity <<= 1;
+
+            buffer->slots.reset(new Slot[buffer->capacity]);
+            buffer->tid  = ++reg.next_tid;
+            buffer->name = state.name.empty() ? iLogger::format("thread %d", buffer->tid) : state.name;
+            reg.buffers.push_back(buffer);
+            state.buffer = buffer;
+            return buffer.get();
+        }
+
+        // 读出[tail, head)中没有被覆盖的事件
+        void read_events(ThreadBuffer* buffer, vector<Event>& events, unsigned long long& head){
+
+            head = buffer->head.load(std::memory_order_acquire);
+            unsigned long long begin = buffer->tail.load(std::memory_order_relaxed);
+            if(head > buffer->capacity)
+                begin = std::max(begin, head - buffer->capacity);
+
+            for(unsigned long long index = begin; index < head; ++index){
+                auto& slot = buffer->slots[index & (buffer->capacity - 1)];
+                unsigned long long expected = 2 * index + 2;
+                if(slot.sequence.load(std::memory_order_acquire) != expected) continue;
+
+                Event event;
+                event.phase     = slot.phase.load(std::memory_order_relaxed);
+                event.name      = slot.name.load(std::memory_order_relaxed);
+                event.category  = slot.category.load(std::memory_order_relaxed);
+                event.arg_name  = slot.arg_name.load(std::memory_order_relaxed);
+                event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+                event.duration  = slot.duration.load(std::memory_order_relaxed);
+                event.id        = slot.id.load(std::memory_order_relaxed);
+                event.arg_value = slot.arg_value.load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(slot.sequence.load(std::memory_order_relaxed) != expected) continue;
+                events.push_back(event);
+            }
+        }
+
+        void append_escaped(string& output, const char* str){
+
+            output.push_back('"');
+            for(const char* p = str ? str : ""; *p; ++p){
+                unsigned char c = *p;
+                if(c == '"' || c == '\\'){
+                    output.push_back('\\');
+                    output.push_back(c);
+                }else if(c < 0x20){
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    output += buffer;
+                }else{
+                    output.push_back(c);
+                }
+            }
+            output.push_back('"');
+        }
+
+        void append_event(string& output, int tid, const Event& event){
+
+            char buffer[128];
+            output += "{\"name\":";
+            append_escaped(output, event.name);
+            output += ",\"cat\":";
+            append_escaped(output, event.category);
+            snprintf(buffer, sizeof(buffer), ",\"ph\":\"%c\",\"ts\":%lld,\"pid\":1,\"tid\":%d", event.phase, event.timestamp, tid);
+            output += buffer;
+
+            if(event.phase == 'X'){
+                snprintf(buffer, sizeof(buffer), ",\"dur\":%lld", event.duration);
+                output += buffer;
+            }else if(event.phase == 'i'){
+                output += ",\"s\":\"t\"";
+            }else{
+                snprintf(buffer, sizeof(buffer), ",\"id\":\"0x%llx\"", event.id);
+                output += buffer;
+            }
+
+            if(event.arg_name){
+                output += ",\"args\":{";
+                append_escaped(output, event.arg_name);
+                snprintf(buffer, sizeof(buffer), ":%lld}", event.arg_value);
+                output += buffer;
+            }
+            output += "}";
+        }
+
+        // 已退出且没有未清除事件的线程缓冲区不再保留，需要持有registry的锁
+        void prune_buffers(Registry& reg){
+            auto& buffers = reg.buffers;
+            buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const shared_ptr<ThreadBuffer>& buffer){
+                return !buffer->alive && buffer->tail.load() >= buffer->head.load();
+            }), buffers.end());
+        }
+    };
+
+    void enable(bool enabled){
+        __enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    void set_buffer_capacity(int events_per_thread){
+        auto& reg = registry();
+        unique_lock<mutex> l(reg.lock);
+        reg.capacity = std::max(16, events_per_thread);
+    }
+
+    void set_thread_name(const string& name){
+
+        auto& state = local_state;
+        auto& reg   = registry();
+        unique_lock<mutex> l(reg.lock);
+        state.name = name;
+        if(state.buffer)
+            state.buffer->name = name;
+    }
+
+    const char* intern(const string& str){
+        auto& reg = registry();
+        unique_lock<mutex> l(reg.lock);
+        return reg.strings.insert(str).first->c_str();
+    }
+
+    long long now_us(){
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    long long next_id(){
+        return ++global_id;
+    }
+
+    void record(char phase, const char* name, const char* category, long long timestamp, long long duration,
+        long long id, const char* arg_name, long long arg_value){
+
+        auto buffer = local_buffer();
+        unsigned long long index = buffer->head.load(std::memory_order_relaxed);
+        auto& slot = buffer->slots[index & (buffer->capacity - 1)];
+
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.phase.store(phase, std::memory_order_relaxed);
+        slot.name.store(name, std::memory_order_relaxed);
+        slot.category.store(category, std::memory_order_relaxed);
+        slot.arg_name.store(arg_name, std::memory_order_relaxed);
+        slot.timestamp.store(timestamp, std::memory_order_relaxed);
+        slot.duration.store(duration, std::memory_order_relaxed);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.arg_value.store(arg_value, std::memory_order_relaxed);
+        slot.sequence.store(2 * index + 2, std::memory_order_release);
+        buffer->head.store(index + 1, std::memory_order_release);
+    }
+
+    string dump(bool clear){
+
+        auto& reg = registry();
+        unique_lock<mutex> l(reg.lock);
+
+        string output = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        vector<Event> events;
+        for(auto& buffer : reg.buffers){
+
+            unsigned long long head = 0;
+            events.clear();
+            read_events(buffer.get(), events, head);
+            if(clear)
+                buffer->tail.store(head, std::memory_order_relaxed);
+
+            if(!first) output += ",";
+            first = false;
+
+            output += iLogger::format("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", buffer->tid);
+            append_escaped(output, buffer->name.c_str());
+            output += "}}";
+
+            for(auto& event : events){
+                output += ",\n";
+                append_event(output, buffer->tid, event);
+            }
+        }
+        output += "]}\n";
+
+        if(clear) prune_buffers(reg);
+        return output;
+    }
+
+    bool save(const string& file, bool clear){
+        return iLogger::save_file(file, dump(clear));
+    }
+
+    void clear(){
+        auto& reg = registry();
+        unique_lock<mutex> l(reg.lock);
+        for(auto& buffer : reg.buffers)
+            buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+        prune_buffers(reg);
+    }
+
+    TraceStatistics statistics(){
+
+        TraceStatistics output;
+        auto& reg = registry();
+        unique_lock<mutex> l(reg.lock);
+        for(auto& buffer : reg.buffers){
+            unsigned long long head = buffer->head.load(std::memory_order_acquire);
+            unsigned long long tail = buffer->tail.load(std::memory_order_relaxed);
+            unsigned long long size = head - std::min(head, tail);
+            output.recorded += std::min(size, buffer->capacity);
+            output.dropped  += size > buffer->capacity ? size - buffer->capacity : 0;
+        }
+        output.threads = reg.buffers.size();
+        return output;
+    }
+};
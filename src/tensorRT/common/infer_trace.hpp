@@ -0,0 +1,110 @@
+#ifndef INFER_TRACE_HPP
+#define INFER_TRACE_HPP
+
+#include <string>
+#include <atomic>
+
+/**
+ * @brief 可选开启的时间线记录，输出为Chrome trace JSON（chrome://tracing、ui.perfetto.dev可以直接打开）
+ * 用于查看多个模型的worker之间的交错：每个任务何时commit、何时被取走组成batch、何时forward、何时交付
+ *   InferTrace::enable();
+ *   ... 运行 ...
+ *   InferTrace::save("workspace/infer.trace.json");
+ *
+ * 每个线程一个环形缓冲区，记录只有本线程写，没有锁；缓冲区满时覆盖最旧的事件，statistics().dropped计数
+ * 关闭时每个记录点只有一次relaxed load。所有时间都是host上的时间（steady_clock，微秒），不需要GPU，
+ * 异步forward的区间只包含提交到stream的耗时，GPU上的耗时见InferMetrics
+ *
+ * name、category、arg_name需要在整个进程期间有效（字符串常量，或者intern返回的指针）
+ */
+namespace InferTrace{
+
+    struct TraceStatistics{
+        long long recorded = 0;     // 缓冲区中尚未清除的事件数
+        long long dropped  = 0;     // 上次清除之后，因缓冲区满而被覆盖的事件数
+        int threads        = 0;     // 记录过事件的线程数
+    };
+
+    extern std::atomic<bool> __enabled;
+
+    inline bool enabled(){
+        return __enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool enabled = true);
+
+    // 每个线程的缓冲区能保存的事件数，向上取整到2的幂，对之后新建的缓冲区生效
+    void set_buffer_capacity(int events_per_thread);
+
+    // 输出中当前线程的名字，不调用时为thread N
+    void set_thread_name(const std::string& name);
+
+    // 返回进程期间一直有效的字符串指针，相同内容返回同一个指针，用于模型名之类的动态字符串
+    const char* intern(const std::string& str);
+
+    long long now_us();
+
+    // 异步区间的id，进程内唯一，从1开始
+    long long next_id();
+
+    void record(char phase, const char* name, const char* category, long long timestamp, long long duration,
+        long long id, const char* arg_name, long long arg_value);
+
+    // 一段已经结束的区间 [begin_us, end_us]，ph = X
+    inline void complete(const char* name, const char* category, long long begin_us, long long end_us,
+        const char* arg_name = nullptr, long long arg_value = 0){
+        if(enabled()) record('X', name, category, begin_us, end_us - begin_us, 0, arg_name, arg_value);
+    }
+
+    inline void instant(const char* name, const char* category, const char* arg_name = nullptr, long long arg_value = 0){
+        if(enabled()) record('i', name, category, now_us(), 0, 0, arg_name, arg_value);
+    }
+
+    // 跨线程的异步区间，例如一个任务从commit到交付，name、category、id相同的begin/end配对
+    inline void async_begin(const char* name, const char* category, long long id){
+        if(enabled()) record('b', name, category, now_us(), 0, id, nullptr, 0);
+    }
+
+    inline void async_instant(const char* name, const char* category, long long id, const char* arg_name = nullptr, long long arg_value = 0){
+        if(enabled()) record('n', name, category, now_us(), 0, id, arg_name, arg_value);
+    }
+
+    inline void async_end(const char* name, const char* category, long long id){
+        if(enabled()) record('e', name, category, now_us(), 0, id, nullptr, 0);
+    }
+
+    // 作用域内的区间，构造时没有开启则不记录
+    class Span{
+    public:
+        Span(const char* name, const char* category, const char* arg_name = nullptr, long long arg_value = 0)
+            :name_(name), category_(category), arg_name_(arg_name), arg_value_(arg_value){
+            if(enabled()) begin_ = now_us();
+        }
+
+        virtual ~Span(){
+            if(begin_ != 0) complete(name_, category_, begin_, now_us(), arg_name_, arg_value_);
+        }
+
+        Span(const Span& other) = delete;
+        Span& operator = (const Span& other) = delete;
+
+    private:
+        const char* name_;
+        const char* category_;
+        const char* arg_name_;
+        long long arg_value_;
+        long long begin_ = 0;
+    };
+
+    /**
+     * @brief 把所有线程缓冲区中的事件输出为Chrome trace JSON
+     * 可以在记录的同时调用，此时正在被覆盖的事件会被跳过。clear为true时输出之后清除这些事件
+     */
+    std::string dump(bool clear = true);
+    bool save(const std::string& file, bool clear = true);
+
+    void clear();
+    TraceStatistics statistics();
+};
+
+#endif // INFER_TRACE_HPP
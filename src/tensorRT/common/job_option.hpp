@@ -0,0 +1,23 @@
+
+#ifndef JOB_OPTION_HPP
+#define JOB_OPTION_HPP
+
+/**
+ * @brief commit时可以指定的任务选项，应用层的Infer接口可以直接使用
+ */
+
+enum class JobPriority : int{
+    High   = 0,     // 例如报警类的实时流
+    Normal = 1,
+    Low    = 2      // 例如建库、重建索引等批量任务
+};
+
+struct JobOption{
+    JobPriority priority = JobPriority::Normal;
+    float deadline_ms    = 0;   // 相对commit时刻，最晚需要开始推理的时间，0表示不限制
+
+    JobOption() = default;
+    JobOption(JobPriority priority, float deadline_ms = 0):priority(priority), deadline_ms(deadline_ms){}
+};
+
+#endif // JOB_OPTION_HPP
@@ -0,0 +1,162 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+/**
+ * @brief 直方图的快照，可以合并，可以查询分位数
+ * 桶的划分与LatencyHistogram相同，buckets[i]为第i个桶的计数
+ */
+struct HistogramSnapshot{
+    long long count = 0;
+    long long sum   = 0;
+    long long min   = 0;
+    long long max   = 0;
+    std::vector<long long> buckets;
+
+    double mean() const{
+        return count == 0 ? 0 : sum / (double)count;
+    }
+
+    // percentile为[0, 100]，返回所在桶的中点，不超过max，误差与桶宽度相同
+    long long percentile(double percentile) const;
+
+    void merge(const HistogramSnapshot& other){
+        if(other.count == 0) return;
+        if(count == 0){
+            *this = other;
+            return;
+        }
+
+        if(buckets.size() < other.buckets.size())
+            buckets.resize(other.buckets.size(), 0);
+
+        for(size_t i = 0; i < other.buckets.size(); ++i)
+            buckets[i] += other.buckets[i];
+
+        min    = std::min(min, other.min);
+        max    = std::max(max, other.max);
+        count += other.count;
+        sum   += other.sum;
+    }
+};
+
+/**
+ * @brief HDR风格的直方图，记录非负整数（耗时用微秒），相对误差不超过1/32
+ * 小于64的值每个值一个桶，之后每个2的幂区间均分为32个桶，最大到2^40，超出的计入最后一个桶
+ * record只有几次relaxed的原子操作，没有锁，可以在commit线程、worker线程上一直开着
+ */
+class LatencyHistogram{
+public:
+    static const int SUB_BUCKET_BITS  = 5;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS   = 40;
+    static const int NUM_BUCKETS      = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    LatencyHistogram(){ reset(); }
+    LatencyHistogram(const LatencyHistogram& other) = delete;
+    LatencyHistogram& operator = (const LatencyHistogram& other) = delete;
+
+    void record(long long value){
+
+        if(value < 0) value = 0;
+        buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        long long current = min_.load(std::memory_order_relaxed);
+        while(value < current && !min_.compare_exchange_weak(current, value, std::memory_order_relaxed));
+
+        current = max_.load(std::memory_order_relaxed);
+        while(value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed));
+    }
+
+    // 与record并发时，各个字段之间可能相差几次记录
+    HistogramSnapshot snapshot() const{
+
+        HistogramSnapshot output;
+        output.count = count_.load(std::memory_order_relaxed);
+        if(output.count == 0) return output;
+
+        output.sum = sum_.load(std::memory_order_relaxed);
+        output.min = min_.load(std::memory_order_relaxed);
+        output.max = max_.load(std::memory_order_relaxed);
+        output.buckets.resize(NUM_BUCKETS);
+        for(int i = 0; i < NUM_BUCKETS; ++i)
+            output.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        return output;
+    }
+
+    void reset(){
+        for(int i = 0; i < NUM_BUCKETS; ++i)
+            buckets_[i].store(0, std::memory_order_relaxed);
+
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(INT64_MAX, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    static int bucket_index(long long value){
+
+        if(value < 2 * SUB_BUCKET_COUNT) return (int)value;
+        if(value >= (1LL << MAX_VALUE_BITS)) return NUM_BUCKETS - 1;
+
+        int exponent = 63 - __builtin_clzll((unsigned long long)value);
+        int mantissa = (int)(value >> (exponent - SUB_BUCKET_BITS));
+        return (exponent - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT + mantissa;
+    }
+
+    // 第index个桶的取值范围[lower, upper]
+    static long long bucket_lower(int index){
+        if(index < 2 * SUB_BUCKET_COUNT) return index;
+
+        int shift    = index / SUB_BUCKET_COUNT - 1;
+        int mantissa = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+        return (long long)mantissa << shift;
+    }
+
+    static long long bucket_upper(int index){
+        if(index < 2 * SUB_BUCKET_COUNT) return index;
+
+        int shift    = index / SUB_BUCKET_COUNT - 1;
+        int mantissa = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+        return (((long long)mantissa + 1) << shift) - 1;
+    }
+
+    // 单调时钟，微秒
+    static long long now_us(){
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::atomic<long long> buckets_[NUM_BUCKETS];
+    std::atomic<long long> count_{0};
+    std::atomic<long long> sum_{0};
+    std::atomic<long long> min_{0};
+    std::atomic<long long> max_{0};
+};
+
+inline long long HistogramSnapshot::percentile(double percentile) const{
+
+    if(count == 0) return 0;
+
+    long long target = (long long)(std::max(0.0, std::min(100.0, percentile)) / 100.0 * count + 0.5);
+    target = std::max(1LL, std::min(count, target));
+
+    long long accumulated = 0;
+    for(size_t i = 0; i < buckets.size(); ++i){
+        accumulated += buckets[i];
+        if(accumulated >= target){
+            long long middle = (LatencyHistogram::bucket_lower(i) + LatencyHistogram::bucket_upper(i)) / 2;
+            return std::max(min, std::min(max, middle));
+        }
+    }
+    return max;
+}
+
+#endif // LATENCY_HISTOGRAM_HPP
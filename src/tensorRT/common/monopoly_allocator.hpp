@@ -7,7 +7,29 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include "latency_histogram.hpp"
+#include "infer_trace.hpp"
 
+struct MonopolyStatistics{
+    int capacity            = 0;
+    int available           = 0;        // 当前空闲数
+    int peak_occupancy      = 0;
+    long long num_query     = 0;        // 成功分配的次数
+    long long num_wait      = 0;        // 需要等待的query次数
+    long long num_timeout   = 0;
+    double total_wait_ms    = 0;
+    double max_wait_ms      = 0;
+};
+
+/**
+ * @brief 独占式的对象分配器，query拿到的对象在release之前不会分配给别人
+ * 空闲对象用无锁栈（Treiber stack）维护，query/release都是O(1)且不需要mutex，
+ * 只有空闲数为0需要等待时才会进入锁。对象表是分段的，扩容时已有对象的地址不变
+ */
 template<class _ItemType>
 class MonopolyAllocator{
 public:
@@ -17,87 +39,267 @@ public:
         void release(){manager_->release_one(this);}
 
     private:
-        MonopolyData(MonopolyAllocator* pmanager){manager_ = pmanager;}
+        MonopolyData(MonopolyAllocator* pmanager, uint32_t index){manager_ = pmanager; index_ = index;}
 
     private:
         friend class MonopolyAllocator;
         MonopolyAllocator* manager_ = nullptr;
         std::shared_ptr<_ItemType> data_;
-        bool available_ = true;
+        std::atomic<bool> available_{true};
+        std::atomic<uint32_t> next_{0};        // 空闲栈中下一个节点的index + 1，0表示栈底
+        uint32_t index_ = 0;
     };
     typedef std::shared_ptr<MonopolyData> MonopolyDataPointer;
 
     MonopolyAllocator(int size){
-        capacity_ = size;
-        num_available_ = size;
-        datas_.resize(size);
-
-        for(int i = 0; i < size; ++i)
-            datas_[i] = std::shared_ptr<MonopolyData>(new MonopolyData(this));
+        for(int i = 0; i < MAX_SEGMENTS; ++i)
+            segments_[i].store(nullptr, std::memory_order_relaxed);
+        resize(size);
     }
 
     virtual ~MonopolyAllocator(){
         run_ = false;
-        cv_.notify_all();
-        
-        std::unique_lock<std::mutex> l(lock_);
-        cv_exit_.wait(l, [&](){
-            return num_wait_thread_ == 0;
-        });
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            cv_.notify_all();
+            cv_exit_.wait(l, [&](){
+                return num_wait_thread_ == 0;
+            });
+        };
+
+        for(int i = 0; i < MAX_SEGMENTS; ++i)
+            delete[] segments_[i].load();
     }
 
     MonopolyDataPointer query(int timeout = 10000){
 
-        std::unique_lock<std::mutex> l(lock_);
         if(!run_) return nullptr;
-        
-        if(num_available_ == 0){
+
+        InferTrace::Span span("allocator_query", "allocator");
+
+        MonopolyData* item = pop_free();
+        if(item == nullptr){
+            auto t0 = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> l(lock_);
             num_wait_thread_++;
 
-            auto state = cv_.wait_for(l, std::chrono::milliseconds(timeout), [&](){
-                return num_available_ > 0 || !run_;
+            // 与release_one中的push配对，保证不会丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv_.wait_for(l, std::chrono::milliseconds(timeout), [&](){
+                return !run_ || (item = pop_free()) != nullptr;
             });
 
             num_wait_thread_--;
             cv_exit_.notify_one();
 
+            double wait_ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count() / 1000.0;
+            num_wait_++;
+            total_wait_ms_ += wait_ms;
+            max_wait_ms_    = std::max(max_wait_ms_, wait_ms);
+
+            wait_histogram_.record((long long)(wait_ms * 1000));
+
             // timeout, no available, exit program
-            if(!state || num_available_ == 0 || !run_)
+            if(item == nullptr || !run_){
+                num_timeout_++;
+                if(item) push_free(item);
                 return nullptr;
+            }
+        }else{
+            wait_histogram_.record(0);
         }
 
-        auto item = std::find_if(datas_.begin(), datas_.end(), [](MonopolyDataPointer& item){return item->available_;});
-        if(item == datas_.end())
-            return nullptr;
-        
-        (*item)->available_ = false;
-        num_available_--;
-        return *item;
+        item->available_ = false;
+        int occupancy = num_live_ - num_available_;
+        int peak      = peak_occupancy_.load(std::memory_order_relaxed);
+        while(occupancy > peak && !peak_occupancy_.compare_exchange_weak(peak, occupancy));
+
+        num_query_++;
+        return node_pointer(item->index_);
+    }
+
+    // 每次query的等待时间（微秒），不需要等待的记为0
+    LatencyHistogram& wait_histogram(){
+        return wait_histogram_;
     }
 
     int num_available(){
         return num_available_;
     }
 
+    int capacity(){
+        return capacity_;
+    }
+
+    /**
+     * @brief 运行时修改容量
+     * 扩容立即生效并唤醒等待者。缩容时先回收空闲的对象，不够的部分等使用者release后再回收，
+     * 被回收对象的data会被释放
+     */
+    bool resize(int new_capacity){
+
+        if(new_capacity < 0 || new_capacity > MAX_SEGMENTS * SEGMENT_SIZE)
+            return false;
+
+        std::unique_lock<std::mutex> l(lock_);
+        int delta = new_capacity - capacity_;
+        capacity_ = new_capacity;
+        if(delta > 0){
+
+            // 先抵消还没完成的缩容
+            int pending = pending_retire_.exchange(0);
+            int cancel  = std::min(delta, pending);
+            pending_retire_ += pending - cancel;
+            delta           -= cancel;
+
+            for(; delta > 0; --delta){
+                MonopolyData* item = nullptr;
+                if(!retired_.empty()){
+                    item = node(retired_.back());
+                    retired_.pop_back();
+                }else{
+                    item = allocate_node();
+                }
+
+                item->available_ = true;
+                num_live_++;
+                push_free(item);
+            }
+            cv_.notify_all();
+        }else if(delta < 0){
+            for(; delta < 0; ++delta){
+                MonopolyData* item = pop_free();
+                if(item == nullptr){
+                    pending_retire_ -= delta;
+                    break;
+                }
+                retire(item);
+            }
+        }
+        return true;
+    }
+
+    MonopolyStatistics statistics(){
+        MonopolyStatistics out;
+        std::unique_lock<std::mutex> l(lock_);
+        out.capacity       = capacity_;
+        out.available      = std::max(0, (int)num_available_);
+        out.peak_occupancy = peak_occupancy_;
+        out.num_query      = num_query_;
+        out.num_wait       = num_wait_;
+        out.num_timeout    = num_timeout_;
+        out.total_wait_ms  = total_wait_ms_;
+        out.max_wait_ms    = max_wait_ms_;
+        return out;
+    }
+
 private:
     void release_one(MonopolyData* prq){
-        std::unique_lock<std::mutex> l(lock_);
-        if(!prq->available_){
-            prq->available_ = true;
-            num_available_++;
+
+        // 重复release是无效的
+        if(prq->available_.exchange(true))
+            return;
+
+        int pending = pending_retire_.load();
+        while(pending > 0){
+            if(pending_retire_.compare_exchange_weak(pending, pending - 1)){
+                std::unique_lock<std::mutex> l(lock_);
+                retire(prq);
+                return;
+            }
+        }
+
+        push_free(prq);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(num_wait_thread_ > 0){
+            std::unique_lock<std::mutex> l(lock_);
             cv_.notify_one();
         }
     }
 
+    // 需要持有lock_，item不在空闲栈中
+    // 回收的对象保持available_ = true，使用者重复release时在release_one中直接返回，不会再次入栈或回收
+    void retire(MonopolyData* item){
+        item->available_ = true;
+        item->data_.reset();
+        retired_.push_back(item->index_);
+        num_live_--;
+    }
+
+    // 需要持有lock_
+    MonopolyData* allocate_node(){
+        uint32_t index = num_nodes_;
+        int segment    = index / SEGMENT_SIZE;
+        if(segments_[segment].load(std::memory_order_relaxed) == nullptr){
+            auto ptr = new MonopolyDataPointer[SEGMENT_SIZE];
+            for(int i = 0; i < SEGMENT_SIZE; ++i)
+                ptr[i] = MonopolyDataPointer(new MonopolyData(this, segment * SEGMENT_SIZE + i));
+            segments_[segment].store(ptr, std::memory_order_release);
+        }
+        num_nodes_++;
+        return node(index);
+    }
+
+    const MonopolyDataPointer& node_pointer(uint32_t index){
+        return segments_[index / SEGMENT_SIZE].load(std::memory_order_acquire)[index % SEGMENT_SIZE];
+    }
+
+    MonopolyData* node(uint32_t index){
+        return node_pointer(index).get();
+    }
+
+    // head_高32位为版本号，防止ABA，低32位为栈顶的index + 1
+    void push_free(MonopolyData* item){
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t new_head;
+        do{
+            item->next_.store((uint32_t)head, std::memory_order_relaxed);
+            new_head = (((head >> 32) + 1) << 32) | (item->index_ + 1);
+        }while(!head_.compare_exchange_weak(head, new_head, std::memory_order_release, std::memory_order_relaxed));
+        num_available_++;
+    }
+
+    MonopolyData* pop_free(){
+        uint64_t head = head_.load(std::memory_order_acquire);
+        while(true){
+            uint32_t top = (uint32_t)head;
+            if(top == 0) return nullptr;
+
+            MonopolyData* item = node(top - 1);
+            uint64_t new_head  = (((head >> 32) + 1) << 32) | item->next_.load(std::memory_order_relaxed);
+            if(head_.compare_exchange_weak(head, new_head, std::memory_order_acquire, std::memory_order_acquire)){
+                num_available_--;
+                return item;
+            }
+        }
+    }
+
 private:
+    static const int SEGMENT_SIZE = 64;
+    static const int MAX_SEGMENTS = 1024;
+
     std::mutex lock_;
     std::condition_variable cv_;
     std::condition_variable cv_exit_;
-    std::vector<MonopolyDataPointer> datas_;
-    int capacity_ = 0;
-    volatile int num_available_ = 0;
-    volatile int num_wait_thread_ = 0;
-    volatile bool run_ = true;
+    std::atomic<MonopolyDataPointer*> segments_[MAX_SEGMENTS];
+    std::atomic<uint64_t> head_{0};
+    std::vector<uint32_t> retired_;
+    uint32_t num_nodes_ = 0;
+
+    std::atomic<int> capacity_{0};
+    std::atomic<int> num_live_{0};          // 没有被回收的对象数，缩容未完成时会大于capacity_
+    std::atomic<int> num_available_{0};
+    std::atomic<int> pending_retire_{0};
+    std::atomic<int> num_wait_thread_{0};
+    std::atomic<bool> run_{true};
+
+    std::atomic<int> peak_occupancy_{0};
+    std::atomic<long long> num_query_{0};
+    long long num_wait_     = 0;        // 以下由lock_保护
+    long long num_timeout_  = 0;
+    double total_wait_ms_   = 0;
+    double max_wait_ms_     = 0;
+    LatencyHistogram wait_histogram_;
 };
 
-#endif // MONOPOLY_ALLOCATOR_HPP
\ No newline at end of file
+#endif // MONOPOLY_ALLOCATOR_HPP
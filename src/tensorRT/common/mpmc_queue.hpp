@@ -0,0 +1,125 @@
+
+#ifndef MPMC_QUEUE_HPP
+#define MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstddef>
+
+/**
+ * @brief 有界的无锁多生产者多消费者队列
+ * 基于Dmitry Vyukov的bounded mpmc queue，每个槽位带一个序号，
+ * 生产者/消费者通过CAS抢占位置，不需要任何mutex
+ * 容量会向上取整到2的幂
+ */
+template<class _ItemType>
+class MPMCQueue{
+public:
+    MPMCQueue(size_t capacity = 1024){
+
+        size_t size = 2;
+        while(size < capacity) size <<= 1;
+
+        mask_  = size - 1;
+        cells_ = std::vector<Cell>(size);
+        for(size_t i = 0; i < size; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    MPMCQueue(const MPMCQueue& other) = delete;
+    MPMCQueue& operator = (const MPMCQueue& other) = delete;
+
+    // 队列满时返回false，此时item不会被move走
+    bool try_push(_ItemType& item){
+
+        Cell* cell = nullptr;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while(true){
+            cell = &cells_[pos & mask_];
+            size_t seq    = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0){
+                if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }else if(diff < 0){
+                return false;
+            }else{
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回false
+    bool try_pop(_ItemType& item){
+
+        Cell* cell = nullptr;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while(true){
+            cell = &cells_[pos & mask_];
+            size_t seq    = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if(diff == 0){
+                if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }else if(diff < 0){
+                return false;
+            }else{
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        item = std::move(cell->data);
+
+        // 清掉槽位上的残留，避免持有的shared_ptr等资源被延迟释放
+        cell->data = _ItemType();
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似判断，仅用于等待条件，不作为pop是否成功的依据
+    bool empty() const{
+        size_t pos = dequeue_pos_.load(std::memory_order_acquire);
+        size_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+    }
+
+    size_t size_approx() const{
+        size_t tail = enqueue_pos_.load(std::memory_order_acquire);
+        size_t head = dequeue_pos_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const{ return mask_ + 1; }
+
+private:
+    struct Cell{
+        std::atomic<size_t> sequence;
+        _ItemType data;
+
+        Cell() = default;
+
+        // vector初始化需要，此时不存在并发访问
+        Cell(const Cell& other):data(other.data){sequence.store(other.sequence.load());}
+    };
+
+    // 生产者和消费者的位置放在不同的cache line，避免false sharing
+    static const int CACHE_LINE_SIZE = 64;
+    char pad0_[CACHE_LINE_SIZE];
+    std::vector<Cell> cells_;
+    size_t mask_ = 0;
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos_;
+    char pad2_[CACHE_LINE_SIZE];
+    std::atomic<size_t> dequeue_pos_;
+    char pad3_[CACHE_LINE_SIZE];
+};
+
+#endif // MPMC_QUEUE_HPP
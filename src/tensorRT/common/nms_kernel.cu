@@ -0,0 +1,385 @@
+
+#include "nms_kernel.cuh"
+
+namespace CUDAKernel{
+
+	static const int NMS_BLOCK_SIZE = 1024;
+	static const int NMS_MASK_BITS  = 64;		// 每个mask word对应的box数，也是mask kernel的block大小
+
+	// workspace的划分
+	struct NMSWorkspace{
+		int* count;						// top-K之后的数量
+		int* index;						// top_k，排序后的box在输入中的索引
+		float* sorted;					// top_k * 6，排序后box的前6个值
+		unsigned long long* mask;		// top_k * words，第i行的第j位表示排序后的第i个box抑制第j个
+	};
+
+	static int mask_words(int top_k){
+		return (top_k + NMS_MASK_BITS - 1) / NMS_MASK_BITS;
+	}
+
+	static NMSWorkspace split_workspace(void* workspace, int top_k){
+		uint8_t* ptr = (uint8_t*)workspace;
+		NMSWorkspace output;
+		output.count  = (int*)ptr;                 ptr += 256;
+		output.index  = (int*)ptr;                 ptr += iLogger::upbound(top_k * sizeof(int), 256);
+		output.sorted = (float*)ptr;               ptr += iLogger::upbound(top_k * 6 * sizeof(float), 256);
+		output.mask   = (unsigned long long*)ptr;
+		return output;
+	}
+
+	size_t nms_workspace_size(int top_k){
+		return 256 + iLogger::upbound(top_k * sizeof(int), 256) + iLogger::upbound(top_k * 6 * sizeof(float), 256)
+			+ (size_t)top_k * mask_words(top_k) * sizeof(unsigned long long);
+	}
+
+	// 与float大小顺序一致的无符号key，-0.0与0.0相同
+	static __device__ unsigned int confidence_key(float confidence){
+		unsigned int bits = __float_as_uint(confidence == 0.0f ? 0.0f : confidence);
+		return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+	}
+
+	// 升序排序后为置信度降序，置信度相同时索引小的在前
+	static __device__ unsigned long long sort_key(unsigned int key, int index){
+		return ((unsigned long long)(~key) << 32) | (unsigned int)index;
+	}
+
+	/**
+	 * 一个block完成top-K的选取和排序
+	 * 1. 按8位一组的基数选择，找到第top_k大的key（threshold_key），以及其中需要取的个数num_equal
+	 * 2. key > threshold_key的全部选中，key == threshold_key的按索引顺序取前num_equal个，保证结果确定
+	 * 3. 在shared memory中bitonic排序
+	 */
+	static __global__ void topk_sort_kernel(const float* boxes, int num_boxes, int box_element, int top_k, float score_threshold, NMSWorkspace workspace, int* num_candidates){
+
+		__shared__ unsigned long long keys[MAX_NMS_TOPK];
+		__shared__ unsigned int histogram[256];
+		__shared__ unsigned int warp_counts[NMS_BLOCK_SIZE / 32];
+		__shared__ int num_valid, num_greater;
+		__shared__ unsigned int prefix, prefix_mask, remain;
+
+		int tid = threadIdx.x;
+		if(tid == 0){
+			num_valid   = 0;
+			num_greater = 0;
+			prefix      = 0;
+			prefix_mask = 0;
+			remain      = top_k;
+		}
+		__syncthreads();
+
+		int local_valid = 0;
+		for(int i = tid; i < num_boxes; i += blockDim.x)
+			local_valid += boxes[i * box_element + 4] >= score_threshold;
+		atomicAdd(&num_valid, local_valid);
+		__syncthreads();
+
+		int num_select     = min(num_valid, top_k);
+		bool take_all      = num_valid <= top_k;
+		unsigned int threshold_key = 0;
+		int num_equal      = 0;
+
+		if(!take_all){
+			for(int shift = 24; shift >= 0; shift -= 8){
+				for(int i = tid; i < 256; i += blockDim.x)
+					histogram[i] = 0;
+				__syncthreads();
+
+				unsigned int current_prefix = prefix;
+				unsigned int current_mask   = prefix_mask;
+				for(int i = tid; i < num_boxes; i += blockDim.x){
+					float confidence = boxes[i * box_element + 4];
+					if(!(confidence >= score_threshold)) continue;
+
+					unsigned int key = confidence_key(confidence);
+					if((key & current_mask) == current_prefix)
+						atomicAdd(&histogram[(key >> shift) & 0xFF], 1u);
+				}
+				__syncthreads();
+
+				if(tid == 0){
+					unsigned int accumulate = 0;
+					for(int bin = 255; bin >= 0; --bin){
+						if(accumulate + histogram[bin] >= remain){
+							remain     -= accumulate;
+							prefix      = current_prefix | ((unsigned int)bin << shift);
+							prefix_mask = current_mask | (0xFFu << shift);
+							break;
+						}
+						accumulate += histogram[bin];
+					}
+				}
+				__syncthreads();
+			}
+			threshold_key = prefix;
+			num_equal     = remain;
+		}
+
+		// key > threshold_key的直接追加，顺序由后面的排序决定
+		for(int i = tid; i < num_boxes; i += blockDim.x){
+			float confidence = boxes[i * box_element + 4];
+			if(!(confidence >= score_threshold)) continue;
+
+			unsigned int key = confidence_key(confidence);
+			if(take_all || key > threshold_key)
+				keys[atomicAdd(&num_greater, 1)] = sort_key(key, i);
+		}
+		__syncthreads();
+
+		// key == threshold_key的按索引顺序取前num_equal个，block内用ballot做exclusive scan
+		if(!take_all){
+			int base  = num_greater;
+			int taken = 0;
+			int lane  = tid & 31;
+			int warp  = tid >> 5;
+			for(int chunk = 0; chunk < num_boxes && taken < num_equal; chunk += blockDim.x){
+				int i      = chunk + tid;
+				bool equal = false;
+				if(i < num_boxes){
+					float confidence = boxes[i * box_element + 4];
+					equal = confidence >= score_threshold && confidence_key(confidence) == threshold_key;
+				}
+
+				unsigned int ballot = __ballot_sync(0xFFFFFFFF, equal);
+				if(lane == 0) warp_counts[warp] = __popc(ballot);
+				__syncthreads();
+
+				int offset = 0, total = 0;
+				for(int w = 0; w < (int)(blockDim.x >> 5); ++w){
+					if(w < warp) offset += warp_counts[w];
+					total += warp_counts[w];
+				}
+
+				int rank = taken + offset + __popc(ballot & ((1u << lane) - 1));
+				if(equal && rank < num_equal)
+					keys[base + rank] = sort_key(threshold_key, i);
+
+				taken += total;
+				__syncthreads();
+			}
+		}
+
+		int size = 1;
+		while(size < num_select) size <<= 1;
+		for(int i = num_select + tid; i < size; i += blockDim.x)
+			keys[i] = ~0ull;
+		__syncthreads();
+
+		for(int k = 2; k <= size; k <<= 1){
+			for(int j = k >> 1; j > 0; j >>= 1){
+				for(int i = tid; i < size; i += blockDim.x){
+					int ixj = i ^ j;
+					if(ixj > i){
+						unsigned long long a = keys[i];
+						unsigned long long b = keys[ixj];
+						bool ascending = (i & k) == 0;
+						if((a > b) == ascending){
+							keys[i]   = b;
+							keys[ixj] = a;
+						}
+					}
+				}
+				__syncthreads();
+			}
+		}
+
+		for(int i = tid; i < num_select; i += blockDim.x){
+			int index            = (int)(keys[i] & 0xFFFFFFFF);
+			const float* pbox    = boxes + index * box_element;
+			float* psorted       = workspace.sorted + i * 6;
+			workspace.index[i]   = index;
+			for(int e = 0; e < 6; ++e)
+				psorted[e] = pbox[e];
+		}
+
+		if(tid == 0){
+			*workspace.count = num_select;
+			if(num_candidates) *num_candidates = num_valid;
+		}
+	}
+
+	// 每个block计算64个box与另外64个box之间的抑制关系，只计算上三角
+	static __global__ void nms_mask_kernel(NMSWorkspace workspace, int words, float nms_threshold, NMSMethod method){
+
+		int count     = *workspace.count;
+		int row_start = blockIdx.y;
+		int col_start = blockIdx.x;
+		if(row_start > col_start) return;
+
+		int row_size = min(count - row_start * NMS_MASK_BITS, NMS_MASK_BITS);
+		int col_size = min(count - col_start * NMS_MASK_BITS, NMS_MASK_BITS);
+		if(row_size <= 0 || col_size <= 0) return;
+
+		__shared__ float block_boxes[NMS_MASK_BITS * 6];
+		if(threadIdx.x < col_size){
+			const float* pbox = workspace.sorted + (col_start * NMS_MASK_BITS + threadIdx.x) * 6;
+			for(int e = 0; e < 6; ++e)
+				block_boxes[threadIdx.x * 6 + e] = pbox[e];
+		}
+		__syncthreads();
+
+		if(threadIdx.x < row_size){
+			int current           = row_start * NMS_MASK_BITS + threadIdx.x;
+			const float* pcurrent = workspace.sorted + current * 6;
+			unsigned long long bits = 0;
+			int start = row_start == col_start ? threadIdx.x + 1 : 0;
+			for(int i = start; i < col_size; ++i){
+				if(box_nms_overlap(pcurrent, block_boxes + i * 6, nms_threshold, method))
+					bits |= 1ull << i;
+			}
+			workspace.mask[current * words + col_start] = bits;
+		}
+	}
+
+	// 按排序后的顺序，未被抑制的box保留，并把它的mask合并到removed中
+	static __global__ void nms_reduce_kernel(const float* boxes, int box_element, NMSWorkspace workspace, int words, float* output){
+
+		__shared__ unsigned long long removed[MAX_NMS_TOPK / NMS_MASK_BITS];
+		__shared__ int num_keep;
+
+		int count = *workspace.count;
+		for(int w = threadIdx.x; w < words; w += blockDim.x)
+			removed[w] = 0;
+		if(threadIdx.x == 0) num_keep = 0;
+		__syncthreads();
+
+		for(int i = 0; i < count; ++i){
+			int word        = i / NMS_MASK_BITS;
+			bool is_removed = (removed[word] >> (i % NMS_MASK_BITS)) & 1;
+			int slot        = num_keep;
+			__syncthreads();
+
+			if(!is_removed){
+				const float* pbox = boxes + workspace.index[i] * box_element;
+				float* pout       = output + 1 + slot * box_element;
+				for(int e = threadIdx.x; e < box_element; e += blockDim.x)
+					pout[e] = pbox[e];
+
+				const unsigned long long* pmask = workspace.mask + i * words;
+				for(int w = word + threadIdx.x; w < words; w += blockDim.x)
+					removed[w] |= pmask[w];
+
+				if(threadIdx.x == 0) num_keep++;
+			}
+			__syncthreads();
+		}
+
+		if(threadIdx.x == 0)
+			*output = num_keep;
+	}
+
+	// (score, index)中更好的一个，分数高的优先，相同时索引小的优先，index为-1表示没有
+	static __device__ void select_best(float& score, int& index, float other_score, int other_index){
+		if(other_index == -1) return;
+		if(index == -1 || other_score > score || (other_score == score && other_index < index)){
+			score = other_score;
+			index = other_index;
+		}
+	}
+
+	// SoftNMS，每次选出剩余中分数最高的box，然后衰减同类别的其他box
+	static __global__ void soft_nms_kernel(const float* boxes, int box_element, NMSWorkspace workspace, float score_threshold, float* output){
+
+		__shared__ float scores[MAX_NMS_TOPK];
+		__shared__ unsigned char alive[MAX_NMS_TOPK];
+		__shared__ float warp_scores[NMS_BLOCK_SIZE / 32];
+		__shared__ int warp_indices[NMS_BLOCK_SIZE / 32];
+		__shared__ int best_shared;
+		__shared__ int num_keep;
+
+		int tid   = threadIdx.x;
+		int count = *workspace.count;
+		for(int i = tid; i < count; i += blockDim.x){
+			scores[i] = workspace.sorted[i * 6 + 4];
+			alive[i]  = 1;
+		}
+		if(tid == 0) num_keep = 0;
+		__syncthreads();
+
+		while(true){
+			float best_score = 0;
+			int best_index   = -1;
+			for(int i = tid; i < count; i += blockDim.x){
+				if(alive[i]) select_best(best_score, best_index, scores[i], i);
+			}
+
+			for(int offset = 16; offset > 0; offset >>= 1){
+				float other_score = __shfl_down_sync(0xFFFFFFFF, best_score, offset);
+				int other_index   = __shfl_down_sync(0xFFFFFFFF, best_index, offset);
+				select_best(best_score, best_index, other_score, other_index);
+			}
+
+			if((tid & 31) == 0){
+				warp_scores[tid >> 5]  = best_score;
+				warp_indices[tid >> 5] = best_index;
+			}
+			__syncthreads();
+
+			if(tid == 0){
+				float score = 0;
+				int index   = -1;
+				for(int w = 0; w < (int)(blockDim.x >> 5); ++w)
+					select_best(score, index, warp_scores[w], warp_indices[w]);
+				best_shared = index != -1 && score >= score_threshold ? index : -1;
+			}
+			__syncthreads();
+
+			int best = best_shared;
+			if(best == -1) break;
+
+			const float* pbox = boxes + workspace.index[best] * box_element;
+			float* pout       = output + 1 + num_keep * box_element;
+			for(int e = tid; e < box_element; e += blockDim.x)
+				pout[e] = e == 4 ? scores[best] : pbox[e];
+			__syncthreads();
+
+			if(tid == 0){
+				alive[best] = 0;
+				num_keep++;
+			}
+
+			const float* pbest = workspace.sorted + best * 6;
+			for(int j = tid; j < count; j += blockDim.x){
+				if(j == best || !alive[j] || workspace.sorted[j * 6 + 5] != pbest[5]) continue;
+
+				float iou  = box_nms_iou(pbest, workspace.sorted + j * 6);
+				scores[j] *= expf(-(iou * iou) / SOFT_NMS_SIGMA);
+				if(scores[j] < score_threshold)
+					alive[j] = 0;
+			}
+			__syncthreads();
+		}
+
+		if(tid == 0)
+			*output = num_keep;
+	}
+
+	void topk_sort_nms(
+		const float* boxes, int num_boxes, int box_element, int top_k,
+		float nms_threshold, NMSMethod method, float score_threshold,
+		float* output, void* workspace, cudaStream_t stream, int* num_candidates){
+
+		Assert(top_k > 0 && top_k <= MAX_NMS_TOPK);
+
+		auto nms_workspace = split_workspace(workspace, top_k);
+		int words          = mask_words(top_k);
+		checkCudaKernel(topk_sort_kernel<<<1, NMS_BLOCK_SIZE, 0, stream>>>(
+			boxes, num_boxes, box_element, top_k, score_threshold, nms_workspace, num_candidates
+		));
+
+		if(method == NMSMethod::SoftNMS){
+			checkCudaKernel(soft_nms_kernel<<<1, NMS_BLOCK_SIZE, 0, stream>>>(
+				boxes, box_element, nms_workspace, score_threshold, output
+			));
+			return;
+		}
+
+		dim3 grid(words, words);
+		checkCudaKernel(nms_mask_kernel<<<grid, NMS_MASK_BITS, 0, stream>>>(
+			nms_workspace, words, nms_threshold, method
+		));
+		checkCudaKernel(nms_reduce_kernel<<<1, NMS_MASK_BITS, 0, stream>>>(
+			boxes, box_element, nms_workspace, words, output
+		));
+	}
+};
@@ -0,0 +1,27 @@
+#ifndef NMS_KERNEL_CUH
+#define NMS_KERNEL_CUH
+
+#include <common/cuda_tools.hpp>
+#include <common/box_nms.hpp>
+
+namespace CUDAKernel{
+
+    // topk_sort_nms需要的workspace字节数
+    size_t nms_workspace_size(int top_k);
+
+    /**
+     * @brief 置信度top-K + 排序 + NMS，与CPUKernel::topk_sort_nms的算法相同
+     * boxes为num_boxes个box，每个box_element个float，confidence < score_threshold的box不参与，
+     * 因此解码时可以把不要的box的confidence置为-1，而不需要原子操作压缩
+     * ClassAware、ClassAgnostic使用bitmask NMS，SoftNMS在一个block中逐个选取
+     * 结果写到output：count，然后count个box（每个box_element个float），按置信度降序，最多top_k个
+     * top_k不能超过MAX_NMS_TOPK，workspace至少nms_workspace_size(top_k)字节，在stream上顺序复用
+     * num_candidates不为空时写入top-K之前满足score_threshold的box数量（device指针），大于top_k即发生了截断
+     */
+    void topk_sort_nms(
+        const float* boxes, int num_boxes, int box_element, int top_k,
+        float nms_threshold, NMSMethod method, float score_threshold,
+        float* output, void* workspace, cudaStream_t stream, int* num_candidates = nullptr);
+};
+
+#endif // NMS_KERNEL_CUH
@@ -0,0 +1,455 @@
+
+#include "preprocess_cpu.hpp"
+#include <math.h>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_KERNEL_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define CPU_KERNEL_NEON
+#endif
+
+namespace CPUKernel{
+
+    using namespace CUDAKernel;
+
+    struct WarpAffineRow{
+        WarpAffineSource source;
+        void* dst;              // 整张图像的输出
+        float* dst_c0;          // float32 NCHW时，当前行在三个平面中的起始位置
+        float* dst_c1;
+        float* dst_c2;
+        bool planar_float;      // 是否为float32 NCHW，其他格式通过store_normalized_pixel写出
+        int dst_width, dst_height, dy;
+        const float* m;
+        uint8_t const_value;
+        int type;               // Norm的类型
+        bool invert_channel;
+        const Norm* norm;
+    };
+
+    // 与kernel中的采样逐行对应
+    static inline void sample_pixel(const WarpAffineRow& row, float src_x, float src_y, float& c0, float& c1, float& c2){
+
+        if(src_x <= -1 || src_x >= row.source.width || src_y <= -1 || src_y >= row.source.height){
+            // out of range
+            c0 = row.const_value;
+            c1 = row.const_value;
+            c2 = row.const_value;
+            return;
+        }
+
+        int y_low  = floorf(src_y);
+        int x_low  = floorf(src_x);
+        int y_high = y_low + 1;
+        int x_high = x_low + 1;
+
+        uint8_t const_value[] = {row.const_value, row.const_value, row.const_value};
+        float ly    = src_y - y_low;
+        float lx    = src_x - x_low;
+        float hy    = 1 - ly;
+        float hx    = 1 - lx;
+        float w1    = hy * hx, w2 = hy * lx, w3 = ly * hx, w4 = ly * lx;
+        const uint8_t* v1 = const_value;
+        const uint8_t* v2 = const_value;
+        const uint8_t* v3 = const_value;
+        const uint8_t* v4 = const_value;
+        uint8_t p1[3], p2[3], p3[3], p4[3];
+        if(y_low >= 0){
+            if (x_low >= 0)
+                v1 = load_bgr_pixel(row.source, x_low, y_low, p1);
+
+            if (x_high < row.source.width)
+                v2 = load_bgr_pixel(row.source, x_high, y_low, p2);
+        }
+
+        if(y_high < row.source.height){
+            if (x_low >= 0)
+                v3 = load_bgr_pixel(row.source, x_low, y_high, p3);
+
+            if (x_high < row.source.width)
+                v4 = load_bgr_pixel(row.source, x_high, y_high, p4);
+        }
+
+        c0 = w1 * v1[0] + w2 * v2[0] + w3 * v3[0] + w4 * v4[0] + 0.5f;
+        c1 = w1 * v1[1] + w2 * v2[1] + w3 * v3[1] + w4 * v4[1] + 0.5f;
+        c2 = w1 * v1[2] + w2 * v2[2] + w3 * v3[2] + w4 * v4[2] + 0.5f;
+    }
+
+    static inline void normalize_pixel(const WarpAffineRow& row, float& c0, float& c1, float& c2){
+
+        if(row.invert_channel){
+            float t = c2;
+            c2 = c0;  c0 = t;
+        }
+
+        const Norm& norm = *row.norm;
+        if(row.type == int(NormType::MeanStd)){
+            c0 = (c0 * norm.alpha - norm.mean[0]) / norm.std[0];
+            c1 = (c1 * norm.alpha - norm.mean[1]) / norm.std[1];
+            c2 = (c2 * norm.alpha - norm.mean[2]) / norm.std[2];
+        }else if(row.type == int(NormType::AlphaBeta)){
+            c0 = c0 * norm.alpha + norm.beta;
+            c1 = c1 * norm.alpha + norm.beta;
+            c2 = c2 * norm.alpha + norm.beta;
+        }
+    }
+
+    static inline void store_pixel(const WarpAffineRow& row, int dx, float c0, float c1, float c2){
+        if(row.planar_float){
+            row.dst_c0[dx] = c0;
+            row.dst_c1[dx] = c1;
+            row.dst_c2[dx] = c2;
+        }else{
+            store_normalized_pixel(row.dst, row.dst_width, row.dst_height, dx, row.dy, c0, c1, c2, *row.norm);
+        }
+    }
+
+    static void warp_affine_row_scalar(const WarpAffineRow& row, int dx_begin){
+
+        const float* m = row.m;
+        for(int dx = dx_begin; dx < row.dst_width; ++dx){
+            float src_x = (m[0] * dx + m[1] * row.dy + m[2]) + 0.5f;
+            float src_y = (m[3] * dx + m[4] * row.dy + m[5]) + 0.5f;
+
+            float c0, c1, c2;
+            sample_pixel(row, src_x, src_y, c0, c1, c2);
+            normalize_pixel(row, c0, c1, c2);
+            store_pixel(row, dx, c0, c1, c2);
+        }
+    }
+
+    // SIMD计算的lanes个像素，float32 NCHW以外的格式逐个写出
+    static inline void store_lanes(const WarpAffineRow& row, int dx, int lanes, const float* c0, const float* c1, const float* c2){
+        for(int k = 0; k < lanes; ++k)
+            store_normalized_pixel(row.dst, row.dst_width, row.dst_height, dx + k, row.dy, c0[k], c1[k], c2[k], *row.norm);
+    }
+
+    // 把lanes个像素的4个邻域取到v[channel][neighbor][lane]中，越界的像素由调用者用const_value替换
+    static inline void gather_neighbors(const WarpAffineRow& row, const int* x_low, const int* y_low, int outside_mask, int lanes, float* v){
+
+        float const_value = row.const_value;
+        const WarpAffineSource& source = row.source;
+        uint8_t buffer[4][3];
+        for(int k = 0; k < lanes; ++k){
+
+            const uint8_t* p[4] = {nullptr, nullptr, nullptr, nullptr};
+            if(!(outside_mask & (1 << k))){
+                int xl = x_low[k], yl = y_low[k];
+                int xh = xl + 1,   yh = yl + 1;
+                if(yl >= 0){
+                    if(xl >= 0)             p[0] = load_bgr_pixel(source, xl, yl, buffer[0]);
+                    if(xh < source.width)   p[1] = load_bgr_pixel(source, xh, yl, buffer[1]);
+                }
+                if(yh < source.height){
+                    if(xl >= 0)             p[2] = load_bgr_pixel(source, xl, yh, buffer[2]);
+                    if(xh < source.width)   p[3] = load_bgr_pixel(source, xh, yh, buffer[3]);
+                }
+            }
+
+            for(int n = 0; n < 4; ++n){
+                for(int c = 0; c < 3; ++c)
+                    v[(c * 4 + n) * lanes + k] = p[n] ? p[n][c] : const_value;
+            }
+        }
+    }
+
+#ifdef CPU_KERNEL_AVX2
+    static bool has_avx2(){
+        static bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256 normalize_channel_avx2(__m256 c, int type, int channel, const Norm& norm){
+        if(type == int(NormType::MeanStd))
+            return _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(c, _mm256_set1_ps(norm.alpha)), _mm256_set1_ps(norm.mean[channel])), _mm256_set1_ps(norm.std[channel]));
+        else if(type == int(NormType::AlphaBeta))
+            return _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(norm.alpha)), _mm256_set1_ps(norm.beta));
+        return c;
+    }
+
+    // 坐标、权重、插值与归一化8个像素一起计算，只有取邻域是标量的，返回处理到的位置
+    // 运算顺序与标量实现相同且不使用fma，因此结果与标量实现逐位一致
+    __attribute__((target("avx2")))
+    static int warp_affine_row_avx2(const WarpAffineRow& row){
+
+        const int LANES = 8;
+        const float* m  = row.m;
+        __m256 lane     = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 m0       = _mm256_set1_ps(m[0]);
+        __m256 m2       = _mm256_set1_ps(m[2]);
+        __m256 m3       = _mm256_set1_ps(m[3]);
+        __m256 m5       = _mm256_set1_ps(m[5]);
+        __m256 m1_dy    = _mm256_set1_ps(m[1] * row.dy);
+        __m256 m4_dy    = _mm256_set1_ps(m[4] * row.dy);
+        __m256 half     = _mm256_set1_ps(0.5f);
+        __m256 one      = _mm256_set1_ps(1.0f);
+        __m256 minus1   = _mm256_set1_ps(-1.0f);
+        __m256 width    = _mm256_set1_ps(row.source.width);
+        __m256 height   = _mm256_set1_ps(row.source.height);
+        __m256 constv   = _mm256_set1_ps(row.const_value);
+
+        alignas(32) int x_low[LANES];
+        alignas(32) int y_low[LANES];
+        alignas(32) float v[3 * 4 * LANES];
+
+        int dx = 0;
+        for(; dx + LANES <= row.dst_width; dx += LANES){
+
+            __m256 vdx   = _mm256_add_ps(_mm256_set1_ps(dx), lane);
+            __m256 src_x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, vdx), m1_dy), m2), half);
+            __m256 src_y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m3, vdx), m4_dy), m5), half);
+
+            __m256 outside = _mm256_or_ps(
+                _mm256_or_ps(_mm256_cmp_ps(src_x, minus1, _CMP_LE_OQ), _mm256_cmp_ps(src_x, width,  _CMP_GE_OQ)),
+                _mm256_or_ps(_mm256_cmp_ps(src_y, minus1, _CMP_LE_OQ), _mm256_cmp_ps(src_y, height, _CMP_GE_OQ))
+            );
+
+            __m256 fx = _mm256_floor_ps(src_x);
+            __m256 fy = _mm256_floor_ps(src_y);
+            __m256 lx = _mm256_sub_ps(src_x, fx);
+            __m256 ly = _mm256_sub_ps(src_y, fy);
+            __m256 hx = _mm256_sub_ps(one, lx);
+            __m256 hy = _mm256_sub_ps(one, ly);
+            __m256 w1 = _mm256_mul_ps(hy, hx);
+            __m256 w2 = _mm256_mul_ps(hy, lx);
+            __m256 w3 = _mm256_mul_ps(ly, hx);
+            __m256 w4 = _mm256_mul_ps(ly, lx);
+
+            int outside_mask = _mm256_movemask_ps(outside);
+            _mm256_store_si256((__m256i*)x_low, _mm256_cvttps_epi32(_mm256_blendv_ps(fx, _mm256_setzero_ps(), outside)));
+            _mm256_store_si256((__m256i*)y_low, _mm256_cvttps_epi32(_mm256_blendv_ps(fy, _mm256_setzero_ps(), outside)));
+            gather_neighbors(row, x_low, y_low, outside_mask, LANES, v);
+
+            __m256 c[3];
+            for(int ic = 0; ic < 3; ++ic){
+                const float* pv = v + ic * 4 * LANES;
+                __m256 value = _mm256_mul_ps(w1, _mm256_load_ps(pv + 0 * LANES));
+                value = _mm256_add_ps(value, _mm256_mul_ps(w2, _mm256_load_ps(pv + 1 * LANES)));
+                value = _mm256_add_ps(value, _mm256_mul_ps(w3, _mm256_load_ps(pv + 2 * LANES)));
+                value = _mm256_add_ps(value, _mm256_mul_ps(w4, _mm256_load_ps(pv + 3 * LANES)));
+                value = _mm256_add_ps(value, half);
+                c[ic] = _mm256_blendv_ps(value, constv, outside);
+            }
+
+            if(row.invert_channel)
+                std::swap(c[0], c[2]);
+
+            for(int ic = 0; ic < 3; ++ic)
+                c[ic] = normalize_channel_avx2(c[ic], row.type, ic, *row.norm);
+
+            if(row.planar_float){
+                _mm256_storeu_ps(row.dst_c0 + dx, c[0]);
+                _mm256_storeu_ps(row.dst_c1 + dx, c[1]);
+                _mm256_storeu_ps(row.dst_c2 + dx, c[2]);
+            }else{
+                alignas(32) float output[3][LANES];
+                for(int ic = 0; ic < 3; ++ic)
+                    _mm256_store_ps(output[ic], c[ic]);
+                store_lanes(row, dx, LANES, output[0], output[1], output[2]);
+            }
+        }
+        return dx;
+    }
+#endif // CPU_KERNEL_AVX2
+
+#ifdef CPU_KERNEL_NEON
+    static inline float32x4_t normalize_channel_neon(float32x4_t c, int type, int channel, const Norm& norm){
+        if(type == int(NormType::MeanStd))
+            return vdivq_f32(vsubq_f32(vmulq_n_f32(c, norm.alpha), vdupq_n_f32(norm.mean[channel])), vdupq_n_f32(norm.std[channel]));
+        else if(type == int(NormType::AlphaBeta))
+            return vaddq_f32(vmulq_n_f32(c, norm.alpha), vdupq_n_f32(norm.beta));
+        return c;
+    }
+
+    // 与AVX2的实现相同，4个像素一组
+    static int warp_affine_row_neon(const WarpAffineRow& row){
+
+        const int LANES = 4;
+        const float* m  = row.m;
+        const float lane_values[] = {0, 1, 2, 3};
+        float32x4_t lane   = vld1q_f32(lane_values);
+        float32x4_t m1_dy  = vdupq_n_f32(m[1] * row.dy);
+        float32x4_t m4_dy  = vdupq_n_f32(m[4] * row.dy);
+        float32x4_t m2     = vdupq_n_f32(m[2]);
+        float32x4_t m5     = vdupq_n_f32(m[5]);
+        float32x4_t half   = vdupq_n_f32(0.5f);
+        float32x4_t one    = vdupq_n_f32(1.0f);
+        float32x4_t minus1 = vdupq_n_f32(-1.0f);
+        float32x4_t width  = vdupq_n_f32(row.source.width);
+        float32x4_t height = vdupq_n_f32(row.source.height);
+        float32x4_t constv = vdupq_n_f32(row.const_value);
+
+        alignas(16) int x_low[LANES];
+        alignas(16) int y_low[LANES];
+        alignas(16) uint32_t outside_lanes[LANES];
+        alignas(16) float v[3 * 4 * LANES];
+
+        int dx = 0;
+        for(; dx + LANES <= row.dst_width; dx += LANES){
+
+            float32x4_t vdx   = vaddq_f32(vdupq_n_f32(dx), lane);
+            float32x4_t src_x = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(vdx, m[0]), m1_dy), m2), half);
+            float32x4_t src_y = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(vdx, m[3]), m4_dy), m5), half);
+
+            uint32x4_t outside = vorrq_u32(
+                vorrq_u32(vcleq_f32(src_x, minus1), vcgeq_f32(src_x, width)),
+                vorrq_u32(vcleq_f32(src_y, minus1), vcgeq_f32(src_y, height))
+            );
+
+            float32x4_t fx = vrndmq_f32(src_x);
+            float32x4_t fy = vrndmq_f32(src_y);
+            float32x4_t lx = vsubq_f32(src_x, fx);
+            float32x4_t ly = vsubq_f32(src_y, fy);
+            float32x4_t hx = vsubq_f32(one, lx);
+            float32x4_t hy = vsubq_f32(one, ly);
+            float32x4_t w1 = vmulq_f32(hy, hx);
+            float32x4_t w2 = vmulq_f32(hy, lx);
+            float32x4_t w3 = vmulq_f32(ly, hx);
+            float32x4_t w4 = vmulq_f32(ly, lx);
+
+            vst1q_u32(outside_lanes, outside);
+            int outside_mask = 0;
+            for(int k = 0; k < LANES; ++k)
+                outside_mask |= outside_lanes[k] ? (1 << k) : 0;
+
+            float32x4_t zero = vdupq_n_f32(0);
+            vst1q_s32(x_low, vcvtq_s32_f32(vbslq_f32(outside, zero, fx)));
+            vst1q_s32(y_low, vcvtq_s32_f32(vbslq_f32(outside, zero, fy)));
+            gather_neighbors(row, x_low, y_low, outside_mask, LANES, v);
+
+            float32x4_t c[3];
+            for(int ic = 0; ic < 3; ++ic){
+                const float* pv = v + ic * 4 * LANES;
+                float32x4_t value = vmulq_f32(w1, vld1q_f32(pv + 0 * LANES));
+                value = vaddq_f32(value, vmulq_f32(w2, vld1q_f32(pv + 1 * LANES)));
+                value = vaddq_f32(value, vmulq_f32(w3, vld1q_f32(pv + 2 * LANES)));
+                value = vaddq_f32(value, vmulq_f32(w4, vld1q_f32(pv + 3 * LANES)));
+                value = vaddq_f32(value, half);
+                c[ic] = vbslq_f32(outside, constv, value);
+            }
+
+            if(row.invert_channel){
+                float32x4_t t = c[0];
+                c[0] = c[2];  c[2] = t;
+            }
+
+            for(int ic = 0; ic < 3; ++ic)
+                c[ic] = normalize_channel_neon(c[ic], row.type, ic, *row.norm);
+
+            if(row.planar_float){
+                vst1q_f32(row.dst_c0 + dx, c[0]);
+                vst1q_f32(row.dst_c1 + dx, c[1]);
+                vst1q_f32(row.dst_c2 + dx, c[2]);
+            }else{
+                alignas(16) float output[3][LANES];
+                for(int ic = 0; ic < 3; ++ic)
+                    vst1q_f32(output[ic], c[ic]);
+                store_lanes(row, dx, LANES, output[0], output[1], output[2]);
+            }
+        }
+        return dx;
+    }
+#endif // CPU_KERNEL_NEON
+
+    const char* simd_name(){
+#if defined(CPU_KERNEL_AVX2)
+        return has_avx2() ? "AVX2" : "Scalar";
+#elif defined(CPU_KERNEL_NEON)
+        return "NEON";
+#else
+        return "Scalar";
+#endif
+    }
+
+    static void warp_affine_row(const WarpAffineRow& row, bool use_simd){
+
+        int dx = 0;
+        if(use_simd){
+#if defined(CPU_KERNEL_AVX2)
+            if(has_avx2())
+                dx = warp_affine_row_avx2(row);
+#elif defined(CPU_KERNEL_NEON)
+            dx = warp_affine_row_neon(row);
+#endif
+        }
+        warp_affine_row_scalar(row, dx);
+    }
+
+    void warp_affine_bilinear_and_normalize(
+        const WarpAffineSource& source,
+        void* dst, int dst_width, int dst_height,
+        const float* matrix_2_3, uint8_t const_value, const Norm& norm,
+        bool use_simd){
+
+        int area = dst_width * dst_height;
+        bool planar_float = norm.output_type() == NormType::Float32 && norm.output_layout() == NormType::NCHW;
+
+        #pragma omp parallel for
+        for(int dy = 0; dy < dst_height; ++dy){
+            WarpAffineRow row;
+            row.source         = source;
+            row.dst            = dst;
+            row.dst_c0         = (float*)dst + dy * dst_width;
+            row.dst_c1         = row.dst_c0 + area;
+            row.dst_c2         = row.dst_c1 + area;
+            row.planar_float   = planar_float;
+            row.dst_width      = dst_width;
+            row.dst_height     = dst_height;
+            row.dy             = dy;
+            row.m              = matrix_2_3;
+            row.const_value    = const_value;
+            row.type           = (unsigned int)(norm.type) & 0x000000FF;
+            row.invert_channel = ((unsigned int)(norm.type) & 0x0000FF00) == (unsigned int)NormType::InvertChannel;
+            row.norm           = &norm;
+            warp_affine_row(row, use_simd);
+        }
+    }
+
+    void warp_affine_bilinear_and_normalize(
+        const uint8_t* src, int src_line_size, int src_width, int src_height,
+        void* dst, int dst_width, int dst_height,
+        const float* matrix_2_3, uint8_t const_value, const Norm& norm,
+        bool use_simd){
+
+        WarpAffineSource source;
+        source.data      = src;
+        source.line_size = src_line_size;
+        source.width     = src_width;
+        source.height    = src_height;
+        warp_affine_bilinear_and_normalize(source, dst, dst_width, dst_height, matrix_2_3, const_value, norm, use_simd);
+    }
+
+    void convert_yuv_to_bgr(const WarpAffineSource& source, uint8_t* dst, int dst_line_size){
+
+        #pragma omp parallel for
+        for(int y = 0; y < source.height; ++y){
+            uint8_t* pdst = dst + y * dst_line_size;
+            uint8_t buffer[3];
+            for(int x = 0; x < source.width; ++x, pdst += 3){
+                const uint8_t* bgr = load_bgr_pixel(source, x, y, buffer);
+                pdst[0] = bgr[0];
+                pdst[1] = bgr[1];
+                pdst[2] = bgr[2];
+            }
+        }
+    }
+
+    void warp_affine_bilinear_and_normalize_batch(
+        const WarpAffineSource* sources, const float* matrices_2_3, int batch,
+        void* dst, int dst_width, int dst_height,
+        uint8_t const_value, const Norm& norm,
+        bool use_simd){
+
+        size_t image_bytes = norm.output_bytes(dst_width, dst_height);
+        for(int ibatch = 0; ibatch < batch; ++ibatch){
+            warp_affine_bilinear_and_normalize(
+                sources[ibatch], (uint8_t*)dst + ibatch * image_bytes, dst_width, dst_height,
+                matrices_2_3 + ibatch * 6, const_value, norm, use_simd
+            );
+        }
+    }
+};
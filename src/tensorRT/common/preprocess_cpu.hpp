@@ -0,0 +1,43 @@
+#ifndef PREPROCESS_CPU_HPP
+#define PREPROCESS_CPU_HPP
+
+#include <common/preprocess_kernel.cuh>
+
+/**
+ * @brief 与CUDAKernel中预处理kernel对应的CPU实现，边界（const_value）与Norm的语义完全一致
+ * 可以作为GPU结果的参考，也可以在没有GPU的节点上使用
+ * 输出的数据类型与布局由Norm决定（float32/float16/int8，NCHW/NHWC/NC4HW4）
+ * 输入可以是BGR，也可以是NV12、I420，YUV的颜色转换与仿射变换、归一化一次完成
+ * x86上运行时检测AVX2，arm64上使用NEON，否则为标量实现
+ */
+namespace CPUKernel{
+
+    // 当前使用的指令集，AVX2、NEON或者Scalar
+    const char* simd_name();
+
+    // use_simd = false时强制使用标量实现，用于对照
+    void warp_affine_bilinear_and_normalize(
+        const uint8_t* src, int src_line_size, int src_width, int src_height,
+        void* dst, int dst_width, int dst_height,
+        const float* matrix_2_3, uint8_t const_value, const CUDAKernel::Norm& norm,
+        bool use_simd = true);
+
+    // source可以是BGR或者YUV，YUV的颜色转换在取邻域时完成
+    void warp_affine_bilinear_and_normalize(
+        const CUDAKernel::WarpAffineSource& source,
+        void* dst, int dst_width, int dst_height,
+        const float* matrix_2_3, uint8_t const_value, const CUDAKernel::Norm& norm,
+        bool use_simd = true);
+
+    // YUV整图转换为BGR，与convert_yuv_to_bgr_invoke一致，是融合路径的两步对照
+    void convert_yuv_to_bgr(const CUDAKernel::WarpAffineSource& source, uint8_t* dst, int dst_line_size);
+
+    // 与CUDAKernel::warp_affine_bilinear_and_normalize_batch相同，这里的指针都是host内存
+    void warp_affine_bilinear_and_normalize_batch(
+        const CUDAKernel::WarpAffineSource* sources, const float* matrices_2_3, int batch,
+        void* dst, int dst_width, int dst_height,
+        uint8_t const_value, const CUDAKernel::Norm& norm,
+        bool use_simd = true);
+};
+
+#endif // PREPROCESS_CPU_HPP
@@ -22,11 +22,13 @@ namespace CUDAKernel{
 		return out;
 	}
 
-	__global__ void warp_affine_bilinear_and_normalize_kernel(uint8_t* src, int src_line_size, int src_width, int src_height, float* dst, int dst_width, int dst_height, 
-		uint8_t const_value_st, float* warp_affine_matrix_2_3, Norm norm, int edge){
+	// 单个像素的采样和归一化，单张和batch的kernel共用，YUV格式在取邻域时转换
+	static __device__ void warp_affine_bilinear_and_normalize_pixel(
+		const WarpAffineSource& source, void* dst, int dst_width, int dst_height, 
+		uint8_t const_value_st, const float* warp_affine_matrix_2_3, const Norm& norm, int dx, int dy){
 
-		int position = blockDim.x * blockIdx.x + threadIdx.x;
-		if (position >= edge) return;
+		int src_width  = source.width;
+		int src_height = source.height;
 
 		float m_x1 = warp_affine_matrix_2_3[0];
 		float m_y1 = warp_affine_matrix_2_3[1];
@@ -35,8 +37,6 @@ namespace CUDAKernel{
 		float m_y2 = warp_affine_matrix_2_3[4];
 		float m_z2 = warp_affine_matrix_2_3[5];
 
-		int dx      = position % dst_width;
-		int dy      = position / dst_width;
 		float src_x = (m_x1 * dx + m_y1 * dy + m_z1) + 0.5f;
 		float src_y = (m_x2 * dx + m_y2 * dy + m_z2) + 0.5f;
 		float c0, c1, c2;
@@ -58,25 +58,25 @@ namespace CUDAKernel{
 			float hy    = 1 - ly;
 			float hx    = 1 - lx;
 			float w1    = hy * hx, w2 = hy * lx, w3 = ly * hx, w4 = ly * lx;
-			float* pdst = dst + dy * dst_width + dx * 3;
-			uint8_t* v1 = const_value;
-			uint8_t* v2 = const_value;
-			uint8_t* v3 = const_value;
-			uint8_t* v4 = const_value;
+			const uint8_t* v1 = const_value;
+			const uint8_t* v2 = const_value;
+			const uint8_t* v3 = const_value;
+			const uint8_t* v4 = const_value;
+			uint8_t p1[3], p2[3], p3[3], p4[3];
 			if(y_low >= 0){
 				if (x_low >= 0)
-					v1 = src + y_low * src_line_size + x_low * 3;
+					v1 = load_bgr_pixel(source, x_low, y_low, p1);
 
 				if (x_high < src_width)
-					v2 = src + y_low * src_line_size + x_high * 3;
+					v2 = load_bgr_pixel(source, x_high, y_low, p2);
 			}
 			
 			if(y_high < src_height){
 				if (x_low >= 0)
-					v3 = src + y_high * src_line_size + x_low * 3;
+					v3 = load_bgr_pixel(source, x_low, y_high, p3);
 
 				if (x_high < src_width)
-					v4 = src + y_high * src_line_size + x_high * 3;
+					v4 = load_bgr_pixel(source, x_high, y_high, p4);
 			}
 
 			c0 = w1 * v1[0] + w2 * v2[0] + w3 * v3[0] + w4 * v4[0] + 0.5f;
@@ -101,13 +101,38 @@ namespace CUDAKernel{
 			c2 = c2 * norm.alpha + norm.beta;
 		}
 
-		int area = dst_width * dst_height;
-		float* pdst_c0 = dst + dy * dst_width + dx;
-		float* pdst_c1 = pdst_c0 + area;
-		float* pdst_c2 = pdst_c1 + area;
-		*pdst_c0 = c0;
-		*pdst_c1 = c1;
-		*pdst_c2 = c2;
+		store_normalized_pixel(dst, dst_width, dst_height, dx, dy, c0, c1, c2, norm);
+	}
+
+	__global__ void warp_affine_bilinear_and_normalize_kernel(WarpAffineSource source, void* dst, int dst_width, int dst_height, 
+		uint8_t const_value_st, const float* warp_affine_matrix_2_3, Norm norm, int edge){
+
+		int position = blockDim.x * blockIdx.x + threadIdx.x;
+		if (position >= edge) return;
+
+		int dx = position % dst_width;
+		int dy = position / dst_width;
+		warp_affine_bilinear_and_normalize_pixel(
+			source, dst, dst_width, dst_height,
+			const_value_st, warp_affine_matrix_2_3, norm, dx, dy
+		);
+	}
+
+	// blockIdx.y为batch中的图像索引
+	__global__ void warp_affine_bilinear_and_normalize_batch_kernel(const WarpAffineSource* sources, const float* matrices_2_3, uint8_t* dst, size_t dst_image_bytes, int dst_width, int dst_height, 
+		uint8_t const_value_st, Norm norm, int edge){
+
+		int position = blockDim.x * blockIdx.x + threadIdx.x;
+		if (position >= edge) return;
+
+		int ibatch = blockIdx.y;
+		const WarpAffineSource& source = sources[ibatch];
+		int dx = position % dst_width;
+		int dy = position / dst_width;
+		warp_affine_bilinear_and_normalize_pixel(
+			source, dst + ibatch * dst_image_bytes, dst_width, dst_height,
+			const_value_st, matrices_2_3 + ibatch * 6, norm, dx, dy
+		);
 	}
 
 	__global__ void normalize_feature_kernel(float* feature_array, int num_feature, int feature_length, int edge){
@@ -145,44 +170,90 @@ namespace CUDAKernel{
 		feature_array[position] = value / l2_norm[irow];
 	}
 
-    static __device__ uint8_t cast(float value){
-        return value < 0 ? 0 : (value > 255 ? 255 : value);
-    }
-
-    static __global__ void convert_nv12_to_bgr_kernel(const uint8_t* y, const uint8_t* uv, int width, int height, int linesize, uint8_t* dst_bgr, int edge){
+    static __global__ void convert_yuv_to_bgr_kernel(WarpAffineSource source, uint8_t* dst_bgr, int edge){
 
         int position = blockDim.x * blockIdx.x + threadIdx.x;
         if (position >= edge) return;
 
-        int ox = position % width;
-        int oy = position / width;
-        const uint8_t& yvalue = y[oy * linesize + ox];
-        int offset_uv = (oy >> 1) * linesize + (ox & 0xFFFFFFFE);
-        const uint8_t& u = uv[offset_uv + 0];
-        const uint8_t& v = uv[offset_uv + 1];
-		dst_bgr[position * 3 + 0] = 1.164f * (yvalue - 16.0f) + 2.018f * (u - 128.0f);
-		dst_bgr[position * 3 + 1] = 1.164f * (yvalue - 16.0f) - 0.813f * (v - 128.0f) - 0.391f * (u - 128.0f);
-		dst_bgr[position * 3 + 2] = 1.164f * (yvalue - 16.0f) + 1.596f * (v - 128.0f);
+        int ox = position % source.width;
+        int oy = position / source.width;
+        uint8_t buffer[3];
+        const uint8_t* bgr = load_bgr_pixel(source, ox, oy, buffer);
+		dst_bgr[position * 3 + 0] = bgr[0];
+		dst_bgr[position * 3 + 1] = bgr[1];
+		dst_bgr[position * 3 + 2] = bgr[2];
     }
 
 
 	/////////////////////////////////////////////////////////////////////////
-	void convert_nv12_to_bgr_invoke(
-		const uint8_t* y, const uint8_t* uv, int width, int height, int linesize, uint8_t* dst, cudaStream_t stream){
+	void convert_yuv_to_bgr_invoke(const WarpAffineSource& source, uint8_t* dst, cudaStream_t stream){
 			
-		int total = width * height;
+		int total = source.width * source.height;
 		dim3 grid = CUDATools::grid_dims(total);
 		dim3 block = CUDATools::block_dims(total);
 
-		checkCudaKernel(convert_nv12_to_bgr_kernel<<<grid, block, 0, stream>>>(
-			y, uv, width, height, linesize,
-			dst, total
+		checkCudaKernel(convert_yuv_to_bgr_kernel<<<grid, block, 0, stream>>>(
+			source, dst, total
 		));
 	}
 
+	void convert_nv12_to_bgr_invoke(
+		const uint8_t* y, const uint8_t* uv, int width, int height, int linesize, uint8_t* dst, cudaStream_t stream){
+			
+		WarpAffineSource source;
+		source.data         = y;
+		source.line_size    = linesize;
+		source.width        = width;
+		source.height       = height;
+		source.format       = ImageFormat::NV12;
+		source.u            = uv;
+		source.uv_line_size = linesize;
+		convert_yuv_to_bgr_invoke(source, dst, stream);
+	}
+
+	WarpAffineSource upload_yuv_image(
+		const YUVImage& image, uint8_t* device_workspace, uint8_t* host_workspace,
+		cudaStream_t stream){
+
+		WarpAffineSource source;
+		source.format       = image.format;
+		source.width        = image.width;
+		source.height       = image.height;
+		source.line_size    = image.y_line_size;
+		source.uv_line_size = image.uv_line_size;
+		if(image.device){
+			source.data = image.y;
+			source.u    = image.u;
+			source.v    = image.v;
+			return source;
+		}
+
+		const uint8_t* planes[] = {image.y, image.u, image.v};
+		size_t sizes[]          = {image.y_bytes(), image.uv_bytes(), image.format == ImageFormat::I420 ? image.uv_bytes() : 0};
+		const uint8_t** outputs[] = {&source.data, &source.u, &source.v};
+		size_t offset = 0;
+		for(int i = 0; i < 3; ++i){
+			if(sizes[i] == 0) continue;
+
+			uint8_t* plane_device = device_workspace + offset;
+			if(CUDATools::is_pinned_memory(planes[i])){
+				// 直接引用调用者的平面，拷贝完成之前由调用者保持有效
+				checkCudaRuntime(cudaMemcpyAsync(plane_device, planes[i], sizes[i], cudaMemcpyHostToDevice, stream));
+			}else{
+				// host到host的拷贝对host是同步的，返回时平面已经复制到host_workspace
+				uint8_t* plane_host = host_workspace + offset;
+				checkCudaRuntime(cudaMemcpyAsync(plane_host,   planes[i],  sizes[i], cudaMemcpyHostToHost,   stream));
+				checkCudaRuntime(cudaMemcpyAsync(plane_device, plane_host, sizes[i], cudaMemcpyHostToDevice, stream));
+			}
+			*outputs[i] = plane_device;
+			offset     += sizes[i];
+		}
+		return source;
+	}
+
 	void warp_affine_bilinear_and_normalize(
-		uint8_t* src, int src_line_size, int src_width, int src_height, float* dst, int dst_width, int dst_height,
-		float* matrix_2_3, uint8_t const_value, const Norm& norm,
+		const WarpAffineSource& source, void* dst, int dst_width, int dst_height,
+		const float* matrix_2_3, uint8_t const_value, const Norm& norm,
 		cudaStream_t stream) {
 		
 		int jobs   = dst_width * dst_height;
@@ -190,9 +261,38 @@ namespace CUDAKernel{
 		auto block = CUDATools::block_dims(jobs);
 		
 		checkCudaKernel(warp_affine_bilinear_and_normalize_kernel << <grid, block, 0, stream >> > (
-			src, src_line_size,
-			src_width, src_height, dst,
-			dst_width, dst_height, const_value, matrix_2_3, norm, jobs
+			source, dst, dst_width, dst_height, const_value, matrix_2_3, norm, jobs
+		));
+	}
+
+	void warp_affine_bilinear_and_normalize(
+		uint8_t* src, int src_line_size, int src_width, int src_height, void* dst, int dst_width, int dst_height,
+		float* matrix_2_3, uint8_t const_value, const Norm& norm,
+		cudaStream_t stream) {
+		
+		WarpAffineSource source;
+		source.data      = src;
+		source.line_size = src_line_size;
+		source.width     = src_width;
+		source.height    = src_height;
+		warp_affine_bilinear_and_normalize(source, dst, dst_width, dst_height, matrix_2_3, const_value, norm, stream);
+	}
+
+	void warp_affine_bilinear_and_normalize_batch(
+		const WarpAffineSource* sources, const float* matrices_2_3, int batch,
+		void* dst, int dst_width, int dst_height,
+		uint8_t const_value, const Norm& norm,
+		cudaStream_t stream) {
+
+		if(batch <= 0) return;
+
+		int jobs   = dst_width * dst_height;
+		auto block = CUDATools::block_dims(jobs);
+		auto grid  = CUDATools::grid_dims(jobs);
+		grid.y     = batch;
+
+		checkCudaKernel(warp_affine_bilinear_and_normalize_batch_kernel << <grid, block, 0, stream >> > (
+			sources, matrices_2_3, (uint8_t*)dst, norm.output_bytes(dst_width, dst_height), dst_width, dst_height, const_value, norm, jobs
 		));
 	}
 
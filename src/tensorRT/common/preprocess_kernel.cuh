@@ -1,24 +1,37 @@
 #ifndef PREPROCESS_KERNEL_CUH
 #define PREPROCESS_KERNEL_CUH
 
+#include <math.h>
 #include <common/cuda_tools.hpp>
+#include <common/yuv_image.hpp>
 
 namespace CUDAKernel{
 
-    //            CHANNEL_ORDER   TYPE
-    // 0x00  00       FF           FF
+    //   LAYOUT   OUTPUT   CHANNEL_ORDER   TYPE
+    // 0x  FF       FF          FF          FF
     enum class NormType : unsigned int{
         None      = 0,
         MeanStd   = 1,
         AlphaBeta = 2,
         InvertChannel = 1 << 8,
-        ToRGB     = InvertChannel
+        ToRGB     = InvertChannel,
+
+        // 输出的数据类型，默认为float32
+        Float32   = 0,
+        Float16   = 1 << 16,
+        Int8      = 2 << 16,    // q = clamp(rint(x / int8_scale), -128, 127)
+
+        // 输出的布局，默认为NCHW
+        NCHW      = 0,
+        NHWC      = 1 << 24,
+        NC4HW4    = 2 << 24     // 通道补齐到4，[C/4][H][W][4]，第4个通道为0
     };
 
     struct Norm{
         float mean[3];
         float std[3];
         float alpha, beta;
+        float int8_scale = 1;
         NormType type = NormType::None;
 
         // out = (x * alpha - mean) / std
@@ -27,19 +40,192 @@ namespace CUDAKernel{
         // out = x * alpha + beta
         static Norm alpha_beta(float alpha, float beta = 0);
 
-        Norm operator + (NormType t){
+        Norm operator + (NormType t) const{
             Norm out = *this;
             out.type = NormType((unsigned int)out.type | (unsigned int)t);
             return out;
         }
+
+        // 输出量化为int8，scale与引擎输入的量化参数一致
+        Norm quantize_int8(float scale) const{
+            Norm out = *this + NormType::Int8;
+            out.int8_scale = scale;
+            return out;
+        }
+
+        NormType output_type()   const{return NormType((unsigned int)type & 0x00FF0000);}
+        NormType output_layout() const{return NormType((unsigned int)type & 0xFF000000);}
+
+        // 一个输出元素的字节数
+        int output_element_size() const{
+            return output_type() == NormType::Float16 ? 2 : (output_type() == NormType::Int8 ? 1 : 4);
+        }
+
+        // 一张图像的输出元素个数，NC4HW4时为4个通道
+        size_t output_count(int width, int height) const{
+            return (size_t)(output_layout() == NormType::NC4HW4 ? 4 : 3) * width * height;
+        }
+
+        size_t output_bytes(int width, int height) const{
+            return output_count(width, height) * output_element_size();
+        }
     };
 
+    // float32到float16（IEEE binary16）的bit，round to nearest even
+    // host和device使用同一个实现，保证两边的结果逐位一致
+    __host__ __device__ inline uint16_t float_to_half(float value){
+
+        union{float f; uint32_t u;} bits;
+        bits.f            = value;
+        uint32_t sign     = (bits.u >> 16) & 0x8000;
+        uint32_t absolute = bits.u & 0x7FFFFFFF;
+
+        if(absolute >= 0x7F800000)                    // inf, nan
+            return sign | 0x7C00 | (absolute > 0x7F800000 ? 0x200 : 0);
+
+        if(absolute >= 0x47800000)                    // >= 65536，溢出为inf
+            return sign | 0x7C00;
+
+        uint32_t exponent = absolute >> 23;
+        if(exponent < 113){
+            // half的非规格化数
+            if(exponent < 102) return sign;
+            uint32_t mantissa = (absolute & 0x7FFFFF) | 0x800000;
+            uint32_t shift    = 126 - exponent;
+            uint32_t output   = mantissa >> shift;
+            uint32_t remain   = mantissa & ((1u << shift) - 1);
+            uint32_t halfway  = 1u << (shift - 1);
+            if(remain > halfway || (remain == halfway && (output & 1))) output++;
+            return sign | output;
+        }
+
+        uint32_t output = ((exponent - 112) << 10) | ((absolute & 0x7FFFFF) >> 13);
+        uint32_t remain = absolute & 0x1FFF;
+        if(remain > 0x1000 || (remain == 0x1000 && (output & 1))) output++;
+        return sign | output;
+    }
+
+    __host__ __device__ inline int8_t float_to_int8(float value, float scale){
+        float q = rintf(value / scale);
+        return q < -128 ? -128 : (q > 127 ? 127 : (int8_t)q);
+    }
+
+    /**
+     * @brief 按norm指定的数据类型和布局，把归一化后的一个像素写到dst
+     * dst为一张图像输出的起始地址，大小为norm.output_bytes(dst_width, dst_height)
+     */
+    __host__ __device__ inline void store_normalized_pixel(
+        void* dst, int dst_width, int dst_height, int dx, int dy,
+        float c0, float c1, float c2, const Norm& norm){
+
+        unsigned int output = (unsigned int)norm.type & 0x00FF0000;
+        unsigned int layout = (unsigned int)norm.type & 0xFF000000;
+        size_t position     = (size_t)dy * dst_width + dx;
+        size_t index, step;
+        int padding = 0;
+        if(layout == (unsigned int)NormType::NHWC){
+            index = position * 3;  step = 1;
+        }else if(layout == (unsigned int)NormType::NC4HW4){
+            index = position * 4;  step = 1;  padding = 1;
+        }else{
+            index = position;      step = (size_t)dst_width * dst_height;
+        }
+
+        if(output == (unsigned int)NormType::Float16){
+            uint16_t* p = (uint16_t*)dst + index;
+            p[0] = float_to_half(c0);  p[step] = float_to_half(c1);  p[2 * step] = float_to_half(c2);
+            if(padding) p[3] = 0;
+        }else if(output == (unsigned int)NormType::Int8){
+            int8_t* p = (int8_t*)dst + index;
+            p[0] = float_to_int8(c0, norm.int8_scale);  p[step] = float_to_int8(c1, norm.int8_scale);  p[2 * step] = float_to_int8(c2, norm.int8_scale);
+            if(padding) p[3] = 0;
+        }else{
+            float* p = (float*)dst + index;
+            p[0] = c0;  p[step] = c1;  p[2 * step] = c2;
+            if(padding) p[3] = 0;
+        }
+    }
+
+    // dst的数据类型和布局由norm决定，默认为float32的NCHW
     void warp_affine_bilinear_and_normalize(
         uint8_t* src, int src_line_size, int src_width, int src_height, 
-        float* dst  , int dst_width, int dst_height,
+        void* dst   , int dst_width, int dst_height,
         float* matrix_2_3, uint8_t const_value, const Norm& norm,
         cudaStream_t stream);
 
+    // batch中一张图像的描述，format为BGR时只使用data和line_size
+    // NV12时data为Y平面、u为交错的UV平面；I420时data、u、v依次为Y、U、V平面
+    struct WarpAffineSource{
+        const uint8_t* data;
+        int line_size;
+        int width, height;
+        ImageFormat format    = ImageFormat::BGR;
+        const uint8_t* u      = nullptr;
+        const uint8_t* v      = nullptr;
+        int uv_line_size      = 0;
+    };
+
+    // 与convert_nv12_to_bgr_invoke相同的转换公式，结果饱和到[0, 255]
+    __host__ __device__ inline void yuv_to_bgr(uint8_t y, uint8_t u, uint8_t v, uint8_t* bgr){
+        float luma = 1.164f * (y - 16.0f);
+        float b    = luma + 2.018f * (u - 128.0f);
+        float g    = luma - 0.813f * (v - 128.0f) - 0.391f * (u - 128.0f);
+        float r    = luma + 1.596f * (v - 128.0f);
+        bgr[0] = b < 0 ? 0 : (b > 255 ? 255 : (uint8_t)b);
+        bgr[1] = g < 0 ? 0 : (g > 255 ? 255 : (uint8_t)g);
+        bgr[2] = r < 0 ? 0 : (r > 255 ? 255 : (uint8_t)r);
+    }
+
+    /**
+     * @brief 取(x, y)位置的BGR像素，BGR格式直接返回图像中的地址
+     * YUV格式在这里转换到buffer中并返回buffer，因此插值的结果与先整图转换为BGR再插值逐位一致
+     */
+    __host__ __device__ inline const uint8_t* load_bgr_pixel(const WarpAffineSource& source, int x, int y, uint8_t* buffer){
+
+        if(source.format == ImageFormat::BGR)
+            return source.data + y * source.line_size + x * 3;
+
+        uint8_t luma = source.data[y * source.line_size + x];
+        int offset   = (y >> 1) * source.uv_line_size;
+        if(source.format == ImageFormat::NV12){
+            const uint8_t* uv = source.u + offset + (x & ~1);
+            yuv_to_bgr(luma, uv[0], uv[1], buffer);
+        }else{
+            yuv_to_bgr(luma, source.u[offset + (x >> 1)], source.v[offset + (x >> 1)], buffer);
+        }
+        return buffer;
+    }
+
+    // 单张图像，source可以是BGR或者YUV
+    void warp_affine_bilinear_and_normalize(
+        const WarpAffineSource& source,
+        void* dst, int dst_width, int dst_height,
+        const float* matrix_2_3, uint8_t const_value, const Norm& norm,
+        cudaStream_t stream);
+
+    /**
+     * @brief 把YUVImage的平面放到device上，返回可以直接用于warp_affine的source
+     * host上的平面复制到device_workspace（至少image.bytes()字节），
+     * 普通host内存先同步复制到host_workspace（同样大小，页锁定）中转，返回后即可释放；
+     * 页锁定的平面不经过中转，直接在stream上异步拷贝，stream上的拷贝完成之前不能释放或者改写
+     * device上的平面不复制，直接引用，此时两个workspace都可以为nullptr
+     */
+    WarpAffineSource upload_yuv_image(
+        const YUVImage& image, uint8_t* device_workspace, uint8_t* host_workspace,
+        cudaStream_t stream);
+
+    /**
+     * @brief 一次launch处理整个batch
+     * 第i张图sources[i]按matrices_2_3[i * 6, i * 6 + 6)（dst到image的2x3矩阵）变换，
+     * 写到dst + i * norm.output_bytes(dst_width, dst_height)字节处，数据类型和布局由norm决定
+     * sources、matrices_2_3以及图像数据都需要是device可以访问的内存
+     */
+    void warp_affine_bilinear_and_normalize_batch(
+        const WarpAffineSource* sources, const float* matrices_2_3, int batch,
+        void* dst, int dst_width, int dst_height,
+        uint8_t const_value, const Norm& norm,
+        cudaStream_t stream);
+
     void norm_feature(
         float* feature_array, int num_feature, int feature_length,
         cudaStream_t stream
@@ -49,6 +235,11 @@ namespace CUDAKernel{
         const uint8_t* y, const uint8_t* uv, int width, int height, 
         int linesize, uint8_t* dst, 
         cudaStream_t stream);
+
+    // source为NV12或者I420，输出为紧密排列的BGR图像，width * 3 * height
+    void convert_yuv_to_bgr_invoke(
+        const WarpAffineSource& source, uint8_t* dst,
+        cudaStream_t stream);
 };
 
 #endif // PREPROCESS_KERNEL_CUH
\ No newline at end of file
@@ -0,0 +1,86 @@
+
+
+#ifndef REPLICA_POOL_HPP
+#define REPLICA_POOL_HPP
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+/**
+ * @brief 同一个模型的多个副本（每个副本有自己的worker线程和执行上下文），
+ * 每次分发给负载最小的副本，负载相同时轮询，避免总是落到第一个副本上
+ * 副本需要在开始分发前全部add进来
+ */
+template<class _Replica>
+class ReplicaPool{
+public:
+    typedef std::function<int(_Replica* replica)> LoadFunction;
+
+    struct ReplicaStatistics{
+        int device          = 0;
+        int load            = 0;
+        long long dispatched = 0;
+    };
+
+    ReplicaPool(const LoadFunction& load_function):load_function_(load_function){}
+
+    void add(const std::shared_ptr<_Replica>& replica, int device){
+        Entry entry;
+        entry.replica    = replica;
+        entry.device     = device;
+        entry.dispatched = std::make_shared<std::atomic<long long>>(0);
+        entries_.emplace_back(entry);
+    }
+
+    // 返回负载最小的副本，没有副本时返回nullptr
+    std::shared_ptr<_Replica> dispatch(){
+
+        int size = entries_.size();
+        if(size == 0) return nullptr;
+
+        int start    = cursor_++ % size;
+        int selected = start;
+        int min_load = load_function_(entries_[start].replica.get());
+        for(int i = 1; i < size && min_load > 0; ++i){
+            int index = (start + i) % size;
+            int load  = load_function_(entries_[index].replica.get());
+            if(load < min_load){
+                min_load = load;
+                selected = index;
+            }
+        }
+
+        auto& entry = entries_[selected];
+        (*entry.dispatched)++;
+        return entry.replica;
+    }
+
+    std::vector<ReplicaStatistics> statistics(){
+        std::vector<ReplicaStatistics> output(entries_.size());
+        for(int i = 0; i < (int)entries_.size(); ++i){
+            output[i].device     = entries_[i].device;
+            output[i].load       = load_function_(entries_[i].replica.get());
+            output[i].dispatched = *entries_[i].dispatched;
+        }
+        return output;
+    }
+
+    int size() const{ return entries_.size(); }
+    bool empty() const{ return entries_.empty(); }
+    const std::shared_ptr<_Replica>& replica(int index) const{ return entries_[index].replica; }
+
+private:
+    struct Entry{
+        std::shared_ptr<_Replica> replica;
+        int device = 0;
+        std::shared_ptr<std::atomic<long long>> dispatched;
+    };
+
+    LoadFunction load_function_;
+    std::vector<Entry> entries_;
+    std::atomic<unsigned int> cursor_{0};
+};
+
+#endif // REPLICA_POOL_HPP
@@ -0,0 +1,130 @@
+
+#include "result_compactor.hpp"
+#include "nms_kernel.cuh"
+#include "ilogger.hpp"
+#include <algorithm>
+
+using namespace std;
+
+ResultCompactor::ResultCompactor(int num_slots, int max_batch_size, int box_element, int capacity, OverflowPolicy policy, cudaStream_t stream){
+
+    max_batch_size_ = max_batch_size;
+    box_element_    = box_element;
+    capacity_       = std::min(std::max(1, capacity), MAX_NMS_TOPK);
+    policy_         = policy;
+    stream_         = stream;
+    checkCudaRuntime(cudaStreamCreateWithFlags(&copy_stream_, cudaStreamNonBlocking));
+
+    int max_capacity = policy_ == OverflowPolicy::Grow ? MAX_NMS_TOPK : capacity_;
+    nms_workspace_.gpu(CUDAKernel::nms_workspace_size(max_capacity));
+
+    for(int i = 0; i < num_slots; ++i){
+        slots_.emplace_back(new Slot());
+        auto& slot = slots_.back();
+        checkCudaRuntime(cudaEventCreateWithFlags(&slot->done, cudaEventDisableTiming));
+        slot->offsets.resize(max_batch_size);
+        slot->header.cpu(max_batch_size * 2 * sizeof(int));
+        slot->header.gpu(max_batch_size * 2 * sizeof(int));
+        begin(i);
+    }
+    statistics_.capacity = capacity_;
+}
+
+ResultCompactor::~ResultCompactor(){
+    for(auto& slot : slots_)
+        checkCudaRuntime(cudaEventDestroy(slot->done));
+    checkCudaRuntime(cudaStreamDestroy(copy_stream_));
+}
+
+void ResultCompactor::begin(int islot){
+
+    // 该slot上一个batch已经交付，这里可以安全地重新分配
+    auto& slot = slots_[islot];
+    if(slot->capacity == capacity_) return;
+
+    size_t bytes_per_image = (size_t)capacity_ * box_element_ * sizeof(float);
+    slot->capacity = capacity_;
+    slot->arrays.gpu(max_batch_size_ * (bytes_per_image + sizeof(float)));
+    slot->packed.gpu(max_batch_size_ * bytes_per_image);
+    slot->packed.cpu(max_batch_size_ * bytes_per_image);
+}
+
+float* ResultCompactor::output(int islot, int ibatch){
+    auto& slot = slots_[islot];
+    return (float*)slot->arrays.gpu() + ibatch * (1 + (size_t)slot->capacity * box_element_);
+}
+
+int* ResultCompactor::candidates(int islot, int ibatch){
+    return (int*)slots_[islot]->header.gpu() + ibatch * 2 + 1;
+}
+
+void ResultCompactor::commit(int islot, int batch){
+
+    auto& slot  = slots_[islot];
+    slot->batch = batch;
+    CUDAKernel::compact_results_invoke(
+        (float*)slot->arrays.gpu(), 1 + (size_t)slot->capacity * box_element_, batch, box_element_,
+        (int*)slot->header.gpu(), (float*)slot->packed.gpu(), stream_
+    );
+
+    // 这里只复制每张图像的数量
+    checkCudaRuntime(cudaMemcpyAsync(slot->header.cpu(), slot->header.gpu(), batch * 2 * sizeof(int), cudaMemcpyDeviceToHost, stream_));
+    checkCudaRuntime(cudaEventRecord(slot->done, stream_));
+}
+
+void ResultCompactor::wait(int islot){
+
+    auto& slot = slots_[islot];
+    checkCudaRuntime(cudaEventSynchronize(slot->done));
+
+    const int* header   = (const int*)slot->header.cpu();
+    int total           = 0;
+    int overflow_images = 0;
+    long long overflow_boxes = 0;
+    for(int i = 0; i < slot->batch; ++i){
+        slot->offsets[i] = total;
+        total += header[i * 2];
+
+        int num_candidates = header[i * 2 + 1];
+        if(num_candidates > slot->capacity){
+            overflow_images++;
+            overflow_boxes += num_candidates - slot->capacity;
+        }
+    }
+
+    // 只复制实际的box，在copy stream上，不需要等待推理stream上已经提交的下一个batch
+    size_t bytes = (size_t)total * box_element_ * sizeof(float);
+    if(bytes > 0){
+        checkCudaRuntime(cudaMemcpyAsync(slot->packed.cpu(), slot->packed.gpu(), bytes, cudaMemcpyDeviceToHost, copy_stream_));
+        checkCudaRuntime(cudaStreamSynchronize(copy_stream_));
+    }
+
+    if(overflow_images > 0 && policy_ == OverflowPolicy::Grow && capacity_ < MAX_NMS_TOPK){
+        capacity_ = std::min(capacity_ * 2, MAX_NMS_TOPK);
+        INFOW("%d images overflow the result capacity %d, grow to %d", overflow_images, slot->capacity, capacity_);
+    }
+
+    std::unique_lock<std::mutex> l(statistics_lock_);
+    statistics_.batches++;
+    statistics_.images          += slot->batch;
+    statistics_.boxes           += total;
+    statistics_.overflow_images += overflow_images;
+    statistics_.overflow_boxes  += overflow_boxes;
+    statistics_.bytes_copied    += slot->batch * 2 * sizeof(int) + bytes;
+    statistics_.bytes_fixed     += slot->batch * (1 + (size_t)slot->capacity * box_element_) * sizeof(float);
+    statistics_.capacity         = capacity_;
+}
+
+int ResultCompactor::count(int islot, int ibatch) const{
+    return ((const int*)slots_[islot]->header.cpu())[ibatch * 2];
+}
+
+const float* ResultCompactor::boxes(int islot, int ibatch) const{
+    auto& slot = slots_[islot];
+    return (const float*)slot->packed.cpu() + (size_t)slot->offsets[ibatch] * box_element_;
+}
+
+ResultStatistics ResultCompactor::statistics(){
+    std::unique_lock<std::mutex> l(statistics_lock_);
+    return statistics_;
+}
@@ -0,0 +1,109 @@
+#ifndef RESULT_COMPACTOR_HPP
+#define RESULT_COMPACTOR_HPP
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include "trt_tensor.hpp"
+#include "cuda_tools.hpp"
+#include "box_nms.hpp"
+
+// 单张图像的候选框超过容量（topk_sort_nms的top_k）时的处理方式
+enum class OverflowPolicy : int{
+    KeepTopK = 0,     // 保留置信度最高的capacity个，其余丢弃并计数
+    Grow     = 1      // 当前batch同KeepTopK，之后的batch容量翻倍，最大为MAX_NMS_TOPK
+};
+
+struct ResultStatistics{
+    long long batches         = 0;
+    long long images          = 0;
+    long long boxes           = 0;      // 交付的box数
+    long long overflow_images = 0;      // 候选框超过容量而被截断的图像数
+    long long overflow_boxes  = 0;      // 因为超过容量而丢弃的候选框数
+    long long bytes_copied    = 0;      // 实际device到host的字节数
+    long long bytes_fixed     = 0;      // 按容量整块复制时的字节数，用于对比
+    int capacity              = 0;      // 当前每张图像的容量
+
+    // 多个副本的统计合并，capacity取最大
+    void merge(const ResultStatistics& other){
+        batches         += other.batches;
+        images          += other.images;
+        boxes           += other.boxes;
+        overflow_images += other.overflow_images;
+        overflow_boxes  += other.overflow_boxes;
+        bytes_copied    += other.bytes_copied;
+        bytes_fixed     += other.bytes_fixed;
+        capacity         = capacity > other.capacity ? capacity : other.capacity;
+    }
+};
+
+namespace CUDAKernel{
+
+    /**
+     * @brief 把batch张图像的结果紧密排列到packed中
+     * 第i张图像的结果位于arrays + i * array_stride，格式为count + count个box（每个box_element个float），与topk_sort_nms的output相同
+     * header[2 * i]写入count，header[2 * i + 1]不修改（由topk_sort_nms写入候选框数量）
+     */
+    void compact_results_invoke(
+        const float* arrays, size_t array_stride, int batch, int box_element,
+        int* header, float* packed, cudaStream_t stream);
+};
+
+/**
+ * @brief 变长结果的紧凑回传，管理流水线中每个slot的输出缓冲区
+ * launch中（推理的stream上）：
+ *   1. begin(slot)，容量变化时重新分配该slot的缓冲区
+ *   2. 每张图像的topk_sort_nms写到output(slot, i)，top_k为capacity()，num_candidates为candidates(slot, i)
+ *   3. commit(slot, batch)，把结果紧密排列，只把每张图像的数量复制到host
+ * deliver中：
+ *   4. wait(slot)，得到数量后在独立的copy stream上只复制实际的box，不排在下一个batch的推理之后
+ *   5. count(slot, i)、boxes(slot, i)读取结果
+ */
+class ResultCompactor{
+public:
+    ResultCompactor(int num_slots, int max_batch_size, int box_element, int capacity, OverflowPolicy policy, cudaStream_t stream);
+    virtual ~ResultCompactor();
+
+    ResultCompactor(const ResultCompactor& other) = delete;
+    ResultCompactor& operator = (const ResultCompactor& other) = delete;
+
+    void begin(int islot);
+    int capacity() const{return capacity_;}
+    float* output(int islot, int ibatch);
+    int* candidates(int islot, int ibatch);
+
+    // topk_sort_nms的workspace，按可能的最大容量分配，所有slot在stream上顺序使用
+    void* nms_workspace(){return nms_workspace_.gpu();}
+
+    void commit(int islot, int batch);
+    void wait(int islot);
+
+    int count(int islot, int ibatch) const;
+    const float* boxes(int islot, int ibatch) const;
+
+    ResultStatistics statistics();
+
+private:
+    struct Slot{
+        TRT::MixMemory arrays;      // gpu：每张图像1 + capacity * box_element个float
+        TRT::MixMemory header;      // 每张图像[count, candidates]，cpu为页锁定内存
+        TRT::MixMemory packed;      // 紧密排列的box
+        std::vector<int> offsets;   // 每张图像在packed中的起始box
+        cudaEvent_t done = nullptr; // header已经复制到host
+        int capacity     = 0;
+        int batch        = 0;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots_;
+    TRT::MixMemory nms_workspace_;
+    int max_batch_size_   = 0;
+    int box_element_      = 0;
+    int capacity_         = 0;
+    OverflowPolicy policy_ = OverflowPolicy::KeepTopK;
+    cudaStream_t stream_      = nullptr;
+    cudaStream_t copy_stream_ = nullptr;
+    std::mutex statistics_lock_;
+    ResultStatistics statistics_;
+};
+
+#endif // RESULT_COMPACTOR_HPP
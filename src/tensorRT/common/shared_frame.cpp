@@ -0,0 +1,234 @@
+#include "shared_frame.hpp"
+#include "trt_tensor.hpp"
+#include "cuda_tools.hpp"
+#include "ilogger.hpp"
+#include <algorithm>
+
+using namespace std;
+
+struct SharedFrame::Buffer{
+    int device_id = 0;
+    TRT::MixMemory memory;                  // gpu为上传的图像，cpu为非页锁定输入的中转
+    cudaEvent_t uploaded = nullptr;         // 当前这一帧上传完成
+    cv::Mat pinned_image;                   // 直接从页锁定原图上传时持有原图，直到uploaded完成
+    vector<cudaEvent_t> events;             // 上一帧释放时在各个stream上记录的事件，前num_pending个有效
+    int num_pending = 0;
+};
+
+SharedFrame::~SharedFrame(){
+
+    for(auto& copy : copies_){
+        auto buffer = copy.buffer;
+        if(buffer == nullptr) continue;
+
+        // 不在这里同步，而是在每个使用过的stream上记录事件，下一次上传之前等待
+        CUDATools::AutoDevice auto_device(copy.device_id);
+        for(auto stream : copy.streams){
+            if(buffer->num_pending == (int)buffer->events.size()){
+                cudaEvent_t event = nullptr;
+                checkCudaRuntime(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+                buffer->events.push_back(event);
+            }
+            checkCudaRuntime(cudaEventRecord(buffer->events[buffer->num_pending++], stream));
+        }
+        pool_->release(buffer);
+    }
+}
+
+CUDAKernel::WarpAffineSource SharedFrame::source(int device_id, cudaStream_t stream){
+
+    std::unique_lock<std::mutex> l(lock_);
+    for(auto& copy : copies_){
+        if(copy.device_id != device_id) continue;
+
+        if(std::find(copy.streams.begin(), copy.streams.end(), stream) == copy.streams.end()){
+            // 上传在别的stream上，先等待上传完成
+            if(copy.uploaded)
+                checkCudaRuntime(cudaStreamWaitEvent(stream, copy.uploaded, 0));
+            copy.streams.push_back(stream);
+        }
+        pool_->record_reuse(bytes_);
+        return copy.source;
+    }
+
+    copies_.emplace_back();
+    auto& copy     = copies_.back();
+    copy.device_id = device_id;
+    copy.streams.push_back(stream);
+    upload(copy, stream);
+    return copy.source;
+}
+
+void SharedFrame::upload(DeviceCopy& copy, cudaStream_t stream){
+
+    // device上的YUV平面直接引用
+    if(bytes_ == 0){
+        copy.source = CUDAKernel::upload_yuv_image(yuv_, nullptr, nullptr, stream);
+        return;
+    }
+
+    auto buffer = pool_->acquire(copy.device_id, bytes_);
+    copy.buffer = buffer;
+
+    // 缓冲区的上一个使用者可能还没有读完
+    for(int i = 0; i < buffer->num_pending; ++i)
+        checkCudaRuntime(cudaStreamWaitEvent(stream, buffer->events[i], 0));
+    buffer->num_pending = 0;
+
+    // 上一帧持有的原图，它的上传在缓冲区被其他stream读完之前早已完成，这里只是确认
+    if(!buffer->pinned_image.empty()){
+        checkCudaRuntime(cudaEventSynchronize(buffer->uploaded));
+        buffer->pinned_image.release();
+    }
+
+    uint8_t* image_device = (uint8_t*)buffer->memory.gpu(bytes_);
+    if(format_ == ImageFormat::BGR){
+        if(CUDATools::is_pinned_memory(image_.data)){
+            // 直接从原图异步拷贝，handle可能在拷贝完成之前释放，由缓冲区持有原图
+            checkCudaRuntime(cudaMemcpyAsync(image_device, image_.data, bytes_, cudaMemcpyHostToDevice, stream));
+            buffer->pinned_image = image_;
+        }else{
+            uint8_t* image_host = (uint8_t*)buffer->memory.cpu(bytes_);
+            checkCudaRuntime(cudaMemcpyAsync(image_host,   image_.data, bytes_, cudaMemcpyHostToHost,   stream));
+            checkCudaRuntime(cudaMemcpyAsync(image_device, image_host,  bytes_, cudaMemcpyHostToDevice, stream));
+        }
+
+        copy.source.data      = image_device;
+        copy.source.line_size = width_ * 3;
+        copy.source.width     = width_;
+        copy.source.height    = height_;
+        copy.source.format    = ImageFormat::BGR;
+    }else{
+        copy.source = CUDAKernel::upload_yuv_image(yuv_, image_device, (uint8_t*)buffer->memory.cpu(bytes_), stream);
+    }
+
+    if(buffer->uploaded == nullptr)
+        checkCudaRuntime(cudaEventCreateWithFlags(&buffer->uploaded, cudaEventDisableTiming));
+    checkCudaRuntime(cudaEventRecord(buffer->uploaded, stream));
+    copy.uploaded = buffer->uploaded;
+    pool_->record_upload(bytes_);
+}
+
+shared_ptr<SharedFramePool> SharedFramePool::create(int max_free_buffers){
+    return shared_ptr<SharedFramePool>(new SharedFramePool(max_free_buffers));
+}
+
+SharedFramePool::~SharedFramePool(){
+    for(auto buffer : free_)
+        destroy(buffer);
+    free_.clear();
+}
+
+FrameHandle SharedFramePool::create_frame(const cv::Mat& image){
+
+    if(image.empty() || image.type() != CV_8UC3){
+        INFOE("Shared frame requires a non-empty CV_8UC3 image");
+        return nullptr;
+    }
+
+    FrameHandle frame(new SharedFrame());
+    frame->pool_   = shared_from_this();
+    frame->format_ = ImageFormat::BGR;
+    frame->width_  = image.cols;
+    frame->height_ = image.rows;
+    frame->bytes_  = (size_t)image.cols * image.rows * 3;
+
+    // 上传按连续内存进行，ROI之类不连续的图像先复制一份
+    frame->image_  = image.isContinuous() ? image : image.clone();
+
+    std::unique_lock<std::mutex> l(lock_);
+    statistics_.frames++;
+    return frame;
+}
+
+FrameHandle SharedFramePool::create_frame(const YUVImage& image){
+
+    if(image.empty()){
+        INFOE("Empty yuv image");
+        return nullptr;
+    }
+
+    FrameHandle frame(new SharedFrame());
+    frame->pool_   = shared_from_this();
+    frame->format_ = image.format;
+    frame->width_  = image.width;
+    frame->height_ = image.height;
+    frame->bytes_  = image.device ? 0 : image.bytes();
+    frame->yuv_    = image;
+
+    std::unique_lock<std::mutex> l(lock_);
+    statistics_.frames++;
+    return frame;
+}
+
+SharedFrameStatistics SharedFramePool::statistics(){
+    std::unique_lock<std::mutex> l(lock_);
+    SharedFrameStatistics output = statistics_;
+    output.free_buffers = free_.size();
+    return output;
+}
+
+SharedFrame::Buffer* SharedFramePool::acquire(int device_id, size_t bytes){
+
+    std::unique_lock<std::mutex> l(lock_);
+
+    // 优先使用同一个device上足够大的缓冲区，其次是同一个device上的任意缓冲区（重新分配）
+    int selected = -1;
+    for(int i = 0; i < (int)free_.size(); ++i){
+        auto buffer = free_[i];
+        if(buffer->device_id != device_id) continue;
+
+        selected = i;
+        if(buffer->memory.gpu_size() >= bytes) break;
+    }
+
+    if(selected != -1){
+        auto buffer = free_[selected];
+        free_.erase(free_.begin() + selected);
+        return buffer;
+    }
+
+    statistics_.allocated++;
+    auto buffer = new SharedFrame::Buffer();
+    buffer->device_id = device_id;
+    return buffer;
+}
+
+void SharedFramePool::release(SharedFrame::Buffer* buffer){
+    {
+        std::unique_lock<std::mutex> l(lock_);
+        if((int)free_.size() < max_free_buffers_){
+            free_.push_back(buffer);
+            return;
+        }
+    }
+    destroy(buffer);
+}
+
+void SharedFramePool::destroy(SharedFrame::Buffer* buffer){
+
+    // 释放device内存时会等待还在读它的工作完成
+    CUDATools::AutoDevice auto_device(buffer->device_id);
+    if(buffer->uploaded){
+        // 持有的原图在上传完成之后才能释放
+        if(!buffer->pinned_image.empty())
+            checkCudaRuntime(cudaEventSynchronize(buffer->uploaded));
+        checkCudaRuntime(cudaEventDestroy(buffer->uploaded));
+    }
+
+    for(auto event : buffer->events)
+        checkCudaRuntime(cudaEventDestroy(event));
+    delete buffer;
+}
+
+void SharedFramePool::record_upload(size_t bytes){
+    std::unique_lock<std::mutex> l(lock_);
+    statistics_.uploads++;
+    statistics_.bytes_uploaded += bytes;
+}
+
+void SharedFramePool::record_reuse(size_t bytes){
+    std::unique_lock<std::mutex> l(lock_);
+    statistics_.reuses++;
+    statistics_.bytes_saved += bytes;
+}
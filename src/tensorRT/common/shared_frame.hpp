@@ -0,0 +1,119 @@
+#ifndef SHARED_FRAME_HPP
+#define SHARED_FRAME_HPP
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "yuv_image.hpp"
+#include "preprocess_kernel.cuh"
+
+/**
+ * @brief 多个模型共享的输入帧，每个device只上传一次
+ * 同一帧交给RetinaFace、Arcface、AlphaPose时，每个模型的preprocess都会把整帧复制到自己的workspace，
+ * FrameHandle把整帧上传一次，同一个device上的所有模型直接从这份device图像warp：
+ *   auto frames = SharedFramePool::create();
+ *   auto frame  = frames->create_frame(image);                 // 只引用image，不复制，也不上传
+ *   auto faces  = detector->commit(frame).get();               // 第一个使用者在自己的stream上上传
+ *   auto pose   = pose_model->commits(frame, boxes);           // 其他stream等待上传完成后直接使用
+ *
+ * 模型在commit返回之前已经把warp提交到stream上，因此commit之后handle就可以释放。
+ * 最后一个handle释放时，在所有使用过这一帧的stream上记录事件，device缓冲区带着这些事件归还给pool，
+ * 下一次复用时由上传的stream等待这些事件，调用线程不会阻塞
+ * 最后一个handle释放之前，不要修改原图。页锁定的原图（例如TRT::create_pinned_mat）不经过中转直接异步上传，
+ * 缓冲区会持有它直到上传完成，所以可以随handle释放，但在这一帧的第一个结果返回之前不要修改。
+ * host上YUV平面的要求见YUVImage::device
+ */
+struct SharedFrameStatistics{
+    long long frames         = 0;   // create_frame的次数
+    long long uploads        = 0;   // 实际的上传次数，每一帧在每个device上最多一次
+    long long reuses         = 0;   // 直接使用已上传图像的次数
+    long long bytes_uploaded = 0;   // host到device实际传输的字节数
+    long long bytes_saved    = 0;   // 因复用而省下的传输字节数，即每个模型各自上传时多出来的部分
+    long long allocated      = 0;   // 新分配的缓冲区数，稳定后不再增加
+    int free_buffers         = 0;
+};
+
+class SharedFramePool;
+
+class SharedFrame{
+public:
+    virtual ~SharedFrame();
+
+    int width() const{ return width_; }
+    int height() const{ return height_; }
+    ImageFormat format() const{ return format_; }
+    cv::Size size() const{ return cv::Size(width_, height_); }
+
+    // 上传一次需要传输的字节数，device上的YUV图像为0
+    size_t bytes() const{ return bytes_; }
+
+    /**
+     * @brief 返回device_id上可以直接用于warp_affine的source，只能在stream上使用
+     * 这一帧在device_id上第一次使用时在stream上上传，之后的调用不再上传，其他stream先等待上传完成
+     * 调用方需要已经切换到device_id（例如CUDATools::AutoDevice）
+     */
+    CUDAKernel::WarpAffineSource source(int device_id, cudaStream_t stream);
+
+private:
+    friend class SharedFramePool;
+    struct Buffer;
+
+    struct DeviceCopy{
+        int device_id  = 0;
+        Buffer* buffer = nullptr;
+        cudaEvent_t uploaded = nullptr;
+        std::vector<cudaStream_t> streams;      // 使用过这份图像的stream，第一个是上传的stream
+        CUDAKernel::WarpAffineSource source;
+    };
+
+    SharedFrame() = default;
+    void upload(DeviceCopy& copy, cudaStream_t stream);
+
+    std::shared_ptr<SharedFramePool> pool_;
+    ImageFormat format_ = ImageFormat::BGR;
+    int width_  = 0;
+    int height_ = 0;
+    size_t bytes_ = 0;
+    cv::Mat image_;             // BGR时引用的原图，页锁定时上传的缓冲区也会引用它
+    YUVImage yuv_;              // NV12/I420时的平面
+    std::mutex lock_;
+    std::vector<DeviceCopy> copies_;
+};
+
+typedef std::shared_ptr<SharedFrame> FrameHandle;
+
+/**
+ * @brief SharedFrame的device缓冲区池，最多缓存max_free_buffers个空闲缓冲区
+ * handle持有池的引用，池在最后一个handle之后析构。handle需要在使用过它的模型（stream）销毁之前释放
+ */
+class SharedFramePool : public std::enable_shared_from_this<SharedFramePool>{
+public:
+    static std::shared_ptr<SharedFramePool> create(int max_free_buffers = 8);
+    virtual ~SharedFramePool();
+
+    // image需要是CV_8UC3的BGR图像，失败时返回nullptr
+    FrameHandle create_frame(const cv::Mat& image);
+
+    // 解码器输出的NV12/I420，host上的平面同样只上传一次，device上的平面直接引用
+    FrameHandle create_frame(const YUVImage& image);
+
+    SharedFrameStatistics statistics();
+
+private:
+    friend class SharedFrame;
+
+    SharedFramePool(int max_free_buffers):max_free_buffers_(max_free_buffers){}
+    SharedFrame::Buffer* acquire(int device_id, size_t bytes);
+    void release(SharedFrame::Buffer* buffer);
+    void destroy(SharedFrame::Buffer* buffer);
+    void record_upload(size_t bytes);
+    void record_reuse(size_t bytes);
+
+    std::mutex lock_;
+    std::vector<SharedFrame::Buffer*> free_;
+    int max_free_buffers_ = 8;
+    SharedFrameStatistics statistics_;
+};
+
+#endif // SHARED_FRAME_HPP
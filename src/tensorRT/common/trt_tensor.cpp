@@ -1,6 +1,13 @@
 
 #include "trt_tensor.hpp"
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <cuda_runtime.h>
 #include "cuda_tools.hpp"
 
@@ -28,6 +35,468 @@ namespace TRT{
 		}
 	}
 
+	const char* memory_type_name(MemoryType type){
+		switch(type){
+		case MemoryType::Host:         return "Host";
+		case MemoryType::HostHugePage: return "HostHugePage";
+		case MemoryType::Pinned:       return "Pinned";
+		case MemoryType::Device:       return "Device";
+		case MemoryType::Managed:      return "Managed";
+		default: return "Unknow";
+		}
+	}
+
+	class HostAllocator : public MemoryAllocator{
+	public:
+		virtual void* allocate(size_t size) override{
+			void* ptr = nullptr;
+			if(posix_memalign(&ptr, ALIGNMENT, size) != 0){
+				INFOE("Allocate host memory failed, size = %lld", size);
+				return nullptr;
+			}
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{ ::free(ptr); }
+		virtual MemoryType type() override{ return MemoryType::Host; }
+
+	private:
+		static const size_t ALIGNMENT = 64;
+	};
+
+	// 优先使用预留的大页（MAP_HUGETLB），失败时使用透明大页
+	class HostHugePageAllocator : public MemoryAllocator{
+	public:
+		virtual void* allocate(size_t size) override{
+
+			size_t aligned_size = upbound(size);
+			void* ptr = mmap(nullptr, aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if(ptr == MAP_FAILED){
+				ptr = mmap(nullptr, aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if(ptr == MAP_FAILED){
+					INFOE("Allocate huge page memory failed, size = %lld", size);
+					return nullptr;
+				}
+				madvise(ptr, aligned_size, MADV_HUGEPAGE);
+			}
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{ munmap(ptr, upbound(size)); }
+		virtual MemoryType type() override{ return MemoryType::HostHugePage; }
+
+	private:
+		static size_t upbound(size_t size){ return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE; }
+		static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	};
+
+	class PinnedAllocator : public MemoryAllocator{
+	public:
+		virtual void* allocate(size_t size) override{
+			void* ptr = nullptr;
+			checkCudaRuntime(cudaMallocHost(&ptr, size));
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{ checkCudaRuntime(cudaFreeHost(ptr)); }
+		virtual MemoryType type() override{ return MemoryType::Pinned; }
+	};
+
+	class DeviceAllocator : public MemoryAllocator{
+	public:
+		virtual void* allocate(size_t size) override{
+			void* ptr = nullptr;
+			checkCudaRuntime(cudaMalloc(&ptr, size));
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{ checkCudaRuntime(cudaFree(ptr)); }
+		virtual MemoryType type() override{ return MemoryType::Device; }
+	};
+
+	class ManagedAllocator : public MemoryAllocator{
+	public:
+		virtual void* allocate(size_t size) override{
+			void* ptr = nullptr;
+			checkCudaRuntime(cudaMallocManaged(&ptr, size));
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{ checkCudaRuntime(cudaFree(ptr)); }
+		virtual MemoryType type() override{ return MemoryType::Managed; }
+	};
+
+	std::shared_ptr<MemoryAllocator> get_memory_allocator(MemoryType type){
+
+		static shared_ptr<MemoryAllocator> allocators[] = {
+			make_shared<HostAllocator>(),
+			make_shared<HostHugePageAllocator>(),
+			make_shared<PinnedAllocator>(),
+			make_shared<DeviceAllocator>(),
+			make_shared<ManagedAllocator>()
+		};
+
+		int index = (int)type;
+		if(index < 0 || index >= (int)(sizeof(allocators) / sizeof(allocators[0]))){
+			INFOE("Unknow memory type %d", index);
+			return nullptr;
+		}
+		return allocators[index];
+	}
+
+	class CachingAllocator : public MemoryAllocator{
+	public:
+		CachingAllocator(shared_ptr<MemoryAllocator> allocator):allocator_(allocator){
+			host_memory_ = is_host_memory(allocator_->type());
+		}
+
+		// 进程退出时cuda可能已经卸载，所以析构时不归还缓存，由系统回收
+		virtual ~CachingAllocator() = default;
+
+		virtual void* allocate(size_t size) override{
+
+			size = allocation_size(size);
+			Block block;
+			bool hit = false;
+			{
+				unique_lock<mutex> l(lock_);
+				auto iter = free_blocks_.find(make_pair(current_device(), size));
+				if(iter != free_blocks_.end() && !iter->second.empty()){
+					hit = take_block(iter->second, block);
+					statistics_.cached_bytes -= size;
+					statistics_.hits++;
+				}else{
+					statistics_.misses++;
+				}
+			}
+
+			if(hit){
+				// 所有块都还在被之前的异步操作使用时，等待最早归还的一个
+				if(block.event != nullptr){
+					if(!block.ready)
+						checkCudaRuntime(cudaEventSynchronize(block.event));
+					release_event(block.event_device, block.event);
+				}
+				return block.ptr;
+			}
+
+			void* ptr = allocator_->allocate(size);
+			if(ptr == nullptr){
+				empty_cache();
+				ptr = allocator_->allocate(size);
+				if(ptr == nullptr)
+					return nullptr;
+			}
+
+			unique_lock<mutex> l(lock_);
+			statistics_.allocated_bytes += size;
+			statistics_.peak_allocated_bytes = std::max(statistics_.peak_allocated_bytes, statistics_.allocated_bytes);
+			return ptr;
+		}
+
+		virtual void free(void* ptr, size_t size) override{
+			free_on_stream(ptr, size, nullptr);
+		}
+
+		virtual void free_on_stream(void* ptr, size_t size, CUStream stream) override{
+
+			size = allocation_size(size);
+			int device = block_device(ptr);
+			{
+				unique_lock<mutex> l(lock_);
+				if(statistics_.cached_bytes + size > max_cached_bytes_){
+					statistics_.allocated_bytes -= size;
+					l.unlock();
+					allocator_->free(ptr, size);
+					return;
+				}
+				statistics_.cached_bytes += size;
+			}
+
+			// device可以访问的内存，在使用它的stream上记录事件，事件完成时这块内存上的异步操作一定已经结束。
+			// 没有指定stream时记录在默认流上，默认流会等待之前所有阻塞流上的操作，与cudaFree隐含的同步等价但不阻塞，
+			// 代价是之后阻塞流上的操作也要等待这个事件
+			Block block;
+			block.ptr = ptr;
+			if(!host_memory_){
+				// 事件需要与stream属于同一个设备。指定的stream属于当前设备，默认流上pinned内存记录在当前设备上，
+				// device内存记录在它所在的设备上
+				int record_device = device;
+				if(stream != nullptr || type() == MemoryType::Pinned)
+					checkCudaRuntime(cudaGetDevice(&record_device));
+
+				CUDATools::AutoDevice auto_device(record_device);
+				block.event        = acquire_event(record_device);
+				block.event_device = record_device;
+				checkCudaRuntime(cudaEventRecord(block.event, stream));
+			}
+
+			unique_lock<mutex> l(lock_);
+			free_blocks_[make_pair(device, size)].push_back(block);
+		}
+
+		virtual MemoryType type() override{ return allocator_->type(); }
+
+		// 512字节以下为一档，之后每个(p, 2p]区间按p/4分为4档
+		virtual size_t allocation_size(size_t size) override{
+			if(size <= MIN_BLOCK_SIZE) return MIN_BLOCK_SIZE;
+
+			size_t p = MIN_BLOCK_SIZE;
+			while(p * 2 < size) p *= 2;
+
+			size_t step = p / 4;
+			return (size + step - 1) / step * step;
+		}
+
+		void empty_cache(){
+			BlockMap blocks;
+			{
+				unique_lock<mutex> l(lock_);
+				std::swap(blocks, free_blocks_);
+				statistics_.allocated_bytes -= statistics_.cached_bytes;
+				statistics_.cached_bytes = 0;
+			}
+
+			for(auto& item : blocks){
+				for(auto& block : item.second){
+					if(block.event){
+						checkCudaRuntime(cudaEventSynchronize(block.event));
+						release_event(block.event_device, block.event);
+					}
+					allocator_->free(block.ptr, item.first.second);
+				}
+			}
+		}
+
+		void set_limit(size_t max_cached_bytes){
+			unique_lock<mutex> l(lock_);
+			max_cached_bytes_ = max_cached_bytes;
+		}
+
+		MemoryCacheStatistics statistics(){
+			unique_lock<mutex> l(lock_);
+			return statistics_;
+		}
+
+	private:
+		struct Block{
+			void* ptr          = nullptr;
+			cudaEvent_t event  = nullptr;
+			int event_device   = 0;		// 事件创建、记录时的设备
+			bool ready         = true;
+		};
+		typedef map<pair<int, size_t>, vector<Block>> BlockMap;
+
+		// 需要持有lock_，优先取异步操作已经完成的块，都没有完成时取最早归还的
+		bool take_block(vector<Block>& blocks, Block& output){
+			for(int i = (int)blocks.size() - 1; i >= 0; --i){
+				if(blocks[i].event == nullptr || cudaEventQuery(blocks[i].event) == cudaSuccess){
+					output = blocks[i];
+					blocks.erase(blocks.begin() + i);
+					return true;
+				}
+			}
+
+			cudaGetLastError();
+			output       = blocks.front();
+			output.ready = false;
+			blocks.erase(blocks.begin());
+			return true;
+		}
+
+		// host内存与设备无关，device内存按分配时的设备分别缓存
+		int current_device(){
+			if(host_memory_ || type() == MemoryType::Pinned) return 0;
+
+			int device = 0;
+			checkCudaRuntime(cudaGetDevice(&device));
+			return device;
+		}
+
+		int block_device(void* ptr){
+			if(host_memory_ || type() == MemoryType::Pinned) return 0;
+
+			cudaPointerAttributes attributes;
+			if(cudaPointerGetAttributes(&attributes, ptr) != cudaSuccess){
+				cudaGetLastError();
+				return current_device();
+			}
+			return attributes.device;
+		}
+
+		// 事件只能记录在创建它的设备的stream上，所以按设备分别缓存，需要在device为当前设备时调用
+		cudaEvent_t acquire_event(int device){
+			{
+				unique_lock<mutex> l(lock_);
+				auto& events = free_events_[device];
+				if(!events.empty()){
+					auto event = events.back();
+					events.pop_back();
+					return event;
+				}
+			}
+
+			cudaEvent_t event = nullptr;
+			checkCudaRuntime(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+			return event;
+		}
+
+		void release_event(int device, cudaEvent_t event){
+			unique_lock<mutex> l(lock_);
+			free_events_[device].push_back(event);
+		}
+
+	private:
+		static const size_t MIN_BLOCK_SIZE = 512;
+
+		mutex lock_;
+		bool host_memory_ = false;
+		shared_ptr<MemoryAllocator> allocator_;
+		BlockMap free_blocks_;
+		map<int, vector<cudaEvent_t>> free_events_;
+		MemoryCacheStatistics statistics_;
+		size_t max_cached_bytes_ = 1024ull * 1024 * 1024;
+	};
+
+	static const int NUM_MEMORY_TYPE = 5;
+
+	static shared_ptr<CachingAllocator>* caching_allocators(){
+		static shared_ptr<CachingAllocator> allocators[NUM_MEMORY_TYPE] = {
+			make_shared<CachingAllocator>(get_memory_allocator(MemoryType::Host)),
+			make_shared<CachingAllocator>(get_memory_allocator(MemoryType::HostHugePage)),
+			make_shared<CachingAllocator>(get_memory_allocator(MemoryType::Pinned)),
+			make_shared<CachingAllocator>(get_memory_allocator(MemoryType::Device)),
+			make_shared<CachingAllocator>(get_memory_allocator(MemoryType::Managed))
+		};
+		return allocators;
+	}
+
+	std::shared_ptr<MemoryAllocator> get_caching_allocator(MemoryType type){
+
+		int index = (int)type;
+		if(index < 0 || index >= NUM_MEMORY_TYPE){
+			INFOE("Unknow memory type %d", index);
+			return nullptr;
+		}
+		return caching_allocators()[index];
+	}
+
+	MemoryCacheStatistics memory_cache_statistics(MemoryType type){
+		int index = (int)type;
+		if(index < 0 || index >= NUM_MEMORY_TYPE)
+			return MemoryCacheStatistics();
+		return caching_allocators()[index]->statistics();
+	}
+
+	void empty_memory_cache(){
+		for(int i = 0; i < NUM_MEMORY_TYPE; ++i)
+			caching_allocators()[i]->empty_cache();
+	}
+
+	void set_memory_cache_limit(size_t max_cached_bytes){
+		for(int i = 0; i < NUM_MEMORY_TYPE; ++i)
+			caching_allocators()[i]->set_limit(max_cached_bytes);
+	}
+
+	static atomic<bool> g_memory_caching{true};
+
+	void set_memory_caching(bool enable){ g_memory_caching = enable; }
+	bool memory_caching(){ return g_memory_caching; }
+
+	static shared_ptr<MemoryAllocator> get_default_allocator(MemoryType type){
+		return memory_caching() ? get_caching_allocator(type) : get_memory_allocator(type);
+	}
+
+	#ifdef USE_OPENCV
+	// 参照opencv的StdMatAllocator，只是把内存换成页锁定内存
+	class PinnedMatAllocator : public cv::MatAllocator{
+	public:
+		#if CV_VERSION_MAJOR >= 4
+		typedef cv::AccessFlag AccessFlagType;
+		#else
+		typedef int AccessFlagType;
+		#endif
+
+		virtual cv::UMatData* allocate(int dims, const int* sizes, int type, void* data0, size_t* step, AccessFlagType flags, cv::UMatUsageFlags usage_flags) const override{
+
+			size_t total = CV_ELEM_SIZE(type);
+			for(int i = dims - 1; i >= 0; i--){
+				if(step){
+					if(data0 && step[i] != CV_AUTOSTEP)
+						total = step[i];
+					else
+						step[i] = total;
+				}
+				total *= sizes[i];
+			}
+
+			uchar* data = data0 ? (uchar*)data0 : (uchar*)get_caching_allocator(MemoryType::Pinned)->allocate(total);
+			if(data == nullptr)
+				CV_Error(cv::Error::StsNoMem, "Allocate pinned memory failed");
+
+			cv::UMatData* u = new cv::UMatData(this);
+			u->data = u->origdata = data;
+			u->size = total;
+			if(data0)
+				u->flags |= cv::UMatData::USER_ALLOCATED;
+			return u;
+		}
+
+		virtual bool allocate(cv::UMatData* u, AccessFlagType flags, cv::UMatUsageFlags usage_flags) const override{
+			return u != nullptr;
+		}
+
+		virtual void deallocate(cv::UMatData* u) const override{
+			if(u == nullptr) return;
+
+			if(!(u->flags & cv::UMatData::USER_ALLOCATED) && u->origdata)
+				get_caching_allocator(MemoryType::Pinned)->free(u->origdata, u->size);
+			delete u;
+		}
+	};
+
+	// 不析构，进程退出时可能还有Mat在引用它
+	cv::MatAllocator* get_pinned_mat_allocator(){
+		static PinnedMatAllocator* allocator = new PinnedMatAllocator();
+		return allocator;
+	}
+
+	cv::Mat create_pinned_mat(int rows, int cols, int type){
+		cv::Mat output;
+		output.allocator = get_pinned_mat_allocator();
+		output.create(rows, cols, type);
+		return output;
+	}
+	#endif // USE_OPENCV
+
+	static atomic<int> g_default_cpu_type{(int)MemoryType::Pinned};
+	static atomic<int> g_default_gpu_type{(int)MemoryType::Managed};
+
+	void set_default_memory_type(MemoryType cpu_type, MemoryType gpu_type){
+		g_default_cpu_type = (int)cpu_type;
+		g_default_gpu_type = (int)gpu_type;
+	}
+
+	MemoryType default_cpu_memory_type(){ return (MemoryType)g_default_cpu_type.load(); }
+	MemoryType default_gpu_memory_type(){ return (MemoryType)g_default_gpu_type.load(); }
+
+	// host_only时直接memcpy，不经过cuda
+	static void copy_memory(void* dst, const void* src, size_t bytes, cudaMemcpyKind kind, CUStream stream, bool host_only){
+		if(host_only){
+			memcpy(dst, src, bytes);
+			return;
+		}
+		checkCudaRuntime(cudaMemcpyAsync(dst, src, bytes, kind, stream));
+	}
+
+	MixMemory::MixMemory()
+	:MixMemory(get_default_allocator(default_cpu_memory_type()), get_default_allocator(default_gpu_memory_type())){}
+
+	MixMemory::MixMemory(std::shared_ptr<MemoryAllocator> cpu_allocator, std::shared_ptr<MemoryAllocator> gpu_allocator){
+		cpu_allocator_ = cpu_allocator ? cpu_allocator : get_default_allocator(default_cpu_memory_type());
+		gpu_allocator_ = gpu_allocator ? gpu_allocator : get_default_allocator(default_gpu_memory_type());
+	}
+
 	MixMemory::~MixMemory() {
 		release_all();
 	}
@@ -37,9 +506,16 @@ namespace TRT{
 		if (gpu_size_ < size) {
 			release_gpu();
 
-			gpu_size_ = size;
-			checkCudaRuntime(cudaMallocManaged(&gpu_, size));
-			checkCudaRuntime(cudaMemset(gpu_, 0, size));
+			gpu_  = gpu_allocator_->allocate(size);
+			Assert(gpu_ != nullptr);
+			gpu_size_ = gpu_allocator_->allocation_size(size);
+
+			if(zero_fill_){
+				if(is_host_memory(gpu_type()))
+					memset(gpu_, 0, size);
+				else
+					checkCudaRuntime(cudaMemset(gpu_, 0, size));
+			}
 		}
 		return gpu_;
 	}
@@ -49,33 +525,35 @@ namespace TRT{
 		if (cpu_size_ < size) {
 			release_cpu();
 
-			cpu_size_ = size;
-			checkCudaRuntime(cudaMallocHost(&cpu_, size));
+			cpu_ = cpu_allocator_->allocate(size);
 			Assert(cpu_ != nullptr);
-			memset(cpu_, 0, size);
+			cpu_size_ = cpu_allocator_->allocation_size(size);
+
+			if(zero_fill_)
+				memset(cpu_, 0, size);
 		}
 		return cpu_;
 	}
 
-	void MixMemory::release_cpu() {
+	void MixMemory::release_cpu(CUStream stream) {
 		if (cpu_) {
-			checkCudaRuntime(cudaFreeHost(cpu_));
+			cpu_allocator_->free_on_stream(cpu_, cpu_size_, stream);
 			cpu_ = nullptr;
 		}
 		cpu_size_ = 0;
 	}
 
-	void MixMemory::release_gpu() {
+	void MixMemory::release_gpu(CUStream stream) {
 		if (gpu_) {
-			checkCudaRuntime(cudaFree(gpu_));
+			gpu_allocator_->free_on_stream(gpu_, gpu_size_, stream);
 			gpu_ = nullptr;
 		}
 		gpu_size_ = 0;
 	}
 
-	void MixMemory::release_all() {
-		release_cpu();
-		release_gpu();
+	void MixMemory::release_all(CUStream stream) {
+		release_cpu(stream);
+		release_gpu(stream);
 	}
 
 	Tensor& Tensor::compute_shape_string(){
@@ -104,8 +582,9 @@ namespace TRT{
 		resize(n, c, h, w);
 	}
 
+	// 析构时stream可能已经随引擎销毁（例如tensor_allocator_中的tensor），所以归还到默认流上
 	Tensor::~Tensor() {
-		release();
+		data_->release_all();
 	}
 
 	Tensor::Tensor(const std::vector<int>& dims, DataType dtType){
@@ -113,6 +592,12 @@ namespace TRT{
 		resize(dims);
 	}
 
+	Tensor::Tensor(const std::vector<int>& dims, std::shared_ptr<MixMemory> data, DataType dtType){
+		this->dtype_ = dtType;
+		this->data_  = data;
+		resize(dims);
+	}
+
 	Tensor::Tensor(int ndims, const int* dims, DataType dtType) {
 
 		this->dtype_ = dtType;
@@ -126,14 +611,16 @@ namespace TRT{
 	}
 
 	shared_ptr<Tensor> Tensor::clone(){
-		auto new_tensor = make_shared<Tensor>(shape_, dtype_);
+		auto new_data   = make_shared<MixMemory>(data_->cpu_allocator(), data_->gpu_allocator());
+		new_data->set_zero_fill(data_->zero_fill());
+		auto new_tensor = make_shared<Tensor>(shape_, new_data, dtype_);
 		if(head_ == DataHead_Init)
 			return new_tensor;
 		
 		if(head_ == DataHead_InCPU){
 			memcpy(new_tensor->cpu(), this->cpu(), this->bytes_);
 		}else if(head_ == DataHead_InGPU){
-			checkCudaRuntime(cudaMemcpyAsync(new_tensor->gpu(), this->gpu(), bytes_, cudaMemcpyDeviceToDevice, stream_));
+			copy_memory(new_tensor->gpu(), this->gpu(), bytes_, cudaMemcpyDeviceToDevice, stream_, data_->host_only());
 		}
 		return new_tensor;
 	}
@@ -157,9 +644,9 @@ namespace TRT{
 		}
 
 		if(head_ == DataHead_InGPU){
-			checkCudaRuntime(cudaMemcpyAsync(gpu<unsigned char>() + offset_location, src, copyed_bytes, cudaMemcpyDeviceToDevice, stream_));
+			copy_memory(gpu<unsigned char>() + offset_location, src, copyed_bytes, cudaMemcpyDeviceToDevice, stream_, data_->host_only());
 		}else if(head_ == DataHead_InCPU){
-			checkCudaRuntime(cudaMemcpyAsync(cpu<unsigned char>() + offset_location, src, copyed_bytes, cudaMemcpyDeviceToHost, stream_));
+			copy_memory(cpu<unsigned char>() + offset_location, src, copyed_bytes, cudaMemcpyDeviceToHost, stream_, data_->host_only());
 		}else{
 			INFOE("Unsupport head type %d", head_);
 		}
@@ -185,17 +672,23 @@ namespace TRT{
 		}
 
 		if(head_ == DataHead_InGPU){
-			checkCudaRuntime(cudaMemcpyAsync(data_->gpu() + offset_location, src, copyed_bytes, cudaMemcpyHostToDevice, stream_));
+			copy_memory((unsigned char*)data_->gpu() + offset_location, src, copyed_bytes, cudaMemcpyHostToDevice, stream_, data_->host_only());
 		}else if(head_ == DataHead_InCPU){
-			checkCudaRuntime(cudaMemcpyAsync(data_->cpu() + offset_location, src, copyed_bytes, cudaMemcpyHostToHost, stream_));
+			copy_memory((unsigned char*)data_->cpu() + offset_location, src, copyed_bytes, cudaMemcpyHostToHost, stream_, data_->host_only());
 		}else{
 			INFOE("Unsupport head type %d", head_);
 		}
 		return *this;
 	}
 
+	// 不同步stream：放回缓存的块由stream_上的事件保证复用前异步操作已经完成，还给cuda时cudaFree/cudaFreeHost本身会同步
+	Tensor& Tensor::release_memory(){
+		data_->release_all(stream_);
+		return *this;
+	}
+
 	Tensor& Tensor::release() {
-		data_->release_all();
+		release_memory();
 		shape_.clear();
 		capacity_ = 0;
 		bytes_ = 0;
@@ -265,7 +758,7 @@ namespace TRT{
 
 		int needed_size = this->numel() * element_size();
 		if (needed_size > capacity_) {
-			data_->release_all();
+			release_memory();
 			bytes_ = 0;
 			head_ = DataHead_Init;
 			capacity_ = needed_size;
@@ -275,7 +768,8 @@ namespace TRT{
 	}
 
 	Tensor& Tensor::synchronize(){ 
-		checkCudaRuntime(cudaStreamSynchronize(stream_));
+		if(!data_->host_only())
+			checkCudaRuntime(cudaStreamSynchronize(stream_));
 		return *this;
 	}
 
@@ -288,7 +782,7 @@ namespace TRT{
 		data_->gpu(capacity_);
 
 		if (copyedIfCPU && data_->cpu() != nullptr) {
-			checkCudaRuntime(cudaMemcpyAsync(data_->gpu(), data_->cpu(), bytes_, cudaMemcpyHostToDevice, stream_));
+			copy_memory(data_->gpu(), data_->cpu(), bytes_, cudaMemcpyHostToDevice, stream_, data_->host_only());
 		}
 		return *this;
 	}
@@ -302,8 +796,12 @@ namespace TRT{
 		data_->cpu(capacity_);
 
 		if (copyedIfGPU && data_->gpu() != nullptr) {
-			checkCudaRuntime(cudaMemcpyAsync(data_->cpu(), data_->gpu(), bytes_, cudaMemcpyDeviceToHost, stream_));
-			checkCudaRuntime(cudaStreamSynchronize(stream_));
+			if(data_->host_only()){
+				memcpy(data_->cpu(), data_->gpu(), bytes_);
+			}else{
+				checkCudaRuntime(cudaMemcpyAsync(data_->cpu(), data_->gpu(), bytes_, cudaMemcpyDeviceToHost, stream_));
+				checkCudaRuntime(cudaStreamSynchronize(stream_));
+			}
 		}
 		return *this;
 	}
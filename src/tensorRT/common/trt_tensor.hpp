@@ -47,32 +47,134 @@ namespace TRT {
 
     int data_type_size(DataType dt);
 
+    enum class MemoryType : int{
+        Host         = 0,     // 普通的对齐内存，不依赖cuda
+        HostHugePage = 1,     // 大页内存，不依赖cuda，适合大块且长期持有的内存
+        Pinned       = 2,     // cudaMallocHost，页锁定内存
+        Device       = 3,     // cudaMalloc，仅device可以访问
+        Managed      = 4      // cudaMallocManaged，统一内存
+    };
+
+    const char* memory_type_name(MemoryType type);
+
+    // 是否为不依赖cuda的host内存
+    inline bool is_host_memory(MemoryType type){ return type == MemoryType::Host || type == MemoryType::HostHugePage; }
+
+    /**
+     * @brief 内存分配器，可以继承实现自己的分配策略，例如内存池
+     */
+    class MemoryAllocator {
+    public:
+        virtual ~MemoryAllocator() = default;
+        virtual void* allocate(size_t size) = 0;
+        virtual void  free(void* ptr, size_t size) = 0;
+        virtual MemoryType type() = 0;
+
+        // ptr上可能还有stream中未完成的异步操作，stream为nullptr表示默认流。默认实现直接free
+        virtual void free_on_stream(void* ptr, size_t size, CUStream stream){ free(ptr, size); }
+
+        // 申请size时实际得到的大小，MixMemory据此记录容量，避免在同一个块内反复重新分配
+        virtual size_t allocation_size(size_t size){ return size; }
+    };
+
+    // 内置分配器，单例
+    std::shared_ptr<MemoryAllocator> get_memory_allocator(MemoryType type);
+
+    struct MemoryCacheStatistics{
+        long long hits              = 0;    // 从缓存中拿到块的次数
+        long long misses            = 0;    // 需要向底层分配器申请的次数
+        size_t cached_bytes         = 0;    // 缓存中空闲块的总大小
+        size_t allocated_bytes      = 0;    // 从底层分配器申请且还没有归还的总大小（含缓存）
+        size_t peak_allocated_bytes = 0;
+    };
+
+    /**
+     * @brief 带缓存的分配器，单例，进程内所有MixMemory共享
+     * 大小按size class向上取整（每个2的幂区间分4档，最坏浪费25%），释放的块放回对应档位的空闲链表，
+     * 下次申请同一档位时直接复用。底层分配失败时会先清空缓存再重试一次
+     * 缓存超过上限后，释放的块直接还给底层分配器
+     * device可以访问的内存归还时在使用它的stream上记录事件，复用前确认事件已经完成，device内存与事件都按设备分别缓存，
+     * 因此释放时不需要同步stream。free_on_stream的stream需要属于当前设备；free以及stream为nullptr时记录在默认流上，
+     * 默认流会等待所有阻塞流，非阻塞的stream不受默认流约束，在这样的stream上使用的内存需要指定stream或者自己同步之后再释放
+     */
+    std::shared_ptr<MemoryAllocator> get_caching_allocator(MemoryType type);
+    MemoryCacheStatistics memory_cache_statistics(MemoryType type);
+
+    // 把所有缓存的空闲块还给底层分配器
+    void empty_memory_cache();
+
+    // 每种内存缓存的上限，默认1GB
+    void set_memory_cache_limit(size_t max_cached_bytes);
+
+    // 新建的MixMemory默认是否使用带缓存的分配器，默认开启
+    void set_memory_caching(bool enable);
+    bool memory_caching();
+
+    #ifdef USE_OPENCV
+    // 数据放在页锁定内存中的cv::Mat，内存来自Pinned的缓存分配器
+    // 解码/读帧直接写到这样的Mat中再commit，预处理会跳过host到host的拷贝，直接异步拷贝到device
+    // 例如: cv::Mat image; image.allocator = TRT::get_pinned_mat_allocator(); capture >> image;
+    // 注意拷贝是异步的，结果返回之前不要改写它的内容
+    cv::MatAllocator* get_pinned_mat_allocator();
+    cv::Mat create_pinned_mat(int rows, int cols, int type);
+    #endif // USE_OPENCV
+
+    // 新建的MixMemory默认使用的分配器，默认cpu为Pinned，gpu为Managed
+    // 在没有cuda的机器上可以设置为Host/Host，此时Tensor的所有拷贝都走memcpy
+    void set_default_memory_type(MemoryType cpu_type, MemoryType gpu_type);
+    MemoryType default_cpu_memory_type();
+    MemoryType default_gpu_memory_type();
+
     /**
      * @brief 对GPU/CPU内存进行管理、分配/释放
+     * cpu/gpu两部分各自使用一个分配器，默认对新分配的内存清零（缓存分配器给出的内存块可能残留之前的数据）
+     * 确定每次都会完整覆盖内存的热路径可以调用set_zero_fill(false)跳过清零
+     * cpu_size/gpu_size为分配器实际给出的大小，可能大于申请的大小
      */
     class MixMemory {
     public:
+        MixMemory();
+        MixMemory(std::shared_ptr<MemoryAllocator> cpu_allocator, std::shared_ptr<MemoryAllocator> gpu_allocator);
+        MixMemory(const MixMemory& other) = delete;
+        MixMemory& operator = (const MixMemory& other) = delete;
         virtual ~MixMemory();
         void* gpu(size_t size);
         void* cpu(size_t size);
-        void release_gpu();
-        void release_cpu();
-        void release_all();
 
-        // 这里的GPU、CPU内存都可以用Host、Device直接访问
-        // 这里的GPU内存，使用统一内存管理
+        // stream为这块内存最后使用的stream，带缓存的分配器在它上面记录事件，nullptr表示默认流
+        void release_gpu(CUStream stream = nullptr);
+        void release_cpu(CUStream stream = nullptr);
+        void release_all(CUStream stream = nullptr);
+
+        // 默认的Managed时，GPU内存可以用Host、Device直接访问
         inline void* gpu() const { return gpu_; }
 
-        // 这里的CPU内存，使用Pinned Memory，页锁定内存
-        // 所以可以Host、Device访问
+        // 默认的Pinned时，CPU内存为页锁定内存，所以可以Host、Device访问
         inline void* cpu() const { return cpu_; }
 
+        inline size_t cpu_size() const { return cpu_size_; }
+        inline size_t gpu_size() const { return gpu_size_; }
+        std::shared_ptr<MemoryAllocator> cpu_allocator() const { return cpu_allocator_; }
+        std::shared_ptr<MemoryAllocator> gpu_allocator() const { return gpu_allocator_; }
+        MemoryType cpu_type() const { return cpu_allocator_->type(); }
+        MemoryType gpu_type() const { return gpu_allocator_->type(); }
+
+        // cpu、gpu两部分都是普通host内存，拷贝不需要经过cuda
+        bool host_only() const { return is_host_memory(cpu_type()) && is_host_memory(gpu_type()); }
+
+        void set_zero_fill(bool zero_fill){ zero_fill_ = zero_fill; }
+        bool zero_fill() const{ return zero_fill_; }
+
     private:
         void* cpu_ = nullptr;
         size_t cpu_size_ = 0;
 
         void* gpu_ = nullptr;
         size_t gpu_size_ = 0;
+
+        bool zero_fill_ = true;
+        std::shared_ptr<MemoryAllocator> cpu_allocator_;
+        std::shared_ptr<MemoryAllocator> gpu_allocator_;
     };
 
     class Tensor {
@@ -84,6 +186,9 @@ namespace TRT {
         explicit Tensor(int n, int c, int h, int w, DataType dtType = DataType::dtFloat);
         explicit Tensor(int ndims, const int* dims, DataType dtType = DataType::dtFloat);
         explicit Tensor(const std::vector<int>& dims, DataType dtType = DataType::dtFloat);
+
+        // 使用指定的内存，例如Host/Host的MixMemory可以在没有cuda的机器上使用Tensor
+        explicit Tensor(const std::vector<int>& dims, std::shared_ptr<MixMemory> data, DataType dtType = DataType::dtFloat);
         virtual ~Tensor();
 
         int numel();
@@ -157,10 +262,10 @@ namespace TRT {
         
         std::shared_ptr<MixMemory> get_data()                    {return data_;}
         std::shared_ptr<MixMemory> get_workspace()               {return workspace_;}
-        Tensor& set_workspace(std::shared_ptr<MixMemory> workspace) {workspace_ = workspace;}
+        Tensor& set_workspace(std::shared_ptr<MixMemory> workspace) {workspace_ = workspace; return *this;}
 
         CUStream get_stream(){return stream_;}
-        Tensor& set_stream(CUStream stream){stream_ = stream;}
+        Tensor& set_stream(CUStream stream){stream_ = stream; return *this;}
 
         #ifdef USE_OPENCV
         Tensor& set_mat     (int n, const cv::Mat& image);
@@ -225,6 +330,7 @@ namespace TRT {
         }
 
         Tensor& compute_shape_string();
+        Tensor& release_memory();
         Tensor& adajust_memory_by_update_dims_or_type();
 
     private:
@@ -0,0 +1,93 @@
+
+#ifndef YUV_IMAGE_HPP
+#define YUV_IMAGE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief 解码器输出的YUV420图像（BT.601，limited range），commit时直接提交，
+ * 颜色转换与仿射变换、归一化在同一个kernel中完成，不需要先转换为BGR
+ *   NV12: Y平面 + 交错的UV平面（u指向UV平面，v不使用）
+ *   I420: Y平面 + U平面 + V平面
+ * 色度平面的高度为(height + 1) / 2
+ */
+enum class ImageFormat : int{
+    BGR  = 0,
+    NV12 = 1,
+    I420 = 2
+};
+
+struct YUVImage{
+    ImageFormat format   = ImageFormat::NV12;
+    int width            = 0;
+    int height           = 0;
+    const uint8_t* y     = nullptr;
+    const uint8_t* u     = nullptr;
+    const uint8_t* v     = nullptr;
+    int y_line_size      = 0;
+    int uv_line_size     = 0;
+
+    // 平面是否为device内存，例如硬件解码的输出
+    // 普通host内存上的平面先同步复制到中转的页锁定内存，commit返回后即可释放或者改写；
+    // 页锁定的host平面（例如来自get_caching_allocator(Pinned)）直接异步拷贝到device，
+    // 与device上的平面一样不会复制，在结果返回之前需要保持有效且不要改写
+    bool device          = false;
+
+    static YUVImage nv12(const uint8_t* y, const uint8_t* uv, int width, int height, int line_size, bool device = false){
+        YUVImage image;
+        image.format       = ImageFormat::NV12;
+        image.width        = width;
+        image.height       = height;
+        image.y            = y;
+        image.u            = uv;
+        image.y_line_size  = line_size;
+        image.uv_line_size = line_size;
+        image.device       = device;
+        return image;
+    }
+
+    // 紧密排列的nv12数据，Y平面后紧跟UV平面
+    static YUVImage nv12(const uint8_t* data, int width, int height, bool device = false){
+        int line_size = (width + 1) / 2 * 2;
+        return nv12(data, data + (size_t)line_size * height, width, height, line_size, device);
+    }
+
+    static YUVImage i420(const uint8_t* y, const uint8_t* u, const uint8_t* v, int width, int height, int y_line_size, int uv_line_size, bool device = false){
+        YUVImage image;
+        image.format       = ImageFormat::I420;
+        image.width        = width;
+        image.height       = height;
+        image.y            = y;
+        image.u            = u;
+        image.v            = v;
+        image.y_line_size  = y_line_size;
+        image.uv_line_size = uv_line_size;
+        image.device       = device;
+        return image;
+    }
+
+    // 紧密排列的i420数据，依次为Y、U、V平面
+    static YUVImage i420(const uint8_t* data, int width, int height, bool device = false){
+        int uv_line_size = (width + 1) / 2;
+        const uint8_t* u = data + (size_t)width * height;
+        const uint8_t* v = u + (size_t)uv_line_size * ((height + 1) / 2);
+        return i420(data, u, v, width, height, width, uv_line_size, device);
+    }
+
+    bool empty() const{
+        if(width <= 0 || height <= 0 || y == nullptr || u == nullptr) return true;
+        if(format == ImageFormat::I420 && v == nullptr) return true;
+        return format != ImageFormat::NV12 && format != ImageFormat::I420;
+    }
+
+    size_t y_bytes()  const{return (size_t)y_line_size * height;}
+
+    // 单个色度平面的字节数，NV12只有一个（交错的）色度平面
+    size_t uv_bytes() const{return (size_t)uv_line_size * ((height + 1) / 2);}
+
+    // 所有平面紧密排列后的总字节数
+    size_t bytes()    const{return y_bytes() + uv_bytes() * (format == ImageFormat::I420 ? 2 : 1);}
+};
+
+#endif // YUV_IMAGE_HPP
@@ -0,0 +1,449 @@
+
+#include "replay_infer.hpp"
+#include <string.h>
+#include <limits.h>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <common/ilogger.hpp>
+#include <common/cuda_tools.hpp>
+#include <common/infer_trace.hpp>
+
+using namespace std;
+
+namespace TRT {
+
+	static const unsigned int REPLAY_MAGIC_NUMBER = 0xFCCFE2E3;
+	static const unsigned int REPLAY_VERSION      = 1;
+
+	static int sample_count(const vector<int>& dims){
+		int count = 1;
+		for(int i = 1; i < (int)dims.size(); ++i)
+			count *= dims[i];
+		return count;
+	}
+
+	// FNV-1a
+	static uint64_t hash_bytes(const void* pdata, size_t size, uint64_t seed = 14695981039346656037ULL){
+		const unsigned char* p = (const unsigned char*)pdata;
+		for(size_t i = 0; i < size; ++i){
+			seed ^= p[i];
+			seed *= 1099511628211ULL;
+		}
+		return seed;
+	}
+
+	class BinaryReader{
+	public:
+		BinaryReader(const void* pdata, size_t size):pdata_((const unsigned char*)pdata), size_(size){}
+
+		bool read(void* pdst, size_t size){
+			if(cursor_ + size > size_) return false;
+			memcpy(pdst, pdata_ + cursor_, size);
+			cursor_ += size;
+			return true;
+		}
+
+		template<typename _T>
+		bool read(_T& value){ return read(&value, sizeof(value)); }
+
+		size_t remain() const{ return size_ - cursor_; }
+
+	private:
+		const unsigned char* pdata_ = nullptr;
+		size_t size_   = 0;
+		size_t cursor_ = 0;
+	};
+
+	bool is_replay_data(const void* pdata, size_t size){
+		unsigned int magic = 0;
+		if(pdata == nullptr || size < sizeof(magic)) return false;
+
+		memcpy(&magic, pdata, sizeof(magic));
+		return magic == REPLAY_MAGIC_NUMBER;
+	}
+
+	static void write_binding(FILE* f, const ReplayBinding& binding){
+		unsigned int name_length = binding.name.size();
+		unsigned int ndims       = binding.dims.size();
+		fwrite(&name_length, 1, sizeof(name_length), f);
+		fwrite(binding.name.data(), 1, name_length, f);
+		fwrite(&ndims, 1, sizeof(ndims), f);
+		fwrite(binding.dims.data(), 1, sizeof(int) * ndims, f);
+	}
+
+	static bool read_binding(BinaryReader& reader, ReplayBinding& binding){
+		unsigned int name_length = 0, ndims = 0;
+		if(!reader.read(name_length) || name_length > 1024) return false;
+
+		binding.name.resize(name_length);
+		if(!reader.read(&binding.name[0], name_length)) return false;
+		if(!reader.read(ndims) || ndims == 0 || ndims > 8) return false;
+
+		binding.dims.resize(ndims);
+		if(!reader.read(binding.dims.data(), sizeof(int) * ndims)) return false;
+
+		// 单个样本的元素数需要能用int表示
+		long long count = 1;
+		for(auto dim : binding.dims){
+			if(dim <= 0) return false;
+			count *= dim;
+			if(count > INT_MAX / (int)sizeof(float)) return false;
+		}
+		return true;
+	}
+
+	bool save_replay_file(const std::string& file, const ReplayModel& model){
+
+		FILE* f = fopen(file.c_str(), "wb");
+		if(f == nullptr){
+			INFOE("Open %s failed", file.c_str());
+			return false;
+		}
+
+		unsigned int head[] = {
+			REPLAY_MAGIC_NUMBER, REPLAY_VERSION,
+			(unsigned int)model.max_batch_size, (unsigned int)model.dynamic_batch
+		};
+		fwrite(head, 1, sizeof(head), f);
+		fwrite(&model.base_ms, 1, sizeof(model.base_ms), f);
+		fwrite(&model.per_item_ms, 1, sizeof(model.per_item_ms), f);
+
+		unsigned int num_bindings[] = {(unsigned int)model.inputs.size(), (unsigned int)model.outputs.size()};
+		fwrite(num_bindings, 1, sizeof(num_bindings), f);
+		for(auto& binding : model.inputs)  write_binding(f, binding);
+		for(auto& binding : model.outputs) write_binding(f, binding);
+
+		unsigned int num_record = model.records.size();
+		fwrite(&num_record, 1, sizeof(num_record), f);
+		for(auto& record : model.records){
+			if(record.inputs.size() != model.inputs.size() || record.outputs.size() != model.outputs.size()){
+				INFOE("Invalid record, number of inputs/outputs mismatch");
+				fclose(f);
+				return false;
+			}
+
+			for(int i = 0; i < (int)model.inputs.size(); ++i){
+				if((int)record.inputs[i].size() != sample_count(model.inputs[i].dims)){
+					INFOE("Invalid record, input %s size mismatch", model.inputs[i].name.c_str());
+					fclose(f);
+					return false;
+				}
+				fwrite(record.inputs[i].data(), 1, sizeof(float) * record.inputs[i].size(), f);
+			}
+
+			for(int i = 0; i < (int)model.outputs.size(); ++i){
+				if((int)record.outputs[i].size() != sample_count(model.outputs[i].dims)){
+					INFOE("Invalid record, output %s size mismatch", model.outputs[i].name.c_str());
+					fclose(f);
+					return false;
+				}
+				fwrite(record.outputs[i].data(), 1, sizeof(float) * record.outputs[i].size(), f);
+			}
+		}
+		fclose(f);
+		return true;
+	}
+
+	static bool load_replay_model(const void* pdata, size_t size, ReplayModel& model){
+
+		BinaryReader reader(pdata, size);
+		unsigned int head[4];
+		if(!reader.read(head, sizeof(head)) || head[0] != REPLAY_MAGIC_NUMBER){
+			INFOE("Not a replay model");
+			return false;
+		}
+
+		if(head[1] != REPLAY_VERSION){
+			INFOE("Unsupport replay version %d", head[1]);
+			return false;
+		}
+
+		model.max_batch_size = head[2];
+		model.dynamic_batch  = head[3] != 0;
+		unsigned int num_bindings[2];
+		if(!reader.read(model.base_ms) || !reader.read(model.per_item_ms) || !reader.read(num_bindings, sizeof(num_bindings)))
+			return false;
+
+		// 每个binding至少有name_length、ndims以及一个dim，共12字节，resize之前先确认文件中有这么多数据
+		const size_t min_binding_bytes = sizeof(unsigned int) * 2 + sizeof(int);
+		if(model.max_batch_size <= 0 || num_bindings[0] == 0 ||
+			(size_t)num_bindings[0] + num_bindings[1] > reader.remain() / min_binding_bytes){
+			INFOE("Invalid replay model, max_batch_size = %d, num_input = %u, num_output = %u", model.max_batch_size, num_bindings[0], num_bindings[1]);
+			return false;
+		}
+
+		model.inputs.resize(num_bindings[0]);
+		model.outputs.resize(num_bindings[1]);
+		for(auto& binding : model.inputs){
+			if(!read_binding(reader, binding)){
+				INFOE("Invalid replay model, bad input binding");
+				return false;
+			}
+		}
+
+		for(auto& binding : model.outputs){
+			if(!read_binding(reader, binding)){
+				INFOE("Invalid replay model, bad output binding");
+				return false;
+			}
+		}
+
+		unsigned int num_record = 0;
+		if(!reader.read(num_record)) return false;
+
+		size_t record_bytes = 0;
+		for(auto& binding : model.inputs)  record_bytes += sizeof(float) * sample_count(binding.dims);
+		for(auto& binding : model.outputs) record_bytes += sizeof(float) * sample_count(binding.dims);
+		if(num_record > reader.remain() / record_bytes){
+			INFOE("Invalid replay model, %u records need %lld bytes, but only %lld bytes left",
+				num_record, (long long)num_record * (long long)record_bytes, (long long)reader.remain()
+			);
+			return false;
+		}
+
+		model.records.resize(num_record);
+		for(auto& record : model.records){
+			record.inputs.resize(model.inputs.size());
+			record.outputs.resize(model.outputs.size());
+			for(int i = 0; i < (int)model.inputs.size(); ++i){
+				record.inputs[i].resize(sample_count(model.inputs[i].dims));
+				if(!reader.read(record.inputs[i].data(), sizeof(float) * record.inputs[i].size())) return false;
+			}
+
+			for(int i = 0; i < (int)model.outputs.size(); ++i){
+				record.outputs[i].resize(sample_count(model.outputs[i].dims));
+				if(!reader.read(record.outputs[i].data(), sizeof(float) * record.outputs[i].size())) return false;
+			}
+		}
+		return true;
+	}
+
+	class ReplayInferImpl : public Infer {
+	public:
+		bool load_from_memory(const void* pdata, size_t size){
+
+			if(!load_replay_model(pdata, size, model_)){
+				INFOE("Load replay model failed");
+				return false;
+			}
+
+			workspace_.reset(new MixMemory());
+			for(auto& binding : model_.inputs){
+				auto tensor = make_shared<Tensor>(binding.dims);
+				tensor->set_workspace(workspace_);
+				inputs_.push_back(tensor);
+			}
+
+			for(auto& binding : model_.outputs){
+				auto tensor = make_shared<Tensor>(binding.dims);
+				tensor->set_workspace(workspace_);
+				outputs_.push_back(tensor);
+			}
+
+			for(int i = 0; i < (int)model_.records.size(); ++i)
+				record_mapper_[hash_sample(model_.records[i].inputs)] = i;
+			return true;
+		}
+
+		virtual void forward(bool sync, bool resize_output_batch_same_input) override{
+
+			auto t0 = chrono::steady_clock::now();
+			int batch_size = inputs_[0]->size(0);
+			Assert(batch_size <= model_.max_batch_size);
+
+			// 包含模拟的耗时，没有GPU时也能看到forward在时间线上的位置
+			InferTrace::Span span("forward", "replay", "batch", batch_size);
+
+			if(resize_output_batch_same_input){
+				for(auto& output : outputs_)
+					output->resize_single_dim(0, batch_size);
+			}
+
+			vector<vector<float>> sample(inputs_.size());
+			for(int ibatch = 0; ibatch < batch_size; ++ibatch){
+
+				for(int i = 0; i < (int)inputs_.size(); ++i){
+					float* pinput = inputs_[i]->cpu<float>(ibatch);
+					sample[i].assign(pinput, pinput + inputs_[i]->count(1));
+				}
+
+				int irecord = 0;
+				auto iter   = record_mapper_.find(hash_sample(sample));
+				if(iter != record_mapper_.end()){
+					irecord = iter->second;
+				}else{
+					num_miss_++;
+					irecord = model_.records.empty() ? -1 : num_miss_ % model_.records.size();
+				}
+
+				for(int i = 0; i < (int)outputs_.size(); ++i){
+					float* poutput = outputs_[i]->cpu<float>(ibatch);
+					int count      = outputs_[i]->count(1);
+					if(irecord == -1)
+						memset(poutput, 0, sizeof(float) * count);
+					else
+						memcpy(poutput, model_.records[irecord].outputs[i].data(), sizeof(float) * count);
+				}
+			}
+
+			float cost_ms = model_.base_ms + model_.per_item_ms * batch_size;
+			if(cost_ms > 0)
+				this_thread::sleep_until(t0 + chrono::microseconds((long long)(cost_ms * 1000)));
+		}
+
+		virtual int get_max_batch_size() override{ return model_.max_batch_size; }
+		virtual void set_stream(CUStream stream) override{ stream_ = stream; }
+		virtual CUStream get_stream() override{ return stream_; }
+		virtual void synchronize() override{}
+		virtual size_t get_device_memory_size() override{ return 0; }
+		virtual bool is_dynamic_batch_dimension() override{ return model_.dynamic_batch; }
+		virtual std::shared_ptr<MixMemory> get_workspace() override{ return workspace_; }
+
+		virtual std::shared_ptr<Tensor> input(int index) override{
+			Assert(index >= 0 && index < (int)inputs_.size());
+			return inputs_[index];
+		}
+
+		virtual std::shared_ptr<Tensor> output(int index) override{
+			Assert(index >= 0 && index < (int)outputs_.size());
+			return outputs_[index];
+		}
+
+		virtual std::shared_ptr<Tensor> tensor(const std::string& name) override{
+			for(int i = 0; i < (int)inputs_.size(); ++i)
+				if(model_.inputs[i].name == name) return inputs_[i];
+
+			for(int i = 0; i < (int)outputs_.size(); ++i)
+				if(model_.outputs[i].name == name) return outputs_[i];
+
+			INFOF("Can not found tensor %s", name.c_str());
+			return nullptr;
+		}
+
+		virtual std::string get_input_name(int index) override{
+			Assert(index >= 0 && index < (int)inputs_.size());
+			return model_.inputs[index].name;
+		}
+
+		virtual std::string get_output_name(int index) override{
+			Assert(index >= 0 && index < (int)outputs_.size());
+			return model_.outputs[index].name;
+		}
+
+		virtual bool is_output_name(const std::string& name) override{
+			for(auto& binding : model_.outputs)
+				if(binding.name == name) return true;
+			return false;
+		}
+
+		virtual bool is_input_name(const std::string& name) override{
+			for(auto& binding : model_.inputs)
+				if(binding.name == name) return true;
+			return false;
+		}
+
+		virtual int num_output() override{ return outputs_.size(); }
+		virtual int num_input() override{ return inputs_.size(); }
+		virtual int device() override{ return -1; }
+
+		virtual void print() override{
+			INFO("Replay infer %p detail", this);
+			INFO("\tMax Batch Size: %d", model_.max_batch_size);
+			INFO("\tDynamic Batch Dimension: %s", model_.dynamic_batch ? "true" : "false");
+			INFO("\tSimulated Latency: %.2f ms + %.2f ms * batch", model_.base_ms, model_.per_item_ms);
+			INFO("\tRecords: %d", (int)model_.records.size());
+			INFO("\tInputs: %d", (int)inputs_.size());
+			for(int i = 0; i < (int)inputs_.size(); ++i)
+				INFO("\t\t%d.%s : shape {%s}", i, model_.inputs[i].name.c_str(), inputs_[i]->shape_string());
+
+			INFO("\tOutputs: %d", (int)outputs_.size());
+			for(int i = 0; i < (int)outputs_.size(); ++i)
+				INFO("\t\t%d.%s : shape {%s}", i, model_.outputs[i].name.c_str(), outputs_[i]->shape_string());
+		}
+
+	private:
+		uint64_t hash_sample(const vector<vector<float>>& sample){
+			uint64_t seed = 14695981039346656037ULL;
+			for(auto& item : sample)
+				seed = hash_bytes(item.data(), sizeof(float) * item.size(), seed);
+			return seed;
+		}
+
+	private:
+		ReplayModel model_;
+		unordered_map<uint64_t, int> record_mapper_;
+		vector<shared_ptr<Tensor>> inputs_;
+		vector<shared_ptr<Tensor>> outputs_;
+		shared_ptr<MixMemory> workspace_;
+		CUStream stream_ = nullptr;
+		long long num_miss_ = 0;
+	};
+
+	class ReplayBackend : public InferBackend{
+	public:
+		virtual const char* name() override{ return "Replay"; }
+		virtual bool accept(const void* pdata, size_t size) override{ return is_replay_data(pdata, size); }
+		virtual std::shared_ptr<Infer> load_from_memory(const void* pdata, size_t size) override{
+
+			shared_ptr<ReplayInferImpl> instance(new ReplayInferImpl());
+			if(!instance->load_from_memory(pdata, size))
+				instance.reset();
+			return instance;
+		}
+	};
+
+	std::shared_ptr<InferBackend> create_replay_backend(){
+		return make_shared<ReplayBackend>();
+	}
+
+	ReplayRecorder::ReplayRecorder(std::shared_ptr<Infer> engine, float base_ms, float per_item_ms){
+
+		engine_ = engine;
+		model_.max_batch_size = engine->get_max_batch_size();
+		model_.dynamic_batch  = engine->is_dynamic_batch_dimension();
+		model_.base_ms        = base_ms;
+		model_.per_item_ms    = per_item_ms;
+
+		for(int i = 0; i < engine->num_input(); ++i){
+			ReplayBinding binding;
+			binding.name    = engine->get_input_name(i);
+			binding.dims    = engine->input(i)->dims();
+			binding.dims[0] = model_.max_batch_size;
+			model_.inputs.emplace_back(binding);
+		}
+
+		for(int i = 0; i < engine->num_output(); ++i){
+			ReplayBinding binding;
+			binding.name    = engine->get_output_name(i);
+			binding.dims    = engine->output(i)->dims();
+			binding.dims[0] = model_.max_batch_size;
+			model_.outputs.emplace_back(binding);
+		}
+	}
+
+	void ReplayRecorder::record(){
+
+		int batch_size = engine_->input(0)->size(0);
+		for(int ibatch = 0; ibatch < batch_size; ++ibatch){
+			ReplayRecord record;
+			for(int i = 0; i < engine_->num_input(); ++i){
+				auto tensor = engine_->input(i);
+				float* p    = tensor->cpu<float>(ibatch);
+				record.inputs.emplace_back(p, p + tensor->count(1));
+			}
+
+			for(int i = 0; i < engine_->num_output(); ++i){
+				auto tensor = engine_->output(i);
+				float* p    = tensor->cpu<float>(ibatch);
+				record.outputs.emplace_back(p, p + tensor->count(1));
+			}
+			model_.records.emplace_back(record);
+		}
+	}
+
+	bool ReplayRecorder::save(const std::string& file){
+		return save_replay_file(file, model_);
+	}
+
+};	//TRTInfer
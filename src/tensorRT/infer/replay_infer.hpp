@@ -0,0 +1,69 @@
+
+
+#ifndef REPLAY_INFER_HPP
+#define REPLAY_INFER_HPP
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <infer/trt_infer.hpp>
+
+/**
+ * @brief 回放推理后端，不依赖TensorRT
+ * 文件中记录了每个输入样本对应的输出，forward时按输入内容查表，把记录的输出写回output tensor，
+ * 查不到时按顺序轮流使用记录。可以指定每次forward的模拟耗时，用于在没有GPU的机器上跑通controller、
+ * 解码、跟踪以及吞吐测试
+ *
+ * 文件格式，均为uint32（耗时为float32）：
+ *   magic(0xFCCFE2E3), version, max_batch_size, dynamic_batch, base_ms, per_item_ms
+ *   num_input, num_output
+ *   每个binding：name_length, name, ndims, dims（dims[0]为max_batch_size）
+ *   num_record
+ *   每条记录：每个input的单个样本数据，每个output的单个样本数据，均为float32
+ */
+namespace TRT {
+
+	struct ReplayBinding{
+		std::string name;
+		std::vector<int> dims;		// dims[0]为batch维
+	};
+
+	struct ReplayRecord{
+		std::vector<std::vector<float>> inputs;		// 每个input一个样本
+		std::vector<std::vector<float>> outputs;
+	};
+
+	struct ReplayModel{
+		int max_batch_size  = 1;
+		bool dynamic_batch  = true;
+		float base_ms       = 0;		// 模拟的forward耗时 = base_ms + per_item_ms * batch
+		float per_item_ms   = 0;
+		std::vector<ReplayBinding> inputs;
+		std::vector<ReplayBinding> outputs;
+		std::vector<ReplayRecord> records;
+	};
+
+	bool is_replay_data(const void* pdata, size_t size);
+	bool save_replay_file(const std::string& file, const ReplayModel& model);
+
+	/**
+	 * @brief 从真实的引擎录制回放文件，每次forward之后调用record，
+	 * 把当前batch中每个样本的输入输出记录下来
+	 */
+	class ReplayRecorder{
+	public:
+		ReplayRecorder(std::shared_ptr<Infer> engine, float base_ms = 0, float per_item_ms = 0);
+		void record();
+		bool save(const std::string& file);
+		int num_record() const{ return model_.records.size(); }
+
+	private:
+		std::shared_ptr<Infer> engine_;
+		ReplayModel model_;
+	};
+
+	std::shared_ptr<InferBackend> create_replay_backend();
+
+};	//TRTInfer
+
+#endif //REPLAY_INFER_HPP
@@ -8,6 +8,9 @@
 #include <NvInferPlugin.h>
 #include <cuda_fp16.h>
 #include <common/cuda_tools.hpp>
+#include <common/infer_trace.hpp>
+#include <mutex>
+#include "replay_infer.hpp"
 
 using namespace nvinfer1;
 using namespace std;
@@ -292,6 +295,9 @@ namespace TRT {
 
 		EngineContext* context = (EngineContext*)context_.get();
 		int inputBatchSize = inputs_[0]->size(0);
+
+		// sync = false时只包含提交到stream的耗时
+		InferTrace::Span span("forward", "tensorRT", "batch", inputBatchSize);
 		if(this->is_dynamic_batch_dimension())
 			Assert(inputBatchSize <= context->engine_->getMaxBatchSize());
 		else
@@ -361,20 +367,65 @@ namespace TRT {
 		return orderdBlobs_[blobsNameMapper_[name]];
 	}
 
+	class TensorRTBackend : public InferBackend{
+	public:
+		virtual const char* name() override{ return "TensorRT"; }
+		virtual bool accept(const void* pdata, size_t size) override{ return pdata != nullptr && size > 0; }
+		virtual std::shared_ptr<Infer> load_from_memory(const void* pdata, size_t size) override{
+
+			std::shared_ptr<InferImpl> Infer(new InferImpl());
+			if (!Infer->load_from_memory(pdata, size))
+				Infer.reset();
+			return Infer;
+		}
+	};
+
+	static std::mutex g_backends_lock;
+	static std::vector<std::shared_ptr<InferBackend>>& infer_backends(){
+		static std::vector<std::shared_ptr<InferBackend>> backends{
+			create_replay_backend(),
+			std::make_shared<TensorRTBackend>()
+		};
+		return backends;
+	}
+
+	void register_infer_backend(std::shared_ptr<InferBackend> backend){
+
+		if(backend == nullptr) return;
+
+		std::unique_lock<std::mutex> l(g_backends_lock);
+		auto& backends = infer_backends();
+		string name    = backend->name();
+		backends.erase(std::remove_if(backends.begin(), backends.end(), [&](std::shared_ptr<InferBackend>& item){
+			return name == item->name();
+		}), backends.end());
+		backends.insert(backends.begin(), backend);
+	}
+
+	std::vector<std::shared_ptr<InferBackend>> get_infer_backends(){
+		std::unique_lock<std::mutex> l(g_backends_lock);
+		return infer_backends();
+	}
+
 	std::shared_ptr<Infer> load_infer_from_memory(const void* pdata, size_t size){
 
-		std::shared_ptr<InferImpl> Infer(new InferImpl());
-		if (!Infer->load_from_memory(pdata, size))
-			Infer.reset();
-		return Infer;
+		for(auto& backend : get_infer_backends()){
+			if(backend->accept(pdata, size))
+				return backend->load_from_memory(pdata, size);
+		}
+
+		INFOE("No backend accept the model data, size = %lld", (long long)size);
+		return nullptr;
 	}
 
 	std::shared_ptr<Infer> load_infer(const string& file) {
 		
-		std::shared_ptr<InferImpl> Infer(new InferImpl());
-		if (!Infer->load(file))
-			Infer.reset();
-		return Infer;
+		auto data = iLogger::load_file(file);
+		if (data.empty()){
+			INFOE("Load model file %s failed", file.c_str());
+			return nullptr;
+		}
+		return load_infer_from_memory(data.data(), data.size());
 	}
 
 	DeviceMemorySummary get_current_device_summary() {
@@ -35,6 +35,22 @@ namespace TRT {
 		virtual int  device() = 0;
 	};
 
+	/**
+	 * @brief 推理后端，load_infer会按顺序询问每个后端是否接受该模型数据，由第一个接受的后端加载
+	 * 默认注册了回放后端（见replay_infer.hpp）和TensorRT后端，TensorRT后端接受所有数据，排在最后
+	 */
+	class InferBackend {
+	public:
+		virtual ~InferBackend() = default;
+		virtual const char* name() = 0;
+		virtual bool accept(const void* pdata, size_t size) = 0;
+		virtual std::shared_ptr<Infer> load_from_memory(const void* pdata, size_t size) = 0;
+	};
+
+	// 注册的后端排在已有后端之前，同名的后端会被替换
+	void register_infer_backend(std::shared_ptr<InferBackend> backend);
+	std::vector<std::shared_ptr<InferBackend>> get_infer_backends();
+
 	struct DeviceMemorySummary {
 		size_t total;
 		size_t available;